@@ -0,0 +1,220 @@
+// Throughput of the CPU color conversion & tensor preprocessing kernels at each
+// SIMD level the host supports, single core and over all cores, for 1080p & 4K frames.
+// Every level is checked to be bit exact to the C kernels first.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "color_convert.h"
+#include "tensor_preprocess.h"
+#include "frame_copy.h"
+#include "simd_dispatch.h"
+
+static void usage(const char * program)
+{
+	printf(
+		"Benchmarks CPU color conversion & tensor preprocessing (MB/s of source frame data).\n"
+		"\n"
+		"Usage: %s [options]\n"
+		"   -t sec     time per measurement (default 1)\n"
+		"   -j N       threads of the multi-threaded run (default all cores)\n",
+		program);
+}
+
+struct Frame
+{
+	int 					width;
+	int 					height;
+	std::vector<uint8_t> 	nv12;
+	std::vector<uint8_t> 	rgb4;
+	std::vector<uint8_t> 	out;
+
+	Frame(int w, int h):width(w), height(h)
+	{
+		//odd widths: chroma rows hold (w+1)/2 pairs at pitch w
+		nv12.resize((size_t)w * h + (size_t)(w + 2) * ((h + 1) / 2));
+		rgb4.resize((size_t)w * h * 4);
+		out.resize(std::max((size_t)w * h * 4, (size_t)640 * 640 * 3 * 4));
+		unsigned int seed = 12345;
+		for(auto &b : nv12){ seed = seed * 1103515245 + 12345; b = (uint8_t)(seed >> 16); }
+		for(auto &b : rgb4){ seed = seed * 1103515245 + 12345; b = (uint8_t)(seed >> 16); }
+	}
+
+	const uint8_t * y(void) const { return nv12.data(); }
+	const uint8_t * uv(void) const { return nv12.data() + (size_t)width * height; }
+};
+
+enum Op {
+	OP_NV12_BGR24 = 0,
+	OP_NV12_BGRA,
+	OP_NV12_RGBP,
+	OP_RGB4_BGR24,
+	OP_NV12_TENSOR_F32,		// 640x640 letterbox, NCHW
+	OP_RGB4_TENSOR_I8,		// 640x640 letterbox, NHWC
+	OP_NV12_I420,
+	OP_I420_NV12,
+	OP_NV12_COPY,			// copy_plane with streaming loads (C: memcpy), only pays off on USWC mappings
+	OP_CNT
+};
+
+static const char * op_name(Op op)
+{
+	switch(op){
+	case OP_NV12_BGR24: return "NV12->BGR24";
+	case OP_NV12_BGRA: 	return "NV12->BGRA";
+	case OP_NV12_RGBP: 	return "NV12->RGBP";
+	case OP_RGB4_BGR24: return "RGB4->BGR24";
+	case OP_NV12_TENSOR_F32: return "NV12->f32";
+	case OP_RGB4_TENSOR_I8: return "RGB4->i8";
+	case OP_NV12_I420: 	return "NV12->I420";
+	case OP_I420_NV12: 	return "I420->NV12";
+	default: 			return "NV12 copy";
+	}
+}
+
+static size_t src_bytes(const Frame & f, Op op)
+{
+	return (op == OP_RGB4_BGR24 || op == OP_RGB4_TENSOR_I8) ? (size_t)f.width * f.height * 4 : (size_t)f.width * f.height * 3 / 2;
+}
+
+static void run_op(Frame & f, Op op, int threads, cc_matrix matrix = CC_BT709, cc_range range = CC_RANGE_LIMITED)
+{
+	int w = f.width, h = f.height;
+	tensor_params tp;
+	tensor_src src;
+	tp.width = tp.height = 640;
+	tp.matrix = matrix;
+	tp.range = range;
+	tp.scale = 1.0f / 255;
+	switch(op){
+	case OP_NV12_BGR24:
+		nv12_to_rgb(f.y(), w, f.uv(), w, w, h, f.out.data(), w*3, CC_FMT_BGR24, matrix, range, threads);
+		break;
+	case OP_NV12_BGRA:
+		nv12_to_rgb(f.y(), w, f.uv(), w, w, h, f.out.data(), w*4, CC_FMT_BGRA, matrix, range, threads);
+		break;
+	case OP_NV12_RGBP:
+		nv12_to_rgb(f.y(), w, f.uv(), w, w, h, f.out.data(), w, CC_FMT_RGBP, matrix, range, threads);
+		break;
+	case OP_RGB4_BGR24:
+		rgb4_to_bgr24(f.rgb4.data(), w*4, w, h, f.out.data(), w*3, threads);
+		break;
+	case OP_NV12_TENSOR_F32:
+		src = {TENSOR_SRC_NV12, {f.y(), f.uv()}, {w, w}, w, h};
+		tensor_preprocess(src, tp, f.out.data(), NULL, threads);
+		break;
+	case OP_NV12_I420:
+		nv12_to_i420(f.y(), w, f.uv(), w, w, h, f.out.data(), threads);
+		break;
+	case OP_I420_NV12:
+		i420_to_nv12(f.y(), w, f.uv(), f.uv() + (size_t)((w + 1) / 2) * ((h + 1) / 2), (w + 1) / 2, w, h,
+					 f.out.data(), w, f.out.data() + (size_t)w * h, w, threads);
+		break;
+	case OP_NV12_COPY:
+		copy_plane(f.nv12.data(), w, f.out.data(), w, w, h * 3 / 2, true, threads);
+		break;
+	default:
+		src = {TENSOR_SRC_RGB4, {f.rgb4.data(), NULL}, {w*4, 0}, w, h};
+		tp.layout = TENSOR_NHWC;
+		tp.dtype = TENSOR_I8;
+		tp.mean[0] = tp.mean[1] = tp.mean[2] = 0.5f;
+		tp.q_scale = 1.0f / 127;
+		tensor_preprocess(src, tp, f.out.data(), NULL, threads);
+		break;
+	}
+}
+
+// every op, matrix & range at level must match the C kernels byte for byte
+static bool verify(simd_level level, int w, int h)
+{
+	Frame ref(w, h), test(w, h);
+	bool bOK = true;
+
+	for(int op = 0; op < OP_CNT; op++){
+		for(int m = CC_BT601; m <= CC_BT709; m++){
+			for(int r = CC_RANGE_LIMITED; r <= CC_RANGE_FULL; r++){
+				simd_force(SIMD_C);
+				run_op(ref, (Op)op, 1, (cc_matrix)m, (cc_range)r);
+				simd_force(level);
+				run_op(test, (Op)op, 1, (cc_matrix)m, (cc_range)r);
+				if(memcmp(ref.out.data(), test.out.data(), ref.out.size()) != 0){
+					printf("\033[31m%s %s %s %s mismatch at %dx%d\033[0m\n", simd_level_name(level), op_name((Op)op),
+						   m == CC_BT709 ? "BT709" : "BT601", r == CC_RANGE_FULL ? "full" : "limited", w, h);
+					bOK = false;
+				}
+			}
+		}
+	}
+	return bOK;
+}
+
+// MB/s of source data over at least duration seconds
+static double measure(Frame & f, Op op, int threads, double duration)
+{
+	auto t0 = std::chrono::steady_clock::now();
+	double elapsed = 0;
+	long frames = 0;
+	do{
+		run_op(f, op, threads);
+		frames ++;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	}while(elapsed < duration);
+
+	return (double)src_bytes(f, op) * frames / elapsed / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+	double duration = 1.0;
+	int threads = std::thread::hardware_concurrency();
+	int opt;
+
+	while((opt = getopt(argc, argv, "t:j:h")) != -1){
+		switch(opt){
+		case 't': duration = atof(optarg); break;
+		case 'j': threads = atoi(optarg); break;
+		default: usage(argv[0]); return 1;
+		}
+	}
+	if(threads < 1) threads = 1;
+
+	simd_level detected = simd_detect();
+	printf("detected SIMD level: %s, %d threads\n", simd_level_name(detected), threads);
+
+	bool bOK = true;
+	for(int l = SIMD_SSE41; l <= detected; l++){
+		//odd sizes exercise row tails and tiles ending on odd rows
+		bOK = verify((simd_level)l, 1920, 1080) && bOK;
+		bOK = verify((simd_level)l, 1001, 67) && bOK;
+	}
+	if(!bOK){
+		printf("\033[31mSIMD kernels are not bit exact to C, aborting\033[0m\n");
+		return 1;
+	}
+	printf("all SIMD levels bit exact to C\n\n");
+
+	const int sizes[][2] = {{1920, 1080}, {3840, 2160}};
+	printf("%-10s %-12s %-7s %12s %12s %14s\n", "frame", "op", "level", "1 core MB/s", "MT MB/s", "MT MB/s/core");
+	for(auto &sz : sizes){
+		Frame f(sz[0], sz[1]);
+		for(int op = 0; op < OP_CNT; op++){
+			for(int l = SIMD_C; l <= detected; l++){
+				simd_force((simd_level)l);
+				double st = measure(f, (Op)op, 1, duration);
+				double mt = measure(f, (Op)op, threads, duration);
+				char res[32];
+				snprintf(res, sizeof(res), "%dx%d", f.width, f.height);
+				printf("%-10s %-12s %-7s %12.1f %12.1f %14.1f\n", res, op_name((Op)op),
+					   simd_level_name((simd_level)l), st, mt, mt / threads);
+			}
+		}
+	}
+	return 0;
+}
@@ -1,5 +1,15 @@
 
 #include <assert.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
 
 class hddlBitstreamBase: public mfxBitstream
 {
@@ -16,14 +26,29 @@ public:
 	}
 	virtual mfxU32 Feed(void)=0;
 	virtual bool IsEnd(void)=0;
+
+	//block until new data may be available or timeout_ms elapsed,
+	//return false on timeout. live sources should override this so an idle
+	//channel waits without spinning; a plain file always has data until EOS.
+	//default can't tell when data arrives: it sleeps timeout_ms then lets caller
+	//poll Feed() again, so such a source never looks idle long enough to hibernate
+	virtual bool WaitData(int timeout_ms){
+		if(IsEnd())
+			return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms < 0 ? 100 : timeout_ms));
+		return true;
+	}
 };
 
 class hddlBitstreamFile: public hddlBitstreamBase
 {
 public:
-	hddlBitstreamFile(const char * fname, bool bRepeat = false){
+	//bFollow: file is still being written (e.g. recorder output or FIFO),
+	//         end of file means "no data yet" instead of end of stream
+	hddlBitstreamFile(const char * fname, bool bRepeat = false, bool bFollow = false){
 		m_fSource = fopen(fname,"rb");
 		m_bRepeat = bRepeat;
+		m_bFollow = bFollow;
 		assert(m_fSource);
 	}
 	virtual ~hddlBitstreamFile(){
@@ -44,6 +69,11 @@ public:
 			//printf("nBytesSpace=%d, nBytesRead=%d\n", nBytesSpace, nBytesRead);
 
 			if (0 == nBytesRead){
+				if(m_bFollow){
+					//allow next fread() to see appended data
+					clearerr(m_fSource);
+					break;
+				}
 				if(m_bRepeat)
 					fseek(m_fSource, 0, SEEK_SET);
 				else
@@ -58,7 +88,261 @@ public:
 		return m_bEOS && this->DataLength == 0;
 	}
 
+	virtual bool WaitData(int timeout_ms){
+		if(!m_bFollow)
+			return !IsEnd();
+
+		//poll file size at low rate, costs nothing measurable while idle
+		const int poll_ms = 10;
+		long pos = ftell(m_fSource);
+		for(int t = 0; ; t += poll_ms){
+			struct stat st;
+			if(fstat(fileno(m_fSource), &st) == 0 && st.st_size > pos)
+				return true;
+			if(t >= timeout_ms)
+				return false;
+			std::this_thread::sleep_for(std::chrono::milliseconds(poll_ms));
+		}
+	}
+
 	FILE *m_fSource = NULL;
 	bool m_bEOS = false;
 	bool m_bRepeat = false;
+	bool m_bFollow = false;
+};
+
+//Segment files (e.g. recorder output) read back to back as one stream, so one decoder
+//session goes on across segment boundaries. next() returns path of the next segment and
+//an empty string after the last one; it may block until the next segment exists.
+//segments that can't be opened are skipped
+//next() given by caller runs on a helper thread: meanwhile Feed() has no data and WaitData()
+//waits for the path, so the decoder stays stoppable. a next() still blocked when the
+//playlist is destroyed is abandoned, its result is dropped
+class hddlBitstreamPlaylist: public hddlBitstreamBase
+{
+public:
+	hddlBitstreamPlaylist(std::function<std::string(void)> next): m_next(next), m_fetch(std::make_shared<Fetch>()){}
+	hddlBitstreamPlaylist(const std::vector<std::string> & files){
+		auto pos = std::make_shared<size_t>(0);
+		m_next = [files, pos](){ return *pos < files.size() ? files[(*pos)++] : std::string(); };
+	}
+	virtual ~hddlBitstreamPlaylist(){
+		if(m_fSource) fclose(m_fSource);
+		if(m_thread.joinable()){
+			std::lock_guard<std::mutex> lk(m_fetch->mutex);
+			if(m_fetch->bBusy)
+				m_thread.detach();
+		}
+		if(m_thread.joinable())
+			m_thread.join();
+	}
+
+	virtual mfxU32 Feed(void){
+
+		memmove(this->Data, this->Data + this->DataOffset, this->DataLength);
+		this->DataOffset = 0;
+
+		//end of a segment is not end of stream: next one is opened in the same Feed()
+		mfxU32 nBytesRead = 0;
+		mfxU32 nBytesSpace = this->MaxLength - this->DataLength;
+		while(!m_bEOS && nBytesRead == 0 && nBytesSpace > 0)
+		{
+			if(!m_fSource){
+				std::string path;
+				if(!next_path(path))
+					break;	// not known yet, WaitData() waits for it
+				if(path.empty()){
+					m_bEOS = true;
+					break;
+				}
+				m_fSource = fopen(path.c_str(), "rb");
+				if(!m_fSource){
+					fprintf(stderr, "playlist: cannot open %s, skipped\n", path.c_str());
+					continue;
+				}
+				m_segments ++;
+			}
+			nBytesRead = (mfxU32) fread(this->Data + this->DataLength, 1, nBytesSpace, m_fSource);
+			if (0 == nBytesRead){
+				fclose(m_fSource);
+				m_fSource = NULL;
+			}
+		}
+		this->TimeStamp ++;
+		this->DataLength += nBytesRead;
+		return nBytesRead;
+	}
+	virtual bool IsEnd(void){
+		return m_bEOS && this->DataLength == 0;
+	}
+
+	virtual bool WaitData(int timeout_ms){
+		if(!m_fetch)
+			return !IsEnd();
+
+		std::unique_lock<std::mutex> lk(m_fetch->mutex);
+		auto done = [this]{ return !m_fetch->bBusy; };
+		if(timeout_ms < 0){
+			m_fetch->cv.wait(lk, done);
+			return true;
+		}
+		return m_fetch->cv.wait_for(lk, std::chrono::milliseconds(timeout_ms), done);
+	}
+
+	//segments opened so far
+	int segments(void){ return m_segments; }
+
+private:
+	//state shared with helper thread, outlives the playlist if next() is abandoned
+	struct Fetch {
+		std::mutex 				mutex;
+		std::condition_variable cv;
+		bool 					bBusy = false;
+		bool 					bReady = false;
+		std::string 			path;
+	};
+
+	//path of next segment, false while next() is still running
+	bool next_path(std::string & path){
+		if(!m_fetch){
+			path = m_next();
+			return true;
+		}
+
+		std::unique_lock<std::mutex> lk(m_fetch->mutex);
+		if(m_fetch->bReady){
+			path = m_fetch->path;
+			m_fetch->bReady = false;
+			return true;
+		}
+		if(m_fetch->bBusy)
+			return false;
+
+		//previous helper has delivered its result, only its exit is left
+		if(m_thread.joinable())
+			m_thread.join();
+		m_fetch->bBusy = true;
+		std::shared_ptr<Fetch> f = m_fetch;
+		std::function<std::string(void)> next = m_next;
+		m_thread = std::thread([f, next](){
+			std::string p = next();
+			std::lock_guard<std::mutex> lk(f->mutex);
+			f->path = p;
+			f->bReady = true;
+			f->bBusy = false;
+			f->cv.notify_all();
+		});
+		return false;
+	}
+
+	std::function<std::string(void)> m_next;
+	std::shared_ptr<Fetch> m_fetch;		// NULL: next() doesn't block (file list)
+	std::thread m_thread;
+	FILE *m_fSource = NULL;
+	bool m_bEOS = false;
+	int m_segments = 0;
+};
+
+//H.264 Annex-B file fed one whole access unit per Feed(), flagged MFX_BITSTREAM_COMPLETE_FRAME,
+//so the decoder outputs a frame as soon as its last byte is fed (low latency mode).
+//an access unit starts at AUD/SPS/PPS/SEI or at a slice with first_mb_in_slice == 0
+class hddlBitstreamFrames: public hddlBitstreamFile
+{
+public:
+	hddlBitstreamFrames(const char * fname, bool bRepeat = false, bool bFollow = false):
+		hddlBitstreamFile(fname, bRepeat, bFollow){}
+
+	virtual mfxU32 Feed(void){
+
+		memmove(this->Data, this->Data + this->DataOffset, this->DataLength);
+		this->DataOffset = 0;
+
+		size_t end = 0;
+		bool bComplete = find_au(end);
+		if(end == 0)
+			return 0;
+
+		//an access unit larger than the buffer is fed in pieces, without the flag
+		mfxU32 nBytesSpace = this->MaxLength - this->DataLength;
+		if(end > nBytesSpace){
+			end = nBytesSpace;
+			bComplete = false;
+		}
+		memcpy(this->Data + this->DataLength, m_in.data() + m_pos, end);
+		m_pos += end;
+		this->DataLength += (mfxU32)end;
+		this->DataFlag = bComplete ? MFX_BITSTREAM_COMPLETE_FRAME : 0;
+		this->TimeStamp ++;
+		return (mfxU32)end;
+	}
+	virtual bool IsEnd(void){
+		return m_bEOS && m_pos >= m_in.size() && this->DataLength == 0;
+	}
+
+private:
+	//read more of the file behind unconsumed input, return false if nothing was read
+	bool read_more(void){
+		if(m_bEOS) return false;
+		if(m_pos > 0){
+			m_in.erase(m_in.begin(), m_in.begin() + m_pos);
+			m_pos = 0;
+		}
+		const size_t chunk = 64*1024;
+		size_t old = m_in.size();
+		m_in.resize(old + chunk);
+		size_t n = fread(m_in.data() + old, 1, chunk, m_fSource);
+		if(n == 0 && m_bRepeat && !m_bFollow){
+			fseek(m_fSource, 0, SEEK_SET);
+			n = fread(m_in.data() + old, 1, chunk, m_fSource);
+		}
+		m_in.resize(old + n);
+		if(n == 0){
+			if(m_bFollow)
+				clearerr(m_fSource);
+			else
+				m_bEOS = true;
+		}
+		return n > 0;
+	}
+
+	//length of the access unit at m_pos, return true if its end is known
+	//(next access unit starts, or end of stream)
+	bool find_au(size_t & end){
+		size_t scan = m_pos;
+		bool bVCL = false;
+		for(;;){
+			const mfxU8 * p = m_in.data();
+			size_t size = m_in.size();
+			size_t i = scan;
+			for(; i + 4 < size; i++){
+				if(p[i] != 0 || p[i + 1] != 0 || p[i + 2] != 1)
+					continue;
+				int type = p[i + 3] & 0x1F;
+				bool bSlice = (type == 1 || type == 5);
+				if(bVCL && (type == 6 || type == 7 || type == 8 || type == 9 || (type >= 14 && type <= 18) ||
+							(bSlice && (p[i + 4] & 0x80)))){
+					//zero_byte of a 4 byte start code belongs to next access unit
+					end = ((i > m_pos && p[i - 1] == 0) ? i - 1 : i) - m_pos;
+					return true;
+				}
+				bVCL = bVCL || bSlice;
+				i += 3;
+			}
+			scan = i;
+			size_t consumed = scan - m_pos;
+			if(!read_more()){
+				if(m_bEOS){
+					end = m_in.size() - m_pos;
+					return true;
+				}
+				//follow mode, tail of file is not a complete access unit yet
+				end = 0;
+				return false;
+			}
+			scan = m_pos + consumed;
+		}
+	}
+
+	std::vector<mfxU8> 	m_in;
+	size_t 				m_pos = 0;
 };
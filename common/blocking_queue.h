@@ -10,6 +10,7 @@
 #include <mutex>
 #include <functional>
 #include <deque>
+#include <chrono>
 #include <condition_variable>
 
 template<class T>
@@ -57,6 +58,29 @@ public:
 
     bool get(T &ret){ return get(ret, [](const T &){return true;}); }
 
+    //like get() but gives up at deadline
+    // return: 1 if got an element
+    //         0 on timeout
+    //         -1 if writer is closed & queue is empty
+    template<class Clock, class Duration>
+    int get_until(T &ret, const std::chrono::time_point<Clock, Duration> & deadline)
+    {
+        std::unique_lock<std::mutex> lk(_m);
+
+        if(!_cv.wait_until(lk, deadline, [this]{ return !_q.empty() || _closed; }))
+            return 0;
+
+        if(_q.empty()) return -1;
+
+        ret = _q.front();
+        _q.pop_front();
+
+        if(_q.size() < _size_limit)
+            _cv_notfull.notify_all();
+
+        return 1;
+    }
+
     bool put(const T & obj, bool drop_on_overflow = false)
     {
         std::unique_lock<std::mutex> lk(_m);
@@ -65,20 +89,60 @@ public:
         	return false;
 
         _cv_notfull.wait(lk, [this]{
-            return _q.size() <_size_limit;
+            return _q.size() <_size_limit || _closed;
         });
 
+        //reader is gone, nobody will consume it
+        if(_closed) return false;
+
         _q.push_back(obj);
         _cv.notify_all();
 
         return true;
     }
 
+    //never blocks: when queue is full, oldest elements are dropped to make room
+    //(limit < size_limit: queue is kept at that many elements, e.g. 1 for latest-wins)
+    //return number of elements dropped, or -1 if queue is closed
+    int put_overwrite(const T & obj, size_t limit = 0x7FFFFFFF)
+    {
+        std::deque<T> dropped;
+        {
+            std::unique_lock<std::mutex> lk(_m);
+            if(_closed) return -1;
+
+            size_t lim = std::max<size_t>(std::min(limit, _size_limit), 1);
+            while(_q.size() >= lim && !_q.empty()){
+                dropped.push_back(_q.front());
+                _q.pop_front();
+            }
+            _q.push_back(obj);
+            _cv.notify_all();
+        }
+        //dropped elements are destructed out of lock
+        return (int)dropped.size();
+    }
+
+    //close the queue: readers get remaining elements then false,
+    //blocked writers are woken up and put() returns false from now on
     void close(void)
     {
         std::unique_lock<std::mutex> lk(_m);
         _closed = true;
         _cv.notify_all();
+        _cv_notfull.notify_all();
+    }
+
+    //drop all remaining elements (e.g. to release resources held by them)
+    void clear(void)
+    {
+        std::deque<T> q;
+        {
+            std::unique_lock<std::mutex> lk(_m);
+            q.swap(_q);
+            _cv_notfull.notify_all();
+        }
+        //elements are destructed out of lock
     }
     int size(void){
         std::unique_lock<std::mutex> lk(_m);
@@ -0,0 +1,223 @@
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "channel_manager.h"
+#include "common_utils.h"
+
+typedef std::chrono::duration<double, std::milli> ms_t;
+
+ChannelManager::ChannelManager(int output_queue_size, mfxIMPL impl, bool drop_on_overflow):
+		m_output_queue_size(output_queue_size),
+		m_impl(impl),
+		m_drop_on_overflow(drop_on_overflow),
+		m_shared_output(false),
+		m_output_mode(MediaDecoder::OutputMode::dec_vpp),
+		m_footprint(0)
+{
+}
+
+ChannelManager::~ChannelManager()
+{
+	remove_all();
+}
+
+bool ChannelManager::admit(int id, const char * file_url, size_t freed)
+{
+	//decoder asserts on a source it can't open, refuse it here instead
+	FILE * f = fopen(file_url, "rb");
+	if(!f){
+		fprintf(stderr, "ChannelManager: cannot open %s, channel %d refused\n", file_url, id);
+		return false;
+	}
+	fclose(f);
+
+	//admission control before any decoder resource is taken: the budget must have room
+	//for a whole channel, not just for its first allocation
+	frame_memory_accountant & fma = frame_memory_accountant::instance();
+	size_t need = m_footprint ? m_footprint.load() : fma.largest_channel();
+	size_t avail = fma.available();
+	if(avail != SIZE_MAX)
+		avail += freed;
+	if(avail == 0 || avail < need){
+		fprintf(stderr, "ChannelManager: frame memory budget has %zu bytes left, channel %d needs %zu, refused\n",
+				avail, id, need);
+		return false;
+	}
+	return true;
+}
+
+std::unique_ptr<ChannelManager::Channel> ChannelManager::make_channel(int id, const char * file_url, FrameCallback cb)
+{
+	std::unique_ptr<Channel> ch(new Channel());
+	ch->id = id;
+	ch->url = file_url;
+	ch->cb = cb;
+	ch->decoder.reset(new MediaDecoder(m_output_queue_size));
+	ch->bPending = true;
+
+	char name[32];
+	snprintf(name, sizeof(name), "channel %d", id);
+	ch->decoder->set_name(name);
+	if(m_shared_output)
+		ch->decoder->set_shared_output(true);
+	ch->decoder->set_output_mode((MediaDecoder::OutputMode)m_output_mode.load());
+	return ch;
+}
+
+void ChannelManager::start_channel(Channel * pch)
+{
+	//url string is owned by channel, so it outlives decode thread
+	pch->t_add = std::chrono::steady_clock::now();
+	pch->decoder->start(pch->url.c_str(), m_impl, m_drop_on_overflow);
+	pch->consumer = std::thread(&ChannelManager::consume, this, pch);
+	pch->bPending = false;
+}
+
+bool ChannelManager::add(int id, const char * file_url, FrameCallback cb)
+{
+	if(!admit(id, file_url, 0))
+		return false;
+
+	std::unique_ptr<Channel> ch = make_channel(id, file_url, cb);
+
+	std::lock_guard<std::mutex> guard(m_mutex);
+	if(m_channels.count(id)){
+		fprintf(stderr, "ChannelManager: channel %d already exists\n", id);
+		return false;
+	}
+
+	start_channel(ch.get());
+	m_channels[id] = std::move(ch);
+	return true;
+}
+
+bool ChannelManager::remove(int id)
+{
+	std::unique_ptr<Channel> ch;
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		auto it = m_channels.find(id);
+		if(it == m_channels.end() || it->second->bPending)
+			return false;
+		ch = std::move(it->second);
+		m_channels.erase(it);
+	}
+
+	//other channels are not blocked by this teardown
+	teardown(ch);
+	return true;
+}
+
+bool ChannelManager::replace(int id, const char * file_url)
+{
+	std::unique_ptr<Channel> old;
+	Channel * pch;
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		auto it = m_channels.find(id);
+		if(it == m_channels.end() || it->second->bPending)
+			return false;
+
+		//refused: old channel keeps running. its frame memory is freed before the new one allocates
+		if(!admit(id, file_url, it->second->decoder->frame_memory()))
+			return false;
+
+		//new channel takes the id right away, it starts once the old one is freed
+		old = std::move(it->second);
+		it->second = make_channel(id, file_url, old->cb);
+		pch = it->second.get();
+	}
+
+	teardown(old);
+
+	std::lock_guard<std::mutex> guard(m_mutex);
+	start_channel(pch);
+	return true;
+}
+
+void ChannelManager::remove_all(void)
+{
+	for(auto id : channels())
+		remove(id);
+}
+
+std::vector<int> ChannelManager::channels(void)
+{
+	std::vector<int> ids;
+	std::lock_guard<std::mutex> guard(m_mutex);
+	for(auto &c : m_channels)
+		ids.push_back(c.first);
+	return ids;
+}
+
+MediaDecoder::State ChannelManager::state(int id)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	auto it = m_channels.find(id);
+	if(it == m_channels.end())
+		return MediaDecoder::State::stopped;
+	return it->second->decoder->state();
+}
+
+void ChannelManager::consume(Channel * pch)
+{
+	bool bFirst = true;
+	MediaDecoder::Output out;
+
+	//get() returns false when stream is drained or decoder is stopped
+	while(pch->decoder->get(out)){
+		if(bFirst){
+			double ms = ms_t(std::chrono::steady_clock::now() - pch->t_add).count();
+			std::lock_guard<std::mutex> guard(m_stat_mutex);
+			m_add_to_first_frame.add(ms);
+			bFirst = false;
+		}
+		if(pch->cb)
+			pch->cb(pch->id, out);
+
+		//return surfaces before blocking on next get()
+		out = MediaDecoder::Output();
+	}
+}
+
+void ChannelManager::teardown(std::unique_ptr<Channel> & ch)
+{
+	auto t0 = std::chrono::steady_clock::now();
+
+	//stop() cancels decoder's blocking waits, so consumer's get() returns promptly
+	ch->decoder->stop();
+	if(ch->consumer.joinable())
+		ch->consumer.join();
+
+	//consumer is gone, so only Outputs the callback kept can be alive now (see channel_manager.h)
+	//surface pools & session can be freed
+	ch->decoder.reset();
+
+	double ms = ms_t(std::chrono::steady_clock::now() - t0).count();
+	std::lock_guard<std::mutex> guard(m_stat_mutex);
+	m_remove_to_freed.add(ms);
+}
+
+ChannelManager::Latency ChannelManager::add_to_first_frame(void)
+{
+	std::lock_guard<std::mutex> guard(m_stat_mutex);
+	return m_add_to_first_frame;
+}
+
+ChannelManager::Latency ChannelManager::remove_to_freed(void)
+{
+	std::lock_guard<std::mutex> guard(m_stat_mutex);
+	return m_remove_to_freed;
+}
+
+void ChannelManager::report(void)
+{
+	Latency a = add_to_first_frame();
+	Latency r = remove_to_freed();
+	printf("ChannelManager: %d channels, add-to-first-frame %d times avg %.2f ms max %.2f ms, "
+			"remove-to-freed %d times avg %.2f ms max %.2f ms\n",
+			(int)channels().size(),
+			a.count, a.avg_ms(), a.max_ms,
+			r.count, r.avg_ms(), r.max_ms);
+}
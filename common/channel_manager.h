@@ -0,0 +1,100 @@
+#ifndef _CHANNEL_MANAGER_H_
+#define _CHANNEL_MANAGER_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+#include "media_pipeline.h"
+
+//Runtime set of decode channels.
+//  each channel owns one MediaDecoder and one consumer thread which pulls
+//  frames and hands them to the user callback, so a channel can be removed
+//  at any time without coordinating with user threads.
+//
+//  remove()/replace()/remove_all() free the decoder's surface pools as soon as
+//  the consumer thread has exited. A callback that keeps copies of the Output
+//  beyond its return (e.g. frames lent to other processes) must drop them
+//  before the channel is removed, otherwise the surfaces outlive their pool.
+class ChannelManager
+{
+public:
+	//called from channel's consumer thread for every decoded frame
+	typedef std::function<void(int id, MediaDecoder::Output & out)> FrameCallback;
+
+	ChannelManager(int output_queue_size = 8, mfxIMPL impl = MFX_IMPL_AUTO, bool drop_on_overflow = true);
+	~ChannelManager();
+
+	//VPP output of channels added afterwards is exportable to other processes
+	//(see MediaDecoder::set_shared_output)
+	void set_shared_output(bool bShared){ m_shared_output = bShared; }
+	//output mode of channels added afterwards (see MediaDecoder::set_output_mode)
+	void set_output_mode(MediaDecoder::OutputMode mode){ m_output_mode = mode; }
+	//frame memory a new channel is expected to take, add() refuses the channel
+	//if the budget has less left. 0 (default): the largest peak any channel reached
+	void set_channel_footprint(size_t bytes){ m_footprint = bytes; }
+
+	bool add(int id, const char * file_url, FrameCallback cb);
+	bool remove(int id);
+	//restart channel id on a new source, keep its callback. if the new source is
+	//refused (can't be opened, over budget) the old one keeps running. until replace()
+	//returns the id stays taken and the channel can't be removed or replaced again
+	bool replace(int id, const char * file_url);
+	void remove_all(void);
+
+	std::vector<int> channels(void);
+	MediaDecoder::State state(int id);
+
+	//churn cost statistics
+	struct Latency {
+		int    count = 0;
+		double sum_ms = 0;
+		double max_ms = 0;
+		void add(double ms){ count++; sum_ms += ms; if(ms > max_ms) max_ms = ms; }
+		double avg_ms(void) const { return count ? sum_ms/count : 0; }
+	};
+	Latency add_to_first_frame(void);
+	Latency remove_to_freed(void);
+	void report(void);
+
+private:
+	struct Channel {
+		int 								id;
+		std::string 						url;
+		FrameCallback						cb;
+		std::unique_ptr<MediaDecoder> 		decoder;
+		std::thread 						consumer;
+		std::chrono::steady_clock::time_point t_add;
+		bool 								bPending;	// not started yet (replace() in progress)
+	};
+
+	//check source & frame memory budget for a new channel, freed: bytes released before it starts
+	bool admit(int id, const char * file_url, size_t freed);
+	std::unique_ptr<Channel> make_channel(int id, const char * file_url, FrameCallback cb);
+	//caller holds m_mutex
+	void start_channel(Channel * pch);
+	void consume(Channel * pch);
+	void teardown(std::unique_ptr<Channel> & ch);
+
+	const int 							m_output_queue_size;
+	const mfxIMPL 						m_impl;
+	const bool 							m_drop_on_overflow;
+	std::atomic<bool> 					m_shared_output;
+	std::atomic<int> 					m_output_mode;
+	std::atomic<size_t> 				m_footprint;
+
+	std::mutex 							m_mutex;
+	std::map<int, std::unique_ptr<Channel>> m_channels;
+
+	std::mutex 							m_stat_mutex;
+	Latency 							m_add_to_first_frame;
+	Latency 							m_remove_to_freed;
+};
+
+#endif
@@ -0,0 +1,140 @@
+
+#include <math.h>
+#include <string.h>
+
+#include "color_convert.h"
+#include "simd_rows.h"
+
+// rows per tile, smaller tiles cost more in thread hand-off than they win
+#define CC_MIN_TILE_ROWS 	32
+
+int cc_format_bpp(cc_format fmt)
+{
+	switch(fmt){
+	case CC_FMT_RGB24:
+	case CC_FMT_BGR24: 	return 3;
+	case CC_FMT_RGBA:
+	case CC_FMT_BGRA: 	return 4;
+	default: 			return 1;
+	}
+}
+
+static int16_t q13(double v)
+{
+	return (int16_t)lround(v * 8192.0);
+}
+
+void cc_make_coeffs(cc_matrix matrix, cc_range range, cc_coeffs * c)
+{
+	// Kr/Kb derived factors of R = Y + rv*V, G = Y - gu*U - gv*V, B = Y + bu*U
+	double rv, gu, gv, bu;
+	if(matrix == CC_BT709){
+		rv = 1.5748; gu = 0.187324; gv = 0.468124; bu = 1.8556;
+	}else{
+		rv = 1.402; gu = 0.344136; gv = 0.714136; bu = 1.772;
+	}
+
+	double ys = 1.0, cs = 1.0;
+	c->y_offset = 0;
+	if(range == CC_RANGE_LIMITED){
+		ys = 255.0 / 219.0;
+		cs = 255.0 / 224.0;
+		c->y_offset = 16;
+	}
+
+	c->y_scale = q13(ys);
+	c->rv = q13(rv * cs);
+	c->gu = q13(gu * cs);
+	c->gv = q13(gv * cs);
+	c->bu = q13(bu * cs);
+}
+
+bool nv12_to_rgb(const uint8_t * y, int y_pitch, const uint8_t * uv, int uv_pitch,
+				 int width, int height, uint8_t * dst, int dst_pitch, cc_format fmt,
+				 cc_matrix matrix, cc_range range, int threads)
+{
+	if(!y || !uv || !dst || width <= 0 || height <= 0)
+		return false;
+	if(dst_pitch < width * cc_format_bpp(fmt))
+		return false;
+
+	cc_coeffs coeffs;
+	cc_make_coeffs(matrix, range, &coeffs);
+
+	cc_layout layout = CC_LAYOUT_PLANAR;
+	if(fmt == CC_FMT_RGB24 || fmt == CC_FMT_BGR24) layout = CC_LAYOUT_PACKED3;
+	if(fmt == CC_FMT_RGBA || fmt == CC_FMT_BGRA) layout = CC_LAYOUT_PACKED4;
+	bool bgr = (fmt == CC_FMT_BGR24 || fmt == CC_FMT_BGRA || fmt == CC_FMT_BGRP);
+
+	size_t plane_size = (size_t)dst_pitch * height;
+	const simd_row_kernels * k = simd_rows_get(simd_active());
+
+	parallel_rows(height, CC_MIN_TILE_ROWS, [&](int y0, int y1){
+		for(int r = y0; r < y1; r++){
+			size_t off = (size_t)dst_pitch * r;
+			uint8_t * const planes[3] = {dst + off, dst + plane_size + off, dst + 2*plane_size + off};
+			k->nv12_to_rgb(y + (size_t)y_pitch * r, uv + (size_t)uv_pitch * (r/2), planes, width, &coeffs, layout, bgr);
+		}
+	}, threads);
+
+	return true;
+}
+
+bool nv12_to_i420(const uint8_t * y, int y_pitch, const uint8_t * uv, int uv_pitch,
+				  int width, int height, uint8_t * dst, int threads)
+{
+	if(!y || !uv || !dst || width <= 0 || height <= 0)
+		return false;
+
+	int cw = (width + 1) / 2;
+	int ch = (height + 1) / 2;
+	uint8_t * dst_u = dst + (size_t)width * height;
+	uint8_t * dst_v = dst_u + (size_t)cw * ch;
+	const simd_row_kernels * k = simd_rows_get(simd_active());
+
+	parallel_rows(height, CC_MIN_TILE_ROWS, [&](int y0, int y1){
+		for(int r = y0; r < y1; r++)
+			memcpy(dst + (size_t)width * r, y + (size_t)y_pitch * r, width);
+		//chroma rows belonging to luma rows [y0, y1)
+		for(int r = (y0 + 1) / 2; r < (y1 + 1) / 2; r++)
+			k->uv_deinterleave(uv + (size_t)uv_pitch * r, dst_u + (size_t)cw * r, dst_v + (size_t)cw * r, cw);
+	}, threads);
+
+	return true;
+}
+
+bool i420_to_nv12(const uint8_t * y, int y_pitch, const uint8_t * u, const uint8_t * v, int uv_pitch,
+				  int width, int height, uint8_t * dst_y, int dst_y_pitch,
+				  uint8_t * dst_uv, int dst_uv_pitch, int threads)
+{
+	if(!y || !u || !v || !dst_y || !dst_uv || width <= 0 || height <= 0)
+		return false;
+
+	int cw = (width + 1) / 2;
+	const simd_row_kernels * k = simd_rows_get(simd_active());
+
+	parallel_rows(height, CC_MIN_TILE_ROWS, [&](int y0, int y1){
+		for(int r = y0; r < y1; r++)
+			memcpy(dst_y + (size_t)dst_y_pitch * r, y + (size_t)y_pitch * r, width);
+		for(int r = (y0 + 1) / 2; r < (y1 + 1) / 2; r++)
+			k->uv_interleave(u + (size_t)uv_pitch * r, v + (size_t)uv_pitch * r, dst_uv + (size_t)dst_uv_pitch * r, cw);
+	}, threads);
+
+	return true;
+}
+
+bool rgb4_to_bgr24(const uint8_t * src, int src_pitch, int width, int height,
+				   uint8_t * dst, int dst_pitch, int threads)
+{
+	if(!src || !dst || width <= 0 || height <= 0 || dst_pitch < width * 3)
+		return false;
+
+	const simd_row_kernels * k = simd_rows_get(simd_active());
+
+	parallel_rows(height, CC_MIN_TILE_ROWS, [&](int y0, int y1){
+		for(int r = y0; r < y1; r++)
+			k->bgra_to_bgr(src + (size_t)src_pitch * r, dst + (size_t)dst_pitch * r, width);
+	}, threads);
+
+	return true;
+}
@@ -0,0 +1,55 @@
+#ifndef _COLOR_CONVERT_H_
+#define _COLOR_CONVERT_H_
+
+#include <stdint.h>
+
+// CPU color conversion of decoded frames, for nodes without VPP or consumers
+// wanting a layout VPP doesn't produce. Vectorized (SSE4.1/AVX2/AVX-512, picked
+// at runtime, see simd_dispatch.h) and split into row tiles over worker threads.
+
+enum cc_matrix {
+	CC_BT601 = 0,
+	CC_BT709,
+};
+
+enum cc_range {
+	CC_RANGE_LIMITED = 0,	// Y 16-235, UV 16-240 (video)
+	CC_RANGE_FULL,			// 0-255 (JPEG)
+};
+
+enum cc_format {
+	CC_FMT_RGB24 = 0,
+	CC_FMT_BGR24,
+	CC_FMT_RGBA,			// alpha 255
+	CC_FMT_BGRA,			// same as Media SDK RGB4 in memory
+	CC_FMT_RGBP,			// 3 planes R,G,B of dst_pitch*height bytes each
+	CC_FMT_BGRP,
+};
+
+// bytes per pixel in the first plane
+int cc_format_bpp(cc_format fmt);
+
+// fixed point coefficients of the row kernels (simd_rows.h)
+struct cc_coeffs;
+void cc_make_coeffs(cc_matrix matrix, cc_range range, cc_coeffs * c);
+
+// NV12 -> fmt, width & height in pixels, threads 0: all cores
+bool nv12_to_rgb(const uint8_t * y, int y_pitch, const uint8_t * uv, int uv_pitch,
+				 int width, int height, uint8_t * dst, int dst_pitch, cc_format fmt,
+				 cc_matrix matrix = CC_BT601, cc_range range = CC_RANGE_LIMITED, int threads = 0);
+
+// NV12 -> I420 planes back to back in dst: Y (width x height), then U & V
+// ((width+1)/2 x (height+1)/2 each)
+bool nv12_to_i420(const uint8_t * y, int y_pitch, const uint8_t * uv, int uv_pitch,
+				  int width, int height, uint8_t * dst, int threads = 0);
+
+// I420 planes -> NV12 (U & V interleaved), any width; pass V before U for YV12
+bool i420_to_nv12(const uint8_t * y, int y_pitch, const uint8_t * u, const uint8_t * v, int uv_pitch,
+				  int width, int height, uint8_t * dst_y, int dst_y_pitch,
+				  uint8_t * dst_uv, int dst_uv_pitch, int threads = 0);
+
+// RGB4 (B,G,R,A in memory) -> BGR24
+bool rgb4_to_bgr24(const uint8_t * src, int src_pitch, int width, int height,
+				   uint8_t * dst, int dst_pitch, int threads = 0);
+
+#endif
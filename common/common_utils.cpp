@@ -9,6 +9,9 @@ Copyright(c) 2005-2014 Intel Corporation. All Rights Reserved.
 *****************************************************************************/
 #include "mfxvideo.h"
 #include "common_utils.h"
+#include "simd_rows.h"
+
+#include <vector>
 
 // ATTENTION: If D3D surfaces are used, DX9_D3D or DX11_D3D must be set in project settings or hardcoded here
 #ifdef WIN32
@@ -163,20 +166,6 @@ void PrintErrString(int err,const char* filestr,int line)
     }
 }
 
-mfxStatus ReadPlaneData(mfxU16 w, mfxU16 h, mfxU8* buf, mfxU8* ptr,
-                        mfxU16 pitch, mfxU16 offset, FILE* fSource)
-{
-    mfxU32 nBytesRead;
-    for (mfxU16 i = 0; i < h; i++) {
-        nBytesRead = (mfxU32) fread(buf, 1, w, fSource);
-        if (w != nBytesRead)
-            return MFX_ERR_MORE_DATA;
-        for (mfxU16 j = 0; j < w; j++)
-            ptr[i * pitch + j * 2 + offset] = buf[j];
-    }
-    return MFX_ERR_NONE;
-}
-
 mfxStatus LoadRawFrame(mfxFrameSurface1* pSurface, FILE* fSource)
 {
     if (!fSource) {
@@ -188,7 +177,6 @@ mfxStatus LoadRawFrame(mfxFrameSurface1* pSurface, FILE* fSource)
             return MFX_ERR_NONE;
     }
 
-    mfxStatus sts = MFX_ERR_NONE;
     mfxU32 nBytesRead;
     mfxU16 w, h, i, pitch;
     mfxU8* ptr;
@@ -213,21 +201,17 @@ mfxStatus LoadRawFrame(mfxFrameSurface1* pSurface, FILE* fSource)
             return MFX_ERR_MORE_DATA;
     }
 
-    mfxU8 buf[2048];        // maximum supported chroma width for nv12
-    w /= 2;
-    h /= 2;
-    ptr = pData->UV + pInfo->CropX + (pInfo->CropY / 2) * pitch;
-    if (w > 2048)
-        return MFX_ERR_UNSUPPORTED;
-
-    // load U
-    sts = ReadPlaneData(w, h, buf, ptr, pitch, 0, fSource);
-    if (MFX_ERR_NONE != sts)
-        return sts;
-    // load V
-    ReadPlaneData(w, h, buf, ptr, pitch, 1, fSource);
-    if (MFX_ERR_NONE != sts)
-        return sts;
+    // read both chroma planes at once, then interleave U/V rows into the UV plane
+    static thread_local std::vector<mfxU8> buf;
+    size_t cw = (w + 1) / 2, ch = (h + 1) / 2;
+    buf.resize(cw * ch * 2);
+    if (fread(buf.data(), 1, buf.size(), fSource) != buf.size())
+        return MFX_ERR_MORE_DATA;
+
+    const simd_row_kernels* k = simd_rows_get(simd_active());
+    ptr = pData->UV + (pInfo->CropX & ~1) + (pInfo->CropY / 2) * pitch;
+    for (i = 0; i < ch; i++)
+        k->uv_interleave(&buf[i * cw], &buf[(ch + i) * cw], ptr + i * pitch, (int)cw);
 
     return MFX_ERR_NONE;
 }
@@ -85,8 +85,9 @@ std::string get_fourcc(mfxU32 fourcc);
 
 void PrintErrString(int err,const char* filestr,int line);
 
-// LoadRawFrame: Reads raw frame from YUV file (YV12) into NV12 surface
-// - YV12 is a more common format for for YUV files than NV12 (therefore the conversion during read and write)
+// LoadRawFrame: Reads raw frame from YUV file (I420) into NV12 surface, any width
+// - I420 is a more common format for for YUV files than NV12 (therefore the conversion during read and write)
+// - see raw_frame_loader.h for mmap'ed input and other formats
 // - For the simulation case (fSource = NULL), the surface is filled with default image data
 // LoadRawRGBFrame: Reads raw RGB32 frames from file into RGB32 surface
 // - For the simulation case (fSource = NULL), the surface is filled with default image data
@@ -0,0 +1,139 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "frame_batcher.h"
+#include "common_utils.h"
+
+#define BATCH_ALIGN 	4096
+
+static uint8_t * batch_alloc(size_t size)
+{
+	void * p = NULL;
+#ifdef _WIN32
+	p = _aligned_malloc(size, BATCH_ALIGN);
+#else
+	if(posix_memalign(&p, BATCH_ALIGN, size) != 0)
+		p = NULL;
+#endif
+	return (uint8_t*)p;
+}
+
+static void batch_free(uint8_t * p)
+{
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+frame_batcher::frame_batcher(int batch_size, const tensor_params & params, int max_wait_ms, int threads):
+	m_batch_size(batch_size > 0 ? batch_size : 1),
+	m_params(params),
+	m_max_wait_ms(max_wait_ms),
+	m_threads(threads),
+	m_tensor_bytes(tensor_size(params)),
+	m_buffer(NULL),
+	m_arrivals(m_batch_size),
+	m_active(0),
+	m_stop(false)
+{
+	m_buffer = batch_alloc(m_tensor_bytes * m_batch_size);
+	if(!m_buffer)
+		fprintf(stderr, ANSI_COLOR_RED "frame_batcher: failed to allocate %zu bytes batch tensor\n" ANSI_COLOR_RESET,
+				m_tensor_bytes * m_batch_size);
+}
+
+frame_batcher::~frame_batcher()
+{
+	stop();
+	batch_free(m_buffer);
+}
+
+void frame_batcher::add_channel(int id, MediaDecoder * pdec, int queue_size)
+{
+	std::unique_ptr<Channel> ch(new Channel);
+	ch->id = id;
+	ch->pdec = pdec;
+	ch->sub = pdec->subscribe(queue_size, 1, MediaDecoder::Overflow::drop_oldest);
+
+	m_active ++;
+	ch->pump = std::thread(&frame_batcher::pump, this, ch.get());
+	m_channels.push_back(std::move(ch));
+}
+
+void frame_batcher::pump(Channel * pch)
+{
+	Item it;
+	it.channel = pch->id;
+	while(pch->sub->get(it.out)){
+		it.t_arrival = std::chrono::steady_clock::now();
+		//blocks while a batch is full & not yet taken, channel queue drops meanwhile
+		if(!m_arrivals.put(it)) break;
+		it.out = MediaDecoder::Output();
+	}
+
+	//last channel ended, let next() return what is left
+	if(--m_active == 0)
+		m_arrivals.close();
+}
+
+int frame_batcher::next(std::vector<Slot> & slots)
+{
+	slots.clear();
+	if(!m_buffer || m_stop) return 0;
+
+	std::chrono::steady_clock::time_point deadline;
+	while((int)slots.size() < m_batch_size){
+		Item it;
+		int r;
+		//the batch starts with whatever frame comes first, however long it takes
+		if(slots.empty())
+			r = m_arrivals.get(it) ? 1 : -1;
+		else
+			r = m_arrivals.get_until(it, deadline);
+		if(r <= 0) break;
+
+		if(slots.empty())
+			deadline = it.t_arrival + std::chrono::milliseconds(m_max_wait_ms);
+
+		Slot s;
+		s.channel = it.channel;
+		s.frame_number = it.out.second->m_FrameNumber;
+		s.timestamp = it.out.second->Data.TimeStamp;
+
+		uint8_t * dst = m_buffer + m_tensor_bytes * slots.size();
+		mfxStatus sts = surface_to_tensor(it.out.second.get(), m_params, dst, &s.letterbox, m_threads);
+		if(sts != MFX_ERR_NONE){
+			fprintf(stderr, ANSI_COLOR_RED "frame_batcher: channel %d frame %lu not converted (%d)\n" ANSI_COLOR_RESET,
+					s.channel, s.frame_number, sts);
+			continue;
+		}
+		s.wait_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - it.t_arrival).count();
+		slots.push_back(s);
+		//it.out goes out of scope here: surfaces return to their pools
+	}
+	return (int)slots.size();
+}
+
+int frame_batcher::dropped(void)
+{
+	int n = 0;
+	for(auto &ch : m_channels)
+		n += ch->sub->dropped();
+	return n;
+}
+
+void frame_batcher::stop(void)
+{
+	m_stop = true;
+	for(auto &ch : m_channels)
+		ch->pdec->unsubscribe(ch->sub);
+	m_arrivals.close();
+	m_arrivals.clear();
+	for(auto &ch : m_channels)
+		if(ch->pump.joinable())
+			ch->pump.join();
+	m_channels.clear();
+}
@@ -0,0 +1,82 @@
+#ifndef _FRAME_BATCHER_H_
+#define _FRAME_BATCHER_H_
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include "media_pipeline.h"
+#include "tensor_preprocess.h"
+
+// Cross-channel batch assembly for inference.
+//   frames of several MediaDecoders are converted (tensor_preprocess) straight
+//   into their slot of one preallocated batch tensor as they arrive, and the
+//   surface is returned to its pool right after. A batch is handed out when it
+//   is full or max_wait_ms after its first frame arrived, whichever is first.
+class frame_batcher
+{
+public:
+	struct Slot {
+		int 				channel;		// id given to add_channel()
+		unsigned long 		frame_number;	// surface1::m_FrameNumber
+		mfxU64 				timestamp;		// mfxFrameData::TimeStamp (90kHz)
+		tensor_letterbox 	letterbox;		// to map results back to the frame
+		double 				wait_ms;		// from arrival at batcher to conversion
+	};
+
+	//batch tensor is batch_size tensors described by params, back to back
+	frame_batcher(int batch_size, const tensor_params & params, int max_wait_ms, int threads = 0);
+	~frame_batcher();
+
+	//take frames of pdec as channel id (subscribes, so best called before pdec->start()).
+	//up to queue_size frames wait per channel, when batching falls behind the
+	//oldest are dropped. all channels must be added before the first next()
+	void add_channel(int id, MediaDecoder * pdec, int queue_size = 2);
+
+	//block until next batch is formed, slots[i] describes tensor i of data().
+	//return number of frames in batch, 0 after stop() or when all channels ended
+	int next(std::vector<Slot> & slots);
+
+	//wake up next() & release all channels
+	void stop(void);
+
+	//frames dropped from channel queues so far, because batching fell behind
+	int dropped(void);
+
+	//64-byte aligned batch tensor, valid until next call to next()
+	uint8_t * data(void){ return m_buffer; }
+	size_t tensor_bytes(void) const { return m_tensor_bytes; }
+	int batch_size(void) const { return m_batch_size; }
+
+private:
+	struct Item {
+		int 									channel;
+		MediaDecoder::Output 					out;
+		std::chrono::steady_clock::time_point 	t_arrival;
+	};
+	struct Channel {
+		int 											id;
+		MediaDecoder * 									pdec;
+		std::shared_ptr<MediaDecoder::Subscription> 	sub;
+		std::thread 									pump;
+	};
+
+	//moves frames of one channel into m_arrivals
+	void pump(Channel * pch);
+
+	const int 						m_batch_size;
+	const tensor_params 			m_params;
+	const int 						m_max_wait_ms;
+	const int 						m_threads;
+	size_t 							m_tensor_bytes;
+	uint8_t * 						m_buffer;
+
+	std::vector<std::unique_ptr<Channel>> m_channels;
+	blocking_queue<Item> 			m_arrivals;
+	std::atomic<int> 				m_active;
+	std::atomic<bool> 				m_stop;
+};
+
+#endif
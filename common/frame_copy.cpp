@@ -0,0 +1,117 @@
+
+#include <string.h>
+#include <emmintrin.h>
+
+#include "frame_copy.h"
+#include "simd_rows.h"
+
+// rows per tile
+#define COPY_MIN_TILE_ROWS 	32
+
+static int crop_w(const mfxFrameInfo & info){ return info.CropW ? info.CropW : info.Width; }
+static int crop_h(const mfxFrameInfo & info){ return info.CropH ? info.CropH : info.Height; }
+
+// bytes per pixel of first plane & number of planes
+static bool plane_format(mfxU32 fourcc, int & bpp, int & planes)
+{
+	switch(fourcc){
+	case MFX_FOURCC_NV12: bpp = 1; planes = 2; return true;
+	case MFX_FOURCC_P010: bpp = 2; planes = 2; return true;
+	case MFX_FOURCC_RGB4: bpp = 4; planes = 1; return true;
+	default: return false;
+	}
+}
+
+// UV row: interleaved pairs, an odd width still has the chroma pair of its last column
+static int uv_row_bytes(const mfxFrameInfo & info, int bpp)
+{
+	return ((crop_w(info) + 1) & ~1) * bpp;
+}
+
+size_t copy_out_size(const mfxFrameInfo & info)
+{
+	int bpp, planes;
+	if(!plane_format(info.FourCC, bpp, planes))
+		return 0;
+	size_t row = (size_t)crop_w(info) * bpp;
+	size_t h = crop_h(info);
+	return (planes == 2) ? row * h + (size_t)uv_row_bytes(info, bpp) * ((h + 1) / 2) : row * h;
+}
+
+copy_layout copy_layout_packed(uint8_t * dst, const mfxFrameInfo & info)
+{
+	copy_layout l;
+	int bpp = 1, planes = 1;
+	plane_format(info.FourCC, bpp, planes);
+	l.pitch[0] = crop_w(info) * bpp;
+	l.pitch[1] = uv_row_bytes(info, bpp);
+	l.plane[0] = dst;
+	l.plane[1] = (planes == 2) ? dst + (size_t)l.pitch[0] * crop_h(info) : NULL;
+	return l;
+}
+
+void copy_plane(const uint8_t * src, int src_pitch, uint8_t * dst, int dst_pitch,
+				int row_bytes, int rows, bool bStream, int threads)
+{
+	void (*copy)(const uint8_t *, uint8_t *, int) = NULL;
+	if(bStream){
+		copy = simd_rows_get(simd_active())->stream_copy;
+		//streaming loads are weakly ordered, make sure all earlier writes are visible
+		_mm_mfence();
+	}
+
+	parallel_rows(rows, COPY_MIN_TILE_ROWS, [&](int y0, int y1){
+		const uint8_t * s = src + (size_t)src_pitch * y0;
+		uint8_t * d = dst + (size_t)dst_pitch * y0;
+		if(!copy && src_pitch == row_bytes && dst_pitch == row_bytes){
+			memcpy(d, s, (size_t)row_bytes * (y1 - y0));
+			return;
+		}
+		for(int y = y0; y < y1; y++, s += src_pitch, d += dst_pitch){
+			if(copy) copy(s, d, row_bytes);
+			else memcpy(d, s, row_bytes);
+		}
+	}, threads);
+}
+
+mfxStatus copy_out(surface1 * psurf, const copy_layout & dst, int threads, copy_mode mode)
+{
+	if(!psurf || !dst.plane[0]) return MFX_ERR_NULL_PTR;
+
+	const mfxFrameInfo & fi = psurf->Info;
+	int bpp, planes;
+	if(!plane_format(fi.FourCC, bpp, planes))
+		return MFX_ERR_UNSUPPORTED;
+	if(planes == 2 && !dst.plane[1])
+		return MFX_ERR_NULL_PTR;
+
+	bool bLocked = false;
+	if(psurf->Data.Y == NULL && psurf->Data.B == NULL){
+		mfxStatus sts = psurf->lock();
+		if(sts != MFX_ERR_NONE) return sts;
+		bLocked = true;
+	}
+
+	bool bStream = (mode == COPY_STREAM);
+	if(mode == COPY_AUTO)
+		bStream = !(psurf->Data.MemType & MFX_MEMTYPE_SYSTEM_MEMORY);
+
+	const mfxFrameData & fd = psurf->Data;
+	int pitch = ((int)fd.PitchHigh << 16) | fd.PitchLow;
+	int w = crop_w(fi), h = crop_h(fi);
+
+	if(planes == 2){
+		copy_plane(fd.Y + (size_t)fi.CropY * pitch + fi.CropX * bpp, pitch,
+				   dst.plane[0], dst.pitch[0], w * bpp, h, bStream, threads);
+		copy_plane(fd.UV + (size_t)(fi.CropY / 2) * pitch + (fi.CropX & ~1) * bpp, pitch,
+				   dst.plane[1], dst.pitch[1], uv_row_bytes(fi, bpp), (h + 1) / 2, bStream, threads);
+	}else{
+		copy_plane(fd.B + (size_t)fi.CropY * pitch + fi.CropX * 4, pitch,
+				   dst.plane[0], dst.pitch[0], w * 4, h, bStream, threads);
+	}
+
+	if(bLocked)
+		psurf->unlock();
+
+	return MFX_ERR_NONE;
+}
@@ -0,0 +1,39 @@
+#ifndef _FRAME_COPY_H_
+#define _FRAME_COPY_H_
+
+#include <stdint.h>
+
+#include "surface_pool.h"
+
+// Copy-out of locked surfaces to caller's memory.
+//   mapped video memory is usually uncached (USWC): plain loads are serialized and
+//   run at a fraction of memory bandwidth, streaming loads (simd_row_kernels::stream_copy)
+//   fetch whole lines instead. system memory surfaces are copied with memcpy.
+
+enum copy_mode {
+	COPY_AUTO = 0,		// streaming loads unless surface is in system memory
+	COPY_MEMCPY,
+	COPY_STREAM,
+};
+
+// destination planes: NV12/P010 plane[0] Y, plane[1] UV; RGB4 plane[0] only
+struct copy_layout
+{
+	uint8_t * 	plane[2];
+	int 		pitch[2];
+};
+
+// planes packed back to back (UV right after Y), pitch is the crop row size
+// (UV rows of an odd width are rounded up to whole UV pairs)
+copy_layout copy_layout_packed(uint8_t * dst, const mfxFrameInfo & info);
+// bytes needed by copy_layout_packed(), 0 if FourCC is not supported
+size_t copy_out_size(const mfxFrameInfo & info);
+
+// copy rows x row_bytes, split over up to threads threads (0: all cores)
+void copy_plane(const uint8_t * src, int src_pitch, uint8_t * dst, int dst_pitch,
+				int row_bytes, int rows, bool bStream, int threads = 1);
+
+// copy crop rectangle of surface (NV12, P010 or RGB4) to dst, locking it if needed
+mfxStatus copy_out(surface1 * psurf, const copy_layout & dst, int threads = 1, copy_mode mode = COPY_AUTO);
+
+#endif
@@ -0,0 +1,83 @@
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "frame_ipc.h"
+
+bool frame_ipc_send(int sock, const frame_ipc_msg & msg, int fd, bool bNonBlock)
+{
+	struct msghdr mh;
+	struct iovec iov;
+	union {
+		struct cmsghdr 	align;
+		char 			buf[CMSG_SPACE(sizeof(int))];
+	} ctrl;
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = (void*)&msg;
+	iov.iov_len = sizeof(msg);
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+
+	if(fd >= 0){
+		memset(&ctrl, 0, sizeof(ctrl));
+		mh.msg_control = ctrl.buf;
+		mh.msg_controllen = sizeof(ctrl.buf);
+		struct cmsghdr * pcm = CMSG_FIRSTHDR(&mh);
+		pcm->cmsg_level = SOL_SOCKET;
+		pcm->cmsg_type = SCM_RIGHTS;
+		pcm->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(pcm), &fd, sizeof(int));
+	}
+
+	int flags = MSG_NOSIGNAL | (bNonBlock ? MSG_DONTWAIT : 0);
+	ssize_t r;
+	while((r = sendmsg(sock, &mh, flags)) < 0 && errno == EINTR);
+	return r == (ssize_t)sizeof(msg);
+}
+
+bool frame_ipc_recv(int sock, frame_ipc_msg & msg, int * pfd)
+{
+	struct msghdr mh;
+	struct iovec iov;
+	union {
+		struct cmsghdr 	align;
+		char 			buf[CMSG_SPACE(sizeof(int))];
+	} ctrl;
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = &msg;
+	iov.iov_len = sizeof(msg);
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = ctrl.buf;
+	mh.msg_controllen = sizeof(ctrl.buf);
+
+	if(pfd) *pfd = -1;
+
+	ssize_t r;
+	while((r = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+	if(r != (ssize_t)sizeof(msg))
+		return false;
+
+	for(struct cmsghdr * pcm = CMSG_FIRSTHDR(&mh); pcm; pcm = CMSG_NXTHDR(&mh, pcm)){
+		if(pcm->cmsg_level == SOL_SOCKET && pcm->cmsg_type == SCM_RIGHTS){
+			int fd;
+			memcpy(&fd, CMSG_DATA(pcm), sizeof(int));
+			//unexpected fd is not leaked
+			if(pfd) *pfd = fd;
+			else close(fd);
+		}
+	}
+	return true;
+}
+
+uint64_t frame_ipc_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
@@ -0,0 +1,64 @@
+#ifndef _FRAME_IPC_H_
+#define _FRAME_IPC_H_
+
+#include <stdint.h>
+
+#include "frame_share.h"
+
+// Frame server protocol over a Unix domain SOCK_SEQPACKET socket (Linux only).
+//   client                            server
+//   SUBSCRIBE(channel, credits)  -->
+//                                <--  POOL(pool_id, pool_size) + memfd     (once per pool)
+//                                <--  FRAME(desc, ...)                     (consumes one credit)
+//   RELEASE(pool_id, index)      -->                                      (returns one credit)
+// A client without credit does not get frames: they are dropped for it only,
+// the decoder and other clients are never stalled.
+
+enum frame_ipc_type {
+	FRAME_IPC_SUBSCRIBE = 1,
+	FRAME_IPC_RELEASE,
+	FRAME_IPC_POOL,
+	FRAME_IPC_FRAME,
+	FRAME_IPC_REJECT,
+};
+
+struct frame_ipc_msg
+{
+	uint32_t 		type;
+	int32_t 		channel;
+	union {
+		//SUBSCRIBE
+		struct {
+			uint32_t 	credits;
+		} subscribe;
+		//RELEASE
+		struct {
+			uint32_t 	pool_id;
+			uint32_t 	index;
+		} release;
+		//POOL, memfd is attached
+		struct {
+			uint32_t 	pool_id;
+			uint64_t 	pool_size;
+		} pool;
+		//FRAME
+		struct {
+			shm_frame_desc 	desc;
+			uint64_t 		frame_number;
+			uint64_t 		ready_ns;	// CLOCK_MONOTONIC when server got the frame from decoder
+			uint64_t 		sent_ns;	// CLOCK_MONOTONIC when server sent it
+			uint64_t 		dropped;	// frames dropped for this client so far
+		} frame;
+	};
+};
+
+// fd >= 0 is passed along with msg (SCM_RIGHTS)
+// non-blocking send returns false instead of waiting for socket buffer
+bool frame_ipc_send(int sock, const frame_ipc_msg & msg, int fd = -1, bool bNonBlock = false);
+
+// *pfd receives passed fd or -1, return false on error or peer closed
+bool frame_ipc_recv(int sock, frame_ipc_msg & msg, int * pfd = NULL);
+
+uint64_t frame_ipc_now_ns(void);
+
+#endif
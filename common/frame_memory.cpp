@@ -0,0 +1,150 @@
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "frame_memory.h"
+#include "common_utils.h"
+
+#define MB(x) ((double)(x)/(1024.0*1024.0))
+#define FRAME_PAGE 			4096
+#define ALIGN_UP(x, a) 		(((x) + (a) - 1) / (a) * (a))
+
+frame_memory_accountant & frame_memory_accountant::instance(void)
+{
+	static frame_memory_accountant theOne;
+	return theOne;
+}
+
+void frame_memory_accountant::set_budget(size_t bytes)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	m_budget = bytes;
+}
+
+size_t frame_memory_accountant::budget(void)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	return m_budget;
+}
+
+size_t frame_memory_accountant::available(void)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	if(m_budget == 0) return SIZE_MAX;
+	return (m_total.current >= m_budget) ? 0 : (m_budget - m_total.current);
+}
+
+bool frame_memory_accountant::charge(const void * owner, mfxU32 fourcc, size_t bytes)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	if(m_budget > 0 && m_total.current + bytes > m_budget)
+		return false;
+
+	m_total.add(bytes);
+	Channel & c = m_channels[owner];
+	c.usage.add(bytes);
+	c.fourcc[fourcc] += bytes;
+	if(c.usage.peak > m_largest) m_largest = c.usage.peak;
+	m_fourcc[fourcc].add(bytes);
+	return true;
+}
+
+void frame_memory_accountant::uncharge(const void * owner, mfxU32 fourcc, size_t bytes)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	m_total.sub(bytes);
+	auto it = m_channels.find(owner);
+	if(it != m_channels.end()){
+		it->second.usage.sub(bytes);
+		size_t & f = it->second.fourcc[fourcc];
+		f = (bytes > f) ? 0 : (f - bytes);
+	}
+	m_fourcc[fourcc].sub(bytes);
+}
+
+void frame_memory_accountant::set_label(const void * owner, const char * label)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	m_channels[owner].label = label ? label : "";
+}
+
+void frame_memory_accountant::forget(const void * owner)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	auto it = m_channels.find(owner);
+	if(it == m_channels.end()) return;
+
+	//memory not freed by owner would otherwise never be returned to budget
+	m_total.sub(it->second.usage.current);
+	for(auto &f : it->second.fourcc)
+		m_fourcc[f.first].sub(f.second);
+	m_channels.erase(it);
+}
+
+frame_memory_accountant::Usage frame_memory_accountant::total(void)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	return m_total;
+}
+
+frame_memory_accountant::Usage frame_memory_accountant::channel(const void * owner)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	auto it = m_channels.find(owner);
+	return (it == m_channels.end()) ? Usage() : it->second.usage;
+}
+
+frame_memory_accountant::Usage frame_memory_accountant::fourcc(mfxU32 fourcc)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	auto it = m_fourcc.find(fourcc);
+	return (it == m_fourcc.end()) ? Usage() : it->second;
+}
+
+size_t frame_memory_accountant::largest_channel(void)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	return m_largest;
+}
+
+void frame_memory_accountant::report(void)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	printf("frame memory: current %.1f MB, peak %.1f MB, budget ", MB(m_total.current), MB(m_total.peak));
+	if(m_budget) printf("%.1f MB\n", MB(m_budget));
+	else printf("unlimited\n");
+
+	for(auto &c : m_channels)
+		printf("    channel %-24s current %8.1f MB  peak %8.1f MB\n",
+				c.second.label.empty() ? "?" : c.second.label.c_str(),
+				MB(c.second.usage.current), MB(c.second.usage.peak));
+	for(auto &f : m_fourcc)
+		printf("    fourcc  %-24s current %8.1f MB  peak %8.1f MB\n",
+				get_fourcc(f.first).c_str(),
+				MB(f.second.current), MB(f.second.peak));
+}
+
+size_t frame_memory_accountant::frame_size(const mfxFrameInfo & info)
+{
+	//driver surfaces: rows padded to 64 bytes, height to 32 lines (tiled), whole pages
+	size_t height = ALIGN_UP((size_t)info.Height, 32);
+	size_t bytes;
+	switch(info.FourCC){
+	case MFX_FOURCC_NV12:
+	case MFX_FOURCC_YV12:
+		bytes = ALIGN_UP((size_t)info.Width, 64) * height * 3 / 2;
+		break;
+	case MFX_FOURCC_YUY2:
+		bytes = ALIGN_UP((size_t)info.Width * 2, 64) * height;
+		break;
+	case MFX_FOURCC_P8:
+		//coded buffer, same size estimation as VAAPI allocator
+		bytes = (size_t)info.Width * info.Height * 400 / (16 * 16);
+		break;
+	case MFX_FOURCC_RGB4:
+	default:
+		bytes = ALIGN_UP((size_t)info.Width * 4, 64) * height;
+		break;
+	}
+	return ALIGN_UP(bytes, FRAME_PAGE);
+}
@@ -0,0 +1,68 @@
+#ifndef _FRAME_MEMORY_H_
+#define _FRAME_MEMORY_H_
+
+#include <map>
+#include <string>
+#include <mutex>
+
+#include "mfxvideo.h"
+
+// Process-wide bookkeeping of frame memory allocated by all videoframe_allocator
+// instances. With a budget set, allocations which would exceed it are refused
+// (MFX_ERR_MEMORY_ALLOC) instead of letting the host run out of memory.
+class frame_memory_accountant
+{
+public:
+	static frame_memory_accountant & instance(void);
+
+	// 0 means unlimited (default)
+	void set_budget(size_t bytes);
+	size_t budget(void);
+	// bytes left before budget is exhausted (SIZE_MAX if unlimited)
+	size_t available(void);
+
+	// admission control: account bytes to owner, or return false if budget would be exceeded
+	bool charge(const void * owner, mfxU32 fourcc, size_t bytes);
+	void uncharge(const void * owner, mfxU32 fourcc, size_t bytes);
+
+	// human readable channel name for reports
+	void set_label(const void * owner, const char * label);
+	// owner is destroyed, drop its statistics
+	void forget(const void * owner);
+
+	struct Usage {
+		size_t current = 0;
+		size_t peak = 0;
+		void add(size_t bytes){ current += bytes; if(current > peak) peak = current; }
+		void sub(size_t bytes){ current = (bytes > current) ? 0 : (current - bytes); }
+	};
+	Usage total(void);
+	Usage channel(const void * owner);
+	Usage fourcc(mfxU32 fourcc);
+	// highest peak any owner has reached, including owners already forgotten
+	size_t largest_channel(void);
+
+	void report(void);
+
+	// estimated memory footprint of one video memory frame: padded pitch x aligned height,
+	// rounded up to whole pages (allocators which know their layout charge that instead)
+	static size_t frame_size(const mfxFrameInfo & info);
+
+private:
+	frame_memory_accountant():m_budget(0),m_largest(0){}
+
+	struct Channel {
+		std::string label;
+		Usage		usage;
+		std::map<mfxU32, size_t> fourcc;	// current bytes per FourCC
+	};
+
+	std::mutex 							m_mutex;
+	size_t 								m_budget;
+	Usage 								m_total;
+	size_t 								m_largest;
+	std::map<const void *, Channel>		m_channels;
+	std::map<mfxU32, Usage> 			m_fourcc;
+};
+
+#endif
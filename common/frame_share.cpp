@@ -0,0 +1,385 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "frame_share.h"
+#include "common_utils.h"
+
+#define SHM_RING_MAGIC 0x52464D48	// "HMFR"
+
+static int shm_create(const char * name, size_t size)
+{
+	int fd = -1;
+#ifdef SYS_memfd_create
+	fd = syscall(SYS_memfd_create, name, 0);
+#endif
+	if(fd < 0){
+		fprintf(stderr, ANSI_BOLD ANSI_COLOR_RED "%s:%d memfd_create(%s) failed: %s\n" ANSI_COLOR_RESET,
+				__FILE__, __LINE__, name, strerror(errno));
+		return -1;
+	}
+	if(ftruncate(fd, size) != 0){
+		fprintf(stderr, ANSI_BOLD ANSI_COLOR_RED "%s:%d ftruncate(%s, %zu) failed: %s\n" ANSI_COLOR_RESET,
+				__FILE__, __LINE__, name, size, strerror(errno));
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+//===================================================================
+struct shm_pool;
+
+struct shm_frame : public mfxFrameData
+{
+	shm_frame_desc 	desc;
+	shm_pool * 		pPool;
+};
+
+struct shm_pool
+{
+	uint32_t 		id;
+	int 			fd;
+	mfxU8 * 		pBuffer;
+	size_t 			size;
+	shm_frame * 	frames;
+};
+
+size_t mem_allocator_shm::alloc_size(const mfxFrameAllocRequest & request)
+{
+	mfxU32 pitch;
+	size_t frame_size;
+	if(!mem_allocator_system::frame_layout(request.Info, pitch, frame_size))
+		return mem_allocator::alloc_size(request);
+	return frame_size * request.NumFrameSuggested;
+}
+mfxStatus mem_allocator_shm::do_alloc(mfxFrameAllocRequest* request, mfxFrameAllocResponse* response)
+{
+	const mfxFrameInfo & info = request->Info;
+	mfxU32 pitch;
+	size_t frame_size;
+
+	//same layout as private system memory frames, so consumers get aligned rows
+	if(!mem_allocator_system::frame_layout(info, pitch, frame_size))
+		return MFX_ERR_UNSUPPORTED;
+
+	static std::atomic<uint32_t> g_pool_id(0);
+
+	int N = request->NumFrameSuggested;
+	shm_pool * pool = new shm_pool();
+	pool->id = ++g_pool_id;
+	pool->size = alloc_size(*request);
+	pool->fd = shm_create("mfx_frames", pool->size);
+	if(pool->fd < 0){
+		delete pool;
+		return MFX_ERR_MEMORY_ALLOC;
+	}
+	pool->pBuffer = (mfxU8*)mmap(NULL, pool->size, PROT_READ | PROT_WRITE, MAP_SHARED, pool->fd, 0);
+	if(pool->pBuffer == MAP_FAILED){
+		fprintf(stderr, ANSI_BOLD ANSI_COLOR_RED "%s:%d mmap %zu bytes failed: %s\n" ANSI_COLOR_RESET,
+				__FILE__, __LINE__, pool->size, strerror(errno));
+		close(pool->fd);
+		delete pool;
+		return MFX_ERR_MEMORY_ALLOC;
+	}
+
+	pool->frames = new shm_frame[N];
+	response->mids = (mfxMemId*)calloc(N, sizeof(mfxMemId));
+
+	for(int i=0; i<N; i++){
+		shm_frame * f = &pool->frames[i];
+		size_t offset = frame_size * i;
+
+		memset((mfxFrameData*)f, 0, sizeof(mfxFrameData));
+		f->pPool = pool;
+		mem_allocator_system::frame_planes(info, pool->pBuffer + offset, pitch, f);
+
+		shm_frame_desc & d = f->desc;
+		memset(&d, 0, sizeof(d));
+		d.fd = pool->fd;
+		d.pool_id = pool->id;
+		d.fourcc = info.FourCC;
+		d.pool_size = pool->size;
+		d.offset = offset;
+		d.uv_offset = (info.FourCC == MFX_FOURCC_NV12) ? (mfxU32)(f->UV - f->Y) : 0;
+		d.pitch = pitch;
+		d.width = info.Width;
+		d.height = info.Height;
+		d.index = i;
+
+		response->mids[i] = (mfxMemId)f;
+	}
+
+	response->NumFrameActual = N;
+	return MFX_ERR_NONE;
+}
+mfxStatus mem_allocator_shm::do_free(mfxFrameAllocResponse* response)
+{
+	if(response->NumFrameActual <= 0) return MFX_ERR_NONE;
+
+	//consumer mappings keep the memory alive until they are unmapped
+	shm_pool * pool = ((shm_frame*)(response->mids[0]))->pPool;
+	munmap(pool->pBuffer, pool->size);
+	close(pool->fd);
+	delete [] pool->frames;
+	delete pool;
+
+	free(response->mids);
+	return MFX_ERR_NONE;
+}
+mfxStatus mem_allocator_shm::do_lock(mfxMemId mid, mfxFrameData* ptr)
+{
+	shm_frame * p = (shm_frame*) mid;
+	ptr->R = p->R;
+	ptr->G = p->G;
+	ptr->B = p->B;
+	ptr->A = p->A;
+	ptr->Pitch = p->Pitch;
+	ptr->PitchHigh = p->PitchHigh;
+	return MFX_ERR_NONE;
+}
+mfxStatus mem_allocator_shm::do_unlock(mfxMemId /*mid*/, mfxFrameData* /*ptr*/)
+{
+	return MFX_ERR_NONE;
+}
+mfxStatus mem_allocator_shm::do_gethdl(mfxMemId /*mid*/, mfxHDL* /*handle*/)
+{
+	return MFX_ERR_UNSUPPORTED;
+}
+
+bool mem_allocator_shm::export_frame(mfxMemId mid, shm_frame_desc & desc)
+{
+	mem_allocator * palloc = NULL;
+	mfxMemId native = videoframe_allocator::native_mid(mid, &palloc);
+	if(dynamic_cast<mem_allocator_shm*>(palloc) == NULL)
+		return false;
+
+	desc = ((shm_frame*)native)->desc;
+	return true;
+}
+
+const uint8_t * mem_allocator_shm::map_pool(int fd, uint64_t pool_size)
+{
+	void * p = mmap(NULL, pool_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(p == MAP_FAILED){
+		fprintf(stderr, ANSI_BOLD ANSI_COLOR_RED "%s:%d mmap pool fd %d failed: %s\n" ANSI_COLOR_RESET,
+				__FILE__, __LINE__, fd, strerror(errno));
+		return NULL;
+	}
+	return (const uint8_t*)p;
+}
+void mem_allocator_shm::unmap_pool(const uint8_t * p, uint64_t pool_size)
+{
+	if(p) munmap((void*)p, pool_size);
+}
+
+//===================================================================
+struct shm_frame_ring::queue
+{
+	sem_t 					items;
+	sem_t 					space;
+	std::atomic<uint32_t> 	head;	// advanced by reader
+	std::atomic<uint32_t> 	tail;	// advanced by writer
+};
+
+struct shm_frame_ring::header
+{
+	uint32_t 				magic;
+	uint32_t 				slots;
+	std::atomic<uint32_t> 	closed;
+	queue 					ready;
+	queue 					released;
+	//followed by: shm_frame_msg ready_msgs[slots]; shm_release_msg released_msgs[slots];
+	shm_frame_msg * ready_msgs(void){ return (shm_frame_msg*)(this + 1); }
+	shm_release_msg * released_msgs(void){ return (shm_release_msg*)(ready_msgs() + slots); }
+
+	static size_t size(int slots){ return sizeof(header) + slots * (sizeof(shm_frame_msg) + sizeof(shm_release_msg)); }
+};
+
+std::unique_ptr<shm_frame_ring> shm_frame_ring::create(int slots)
+{
+	size_t size = header::size(slots);
+	int fd = shm_create("mfx_frame_ring", size);
+	if(fd < 0)
+		return nullptr;
+
+	header * phdr = (header*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(phdr == MAP_FAILED){
+		::close(fd);
+		return nullptr;
+	}
+
+	phdr->slots = slots;
+	phdr->closed = 0;
+	queue * qs[2] = {&phdr->ready, &phdr->released};
+	for(auto q : qs){
+		sem_init(&q->items, 1, 0);
+		sem_init(&q->space, 1, slots);
+		q->head = 0;
+		q->tail = 0;
+	}
+	//consumer validates magic, write it last
+	phdr->magic = SHM_RING_MAGIC;
+
+	return std::unique_ptr<shm_frame_ring>(new shm_frame_ring(fd, phdr, size));
+}
+
+std::unique_ptr<shm_frame_ring> shm_frame_ring::attach(int fd)
+{
+	header * phdr = (header*)mmap(NULL, sizeof(header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(phdr == MAP_FAILED)
+		return nullptr;
+	if(phdr->magic != SHM_RING_MAGIC){
+		fprintf(stderr, "%s:%d fd %d is not a frame ring\n", __FILE__, __LINE__, fd);
+		munmap(phdr, sizeof(header));
+		return nullptr;
+	}
+
+	//remap with the message arrays
+	size_t size = header::size(phdr->slots);
+	munmap(phdr, sizeof(header));
+	phdr = (header*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(phdr == MAP_FAILED)
+		return nullptr;
+
+	return std::unique_ptr<shm_frame_ring>(new shm_frame_ring(fd, phdr, size));
+}
+
+shm_frame_ring::~shm_frame_ring()
+{
+	munmap(m_hdr, m_size);
+	::close(m_fd);
+}
+
+int shm_frame_ring::slots(void)
+{
+	return m_hdr->slots;
+}
+
+bool shm_frame_ring::wait(sem_t * psem, int timeout_ms)
+{
+	int r;
+	if(timeout_ms < 0){
+		while((r = sem_wait(psem)) != 0 && errno == EINTR);
+	}else if(timeout_ms == 0){
+		r = sem_trywait(psem);
+	}else{
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += timeout_ms / 1000;
+		ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+		if(ts.tv_nsec >= 1000000000L){
+			ts.tv_sec ++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		while((r = sem_timedwait(psem, &ts)) != 0 && errno == EINTR);
+	}
+	return r == 0;
+}
+
+bool shm_frame_ring::push_ready(const shm_frame_msg & msg, int timeout_ms)
+{
+	queue & q = m_hdr->ready;
+	if(is_closed() || !wait(&q.space, timeout_ms))
+		return false;
+
+	uint32_t t = q.tail.load();
+	m_hdr->ready_msgs()[t % m_hdr->slots] = msg;
+	q.tail.store(t + 1);
+	sem_post(&q.items);
+	return true;
+}
+
+bool shm_frame_ring::pop_ready(shm_frame_msg & msg, int timeout_ms)
+{
+	queue & q = m_hdr->ready;
+	if(!wait(&q.items, timeout_ms))
+		return false;
+
+	uint32_t h = q.head.load();
+	if(h == q.tail.load()){
+		//woken by close(), pass the wakeup on to other waiters
+		sem_post(&q.items);
+		return false;
+	}
+	msg = m_hdr->ready_msgs()[h % m_hdr->slots];
+	q.head.store(h + 1);
+	sem_post(&q.space);
+	return true;
+}
+
+bool shm_frame_ring::push_released(const shm_release_msg & msg)
+{
+	queue & q = m_hdr->released;
+	if(!wait(&q.space, 0))
+		return false;
+
+	uint32_t t = q.tail.load();
+	m_hdr->released_msgs()[t % m_hdr->slots] = msg;
+	q.tail.store(t + 1);
+	sem_post(&q.items);
+	return true;
+}
+
+bool shm_frame_ring::pop_released(shm_release_msg & msg, int timeout_ms)
+{
+	queue & q = m_hdr->released;
+	if(!wait(&q.items, timeout_ms))
+		return false;
+
+	uint32_t h = q.head.load();
+	msg = m_hdr->released_msgs()[h % m_hdr->slots];
+	q.head.store(h + 1);
+	sem_post(&q.space);
+	return true;
+}
+
+void shm_frame_ring::close(void)
+{
+	if(m_hdr->closed.exchange(1) == 0)
+		sem_post(&m_hdr->ready.items);
+}
+
+bool shm_frame_ring::is_closed(void)
+{
+	return m_hdr->closed.load() != 0;
+}
+
+//===================================================================
+bool shm_frame_publisher::publish(std::shared_ptr<surface1> surf, uint64_t frame_number, int timeout_ms)
+{
+	shm_frame_msg msg;
+
+	reclaim(0);
+
+	if(!surf || !mem_allocator_shm::export_frame(surf->Data.MemId, msg.desc))
+		return false;
+	msg.frame_number = frame_number;
+	msg.timestamp = surf->Data.TimeStamp;
+
+	//referenced before posting: consumer may release it right away
+	auto key = std::make_pair(msg.desc.pool_id, msg.desc.index);
+	m_inflight[key] = surf;
+	if(!m_ring.push_ready(msg, timeout_ms)){
+		m_inflight.erase(key);
+		return false;
+	}
+	return true;
+}
+
+int shm_frame_publisher::reclaim(int timeout_ms)
+{
+	int cnt = 0;
+	shm_release_msg rel;
+	while(m_ring.pop_released(rel, cnt ? 0 : timeout_ms)){
+		m_inflight.erase(std::make_pair(rel.pool_id, rel.index));
+		cnt ++;
+	}
+	return cnt;
+}
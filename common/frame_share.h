@@ -0,0 +1,137 @@
+#ifndef _FRAME_SHARE_H_
+#define _FRAME_SHARE_H_
+
+#include <stdint.h>
+#include <semaphore.h>
+#include <map>
+#include <memory>
+#include <atomic>
+
+#include "videoframe_allocator.h"
+#include "surface_pool.h"
+
+// Zero-copy frame sharing with consumer processes (Linux only).
+//   mem_allocator_shm backs VPP output frames by one memfd per pool, so a
+//   consumer process maps the pool once and reads frames in place.
+//   shm_frame_ring carries frame ready/released messages between processes.
+
+//location of one frame inside an exported pool
+struct shm_frame_desc
+{
+	int32_t 	fd;			// memfd of the pool, only valid in producer process
+	uint32_t 	pool_id;	// unique in producer process, fd numbers may be reused
+	uint32_t 	fourcc;
+	uint64_t 	pool_size;	// bytes to map
+	uint64_t 	offset;		// first byte of frame in pool (page aligned)
+	uint32_t 	uv_offset;	// NV12: chroma plane, relative to offset
+	uint32_t 	pitch;
+	uint16_t 	width;
+	uint16_t 	height;
+	uint32_t 	index;		// frame index in pool
+};
+
+class mem_allocator_shm: public mem_allocator
+{
+public:
+	virtual ~mem_allocator_shm(){}
+	//only VPP output in system memory is shared
+	virtual bool is_mytype(int type){
+		return ((type & MFX_MEMTYPE_SYSTEM_MEMORY) == MFX_MEMTYPE_SYSTEM_MEMORY) &&
+			   ((type & MFX_MEMTYPE_FROM_VPPOUT) == MFX_MEMTYPE_FROM_VPPOUT);
+	}
+	virtual size_t alloc_size(const mfxFrameAllocRequest & request);
+	virtual mfxStatus do_alloc(mfxFrameAllocRequest* request, mfxFrameAllocResponse* response);
+	virtual mfxStatus do_lock(mfxMemId mid, mfxFrameData* ptr);
+	virtual mfxStatus do_unlock(mfxMemId mid, mfxFrameData* ptr);
+	virtual mfxStatus do_gethdl(mfxMemId mid, mfxHDL* handle);
+	virtual mfxStatus do_free(mfxFrameAllocResponse* response);
+
+	//describe frame of a surface from videoframe_allocator,
+	//return false if it's not allocated by mem_allocator_shm
+	static bool export_frame(mfxMemId mid, shm_frame_desc & desc);
+
+	//consumer side: map a whole pool read-only, NULL on failure
+	static const uint8_t * map_pool(int fd, uint64_t pool_size);
+	static void unmap_pool(const uint8_t * p, uint64_t pool_size);
+};
+
+//message of a ready frame
+struct shm_frame_msg
+{
+	shm_frame_desc 	desc;
+	uint64_t 		frame_number;
+	uint64_t 		timestamp;
+};
+
+//message of a frame consumer no longer reads, index alone is ambiguous once pools are replaced
+struct shm_release_msg
+{
+	uint32_t 		pool_id;
+	uint32_t 		index;
+};
+
+//Single producer/single consumer rings in a memfd, blocking by process-shared semaphores:
+//   ready    : producer -> consumer, frames to read
+//   released : consumer -> producer, frames (pool_id, index) no longer read by consumer
+//slots must not be less than pool size, so releasing never blocks.
+class shm_frame_ring
+{
+public:
+	//producer: create ring in a new memfd
+	static std::unique_ptr<shm_frame_ring> create(int slots);
+	//consumer: map the ring created by producer (fd received from it, owned by ring afterwards)
+	static std::unique_ptr<shm_frame_ring> attach(int fd);
+	~shm_frame_ring();
+
+	int fd(void){ return m_fd; }
+	int slots(void);
+
+	//timeout_ms < 0 means wait forever, 0 means no wait
+	bool push_ready(const shm_frame_msg & msg, int timeout_ms);
+	//return false on timeout, or when ring is closed and no frame is left
+	bool pop_ready(shm_frame_msg & msg, int timeout_ms);
+
+	bool push_released(const shm_release_msg & msg);
+	bool pop_released(shm_release_msg & msg, int timeout_ms);
+
+	//producer is leaving, pending & future pop_ready() return false after draining
+	void close(void);
+	bool is_closed(void);
+
+private:
+	struct queue;
+	struct header;
+
+	shm_frame_ring(int fd, header * phdr, size_t size):m_fd(fd), m_hdr(phdr), m_size(size){}
+	static bool wait(sem_t * psem, int timeout_ms);
+
+	int 		m_fd;
+	header * 	m_hdr;
+	size_t 		m_size;
+};
+
+//producer side: keep surfaces referenced while the consumer reads them
+class shm_frame_publisher
+{
+public:
+	shm_frame_publisher(shm_frame_ring & ring):m_ring(ring){}
+	~shm_frame_publisher(){ clear(); }
+
+	//export & post a frame, false if surface is not shared memory or ring stays full
+	bool publish(std::shared_ptr<surface1> surf, uint64_t frame_number, int timeout_ms);
+
+	//drop references of frames released by consumer, return number of frames reclaimed
+	int reclaim(int timeout_ms = 0);
+
+	int in_flight(void){ return (int)m_inflight.size(); }
+
+	//consumer is gone, return every frame to its pool
+	void clear(void){ m_inflight.clear(); }
+
+private:
+	shm_frame_ring & 								m_ring;
+	//keyed by (pool_id, index), pool is replaced on realloc while its frames may be in flight
+	std::map<std::pair<uint32_t, uint32_t>, std::shared_ptr<surface1>> m_inflight;
+};
+
+#endif
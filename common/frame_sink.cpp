@@ -0,0 +1,301 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <algorithm>
+
+#include "frame_sink.h"
+#include "frame_copy.h"
+#include "color_convert.h"
+#include "common_utils.h"
+
+#define SINK_ALIGN 		4096
+// O_DIRECT writes are gathered into chunks of this size
+#define SINK_CHUNK 		(8 << 20)
+
+static uint8_t * sink_alloc(size_t size)
+{
+	void * p = NULL;
+	size = (size + SINK_ALIGN - 1) & ~(size_t)(SINK_ALIGN - 1);
+	if(posix_memalign(&p, SINK_ALIGN, size) != 0)
+		return NULL;
+	return (uint8_t*)p;
+}
+
+frame_sink::frame_sink():
+	m_format(nv12),
+	m_fd(-1),
+	m_frame_bytes(0),
+	m_record_bytes(0),
+	m_offset(0),
+	m_chunk(NULL),
+	m_chunk_fill(0),
+	m_error(false),
+	m_frames(0),
+	m_dropped(0),
+	m_bytes(0)
+{
+	memset(&m_info, 0, sizeof(m_info));
+}
+
+frame_sink::~frame_sink()
+{
+	close();
+}
+
+bool frame_sink::parse_format(const char * name, Format & fmt)
+{
+	if(strcmp(name, "nv12") == 0) fmt = nv12;
+	else if(strcmp(name, "i420") == 0) fmt = i420;
+	else if(strcmp(name, "y4m") == 0) fmt = y4m;
+	else if(strcmp(name, "rgb4") == 0) fmt = rgb4;
+	else return false;
+	return true;
+}
+
+mfxStatus frame_sink::open(const char * path, Format fmt, const mfxFrameInfo & info, const frame_sink_options & opt)
+{
+	if(m_fd >= 0) return MFX_ERR_UNDEFINED_BEHAVIOR;
+
+	bool bRGB = (info.FourCC == MFX_FOURCC_RGB4);
+	if((fmt == rgb4) != bRGB || (!bRGB && info.FourCC != MFX_FOURCC_NV12)){
+		fprintf(stderr, ANSI_COLOR_RED "frame_sink: format %d can't be written from FourCC 0x%x\n" ANSI_COLOR_RESET,
+				fmt, info.FourCC);
+		return MFX_ERR_UNSUPPORTED;
+	}
+
+	m_format = fmt;
+	m_opt = opt;
+	if(m_opt.queue_depth < 1) m_opt.queue_depth = 1;
+	m_info = info;
+	if(!m_info.CropW || !m_info.CropH){
+		m_info.CropW = m_info.Width;
+		m_info.CropH = m_info.Height;
+	}
+
+	int w = m_info.CropW, h = m_info.CropH;
+	if(bRGB)
+		m_frame_bytes = (size_t)w * h * 4;
+	else
+		m_frame_bytes = (size_t)w * h + (size_t)((w + 1) / 2) * ((h + 1) / 2) * 2;
+
+	std::string stream_header;
+	m_frame_header.clear();
+	if(fmt == y4m){
+		//decoded H.264/HEVC chroma is left-sited (MPEG-2 siting), not centered like C420jpeg
+		char hdr[128];
+		snprintf(hdr, sizeof(hdr), "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420mpeg2\n", w, h, m_opt.fps_n, m_opt.fps_d);
+		stream_header = hdr;
+		m_frame_header = "FRAME\n";
+	}
+	m_record_bytes = m_frame_header.size() + m_frame_bytes;
+
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	m_fd = ::open(path, flags | (m_opt.bDirect ? O_DIRECT : 0), 0644);
+	if(m_fd < 0 && m_opt.bDirect && errno == EINVAL){
+		//file system without O_DIRECT support
+		fprintf(stderr, ANSI_COLOR_YELLOW "frame_sink: O_DIRECT not supported for %s, using page cache\n" ANSI_COLOR_RESET, path);
+		m_opt.bDirect = false;
+		m_fd = ::open(path, flags, 0644);
+	}
+	if(m_fd < 0){
+		fprintf(stderr, ANSI_COLOR_RED "frame_sink: can't open %s: %s\n" ANSI_COLOR_RESET, path, strerror(errno));
+		return MFX_ERR_NULL_PTR;
+	}
+
+	//reserve extents up front, file size grows only as frames are written
+	if(m_opt.prealloc_frames > 0)
+		fallocate(m_fd, FALLOC_FL_KEEP_SIZE, 0, stream_header.size() + m_record_bytes * m_opt.prealloc_frames);
+
+	m_offset = 0;
+	m_chunk_fill = 0;
+	m_error = false;
+	m_frames = 0;
+	m_dropped = 0;
+	m_bytes = 0;
+	if(m_opt.bDirect){
+		m_chunk = sink_alloc(SINK_CHUNK);
+		if(!m_chunk) goto fail;
+	}
+	if(!stream_header.empty() && !emit((const uint8_t*)stream_header.data(), stream_header.size()))
+		goto fail;
+
+	m_free.reset(new blocking_queue<Buffer>(m_opt.queue_depth));
+	m_ready.reset(new blocking_queue<Buffer>(m_opt.queue_depth));
+	for(int i = 0; i < m_opt.queue_depth; i++){
+		Buffer b;
+		b.size = m_record_bytes;
+		b.p = sink_alloc(m_record_bytes);
+		if(!b.p) goto fail;
+		memcpy(b.p, m_frame_header.data(), m_frame_header.size());
+		m_buffers.push_back(b);
+		m_free->put(b);
+	}
+
+	m_thread = std::thread(&frame_sink::writer, this);
+	return MFX_ERR_NONE;
+
+fail:
+	fprintf(stderr, ANSI_COLOR_RED "frame_sink: failed to set up %s\n" ANSI_COLOR_RESET, path);
+	m_error = true;
+	close();
+	return MFX_ERR_MEMORY_ALLOC;
+}
+
+bool frame_sink::close(void)
+{
+	if(m_fd < 0) return true;
+
+	if(m_thread.joinable()){
+		m_ready->close();
+		m_thread.join();
+	}
+
+	//last partial chunk can't be written with O_DIRECT
+	if(m_chunk_fill > 0){
+		fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+		size_t fill = m_chunk_fill;
+		m_chunk_fill = 0;
+		if(!pwrite_all(m_chunk, fill))
+			m_error = true;
+	}
+
+	::close(m_fd);
+	m_fd = -1;
+
+	for(auto &b : m_buffers)
+		free(b.p);
+	m_buffers.clear();
+	m_free.reset();
+	m_ready.reset();
+	free(m_chunk);
+	m_chunk = NULL;
+	std::vector<uint8_t>().swap(m_nv12);
+
+	return !m_error;
+}
+
+mfxStatus frame_sink::write(surface1 * psurf, bool bDrop)
+{
+	if(m_fd < 0 || !m_free) return MFX_ERR_NOT_INITIALIZED;
+	if(!psurf) return MFX_ERR_NULL_PTR;
+	if(m_error) return MFX_ERR_DEVICE_FAILED;
+
+	Buffer b;
+	if(bDrop){
+		if(m_free->get_until(b, std::chrono::steady_clock::now()) <= 0){
+			m_dropped ++;
+			return MFX_ERR_NONE;
+		}
+	}else if(!m_free->get(b)){
+		return MFX_ERR_ABORTED;
+	}
+
+	mfxStatus sts = stage(psurf, b.p + m_frame_header.size());
+	if(sts != MFX_ERR_NONE){
+		m_free->put(b);
+		return sts;
+	}
+	m_ready->put(b);
+	return MFX_ERR_NONE;
+}
+
+mfxStatus frame_sink::stage(surface1 * psurf, uint8_t * dst)
+{
+	const mfxFrameInfo & fi = psurf->Info;
+	int w = fi.CropW ? fi.CropW : fi.Width;
+	int h = fi.CropH ? fi.CropH : fi.Height;
+	if(fi.FourCC != m_info.FourCC || w != m_info.CropW || h != m_info.CropH)
+		return MFX_ERR_INCOMPATIBLE_VIDEO_PARAM;
+
+	if(m_format != i420 && m_format != y4m)
+		return copy_out(psurf, copy_layout_packed(dst, fi), m_opt.threads);
+
+	bool bLocked = false;
+	if(psurf->Data.Y == NULL){
+		mfxStatus sts = psurf->lock();
+		if(sts != MFX_ERR_NONE) return sts;
+		bLocked = true;
+	}
+
+	const mfxFrameData & fd = psurf->Data;
+	const uint8_t * y = fd.Y + (size_t)fi.CropY * fd.Pitch + fi.CropX;
+	const uint8_t * uv = fd.UV + (size_t)(fi.CropY / 2) * fd.Pitch + (fi.CropX & ~1);
+	int y_pitch = fd.Pitch, uv_pitch = fd.Pitch;
+	mfxStatus sts = MFX_ERR_NONE;
+
+	//mapped video memory is read once with streaming loads, then deinterleaved from cache
+	if(!(fd.MemType & MFX_MEMTYPE_SYSTEM_MEMORY)){
+		m_nv12.resize(copy_out_size(fi));
+		copy_layout l = copy_layout_packed(m_nv12.data(), fi);
+		sts = copy_out(psurf, l, m_opt.threads, COPY_STREAM);
+		y = l.plane[0];
+		uv = l.plane[1];
+		y_pitch = l.pitch[0];
+		uv_pitch = l.pitch[1];
+	}
+	if(sts == MFX_ERR_NONE)
+		nv12_to_i420(y, y_pitch, uv, uv_pitch, w, h, dst, m_opt.threads);
+
+	if(bLocked)
+		psurf->unlock();
+	return sts;
+}
+
+void frame_sink::writer(void)
+{
+	Buffer b;
+	while(m_ready->get(b)){
+		if(!m_error){
+			if(emit(b.p, b.size)){
+				m_frames ++;
+				m_bytes += b.size;
+			}else{
+				m_error = true;
+			}
+		}
+		m_free->put(b);
+	}
+}
+
+bool frame_sink::emit(const uint8_t * p, size_t size)
+{
+	if(!m_chunk)
+		return pwrite_all(p, size);
+
+	while(size > 0){
+		size_t n = std::min(size, (size_t)SINK_CHUNK - m_chunk_fill);
+		memcpy(m_chunk + m_chunk_fill, p, n);
+		m_chunk_fill += n;
+		p += n;
+		size -= n;
+		if(m_chunk_fill == SINK_CHUNK){
+			m_chunk_fill = 0;
+			if(!pwrite_all(m_chunk, SINK_CHUNK))
+				return false;
+		}
+	}
+	return true;
+}
+
+bool frame_sink::pwrite_all(const uint8_t * p, size_t size)
+{
+	while(size > 0){
+		ssize_t n = pwrite(m_fd, p, size, m_offset);
+		if(n < 0){
+			if(errno == EINTR) continue;
+			fprintf(stderr, ANSI_COLOR_RED "frame_sink: write failed at %llu: %s\n" ANSI_COLOR_RESET,
+					(unsigned long long)m_offset, strerror(errno));
+			return false;
+		}
+		p += n;
+		size -= n;
+		m_offset += n;
+	}
+	return true;
+}
@@ -0,0 +1,94 @@
+#ifndef _FRAME_SINK_H_
+#define _FRAME_SINK_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+
+#include "surface_pool.h"
+#include "blocking_queue.h"
+
+// Raw frame dump at disk speed (Linux only).
+//   write() stages the frame into a free buffer (SIMD deinterleave for I420/Y4M,
+//   streaming loads for video memory) and queues it, a writer thread stores each
+//   frame with one pwrite. the caller only blocks when all buffers are in flight.
+struct frame_sink_options
+{
+	int 	queue_depth = 4;		// staging buffers (frames in flight)
+	bool 	bDirect = false;		// O_DIRECT, bypass page cache
+	int 	prealloc_frames = 0;	// fallocate() room for that many frames
+	int 	fps_n = 30;				// y4m header only
+	int 	fps_d = 1;
+	int 	threads = 1;			// staging threads (0: all cores)
+};
+
+class frame_sink
+{
+public:
+	enum Format{
+		nv12 = 0,	// NV12 surfaces as is
+		i420,		// NV12 surfaces, chroma deinterleaved
+		y4m,		// i420 with YUV4MPEG2 stream & frame headers
+		rgb4,		// RGB4 surfaces as is (B,G,R,A)
+	};
+
+	frame_sink();
+	~frame_sink();
+
+	//frame size & FourCC come from info (crop rectangle if set)
+	mfxStatus open(const char * path, Format fmt, const mfxFrameInfo & info, const frame_sink_options & opt = frame_sink_options());
+	//flush queued frames & close file, return false if any write failed
+	bool close(void);
+
+	//stage & queue one frame; if bDrop and all buffers are in flight the frame
+	//is dropped instead of waiting for the writer
+	mfxStatus write(surface1 * psurf, bool bDrop = false);
+
+	uint64_t frames(void){ return m_frames.load(); }
+	uint64_t dropped(void){ return m_dropped.load(); }
+	uint64_t bytes(void){ return m_bytes.load(); }
+
+	static bool parse_format(const char * name, Format & fmt);
+
+private:
+	struct Buffer {
+		uint8_t * 	p;
+		size_t 		size;
+	};
+
+	void writer(void);
+	//append bytes to file, through m_chunk in O_DIRECT mode
+	bool emit(const uint8_t * p, size_t size);
+	bool pwrite_all(const uint8_t * p, size_t size);
+	mfxStatus stage(surface1 * psurf, uint8_t * dst);
+
+	Format 						m_format;
+	frame_sink_options 			m_opt;
+	mfxFrameInfo 				m_info;
+	int 						m_fd;
+	size_t 						m_frame_bytes;	// payload of one frame
+	size_t 						m_record_bytes;	// frame header + payload
+	std::string 				m_frame_header;
+
+	std::vector<Buffer> 		m_buffers;
+	std::vector<uint8_t> 		m_nv12;			// copy-out of video memory before deinterleave
+	std::unique_ptr<blocking_queue<Buffer>> m_free;
+	std::unique_ptr<blocking_queue<Buffer>> m_ready;
+	std::thread 				m_thread;
+
+	//writer thread only
+	uint64_t 					m_offset;
+	uint8_t * 					m_chunk;		// O_DIRECT staging of aligned writes
+	size_t 						m_chunk_fill;
+
+	std::atomic<bool> 			m_error;
+	std::atomic<uint64_t> 		m_frames;
+	std::atomic<uint64_t> 		m_dropped;
+	std::atomic<uint64_t> 		m_bytes;
+};
+
+#endif
@@ -0,0 +1,351 @@
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "media_compositor.h"
+#include "common_utils.h"
+
+#define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
+
+// how long start-up waits for first frame of every channel, to size VPP input
+#define COMPOSITOR_FIRST_FRAME_MS 	1000
+
+MediaCompositor::MediaCompositor(int width, int height, mfxU32 fourcc, int fps_n, int fps_d, int queue_size):
+	m_width(width),
+	m_height(height),
+	m_fourcc(fourcc),
+	m_fps_n(fps_n > 0 ? fps_n : 30),
+	m_fps_d(fps_d > 0 ? fps_d : 1),
+	m_in_fourcc(MFX_FOURCC_NV12),
+	m_outputs(queue_size > 0 ? queue_size : 1),
+	spOut(m_mfxAllocator),
+	spBlank(m_mfxAllocator),
+	m_pthread(NULL),
+	m_stop(false),
+	m_composed(0)
+{
+	memset(&m_VPPParams, 0, sizeof(m_VPPParams));
+	memset(&m_extComposite, 0, sizeof(m_extComposite));
+	m_mfxAllocator.set_name("compositor");
+}
+
+MediaCompositor::~MediaCompositor()
+{
+	stop();
+}
+
+int MediaCompositor::add_channel(MediaDecoder * pdec, int x, int y, int w, int h)
+{
+	Channel ch;
+	ch.pdec = pdec;
+	//only the newest frame matters, older ones are dropped by the decoder
+	ch.sub = pdec->subscribe(1, 1, MediaDecoder::Overflow::drop_oldest);
+	ch.tile.x = x;
+	ch.tile.y = y;
+	ch.tile.w = w;
+	ch.tile.h = h;
+	ch.tile.bFresh = false;
+	ch.tile.bValid = false;
+	ch.tile.frame_number = 0;
+	ch.tile.age_ms = 0;
+	ch.bEnded = false;
+	m_channels.push_back(ch);
+	return (int)m_channels.size() - 1;
+}
+
+void MediaCompositor::add_grid(const std::vector<MediaDecoder *> & decoders, int cols, int rows)
+{
+	if(cols <= 0 || rows <= 0) return;
+	int cw = m_width / cols, ch = m_height / rows;
+	for(size_t i = 0; i < decoders.size() && (int)i < cols * rows; i++)
+		add_channel(decoders[i], (i % cols) * cw, (i / cols) * ch, cw, ch);
+}
+
+void MediaCompositor::start(mfxIMPL impl)
+{
+	if(m_pthread){
+		fprintf(stderr,"Error, compositor is already running\n");
+		return;
+	}
+	if(m_channels.empty()){
+		fprintf(stderr, ANSI_COLOR_RED "%s:%d no channel to compose\n" ANSI_COLOR_RESET, __FILENAME__, __LINE__);
+		return;
+	}
+	m_stop = false;
+	spOut.abort(false);
+	m_pthread = new std::thread(&MediaCompositor::compose, this, impl);
+}
+
+void MediaCompositor::stop(void)
+{
+	if(!m_pthread) return;
+
+	m_stop = true;
+	m_outputs.close();
+	spOut.abort();
+	if(m_pthread->joinable())
+		m_pthread->join();
+	delete m_pthread;
+	m_pthread = NULL;
+
+	m_outputs.clear();
+	for(auto &ch : m_channels){
+		ch.pdec->unsubscribe(ch.sub);
+		//stale frames go back to their decoder's pool
+		ch.last = MediaDecoder::Output();
+	}
+}
+
+surface1 * MediaCompositor::source(Channel & ch)
+{
+	surface1 * psurf = ch.last.first ? ch.last.first.get() : ch.last.second.get();
+	if(!psurf || psurf->Info.FourCC != m_in_fourcc)
+		return NULL;
+	//frames bigger than VPP input (channel started late with larger stream) can't be composed
+	mfxU16 w = psurf->Info.CropW ? psurf->Info.CropW : psurf->Info.Width;
+	mfxU16 h = psurf->Info.CropH ? psurf->Info.CropH : psurf->Info.Height;
+	if(m_pmfxVPP && (w > m_VPPParams.vpp.In.Width || h > m_VPPParams.vpp.In.Height))
+		return NULL;
+	return psurf;
+}
+
+bool MediaCompositor::collect(void)
+{
+	auto now = std::chrono::steady_clock::now();
+	bool bAlive = false;
+	for(auto &ch : m_channels){
+		ch.tile.bFresh = false;
+		MediaDecoder::Output out;
+		int r;
+		while(!ch.bEnded && (r = ch.sub->get_until(out, now)) != 0){
+			if(r < 0){
+				ch.bEnded = true;
+				break;
+			}
+			ch.last = out;
+			ch.t_last = now;
+			ch.tile.bFresh = true;
+		}
+		if(!ch.bEnded)
+			bAlive = true;
+
+		surface1 * psurf = source(ch);
+		ch.tile.bValid = (psurf != NULL);
+		if(psurf){
+			ch.tile.frame_number = psurf->m_FrameNumber;
+			ch.tile.age_ms = std::chrono::duration<double, std::milli>(now - ch.t_last).count();
+		}
+	}
+	return bAlive;
+}
+
+mfxStatus MediaCompositor::fill_blank(surface1 * psurf)
+{
+	mfxStatus sts = psurf->lock();
+	if(sts != MFX_ERR_NONE) return sts;
+
+	mfxFrameData & d = psurf->Data;
+	mfxFrameInfo & fi = psurf->Info;
+	int pitch = ((int)d.PitchHigh << 16) | d.PitchLow;
+	if(fi.FourCC == MFX_FOURCC_NV12){
+		memset(d.Y, 16, (size_t)pitch * fi.Height);
+		memset(d.UV, 128, (size_t)pitch * fi.Height / 2);
+	}else{
+		for(int y = 0; y < fi.Height; y++){
+			mfxU32 * row = (mfxU32*)(d.B + (size_t)pitch * y);
+			std::fill(row, row + fi.Width, 0xFF000000u);
+		}
+	}
+	return psurf->unlock();
+}
+
+mfxStatus MediaCompositor::pipeline_init(mfxIMPL impl)
+{
+	mfxVersion ver = { {0, 1} };
+	mfxStatus sts = Initialize(impl, ver, &m_session, &m_mfxAllocator);
+	if(sts != MFX_ERR_NONE) return sts;
+	m_pmfxVPP.reset(new MFXVideoVPP(m_session));
+
+	//VPP input is as large as the largest first frame, tiles scale from there
+	mfxU16 in_w = 0, in_h = 0;
+	for(auto &ch : m_channels){
+		surface1 * psurf = source(ch);
+		if(!psurf) continue;
+		in_w = std::max(in_w, psurf->Info.CropW ? psurf->Info.CropW : psurf->Info.Width);
+		in_h = std::max(in_h, psurf->Info.CropH ? psurf->Info.CropH : psurf->Info.Height);
+	}
+	if(!in_w || !in_h){
+		in_w = m_width;
+		in_h = m_height;
+	}
+
+	mfxVideoParam & VPPParams = m_VPPParams;
+	memset(&VPPParams, 0, sizeof(VPPParams));
+	VPPParams.vpp.In.FourCC = m_in_fourcc;
+	VPPParams.vpp.In.ChromaFormat = (m_in_fourcc == MFX_FOURCC_RGB4) ? MFX_CHROMAFORMAT_YUV444 : MFX_CHROMAFORMAT_YUV420;
+	VPPParams.vpp.In.CropW = in_w;
+	VPPParams.vpp.In.CropH = in_h;
+	VPPParams.vpp.In.Width = MSDK_ALIGN16(in_w);
+	VPPParams.vpp.In.Height = MSDK_ALIGN16(in_h);
+	VPPParams.vpp.In.PicStruct = MFX_PICSTRUCT_PROGRESSIVE;
+	VPPParams.vpp.In.FrameRateExtN = m_fps_n;
+	VPPParams.vpp.In.FrameRateExtD = m_fps_d;
+	VPPParams.vpp.Out = VPPParams.vpp.In;
+	VPPParams.vpp.Out.FourCC = m_fourcc;
+	VPPParams.vpp.Out.ChromaFormat = (m_fourcc == MFX_FOURCC_RGB4) ? MFX_CHROMAFORMAT_YUV444 : MFX_CHROMAFORMAT_YUV420;
+	VPPParams.vpp.Out.CropW = m_width;
+	VPPParams.vpp.Out.CropH = m_height;
+	VPPParams.vpp.Out.Width = MSDK_ALIGN16(m_width);
+	VPPParams.vpp.Out.Height = MSDK_ALIGN16(m_height);
+	VPPParams.IOPattern = MFX_IOPATTERN_IN_VIDEO_MEMORY | MFX_IOPATTERN_OUT_VIDEO_MEMORY;
+
+	//one input stream per tile, in channel order; uncovered area is black
+	m_streams.resize(m_channels.size());
+	for(size_t i = 0; i < m_channels.size(); i++){
+		const Tile & t = m_channels[i].tile;
+		memset(&m_streams[i], 0, sizeof(mfxVPPCompInputStream));
+		m_streams[i].DstX = t.x;
+		m_streams[i].DstY = t.y;
+		m_streams[i].DstW = t.w;
+		m_streams[i].DstH = t.h;
+	}
+	memset(&m_extComposite, 0, sizeof(m_extComposite));
+	m_extComposite.Header.BufferId = MFX_EXTBUFF_VPP_COMPOSITE;
+	m_extComposite.Header.BufferSz = sizeof(m_extComposite);
+	if(m_fourcc == MFX_FOURCC_NV12){
+		m_extComposite.Y = 16;
+		m_extComposite.U = 128;
+		m_extComposite.V = 128;
+	}
+	m_extComposite.NumInputStream = (mfxU16)m_streams.size();
+	m_extComposite.InputStream = m_streams.data();
+	m_extParams[0] = (mfxExtBuffer*)&m_extComposite;
+	VPPParams.ExtParam = m_extParams;
+	VPPParams.NumExtParam = 1;
+
+	mfxFrameAllocRequest VPPRequest[2];
+	memset(VPPRequest, 0, sizeof(VPPRequest));
+	sts = m_pmfxVPP->QueryIOSurf(&VPPParams, VPPRequest);
+	MSDK_IGNORE_MFX_STS(sts, MFX_WRN_PARTIAL_ACCELERATION);
+	if(sts != MFX_ERR_NONE) return sts;
+
+	//input frames come from the channels' own pools, only the black frame is ours
+	VPPRequest[0].NumFrameMin = VPPRequest[0].NumFrameSuggested = 1;
+	sts = spBlank.realloc(VPPRequest[0]);
+	if(sts != MFX_ERR_NONE) return sts;
+	sts = spOut.realloc(VPPRequest[1], (int)m_outputs.size_limit() + 1, 1);
+	if(sts != MFX_ERR_NONE) return sts;
+
+	sts = m_pmfxVPP->Init(&VPPParams);
+	MSDK_IGNORE_MFX_STS(sts, MFX_WRN_PARTIAL_ACCELERATION);
+	return sts;
+}
+
+void MediaCompositor::pipeline_close(void)
+{
+	if(!m_pmfxVPP) return;
+	//component destructor calls Close()
+	m_pmfxVPP.reset();
+	m_session.Close();
+	Release();
+}
+
+void MediaCompositor::compose(mfxIMPL impl)
+{
+	mfxStatus sts = MFX_ERR_NONE;
+	surface1 * pBlank = NULL;
+	unsigned long number = 0;
+	const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>((double)m_fps_d / m_fps_n));
+	auto t_next = std::chrono::steady_clock::now();
+
+	//size VPP input from first frames, don't wait for channels that are slow to start
+	auto t_first = t_next + std::chrono::milliseconds(COMPOSITOR_FIRST_FRAME_MS);
+	while(!m_stop && std::chrono::steady_clock::now() < t_first){
+		bool bAlive = collect();
+		bool bAll = true;
+		for(auto &ch : m_channels)
+			if(!ch.tile.bValid && !ch.bEnded) bAll = false;
+		if(bAll || !bAlive) break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+
+	sts = pipeline_init(impl);
+	if(sts != MFX_ERR_NONE){
+		fprintf(stderr, ANSI_COLOR_RED "%s:%d compositor pipeline_init failed %d\n" ANSI_COLOR_RESET, __FILENAME__, __LINE__, sts);
+		goto COMPOSE_EXIT;
+	}
+	pBlank = spBlank.getfree();
+	sts = pBlank ? fill_blank(pBlank) : MFX_ERR_MEMORY_ALLOC;
+	if(sts != MFX_ERR_NONE){
+		fprintf(stderr, ANSI_COLOR_RED "%s:%d compositor background frame failed %d\n" ANSI_COLOR_RESET, __FILENAME__, __LINE__, sts);
+		goto COMPOSE_EXIT;
+	}
+
+	while(!m_stop){
+		bool bAlive = collect();
+
+		bool bFresh = false;
+		for(auto &ch : m_channels)
+			bFresh = bFresh || ch.tile.bFresh;
+
+		//nothing changed since last mosaic: don't compose the same picture again
+		if(bFresh){
+			surface1 * pOut = spOut.getfree();
+			if(pOut == NULL){
+				fprintf(stderr, "%s:%d spOut.getfree() return NULL\n", __FILENAME__, __LINE__);
+				break;
+			}
+
+			//one call per input stream in stream order, the last one produces the mosaic
+			mfxSyncPoint syncp = NULL;
+			for(size_t i = 0; i < m_channels.size() && !m_stop; i++){
+				surface1 * pIn = source(m_channels[i]);
+				if(!pIn) pIn = pBlank;
+				do{
+					sts = m_pmfxVPP->RunFrameVPPAsync(pIn, pOut, NULL, &syncp);
+					if(MFX_WRN_DEVICE_BUSY == sts)
+						MSDK_SLEEP(1);
+				}while(MFX_ERR_NONE < sts && !syncp && !m_stop);
+				if(sts < MFX_ERR_NONE && sts != MFX_ERR_MORE_DATA)
+					break;
+			}
+			if(sts < MFX_ERR_NONE || !syncp){
+				fprintf(stderr, ANSI_BOLD ANSI_COLOR_RED "%s:%d composite RunFrameVPPAsync() return err %d\n" ANSI_COLOR_RESET, __FILENAME__, __LINE__, sts);
+				break;
+			}
+			sts = m_session.SyncOperation(syncp, 60000);
+			if(sts != MFX_ERR_NONE){
+				fprintf(stderr, ANSI_BOLD ANSI_COLOR_RED "%s:%d SyncOperation() failed with %d\n" ANSI_COLOR_RESET, __FILENAME__, __LINE__, sts);
+				break;
+			}
+
+			//consumer too slow: this mosaic is dropped, next one has newer frames anyway
+			if(spOut.reserve(pOut, true)){
+				Mosaic m;
+				pOut->m_FrameNumber = number;
+				m.surface.reset(pOut, [this](surface1 * p){ spOut.unreserve(p); });
+				m.number = number++;
+				for(auto &ch : m_channels)
+					m.tiles.push_back(ch.tile);
+				m_outputs.put(m, true);
+				m_composed ++;
+			}
+		}
+
+		if(!bAlive) break;
+
+		t_next += period;
+		auto now = std::chrono::steady_clock::now();
+		if(t_next < now)
+			t_next = now;	// late, don't try to catch up
+		else
+			std::this_thread::sleep_until(t_next);
+	}
+
+COMPOSE_EXIT:
+	m_outputs.close();
+	pipeline_close();
+}
@@ -0,0 +1,99 @@
+#ifndef _MEDIA_COMPOSITOR_H_
+#define _MEDIA_COMPOSITOR_H_
+
+#include "media_pipeline.h"
+
+#include <vector>
+#include <thread>
+#include <chrono>
+
+// Mosaic of many channels in one surface by a single VPP composite pass
+// (MFX_EXTBUFF_VPP_COMPOSITE), e.g. 16 low-res cameras into one inference input.
+//   each channel is subscribed with a one frame drop_oldest queue, the compositor
+//   thread takes the newest frame of every channel at the output rate and composes
+//   them straight from video memory (no CPU copy). a channel without a new frame
+//   keeps its last frame in its tile (stale tile), a channel that never delivered
+//   one (or ended before) shows black.
+class MediaCompositor
+{
+public:
+	//output surface width x height of given FourCC (RGB4 or NV12), composed at fps_n/fps_d
+	MediaCompositor(int width, int height, mfxU32 fourcc = MFX_FOURCC_RGB4,
+					int fps_n = 30, int fps_d = 1, int queue_size = 2);
+	~MediaCompositor();
+
+	//tile rectangle in output; source is channel's decoded surface (dec_vpp mode), or
+	//its VPP output in vpp_only mode. sources must share one FourCC, NV12 by default.
+	//(must be called before decoder & compositor start)
+	int add_channel(MediaDecoder * pdec, int x, int y, int w, int h);
+	//uniform cols x rows grid, channel i in cell i (row major)
+	void add_grid(const std::vector<MediaDecoder *> & decoders, int cols, int rows);
+
+	void set_input_fourcc(mfxU32 fourcc){ m_in_fourcc = fourcc; }
+
+	void start(mfxIMPL impl = MFX_IMPL_AUTO);
+	void stop(void);
+
+	struct Tile {
+		int 			x, y, w, h;		// rectangle in output
+		bool 			bFresh;			// new frame since previous mosaic
+		bool 			bValid;			// false: channel never delivered a frame
+		unsigned long 	frame_number;	// source frame shown
+		double 			age_ms;			// since that frame arrived
+	};
+	struct Mosaic {
+		std::shared_ptr<surface1> 	surface;
+		std::vector<Tile> 			tiles;
+		unsigned long 				number;
+	};
+	//return false after stop or when every channel has ended
+	bool get(Mosaic & r){ return m_outputs.get(r); }
+
+	int tiles(void){ return (int)m_channels.size(); }
+	unsigned long composed(void){ return m_composed.load(); }
+
+private:
+	struct Channel {
+		MediaDecoder * 	pdec;
+		std::shared_ptr<MediaDecoder::Subscription> sub;
+		Tile 			tile;
+		MediaDecoder::Output last;		// kept for stale tile reuse
+		std::chrono::steady_clock::time_point t_last;
+		bool 			bEnded;
+	};
+
+	void compose(mfxIMPL impl);
+	mfxStatus pipeline_init(mfxIMPL impl);
+	void pipeline_close(void);
+	//take newest frame of every channel, return false if all channels have ended
+	bool collect(void);
+	mfxStatus fill_blank(surface1 * psurf);
+	//source surface of channel's last frame, NULL if none or FourCC doesn't match
+	surface1 * source(Channel & ch);
+
+	const int 						m_width;
+	const int 						m_height;
+	const mfxU32 					m_fourcc;
+	const int 						m_fps_n;
+	const int 						m_fps_d;
+	mfxU32 							m_in_fourcc;
+
+	std::vector<Channel> 			m_channels;
+	blocking_queue<Mosaic> 			m_outputs;
+
+	videoframe_allocator			m_mfxAllocator;
+	surface_pool 					spOut;
+	surface_pool 					spBlank;		// one background frame for channels without frame
+	MFXVideoSession 				m_session;
+	std::unique_ptr<MFXVideoVPP>	m_pmfxVPP;
+	mfxVideoParam 					m_VPPParams;
+	mfxExtVPPComposite 				m_extComposite;
+	mfxExtBuffer * 					m_extParams[1];
+	std::vector<mfxVPPCompInputStream> m_streams;
+
+	std::thread * 					m_pthread;
+	std::atomic<bool> 				m_stop;
+	std::atomic<unsigned long> 		m_composed;
+};
+
+#endif
@@ -14,22 +14,45 @@
 
 #include "media_pipeline.h"
 #include "common_utils.h"
+#ifdef __linux__
+#include "frame_share.h"
+#include "raw_frame_loader.h"
+#endif
 
 #include <string.h>
 #define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
 
+//printable id of calling thread, std::thread::id has no integer conversion
+static unsigned int thread_no(void)
+{
+	return (unsigned int)std::hash<std::thread::id>()(std::this_thread::get_id());
+}
+
 MediaDecoder::MediaDecoder(int output_queue_size):
 		spDEC(m_mfxAllocator),
 		spVPP(m_mfxAllocator),
 		m_outputs(output_queue_size),
-		m_debug(Debug::no)
+		m_encode(false),
+		m_hibernate_ms(0),
+		m_shared_output(false),
+		m_output_mode(OutputMode::dec_vpp),
+		m_low_latency(false),
+		m_recovery(Recovery::reset),
+		m_debug(Debug::no),
+		m_stop(false),
+		m_pause(false),
+		m_state(State::stopped)
 {
+	m_latency = LatencyStats{0, 0, 0, 0};
+	m_switches = SwitchStats{0, 0, 0};
+	m_recovery_stats = RecoveryStats{0, 0, 0};
 	char * pdebug = getenv("MD_DEBUG");
 	if(pdebug){
 		if(strcmp(pdebug,"yes") == 0) m_debug = Debug::yes;
 		if(strcmp(pdebug,"dec") == 0) m_debug = Debug::dec;
 		if(strcmp(pdebug,"out") == 0) m_debug = Debug::out;
 		if(strcmp(pdebug,"st") == 0) m_debug = Debug::st;
+		if(strcmp(pdebug,"lat") == 0) m_debug = Debug::lat;
 	}
 }
 
@@ -38,7 +61,184 @@ MediaDecoder::~MediaDecoder()
 	stop();
 }
 
+void MediaDecoder::set_name(const char * name)
+{
+	m_name = name;
+	m_mfxAllocator.set_name(name);
+}
+
+bool MediaDecoder::set_shared_output(bool bShared)
+{
+#ifdef __linux__
+	//both allocators claim system memory VPP output, the one added second would never be used
+	if(bShared && m_user_buffers){
+		fprintf(stderr, "%s:%d shared output can't be combined with user buffers\n", __FILENAME__, __LINE__);
+		return false;
+	}
+	if(bShared && !m_shared_output)
+		m_mfxAllocator.add_allocator(std::make_shared<mem_allocator_shm>());
+	m_shared_output = m_shared_output || bShared;
+	return true;
+#else
+	if(bShared){
+		fprintf(stderr, "%s:%d shared output is not supported on this platform\n", __FILENAME__, __LINE__);
+		return false;
+	}
+	return true;
+#endif
+}
+
+void MediaDecoder::set_crop(int x, int y, int w, int h)
+{
+	std::lock_guard<std::mutex> lk(m_crop_mutex);
+	if(w <= 0 || h <= 0){
+		m_crop = Crop{0, 0, 0, 0};
+		return;
+	}
+	//4:2:0 chroma: keep rectangle on even pixels, clipping is done per frame
+	x = std::max(x, 0) & ~1;
+	y = std::max(y, 0) & ~1;
+	m_crop = Crop{(mfxU16)std::min(x, 0xFFFE), (mfxU16)std::min(y, 0xFFFE),
+				  (mfxU16)std::min((w + 1) & ~1, 0xFFFE), (mfxU16)std::min((h + 1) & ~1, 0xFFFE)};
+}
+
+MediaDecoder::Crop MediaDecoder::crop_begin(surface1 * pIn, surface1 * pOut)
+{
+	Crop saved = {0, 0, 0, 0};
+	if(pOut){
+		pOut->m_RoiX = pOut->m_RoiY = 0;
+		pOut->m_RoiW = pOut->m_RoiH = 0;
+	}
+	if(!pIn) return saved;
+
+	mfxFrameInfo & fi = pIn->Info;
+	saved = Crop{fi.CropX, fi.CropY, fi.CropW, fi.CropH};
+
+	Crop c;
+	{
+		std::lock_guard<std::mutex> lk(m_crop_mutex);
+		c = m_crop;
+	}
+	if(c.w == 0) return saved;
+
+	//a rectangle outside of the frame leaves the whole frame, one partly inside is clipped
+	if(c.x >= saved.w || c.y >= saved.h) return saved;
+	int x = c.x, y = c.y;
+	int w = std::min<int>(c.w, saved.w - x);
+	int h = std::min<int>(c.h, saved.h - y);
+	if(w < 2 || h < 2) return saved;
+
+	fi.CropX = saved.x + x;
+	fi.CropY = saved.y + y;
+	fi.CropW = w;
+	fi.CropH = h;
+	if(pOut){
+		pOut->m_RoiX = x;
+		pOut->m_RoiY = y;
+		pOut->m_RoiW = w;
+		pOut->m_RoiH = h;
+	}
+	return saved;
+}
+
+void MediaDecoder::crop_end(surface1 * pIn, const Crop & saved)
+{
+	//input surface is the consumer's DEC frame (or reloaded raw frame), keep its own crop
+	if(!pIn) return;
+	pIn->Info.CropX = saved.x;
+	pIn->Info.CropY = saved.y;
+	pIn->Info.CropW = saved.w;
+	pIn->Info.CropH = saved.h;
+}
+
+void MediaDecoder::set_encode(const EncodeParams & params)
+{
+	m_encode = true;
+	m_enc = params;
+	m_packets.reset(new blocking_queue<Packet>(m_enc.packet_queue > 0 ? m_enc.packet_queue : 1));
+}
+
+bool MediaDecoder::add_user_buffer(void * ptr, size_t size, int pitch)
+{
+	if(m_shared_output){
+		fprintf(stderr, "%s:%d user buffers can't be combined with shared output\n", __FILENAME__, __LINE__);
+		return false;
+	}
+	if(!m_user_buffers){
+		m_user_buffers = std::make_shared<mem_allocator_user>();
+		m_mfxAllocator.add_allocator(m_user_buffers);
+	}
+	m_user_buffers->add_buffer(ptr, size, pitch);
+	return true;
+}
+
 void MediaDecoder::start(const char * file_url, mfxIMPL impl, bool drop_on_overflow)
+{
+	if(m_name.empty())
+		set_name(file_url);
+	//low latency: whole frames are fed, so a frame is decoded as soon as it is read
+	if(m_low_latency)
+		start(std::make_shared<hddlBitstreamFrames>(file_url, false), impl, drop_on_overflow);
+	else
+		start(std::make_shared<hddlBitstreamFile>(file_url, false), impl, drop_on_overflow);
+}
+
+void MediaDecoder::start_playlist(const std::vector<std::string> & files, mfxIMPL impl, bool drop_on_overflow)
+{
+	if(m_name.empty() && !files.empty())
+		set_name(files[0].c_str());
+	start(std::make_shared<hddlBitstreamPlaylist>(files), impl, drop_on_overflow);
+}
+
+void MediaDecoder::start_playlist(std::function<std::string(void)> next_segment, mfxIMPL impl, bool drop_on_overflow)
+{
+	if(m_name.empty())
+		set_name("playlist");
+	start(std::make_shared<hddlBitstreamPlaylist>(next_segment), impl, drop_on_overflow);
+}
+
+void MediaDecoder::start(std::shared_ptr<hddlBitstreamBase> source, mfxIMPL impl, bool drop_on_overflow)
+{
+	if(m_pthread){
+		fprintf(stderr,"Error, thread is already running\n");
+		return;
+	}
+	m_raw.bEnabled = false;
+	start_thread(std::bind(&MediaDecoder::decode, this, source, impl, drop_on_overflow));
+}
+
+void MediaDecoder::start_raw(const char * file, const char * format, int width, int height, mfxIMPL impl,
+							 bool drop_on_overflow, bool loop, int preload)
+{
+	if(m_pthread){
+		fprintf(stderr,"Error, thread is already running\n");
+		return;
+	}
+#ifdef __linux__
+	raw_frame_loader::Format fmt;
+	bool bFormat = raw_frame_loader::parse_format(format, fmt);
+#else
+	bool bFormat = strcmp(format, "i420") == 0 || strcmp(format, "rgb4") == 0;
+#endif
+	if(!bFormat){
+		fprintf(stderr, ANSI_COLOR_RED "%s:%d raw format %s is not supported\n" ANSI_COLOR_RESET, __FILENAME__, __LINE__, format);
+		close_outputs();
+		return;
+	}
+	if(m_name.empty())
+		set_name(file);
+	m_raw.bEnabled = true;
+	m_raw.file = file;
+	m_raw.format = format;
+	m_raw.fourcc = strcmp(format, "rgb4") == 0 ? MFX_FOURCC_RGB4 : MFX_FOURCC_NV12;
+	m_raw.width = width;
+	m_raw.height = height;
+	m_raw.bLoop = loop;
+	m_raw.preload = preload > 0 ? preload : 0;
+	start_thread(std::bind(&MediaDecoder::process_raw, this, impl, drop_on_overflow));
+}
+
+void MediaDecoder::start_thread(std::function<void(void)> body)
 {
 	static std::atomic<int> g_tty_color(0);
 
@@ -58,77 +258,538 @@ void MediaDecoder::start(const char * file_url, mfxIMPL impl, bool drop_on_overf
 		fprintf(stderr,"Error, thread is already running\n");
 	}else{
 		m_stop = false;
-		m_pthread = new std::thread(&MediaDecoder::decode, this, file_url, impl, drop_on_overflow);
+		m_state = State::running;
+		spDEC.abort(false);
+		spVPP.abort(false);
+		m_pthread = new std::thread(body);
 	}
 }
 void MediaDecoder::stop(void)
 {
 	if(m_pthread){
-		m_stop = true;
-
-		//drain the queue, or decode thread may blocked
-		Output out_ignore;
-		while(get(out_ignore));
+		{
+			std::lock_guard<std::mutex> guard(m_state_mutex);
+			m_stop = true;
+			m_cv_state.notify_all();
+		}
+
+		//cancel every blocking wait of decode thread immediately,
+		//so teardown only waits for the Media SDK call in flight
+		close_outputs();
+		{
+			std::lock_guard<std::mutex> guard(m_task_mutex);
+			m_cv_task.notify_all();
+		}
+		spDEC.abort();
+		spVPP.abort();
 
 		if(m_pthread->joinable())
 			m_pthread->join();
+		delete m_pthread;
 		m_pthread = NULL;
+
+		//release surfaces of frames nobody will get(), and packets nobody will get_packet()
+		drop_outputs();
+		if(m_packets) m_packets->clear();
 	}
 }
 
-void MediaDecoder::decode(const char * file_url, mfxIMPL impl, bool drop_on_overflow)
+void MediaDecoder::drop_outputs(void)
 {
-	hddlBitstreamFile Bs(file_url, false);
+	m_outputs.clear();
+	std::lock_guard<std::mutex> guard(m_sub_mutex);
+	for(auto &sub : m_subscribers)
+		sub->m_queue.clear();
+	for(auto &sub : m_clip_subscribers)
+		sub->m_queue.clear();
+	clip_windows_clear();
+}
 
-#define MD_CHECK_RESULT(sts, value, predix, goto_where)     \
-	if(sts != value) {\
-	printf("(%s:%d) "#predix" return error %d \n", __FILENAME__, __LINE__, sts);\
-	return;\
+void MediaDecoder::clip_windows_clear(void)
+{
+	//a window being filled pins up to clip_len surfaces nobody can release but us,
+	//next window starts from scratch
+	for(auto &sub : m_clip_subscribers){
+		sub->m_window.clear();
+		sub->m_skip = 0;
 	}
+}
 
-	mfxStatus sts = MFX_ERR_NONE;
+std::shared_ptr<MediaDecoder::Subscription> MediaDecoder::subscribe(int queue_size, int every_nth, Overflow policy)
+{
+	std::shared_ptr<Subscription> sub = std::make_shared<Subscription>(queue_size, every_nth, policy);
+	std::lock_guard<std::mutex> guard(m_sub_mutex);
+	//stream has ended or decoder is stopped: no frame will come, get() returns false at once
+	if(m_outputs_closed){
+		sub->m_queue.close();
+		return sub;
+	}
+	m_subscribers.push_back(sub);
+	return sub;
+}
+
+void MediaDecoder::unsubscribe(std::shared_ptr<Subscription> sub)
+{
+	{
+		std::lock_guard<std::mutex> guard(m_sub_mutex);
+		auto it = std::find(m_subscribers.begin(), m_subscribers.end(), sub);
+		if(it == m_subscribers.end())
+			return;
+		m_subscribers.erase(it);
+	}
+	//wake up the subscriber & decoder blocked on it, return queued surfaces
+	sub->m_queue.close();
+	sub->m_queue.clear();
+}
+
+std::shared_ptr<MediaDecoder::ClipSubscription> MediaDecoder::subscribe_clips(int clip_len, int stride, int queue_size, Overflow policy)
+{
+	std::shared_ptr<ClipSubscription> sub = std::make_shared<ClipSubscription>(clip_len, stride, queue_size, policy);
+	std::lock_guard<std::mutex> guard(m_sub_mutex);
+	if(m_outputs_closed){
+		sub->m_queue.close();
+		return sub;
+	}
+	m_clip_subscribers.push_back(sub);
+	return sub;
+}
+
+void MediaDecoder::unsubscribe(std::shared_ptr<ClipSubscription> sub)
+{
+	{
+		std::lock_guard<std::mutex> guard(m_sub_mutex);
+		auto it = std::find(m_clip_subscribers.begin(), m_clip_subscribers.end(), sub);
+		if(it == m_clip_subscribers.end())
+			return;
+		m_clip_subscribers.erase(it);
+	}
+	//the window is only touched by decode thread, which no longer sees this subscriber
+	//after the next put_output(); it's released with the subscription
+	sub->m_queue.close();
+	sub->m_queue.clear();
+}
+
+void MediaDecoder::close_outputs(void)
+{
+	m_outputs.close();
+	if(m_packets) m_packets->close();
+	std::lock_guard<std::mutex> guard(m_sub_mutex);
+	m_outputs_closed = true;
+	for(auto &sub : m_subscribers)
+		sub->m_queue.close();
+	for(auto &sub : m_clip_subscribers)
+		sub->m_queue.close();
+}
 
+int MediaDecoder::output_depth(void)
+{
+	std::lock_guard<std::mutex> guard(m_sub_mutex);
+	if(m_subscribers.empty() && m_clip_subscribers.empty())
+		return m_low_latency ? 1 : m_outputs.size_limit();
+
+	//subscribers hold frames independently, worst case no frame is shared: a full queue
+	//plus the frame its consumer holds after get() (e.g. a compositor's last frame)
+	int depth = 0;
+	for(auto &sub : m_subscribers)
+		depth += sub->queue_size() + 1;
+	//clip window being filled, queued clips & the clip its consumer holds
+	for(auto &sub : m_clip_subscribers)
+		depth += sub->frames_held();
+	return depth;
+}
+
+template<class T>
+bool MediaDecoder::offer(blocking_queue<T> & q, const T & item, Overflow policy, std::atomic<int> & dropped)
+{
+	bool bOK = false;
+	switch(policy){
+	case Overflow::block:
+		if(q.size() >= (int)q.size_limit())
+			m_state = State::backpressured;
+		bOK = q.put(item, false);
+		m_state = State::running;
+		break;
+	case Overflow::drop_newest:
+		bOK = q.put(item, true);
+		break;
+	case Overflow::drop_oldest:
+	{
+		int n = q.put_overwrite(item);
+		bOK = (n >= 0);
+		if(n > 0) dropped += n;
+		break;
+	}
+	}
+	if(!bOK) dropped ++;
+	return bOK;
+}
+
+bool MediaDecoder::put_output(const Output & out, bool drop_on_overflow)
+{
+	std::vector<std::shared_ptr<Subscription>> subs;
+	std::vector<std::shared_ptr<ClipSubscription>> clip_subs;
+	{
+		std::lock_guard<std::mutex> guard(m_sub_mutex);
+		subs = m_subscribers;
+		clip_subs = m_clip_subscribers;
+	}
+
+	if(subs.empty() && clip_subs.empty()){
+		//latest wins: a frame the consumer didn't take yet is replaced by the newer one
+		if(m_low_latency)
+			return m_outputs.put_overwrite(out, 1) >= 0;
+		if(!drop_on_overflow && m_outputs.size() >= (int)m_outputs.size_limit())
+			m_state = State::backpressured;
+		bool bOK = m_outputs.put(out, drop_on_overflow);
+		m_state = State::running;
+		return bOK;
+	}
+
+	//every subscriber references the same surfaces, they are recycled after the last one is done
+	bool bTaken = false;
+	for(auto &sub : subs){
+		if((sub->m_count++ % sub->m_every_nth) != 0)
+			continue;
+		if(offer(sub->m_queue, out, sub->m_policy, sub->m_dropped))
+			bTaken = true;
+	}
+
+	for(auto &sub : clip_subs){
+		if(sub->m_skip > 0){
+			sub->m_skip --;
+			continue;
+		}
+		sub->m_window.push_back(out);
+		bTaken = true;
+		if((int)sub->m_window.size() < sub->m_clip_len)
+			continue;
+
+		Clip clip(sub->m_window.begin(), sub->m_window.end());
+		offer(sub->m_queue, clip, sub->m_policy, sub->m_dropped);
+
+		//slide: keep the overlap with next window, or skip the gap before it
+		if(sub->m_stride >= sub->m_clip_len){
+			sub->m_window.clear();
+			sub->m_skip = sub->m_stride - sub->m_clip_len;
+		}else{
+			sub->m_window.erase(sub->m_window.begin(), sub->m_window.begin() + sub->m_stride);
+		}
+	}
+	return bTaken;
+}
+
+bool MediaDecoder::get(Output & r)
+{
+	if(!m_outputs.get(r))
+		return false;
+
+	surface1 * psurf = r.second.get();
+	if(!m_low_latency || !psurf || psurf->m_Arrival.time_since_epoch().count() == 0)
+		return true;
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - psurf->m_Arrival).count();
+	{
+		std::lock_guard<std::mutex> guard(m_stats_mutex);
+		m_latency.frames ++;
+		m_latency.last_ms = ms;
+		m_latency.avg_ms += (ms - m_latency.avg_ms) / m_latency.frames;
+		m_latency.max_ms = std::max(m_latency.max_ms, ms);
+	}
+	if(m_debug == Debug::lat)
+		printf("%s%s frame %lu latency %.2f ms\n" ANSI_COLOR_RESET, m_tty_color, m_name.c_str(), psurf->m_FrameNumber, ms);
+	return true;
+}
+
+MediaDecoder::LatencyStats MediaDecoder::latency(void)
+{
+	std::lock_guard<std::mutex> guard(m_stats_mutex);
+	return m_latency;
+}
+
+MediaDecoder::SwitchStats MediaDecoder::switches(void)
+{
+	std::lock_guard<std::mutex> guard(m_stats_mutex);
+	return m_switches;
+}
+
+MediaDecoder::RecoveryStats MediaDecoder::recovery(void)
+{
+	std::lock_guard<std::mutex> guard(m_stats_mutex);
+	return m_recovery_stats;
+}
+
+size_t MediaDecoder::frame_memory(void)
+{
+	return frame_memory_accountant::instance().channel(&m_mfxAllocator).current;
+}
+
+void MediaDecoder::switch_done(std::chrono::steady_clock::time_point t_last)
+{
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_last).count();
+	{
+		std::lock_guard<std::mutex> guard(m_stats_mutex);
+		m_switches.count ++;
+		m_switches.last_gap_ms = ms;
+		m_switches.max_gap_ms = std::max(m_switches.max_gap_ms, ms);
+	}
+	printf("%s%s stream now %dx%d, output gap %.2f ms\n" ANSI_COLOR_RESET, m_tty_color, m_name.c_str(),
+			m_DECParams.mfx.FrameInfo.CropW, m_DECParams.mfx.FrameInfo.CropH, ms);
+}
+
+void MediaDecoder::pause(void)
+{
+	std::lock_guard<std::mutex> guard(m_state_mutex);
+	m_pause = true;
+}
+
+void MediaDecoder::resume(void)
+{
+	std::lock_guard<std::mutex> guard(m_state_mutex);
+	m_pause = false;
+	m_cv_state.notify_all();
+}
+
+const char * MediaDecoder::state_name(State s)
+{
+	switch(s){
+	case State::running: 		return "running";
+	case State::backpressured: 	return "backpressured";
+	case State::paused: 		return "paused";
+	case State::drained: 		return "drained";
+	case State::hibernating: 	return "hibernating";
+	case State::stopped: 		return "stopped";
+	}
+	return "unknown";
+}
+
+bool MediaDecoder::wait_resume(void)
+{
+	std::unique_lock<std::mutex> lk(m_state_mutex);
+	if(m_pause && !m_stop){
+		//parked at frame boundary: every surface we still hold is either
+		//referenced by decoder or waiting in output queue. pools are kept, a pool is
+		//one allocation and the decoder's references must survive for resume() to
+		//go on from the same frame; idle sources release them by hibernating
+		m_state = State::paused;
+		m_cv_state.wait(lk, [this]{ return !m_pause || m_stop; });
+		m_state = State::running;
+	}
+	return !m_stop;
+}
+
+// wait for more bitstream data without burning CPU, interruptible by stop()
+// timeout_ms < 0 means wait forever
+bool MediaDecoder::wait_data(hddlBitstreamBase & Bs, int timeout_ms)
+{
+	const int slice_ms = 100;
+	int waited_ms = 0;
+	while(!m_stop && !Bs.IsEnd()){
+		int t = slice_ms;
+		if(timeout_ms >= 0 && timeout_ms - waited_ms < t)
+			t = timeout_ms - waited_ms;
+		if(Bs.WaitData(t))
+			return true;
+		waited_ms += t;
+		if(timeout_ms >= 0 && waited_ms >= timeout_ms)
+			break;
+	}
+	return false;
+}
+
+mfxU32 MediaDecoder::feed(hddlBitstreamBase & Bs)
+{
+	mfxU32 n = Bs.Feed();
+	if(m_low_latency && n > 0){
+		//decoder copies bitstream TimeStamp into the frame, that is how a frame finds its arrival
+		m_arrivals.emplace_back(Bs.TimeStamp, std::chrono::steady_clock::now());
+		if(m_arrivals.size() > 64)
+			m_arrivals.pop_front();
+	}
+	return n;
+}
+
+void MediaDecoder::stamp_arrival(surface1 * psurf)
+{
+	psurf->m_Arrival = std::chrono::steady_clock::time_point();
+	if(!m_low_latency) return;
+	for(auto it = m_arrivals.begin(); it != m_arrivals.end(); ++it){
+		if(it->first == psurf->Data.TimeStamp){
+			psurf->m_Arrival = it->second;
+			//frames come out in decoded order, older chunks are done
+			m_arrivals.erase(m_arrivals.begin(), it + 1);
+			break;
+		}
+	}
+}
+
+// Recovery after corruption: the IDR access unit starts at the AUD/SPS/PPS/SEI right before
+// the IDR slice, if any. pictures in between are counted (slices with first_mb_in_slice == 0)
+bool MediaDecoder::seek_idr(hddlBitstreamBase & Bs)
+{
+	const mfxU8 * p = Bs.Data + Bs.DataOffset;
+	mfxU32 size = Bs.DataLength;
+	bool bAU = false;		// non-VCL NAL seen after last slice, next access unit starts at au
+	mfxU32 au = 0;
+	mfxU32 drop = 0;
+	bool bFound = false;
+	unsigned long skipped = 0;
+
+	for(mfxU32 i = 0; i + 4 < size; i++){
+		if(p[i] != 0 || p[i + 1] != 0 || p[i + 2] != 1)
+			continue;
+		int type = p[i + 3] & 0x1F;
+		mfxU32 start = (i > 0 && p[i - 1] == 0) ? i - 1 : i;
+		if(type == 5){
+			drop = bAU ? au : start;
+			bFound = true;
+			break;
+		}
+		if(type == 6 || type == 7 || type == 8 || type == 9){
+			if(!bAU) au = start;
+			bAU = true;
+		}else if(type == 1){
+			bAU = false;
+			if(p[i + 4] & 0x80) skipped ++;
+		}
+		i += 3;
+	}
+	if(!bFound){
+		//keep a start code that may continue in next data, and headers of next access unit
+		drop = size > 4 ? size - 4 : 0;
+		if(bAU && au < drop) drop = au;
+	}
+
+	Bs.DataOffset += drop;
+	Bs.DataLength -= drop;
+	if(skipped){
+		std::lock_guard<std::mutex> guard(m_stats_mutex);
+		m_recovery_stats.skipped += skipped;
+	}
+	return bFound;
+}
+
+mfxStatus MediaDecoder::session_open(mfxIMPL impl)
+{
 	mfxVersion ver = { {0, 1} };
-    MFXVideoSession session;
+	mfxStatus sts = Initialize(impl, ver, &m_session, &m_mfxAllocator);
+	if(sts != MFX_ERR_NONE)
+		return sts;
+
+	// Create Media SDK decoder & VPP component
+	m_pmfxDEC.reset(new MFXVideoDECODE(m_session));
+	m_pmfxVPP.reset(new MFXVideoVPP(m_session));
+	if(m_encode)
+		m_pmfxENC.reset(new MFXVideoENCODE(m_session));
+	return MFX_ERR_NONE;
+}
 
-    sts = Initialize(impl, ver, &session, &m_mfxAllocator);
-    MD_CHECK_RESULT(sts , MFX_ERR_NONE,"Initialize", DECODE_EXIT0);
+void MediaDecoder::session_close(void)
+{
+	if(!m_pmfxDEC) return;
+
+	//component destructors call Close()
+	m_pmfxENC.reset();
+	m_pmfxVPP.reset();
+	m_pmfxDEC.reset();
+	m_session.Close();
+	Release();
+}
 
-    // Create Media SDK decoder
-    MFXVideoDECODE mfxDEC(session);
-    // Create Media SDK VPP component
-    MFXVideoVPP mfxVPP(session);
+// Find the first decodable header, then fill & cache decoder/VPP parameters and
+// surface requirements. No frame surface is allocated before header is found.
+mfxStatus MediaDecoder::parse_header(hddlBitstreamBase & Bs, bool bKeepOutput)
+{
+	mfxStatus sts = MFX_ERR_NONE;
 
     // Set required video parameters for decode
-    mfxVideoParam mfxVideoParams;
+    mfxVideoParam & mfxVideoParams = m_DECParams;
     memset(&mfxVideoParams, 0, sizeof(mfxVideoParams));
     mfxVideoParams.mfx.CodecId = MFX_CODEC_AVC;
     //mfxVideoParams.IOPattern = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
     mfxVideoParams.IOPattern = MFX_IOPATTERN_OUT_VIDEO_MEMORY;
 
-    // Prepare Media SDK bit stream buffer
-    // - Arbitrary buffer size for this example
-    // Read a chunk of data from stream file into bit stream buffer
-    // - Parse bit stream, searching for header and fill video parameters structure
-    // - Abort if bit stream header is not found in the first bit stream buffer chunk
-    Bs.Feed();
+    // Read chunks of data from stream into bit stream buffer until header is found
+    // - live source may have no data for a long time, wait for it without allocating anything
+    do{
+    	if(feed(Bs) == 0 && !Bs.IsEnd()){
+    		if(Bs.DataLength >= Bs.MaxLength){
+    			fprintf(stderr, "%s:%d no header found in %u bytes\n", __FILENAME__, __LINE__, Bs.DataLength);
+    			return MFX_ERR_NOT_ENOUGH_BUFFER;
+    		}
+    		if(!wait_data(Bs, -1))
+    			return MFX_ERR_ABORTED;
+    	}
+
+    	sts = m_pmfxDEC->DecodeHeader(&Bs, &mfxVideoParams);
+    	MSDK_IGNORE_MFX_STS(sts, MFX_WRN_PARTIAL_ACCELERATION);
+    }while(sts == MFX_ERR_MORE_DATA && !Bs.IsEnd() && !m_stop);
+
+    if(sts != MFX_ERR_NONE)
+    	return sts;
 
-    sts = mfxDEC.DecodeHeader(&Bs, &mfxVideoParams);
+    if(m_low_latency){
+    	//no frames queued inside decoder; decoded order is only correct without B frames
+    	mfxVideoParams.AsyncDepth = 1;
+    	if(mfxVideoParams.mfx.CodecId == MFX_CODEC_AVC &&
+    	   (mfxVideoParams.mfx.CodecProfile == MFX_PROFILE_AVC_BASELINE ||
+    		mfxVideoParams.mfx.CodecProfile == MFX_PROFILE_AVC_CONSTRAINED_BASELINE))
+    		mfxVideoParams.mfx.DecodedOrder = 1;
+    }
+
+    //consumers (and encoder) keep getting frames of the same format after a change
+    mfxFrameInfo VPPOut = m_VPPParams.vpp.Out;
+    mfxFrameAllocRequest VPPOutRequest = m_VPPRequest[1];
+    vpp_params(MFX_FOURCC_NV12, mfxVideoParams.mfx.FrameInfo.CropW, mfxVideoParams.mfx.FrameInfo.CropH);
+    mfxVideoParam & VPPParams = m_VPPParams;
+    if(bKeepOutput)
+    	VPPParams.vpp.Out = VPPOut;
+
+    // Query number of required surfaces for decoder
+    mfxFrameAllocRequest & DecRequest = m_DECRequest;
+    memset(&DecRequest, 0, sizeof(DecRequest));
+    sts = m_pmfxDEC->QueryIOSurf(&mfxVideoParams, &DecRequest);
     MSDK_IGNORE_MFX_STS(sts, MFX_WRN_PARTIAL_ACCELERATION);
-    MD_CHECK_RESULT(sts , MFX_ERR_NONE, "DecodeHeader", DECODE_EXIT1);
+    if(sts != MFX_ERR_NONE)
+    	return sts;
 
+    // Query number of required surfaces for VPP
+    mfxFrameAllocRequest * VPPRequest = m_VPPRequest;     // [0] - in, [1] - out
+    memset(VPPRequest, 0, sizeof(mfxFrameAllocRequest) * 2);
+    sts = m_pmfxVPP->QueryIOSurf(&VPPParams, VPPRequest);
+    if(sts != MFX_ERR_NONE)
+    	return sts;
+
+    if(bKeepOutput){
+    	//VPP output pool (shared with encoder input) is not touched
+    	VPPRequest[1] = VPPOutRequest;
+    	return MFX_ERR_NONE;
+    }
+
+    sts = encode_query();
+    if(sts != MFX_ERR_NONE)
+    	return sts;
+
+    mfxPrintReq(&DecRequest, "DecRequest");
+    mfxPrintReq(&VPPRequest[0], "VPPRequest[0]");
+    mfxPrintReq(&VPPRequest[1], "VPPRequest[1]");
+    return MFX_ERR_NONE;
+}
+
+// VPP parameters for input of given FourCC & size (decoder output or raw frames)
+void MediaDecoder::vpp_params(mfxU32 fourcc, mfxU16 width, mfxU16 height)
+{
     // Initialize VPP parameters
     // - For simplistic memory management, system memory surfaces are used to store the raw frames
     //   (Note that when using HW acceleration D3D surfaces are prefered, for better performance)
-    mfxVideoParam VPPParams;
+    mfxVideoParam & VPPParams = m_VPPParams;
     memset(&VPPParams, 0, sizeof(VPPParams));
     // Input data
-    VPPParams.vpp.In.FourCC = MFX_FOURCC_NV12;
-    VPPParams.vpp.In.ChromaFormat = MFX_CHROMAFORMAT_YUV420;
+    VPPParams.vpp.In.FourCC = fourcc;
+    VPPParams.vpp.In.ChromaFormat = (fourcc == MFX_FOURCC_RGB4) ? MFX_CHROMAFORMAT_YUV444 : MFX_CHROMAFORMAT_YUV420;
     VPPParams.vpp.In.CropX = 0;
     VPPParams.vpp.In.CropY = 0;
-    VPPParams.vpp.In.CropW = mfxVideoParams.mfx.FrameInfo.CropW;
-    VPPParams.vpp.In.CropH = mfxVideoParams.mfx.FrameInfo.CropH;
+    VPPParams.vpp.In.CropW = width;
+    VPPParams.vpp.In.CropH = height;
     VPPParams.vpp.In.PicStruct = MFX_PICSTRUCT_PROGRESSIVE;
     VPPParams.vpp.In.FrameRateExtN = 30;
     VPPParams.vpp.In.FrameRateExtD = 1;
@@ -146,6 +807,12 @@ void MediaDecoder::decode(const char * file_url, mfxIMPL impl, bool drop_on_over
     VPPParams.vpp.Out.CropY = 0;
     VPPParams.vpp.Out.CropW = 448;   // Resize to half size resolution
     VPPParams.vpp.Out.CropH = 448;
+    if(m_encode){
+    	//encoder input
+    	VPPParams.vpp.Out.FourCC = MFX_FOURCC_NV12;
+    	VPPParams.vpp.Out.CropW = m_enc.width ? m_enc.width : width;
+    	VPPParams.vpp.Out.CropH = m_enc.height ? m_enc.height : height;
+    }
     VPPParams.vpp.Out.PicStruct = MFX_PICSTRUCT_PROGRESSIVE;
     VPPParams.vpp.Out.FrameRateExtN = 30;
     VPPParams.vpp.Out.FrameRateExtD = 1;
@@ -157,62 +824,419 @@ void MediaDecoder::decode(const char * file_url, mfxIMPL impl, bool drop_on_over
         MSDK_ALIGN16(VPPParams.vpp.Out.CropH) :
         MSDK_ALIGN32(VPPParams.vpp.Out.CropH);
 
+    if(m_low_latency)
+    	VPPParams.AsyncDepth = 1;
+
     //VPPParams.IOPattern = MFX_IOPATTERN_IN_SYSTEM_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
     VPPParams.IOPattern = MFX_IOPATTERN_IN_VIDEO_MEMORY | MFX_IOPATTERN_OUT_VIDEO_MEMORY;
+    //shared output/user buffers: VPP writes straight into memfd backed/caller's frames
+    if((m_shared_output || m_user_buffers) && !m_encode)
+    	VPPParams.IOPattern = MFX_IOPATTERN_IN_VIDEO_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+}
 
-    // Query number of required surfaces for decoder
-    mfxFrameAllocRequest DecRequest;
-    memset(&DecRequest, 0, sizeof(DecRequest));
-    sts = mfxDEC.QueryIOSurf(&mfxVideoParams, &DecRequest);
-    MSDK_IGNORE_MFX_STS(sts, MFX_WRN_PARTIAL_ACCELERATION);
-    MD_CHECK_RESULT(sts, MFX_ERR_NONE, "mfxDEC.QueryIOSurf", DECODE_EXIT2);
-
-    // Query number of required surfaces for VPP
-    mfxFrameAllocRequest VPPRequest[2];     // [0] - in, [1] - out
-    memset(&VPPRequest, 0, sizeof(mfxFrameAllocRequest) * 2);
-    sts = mfxVPP.QueryIOSurf(&VPPParams, VPPRequest);
-    MD_CHECK_RESULT(sts, MFX_ERR_NONE, "mfxVPP.QueryIOSurf", DECODE_EXIT2);
-
-    // Determine the required number of surfaces for decoder output (VPP input) and for VPP output
-    mfxU16 nSurfNumDecVPP = DecRequest.NumFrameSuggested + VPPRequest[0].NumFrameSuggested;
-    mfxU16 nSurfNumVPPOut = VPPRequest[1].NumFrameSuggested;
+int MediaDecoder::dec_reserve(void)
+{
+	//encode: frames are never queued for consumers, encoder locks what it still needs
+	if(m_output_mode == OutputMode::vpp_only || m_encode)
+		return 2;
+	return output_depth() + 2;
+}
 
-    mfxPrintReq(&DecRequest, "DecRequest");
-    mfxPrintReq(&VPPRequest[0], "VPPRequest[0]");
-    mfxPrintReq(&VPPRequest[1], "VPPRequest[1]");
+// allocate surface pools & initialize DEC/VPP from cached parameters
+// bKeepSurfaces: pools are still allocated (and may be in use), only components are initialized
+mfxStatus MediaDecoder::pipeline_init(bool bKeepSurfaces)
+{
+	mfxStatus sts = MFX_ERR_NONE;
 
     //Surface pool, here we reserved few more frames because:
     //   DEC may advance 2 frames before blocking-put into queue
     //   VPP may advance 1 frames before blocking-put into queue
-    spDEC.realloc(DecRequest, 		m_outputs.size_limit()+2);
-    spVPP.realloc(VPPRequest[1], 	m_outputs.size_limit()+1);
+    //when frame memory budget is tight, fewer reserved frames are accepted
+    //(consumer then sees a shorter effective queue)
+    //vpp_only: DEC surfaces are only held between DEC & VPP stage
+    int depth = output_depth();
+    if(m_raw.bEnabled){
+    	//raw source: spDEC holds VPP input, preloaded frames stay reserved while running
+    	if(!bKeepSurfaces){
+    		sts = spDEC.realloc(m_VPPRequest[0], m_raw.preload, m_raw.preload);
+    		if(sts != MFX_ERR_NONE) return sts;
+    		sts = spVPP.realloc(m_VPPRequest[1], m_encode ? 1 : depth+1, 1);
+    		if(sts != MFX_ERR_NONE) return sts;
+    	}
+
+    	sts = m_pmfxVPP->Init(&m_VPPParams);
+    	MSDK_IGNORE_MFX_STS(sts, MFX_WRN_PARTIAL_ACCELERATION);
+    	if(sts != MFX_ERR_NONE) return sts;
+    	return encode_init();
+    }
+
+    if(!bKeepSurfaces){
+    	sts = spDEC.realloc(m_DECRequest, dec_reserve(), 2);
+    	if(sts != MFX_ERR_NONE) return sts;
+    	sts = spVPP.realloc(m_VPPRequest[1], m_encode ? 1 : depth+1, 1);
+    	if(sts != MFX_ERR_NONE) return sts;
+    }
 
     // Initialize the Media SDK decoder
-    sts = mfxDEC.Init(&mfxVideoParams);
+    sts = m_pmfxDEC->Init(&m_DECParams);
     MSDK_IGNORE_MFX_STS(sts, MFX_WRN_PARTIAL_ACCELERATION);
-    MD_CHECK_RESULT(sts, MFX_ERR_NONE, "mfxDEC.Init", DECODE_EXIT3);
+    if(sts != MFX_ERR_NONE) return sts;
 
     // Initialize Media SDK VPP
-    sts = mfxVPP.Init(&VPPParams);
+    sts = m_pmfxVPP->Init(&m_VPPParams);
     MSDK_IGNORE_MFX_STS(sts, MFX_WRN_PARTIAL_ACCELERATION);
-    MD_CHECK_RESULT(sts, MFX_ERR_NONE, "mfxVPP.Init", DECODE_EXIT4);
+    if(sts != MFX_ERR_NONE) return sts;
 
+    return encode_init();
+}
 
-    mfxSyncPoint syncpD;
-    mfxSyncPoint syncpV;
+// New sequence header the decoder can't continue with (e.g. larger resolution). Decoder
+// is drained and its remaining frames are delivered, the header is at the bitstream position.
+// DEC surfaces are replaced only when they are too small or too few: the new pool is allocated
+// right away, the old one is freed once consumers gave back every frame of it (a consumer may
+// keep its last frame until a new one arrives). VPP output & encoder are kept as they are.
+mfxStatus MediaDecoder::param_change(hddlBitstreamBase & Bs)
+{
+	mfxStatus sts = MFX_ERR_NONE;
 
-    bool bRunningDEC = true;
-    bool bRunningVPP = true;
+	m_pmfxDEC->Close();
+	m_pmfxVPP->Close();
+
+	sts = parse_header(Bs, true);
+	if(sts != MFX_ERR_NONE) return sts;
+
+	int reserve = dec_reserve();
+	if(!spDEC.fits(m_DECRequest, reserve)){
+		if(m_debug != Debug::no)
+			printf("%sthread 0x%08X DEC surfaces are too small, realloc\n" ANSI_COLOR_RESET, m_tty_color, thread_no());
+		//frames held by consumers keep the old pool alive
+		sts = spDEC.realloc(m_DECRequest, reserve, 2);
+		if(sts == MFX_ERR_MEMORY_ALLOC){
+			//no room for both pools: queued frames go, old pool is freed first if nobody else holds a frame of it
+			drop_outputs();
+			if(spDEC.wait_idle(0)){
+				spDEC.release();
+				sts = spDEC.realloc(m_DECRequest, reserve, 2);
+			}
+		}
+		if(sts != MFX_ERR_NONE){
+			fprintf(stderr, ANSI_BOLD ANSI_COLOR_RED "%s:%d DEC surfaces can't be replaced, sts=%d\n" ANSI_COLOR_RESET,
+					__FILENAME__, __LINE__, sts);
+			return sts;
+		}
+	}
+
+	sts = m_pmfxDEC->Init(&m_DECParams);
+	MSDK_IGNORE_MFX_STS(sts, MFX_WRN_PARTIAL_ACCELERATION);
+	if(sts != MFX_ERR_NONE) return sts;
+
+	sts = m_pmfxVPP->Init(&m_VPPParams);
+	MSDK_IGNORE_MFX_STS(sts, MFX_WRN_PARTIAL_ACCELERATION);
+	return sts;
+}
+
+// Compatible new sequence header, decoder goes on with existing surfaces. Cached parameters
+// are refreshed (they rebuild the pipeline after hibernation) and VPP is re-initialized
+// for the new crop; nothing is in flight inside VPP between frames.
+mfxStatus MediaDecoder::param_update(bool & bResized)
+{
+	bResized = false;
+	mfxVideoParam par;
+	memset(&par, 0, sizeof(par));
+	mfxStatus sts = m_pmfxDEC->GetVideoParam(&par);
+	if(sts != MFX_ERR_NONE) return sts;
+
+	bool bCrop = par.mfx.FrameInfo.CropW != m_DECParams.mfx.FrameInfo.CropW ||
+				 par.mfx.FrameInfo.CropH != m_DECParams.mfx.FrameInfo.CropH;
+	m_DECParams.mfx = par.mfx;
+	if(!bCrop) return MFX_ERR_NONE;
+	bResized = true;
+
+	mfxFrameInfo VPPOut = m_VPPParams.vpp.Out;
+	vpp_params(MFX_FOURCC_NV12, par.mfx.FrameInfo.CropW, par.mfx.FrameInfo.CropH);
+	m_VPPParams.vpp.Out = VPPOut;
+
+	m_pmfxVPP->Close();
+	sts = m_pmfxVPP->Init(&m_VPPParams);
+	MSDK_IGNORE_MFX_STS(sts, MFX_WRN_PARTIAL_ACCELERATION);
+	return sts;
+}
+
+void MediaDecoder::pipeline_close(void)
+{
+	if(!m_pmfxDEC) return;
+	if(m_pmfxENC)
+		m_pmfxENC->Close();
+	m_enc_inflight.clear();
+	m_pmfxVPP->Close();
+	if(!m_raw.bEnabled)
+		m_pmfxDEC->Close();
+}
+
+// encoder parameters follow VPP output, encoder surface needs are added to the VPP
+// output request so VPP writes straight into frames the encoder takes as input
+mfxStatus MediaDecoder::encode_query(void)
+{
+	if(!m_encode) return MFX_ERR_NONE;
+
+	mfxVideoParam & par = m_ENCParams;
+	memset(&par, 0, sizeof(par));
+	par.mfx.CodecId = m_enc.codec;
+	par.mfx.TargetUsage = MFX_TARGETUSAGE_BALANCED;
+	par.mfx.RateControlMethod = MFX_RATECONTROL_VBR;
+	par.mfx.TargetKbps = m_enc.bitrate_kbps;
+	par.mfx.GopPicSize = m_enc.gop_size;
+	par.mfx.FrameInfo = m_VPPParams.vpp.Out;
+	par.mfx.FrameInfo.FrameRateExtN = m_enc.framerate_n;
+	par.mfx.FrameInfo.FrameRateExtD = m_enc.framerate_d;
+	par.AsyncDepth = m_enc.async_depth;
+	par.IOPattern = MFX_IOPATTERN_IN_VIDEO_MEMORY;
+
+	memset(&m_ENCRequest, 0, sizeof(m_ENCRequest));
+	mfxStatus sts = m_pmfxENC->QueryIOSurf(&par, &m_ENCRequest);
+	MSDK_IGNORE_MFX_STS(sts, MFX_WRN_PARTIAL_ACCELERATION);
+	if(sts != MFX_ERR_NONE) return sts;
+	mfxPrintReq(&m_ENCRequest, "ENCRequest");
+
+	m_VPPRequest[1].Type |= MFX_MEMTYPE_FROM_ENCODE;
+	m_VPPRequest[1].NumFrameMin += m_ENCRequest.NumFrameMin;
+	m_VPPRequest[1].NumFrameSuggested += m_ENCRequest.NumFrameSuggested;
+	return MFX_ERR_NONE;
+}
+
+mfxStatus MediaDecoder::encode_init(void)
+{
+	if(!m_encode) return MFX_ERR_NONE;
+
+	mfxStatus sts = m_pmfxENC->Init(&m_ENCParams);
+	MSDK_IGNORE_MFX_STS(sts, MFX_WRN_PARTIAL_ACCELERATION);
+	MSDK_IGNORE_MFX_STS(sts, MFX_WRN_INCOMPATIBLE_VIDEO_PARAM);
+	if(sts != MFX_ERR_NONE) return sts;
+
+	//buffer size & async depth as chosen by encoder
+	mfxVideoParam par;
+	memset(&par, 0, sizeof(par));
+	sts = m_pmfxENC->GetVideoParam(&par);
+	if(sts != MFX_ERR_NONE) return sts;
+	m_ENCParams.AsyncDepth = std::max<mfxU16>(par.AsyncDepth, 1);
+
+	//bitstream pool is kept across hibernation, consumer may still hold packets
+	if(!m_tasks.empty()) return MFX_ERR_NONE;
+
+	size_t buffer_size = (size_t)par.mfx.BufferSizeInKB * 1000 * std::max<mfxU16>(par.mfx.BRCParamMultiplier, 1);
+	//frames inside encoder + queued packets + the one consumer is working on
+	int count = m_ENCParams.AsyncDepth + (int)m_packets->size_limit() + 1;
+	m_tasks.resize(count);
+	m_task_data.resize(count);
+	for(int i = 0; i < count; i++){
+		m_task_data[i].resize(buffer_size);
+		memset(&m_tasks[i], 0, sizeof(Task));
+		m_tasks[i].mfxBS.Data = m_task_data[i].data();
+		m_tasks[i].mfxBS.MaxLength = (mfxU32)buffer_size;
+	}
+	return MFX_ERR_NONE;
+}
+
+// submit one VPP output frame to encoder, NULL drains it; packets are delivered in
+// submission order once more than AsyncDepth frames are in flight
+mfxStatus MediaDecoder::encode_frame(surface1 * psurf)
+{
+	mfxStatus sts = MFX_ERR_NONE;
+
+	while(!m_stop){
+		if((int)m_enc_inflight.size() >= m_ENCParams.AsyncDepth){
+			sts = encode_deliver();
+			if(sts != MFX_ERR_NONE) return sts;
+		}
+
+		int i;
+		{
+			std::unique_lock<std::mutex> lk(m_task_mutex);
+			i = GetFreeTaskIndex(m_tasks.data(), (mfxU16)m_tasks.size());
+			if(i < 0 && m_enc_inflight.empty()){
+				//every buffer is queued or held by consumer
+				m_state = State::backpressured;
+				m_cv_task.wait(lk, [&]{
+					i = GetFreeTaskIndex(m_tasks.data(), (mfxU16)m_tasks.size());
+					return i >= 0 || m_stop;
+				});
+				m_state = State::running;
+				if(i < 0) break;
+			}
+		}
+		if(i < 0){
+			sts = encode_deliver();
+			if(sts != MFX_ERR_NONE) return sts;
+			continue;
+		}
+
+		Task & task = m_tasks[i];
+		sts = m_pmfxENC->EncodeFrameAsync(NULL, psurf, &task.mfxBS, &task.syncp);
+		if(MFX_ERR_NONE < sts && !task.syncp){
+			if(MFX_WRN_DEVICE_BUSY == sts)
+				MSDK_SLEEP(1);
+			continue;
+		}
+		// ignore warnings if output is available
+		if(MFX_ERR_NONE < sts)
+			sts = MFX_ERR_NONE;
+
+		if(sts == MFX_ERR_MORE_DATA){
+			//frame is buffered by encoder, or nothing is left to drain
+			task.syncp = NULL;
+			if(psurf) return MFX_ERR_NONE;
+			while(!m_enc_inflight.empty()){
+				sts = encode_deliver();
+				if(sts != MFX_ERR_NONE) return sts;
+			}
+			return MFX_ERR_NONE;
+		}
+		if(sts != MFX_ERR_NONE){
+			task.syncp = NULL;
+			fprintf(stderr, ANSI_BOLD ANSI_COLOR_RED "EncodeFrameAsync() return err %d\n" ANSI_COLOR_RESET, sts);
+			return sts;
+		}
+
+		m_enc_inflight.push_back(i);
+		if(psurf) return MFX_ERR_NONE;
+	}
+	return MFX_ERR_ABORTED;
+}
+
+// sync oldest submitted frame & queue its packet, the buffer goes back to the pool
+// (Task.syncp cleared) when the last reference to the packet is released
+mfxStatus MediaDecoder::encode_deliver(void)
+{
+	if(m_enc_inflight.empty()) return MFX_ERR_NONE;
+
+	Task & task = m_tasks[m_enc_inflight.front()];
+	m_enc_inflight.pop_front();
+
+	auto recycle = [this, &task](mfxBitstream * pbs){
+		std::lock_guard<std::mutex> guard(m_task_mutex);
+		pbs->DataOffset = 0;
+		pbs->DataLength = 0;
+		task.syncp = NULL;
+		m_cv_task.notify_all();
+	};
+
+	mfxStatus sts = m_session.SyncOperation(task.syncp, 60000);
+	if(sts != MFX_ERR_NONE){
+		fprintf(stderr, ANSI_BOLD ANSI_COLOR_RED "%s:%d encoder SyncOperation() failed with %d\n" ANSI_COLOR_RESET, __FILENAME__, __LINE__, sts);
+		recycle(&task.mfxBS);
+		return sts;
+	}
+
+	//an encoded stream can't skip frames, wait for consumer instead of dropping
+	Packet p(&task.mfxBS, recycle);
+	if(m_packets->size() >= (int)m_packets->size_limit())
+		m_state = State::backpressured;
+	m_packets->put(p, false);
+	m_state = State::running;
+	return MFX_ERR_NONE;
+}
+
+// release surfaces & session of an idle channel, then wait for new data
+// MFX_ERR_NONE: woke up, pipeline must be rebuilt
+// MFX_WRN_IN_EXECUTION: frames are still held by consumers, channel stays awake on its surfaces
+// else: stop requested
+mfxStatus MediaDecoder::hibernate(hddlBitstreamBase & Bs)
+{
+	m_state = State::hibernating;
+	if(m_debug != Debug::no)
+		printf("%sthread 0x%08X hibernate after %d ms idle\n" ANSI_COLOR_RESET, m_tty_color, thread_no(), m_hibernate_ms);
+
+	pipeline_close();
+
+	//frames nobody has taken after the idle time are dropped, frames still held by
+	//consumers (e.g. compositor's last tile) get the idle time to come back
+	drop_outputs();
+	if(!spDEC.wait_idle(m_hibernate_ms) || !spVPP.wait_idle(m_hibernate_ms)){
+		m_state = State::running;
+		if(m_stop)
+			return MFX_ERR_ABORTED;
+		if(m_debug != Debug::no)
+			printf("%sthread 0x%08X frames are still held, hibernation skipped\n" ANSI_COLOR_RESET, m_tty_color, thread_no());
+		return MFX_WRN_IN_EXECUTION;
+	}
+	//nothing is reserved & decode thread is the only one reserving, release can't block
+	spDEC.release();
+	spVPP.release();
+
+	session_close();
+
+	bool bWake = wait_data(Bs, -1);
+
+	if(bWake && m_debug != Debug::no)
+		printf("%sthread 0x%08X wake up\n" ANSI_COLOR_RESET, m_tty_color, thread_no());
+
+	m_state = State::running;
+	return bWake ? MFX_ERR_NONE : MFX_ERR_ABORTED;
+}
+
+void MediaDecoder::decode(std::shared_ptr<hddlBitstreamBase> pBs, mfxIMPL impl, bool drop_on_overflow)
+{
+	hddlBitstreamBase & Bs = *pBs;
+
+#define MD_CHECK_RESULT(sts, value, predix, goto_where)     \
+	if(sts != value) {\
+	printf("(%s:%d) "#predix" return error %d \n", __FILENAME__, __LINE__, sts);\
+	goto goto_where;\
+	}
+
+	mfxStatus sts = MFX_ERR_NONE;
 
     int dec_id = 0;
     int vpp_id = 0;
     int dropped_cnt = 0;
 
-
     unsigned int st_tick = 0;
     auto t_last = std::chrono::steady_clock::now();
+
+    //source went idle, drain decoder & hibernate
+    bool bFlushDEC = false;
+    //new stream parameters, drain decoder & re-init in place
+    bool bParamChange = false;
+    //skip_to_idr recovery after a corrupted frame, bitstream is discarded up to next IDR
+    bool bRecover = false;
+    //last output frame, a parameter change measures the gap from it to next output
+    auto t_out = std::chrono::steady_clock::now();
+    bool bGapPending = false;
+
+    sts = session_open(impl);
+    MD_CHECK_RESULT(sts , MFX_ERR_NONE,"Initialize", DECODE_EXIT0);
+
+    // Parse bit stream, searching for header and fill video parameters structure
+    sts = parse_header(Bs);
+    MD_CHECK_RESULT(sts , MFX_ERR_NONE, "DecodeHeader", DECODE_EXIT0);
+
+PIPELINE_START:
+	//(re)build pipeline, session is closed if we wake up from hibernation
+	if(!m_pmfxDEC){
+		sts = session_open(impl);
+		MD_CHECK_RESULT(sts , MFX_ERR_NONE,"Initialize", DECODE_EXIT0);
+	}
+
+	sts = pipeline_init();
+	MD_CHECK_RESULT(sts , MFX_ERR_NONE,"pipeline_init", DECODE_LOOPEND);
+
+PIPELINE_RUN:
+	bFlushDEC = false;
+	bParamChange = false;
+
+	{
+    MFXVideoSession & session = m_session;
+    MFXVideoDECODE & mfxDEC = *m_pmfxDEC;
+    MFXVideoVPP & mfxVPP = *m_pmfxVPP;
+
+    mfxSyncPoint syncpD;
+    mfxSyncPoint syncpV;
+
+    bool bRunningDEC = true;
+    bool bRunningVPP = true;
+
     // Main loop
-    while ((bRunningDEC || bRunningVPP) && (!m_stop)) {
+    while ((bRunningDEC || bRunningVPP) && wait_resume()) {
 
     	if(m_debug == Debug::st)
     	{
@@ -224,10 +1248,10 @@ void MediaDecoder::decode(const char * file_url, mfxIMPL impl, bool drop_on_over
 
     			t_last = t_cur;
 
-    			printf("%s[%d]thread 0x%08X, status: dec %-8d vpp %-8d dropped %-8d fps %d effective fps %d\n" ANSI_COLOR_RESET,
+    			printf("%s[%d]thread 0x%08X, status: dec %-8d vpp %-8d dropped %-8d %-13s fps %d effective fps %d\n" ANSI_COLOR_RESET,
     					m_tty_color,
-    					st_tick/1000, (std::this_thread::get_id()),
-    					dec_id, vpp_id, dropped_cnt,
+    					st_tick/1000, thread_no(),
+    					dec_id, vpp_id, dropped_cnt, state_name(state()),
 						(vpp_id * 1000/ st_tick), ((vpp_id - dropped_cnt) * 1000/ st_tick)
 						);
     		}
@@ -240,13 +1264,27 @@ void MediaDecoder::decode(const char * file_url, mfxIMPL impl, bool drop_on_over
     	surface1 *    phddlSurfaceVPP = NULL;
 
     	bool bOutReadyDEC = false;
-    	while(bRunningDEC && !bOutReadyDEC){
+    	while(bRunningDEC && !bOutReadyDEC && !m_stop){
 
 			// Decode a frame asychronously (returns immediately)
 
     		mfxFrameSurface1* pmfxSurfaceWork = NULL;
     		mfxFrameSurface1* pmfxSurfaceOut = NULL;
 
+    		//the decoder never sees pictures depending on the corrupted one
+    		if(bRecover && !bFlushDEC && !bParamChange && !Bs.IsEnd()){
+    			if(!seek_idr(Bs)){
+    				if(feed(Bs) == 0 && !Bs.IsEnd()){
+    					if(!wait_data(Bs, m_hibernate_ms > 0 ? m_hibernate_ms : -1) && !m_stop)
+    						bFlushDEC = true;
+    				}
+    				continue;
+    			}
+    			bRecover = false;
+    			if(m_debug != Debug::no)
+    				printf("%sthread 0x%08X recovered at IDR\n" ANSI_COLOR_RESET, m_tty_color, thread_no());
+    		}
+
     		// Just provide one free work surface each time call DecodeFrameAsync
     		// it will be locked by DecodeFrameAsync() when necessary
     		pmfxSurfaceWork = spDEC.getfree();
@@ -256,7 +1294,7 @@ void MediaDecoder::decode(const char * file_url, mfxIMPL impl, bool drop_on_over
 				goto DECODE_LOOPEND;
 			}
 
-			sts = mfxDEC.DecodeFrameAsync(Bs.IsEnd()?NULL:&Bs, pmfxSurfaceWork, &pmfxSurfaceOut, &syncpD);
+			sts = mfxDEC.DecodeFrameAsync((Bs.IsEnd() || bFlushDEC || bParamChange)?NULL:&Bs, pmfxSurfaceWork, &pmfxSurfaceOut, &syncpD);
 			phddlSurfaceDEC = static_cast<surface1*>(pmfxSurfaceOut);
 
     		switch(sts)
@@ -266,30 +1304,44 @@ void MediaDecoder::decode(const char * file_url, mfxIMPL impl, bool drop_on_over
 				printf(" >>>>>>>>>>>>>>>>>>>>>> DEC  MFX_WRN_DEVICE_BUSY  <<<<<<<<<<<<<<<<<<<<<<< \n");
     			break;
     		case MFX_ERR_MORE_DATA:
-				if(Bs.IsEnd()) {
+				if(Bs.IsEnd() || bFlushDEC || bParamChange) {
 					//printf("WARNING: Bs is end and decoder still requires more data\n");
 					bRunningDEC = false;
 					break;
 				}
-				Bs.Feed();
+				if(feed(Bs) == 0 && !Bs.IsEnd()){
+					//live source has no data now, block (instead of spinning) until it arrives,
+					//after m_hibernate_ms idle time drain the decoder and release resources
+					if(!wait_data(Bs, m_hibernate_ms > 0 ? m_hibernate_ms : -1) && !m_stop)
+						bFlushDEC = true;
+				}
     			break;
     		case MFX_ERR_MORE_SURFACE:
     			//pmfxWorkSurfaceDEC = NULL;
     			break;
     		case MFX_WRN_VIDEO_PARAM_CHANGED:
-    			//TODO
-    			// Drain all frames by using NULL bitstream
-    			// call MFXVideoDECODE_GetVideoParam() realloc surface pool
-    			// call MFXVideoDECODE_Close() to restart
+    		{
+    			//new header decoder can go on with (output may come with it),
+    			//e.g. streams that repeat their headers before every IDR
+    			bool bResized = false;
+    			if(param_update(bResized) != MFX_ERR_NONE){
+    				fprintf(stderr, ANSI_BOLD ANSI_COLOR_RED "%s:%d VPP re-init after parameter change failed\n" ANSI_COLOR_RESET, __FILENAME__, __LINE__);
+    				goto DECODE_LOOPEND;
+    			}
+    			bGapPending = bGapPending || bResized;
+    			break;
+    		}
+    		case MFX_ERR_INCOMPATIBLE_VIDEO_PARAM:
+    			//new header needs a new decoder (e.g. larger resolution): drain it with NULL
+    			//bitstream, new header stays in Bs for param_change()
+    			bParamChange = true;
     			break;
 			case MFX_ERR_NONE:
 				break;
     		default:
-    			//other error, we cannot handle
-				fprintf(stderr, ANSI_BOLD ANSI_COLOR_RED "DecodeFrameAsync() return err %d\n" ANSI_COLOR_RESET, sts);
-				exit(1);
-				assert(0);
-    			break;
+    			//other error, we cannot handle: end this channel, not the process
+				fprintf(stderr, ANSI_BOLD ANSI_COLOR_RED "%s:%d DecodeFrameAsync() return err %d\n" ANSI_COLOR_RESET, __FILENAME__, __LINE__, sts);
+				goto DECODE_LOOPEND;
     		}
 
             // Ignore warnings if output is available,
@@ -302,10 +1354,21 @@ void MediaDecoder::decode(const char * file_url, mfxIMPL impl, bool drop_on_over
 				//we only need to make sure the performance is good enough for 1 channel of video.
 				sts = session.SyncOperation(syncpD, 60000);
 				if(sts == MFX_ERR_NONE){
-					if(phddlSurfaceDEC->Data.Corrupted)
-						mfxDEC.Reset(&mfxVideoParams);
-					else
+					if(phddlSurfaceDEC->Data.Corrupted){
+						//corrupted frame is dropped, then either reset or skip to next IDR
+						bool bReset = (m_recovery == Recovery::reset);
+						{
+							std::lock_guard<std::mutex> guard(m_stats_mutex);
+							m_recovery_stats.corrupted ++;
+							if(bReset) m_recovery_stats.resets ++;
+						}
+						if(bReset)
+							mfxDEC.Reset(&m_DECParams);
+						else
+							bRecover = true;
+					}else{
 						bOutReadyDEC = true;
+					}
 				}
     		}
     	}
@@ -328,8 +1391,11 @@ void MediaDecoder::decode(const char * file_url, mfxIMPL impl, bool drop_on_over
 
     	if(phddlSurfaceDEC) {
     		phddlSurfaceDEC->m_FrameNumber = dec_id;
+    		stamp_arrival(phddlSurfaceDEC);
     		//spDEC.debug();
+    		if(!drop_on_overflow && spDEC.is_full()) m_state = State::backpressured;
     		spDEC.reserve(phddlSurfaceDEC, drop_on_overflow);
+    		m_state = State::running;
     		dec_id ++;
     	}
 
@@ -344,6 +1410,8 @@ void MediaDecoder::decode(const char * file_url, mfxIMPL impl, bool drop_on_over
 
             // until some meaningful result is got
 			mfxFrameSurface1* pmfxSurfaceOut = NULL;
+			//dynamic ROI is taken from input surface crop at submit
+			Crop crop_saved = crop_begin(phddlSurfaceDEC, static_cast<surface1 *>(pmfxOutSurfaceVPP));
             do
             {
                 // Process a frame asychronously (returns immediately)
@@ -355,7 +1423,10 @@ void MediaDecoder::decode(const char * file_url, mfxIMPL impl, bool drop_on_over
 				}
                 //if(MFX_ERR_NONE != sts) printf(">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> %d, %p\n", sts, syncpV);
 
-            }while(MFX_ERR_NONE < sts && !syncpV);
+            }while(MFX_ERR_NONE < sts && !syncpV && !m_stop);
+			//nothing submitted: input crop comes back now, else after VPP is synced
+			if(sts < MFX_ERR_NONE || !syncpV)
+				crop_end(phddlSurfaceDEC, crop_saved);
 
             phddlSurfaceVPP = static_cast<surface1 *>(pmfxOutSurfaceVPP);
 
@@ -384,13 +1455,21 @@ void MediaDecoder::decode(const char * file_url, mfxIMPL impl, bool drop_on_over
             if (MFX_ERR_NONE <= sts && syncpV){
             	// ignore warnings if output is available
    				// Synchronize. Wait until decoded frame is ready
-    			if (MFX_ERR_NONE == (sts=session.SyncOperation(syncpV, 60000))) {
+    			sts = session.SyncOperation(syncpV, 60000);
+    			//VPP has read the input, its own crop can be restored
+    			crop_end(phddlSurfaceDEC, crop_saved);
+    			if (MFX_ERR_NONE == sts) {
 
     				//reserve VPP output surface & find corresponding decode output
+    				if(!drop_on_overflow && spVPP.is_full()) m_state = State::backpressured;
     				spVPP.reserve(phddlSurfaceVPP, drop_on_overflow);
+    				m_state = State::running;
     				phddlSurfaceVPP->m_FrameNumber = vpp_id;
 
-    				surface1 * phddlSurfaceVPPDEC = spDEC.find(phddlSurfaceVPP->Data.FrameOrder);
+    				//low latency: VPP is 1:1 & synced per frame, output is made from the frame just
+    				//submitted, no need to search the pool for it
+    				surface1 * phddlSurfaceVPPDEC = (m_low_latency && phddlSurfaceDEC) ? phddlSurfaceDEC :
+    												spDEC.find(phddlSurfaceVPP->Data.FrameOrder);
     				if(phddlSurfaceVPPDEC)
     					spDEC.reserve(phddlSurfaceVPPDEC, drop_on_overflow);
     				else
@@ -399,6 +1478,14 @@ void MediaDecoder::decode(const char * file_url, mfxIMPL impl, bool drop_on_over
     					goto DECODE_LOOPEND;
     				}
 
+    				phddlSurfaceVPP->m_Arrival = phddlSurfaceVPPDEC->m_Arrival;
+
+    				if(bGapPending){
+    					switch_done(t_out);
+    					bGapPending = false;
+    				}
+    				t_out = std::chrono::steady_clock::now();
+
     				if(m_debug == Debug::out || m_debug == Debug::yes){
     					printf("%s:%d, [%d,%d], id:%d,%d, DEC%lu@%d(%dx%d %c%c%c%c locked_%d reserved_%d forder_0x%X),VPP%lu@%d(%dx%d %c%c%c%c locked_%d reserved_%d forder_0x%X)\n",
     							__FILENAME__,__LINE__, bRunningDEC, bOutReadyDEC, dec_id, vpp_id,
@@ -418,18 +1505,32 @@ void MediaDecoder::decode(const char * file_url, mfxIMPL impl, bool drop_on_over
 								phddlSurfaceVPP->Data.Locked, phddlSurfaceVPP->is_reserved(),	phddlSurfaceVPP->Data.FrameOrder);
     				}
 
+    				if(m_encode){
+    					//encoder locks the surface as long as it needs it, nothing is queued for get()
+    					spVPP.unreserve(phddlSurfaceVPP);
+    					spDEC.unreserve(phddlSurfaceVPPDEC);
+    					vpp_id++;
+    					if(encode_frame(phddlSurfaceVPP) != MFX_ERR_NONE)
+    						goto DECODE_LOOPEND;
+    					continue;
+    				}
+
     				//setup deleter as unreserve() so it can be re-cycled
     				//note the deleter will be called from user thread context, so it must be multithread-safe
-					std::shared_ptr<surface1> o1(phddlSurfaceVPPDEC, [this](surface1*p) {spDEC.unreserve(p); });
+					std::shared_ptr<surface1> o1;
 					std::shared_ptr<surface1> o2(phddlSurfaceVPP, [this](surface1*p) {spVPP.unreserve(p); });
 
-					//only output both reserved frames(or they will got unreserved automatically by shared_ptr)
+					//VPP is synced, DEC surface is no longer needed by output
+					if(m_output_mode == OutputMode::vpp_only)
+						spDEC.unreserve(phddlSurfaceVPPDEC);
+					else
+						o1.reset(phddlSurfaceVPPDEC, [this](surface1*p) {spDEC.unreserve(p); });
+
+					//only output reserved frames(or they will got unreserved automatically by shared_ptr)
 					bool bEnqueueOK = false;
 
-					if (o1->is_reserved() && o2->is_reserved())
-					{
-						bEnqueueOK = m_outputs.put(Output(o1, o2), drop_on_overflow);
-					}
+					if ((!o1 || o1->is_reserved()) && o2->is_reserved())
+						bEnqueueOK = put_output(Output(o1, o2), drop_on_overflow);
 
 					if (!bEnqueueOK)
 					{
@@ -447,20 +1548,258 @@ void MediaDecoder::decode(const char * file_url, mfxIMPL impl, bool drop_on_over
     	}
     }
 
+	}
+
+    //decoder is drained, its frames are delivered: continue with new parameters,
+    //encoder keeps its stream going
+    if(bParamChange && !m_stop){
+    	sts = param_change(Bs);
+    	MD_CHECK_RESULT(sts, MFX_ERR_NONE, "param_change", DECODE_LOOPEND);
+    	bGapPending = true;
+    	goto PIPELINE_RUN;
+    }
+
+    //frames buffered inside encoder
+    if(m_encode && !m_stop && encode_frame(NULL) != MFX_ERR_NONE)
+    	goto DECODE_LOOPEND;
+
+    if(bFlushDEC && !m_stop){
+    	sts = hibernate(Bs);
+    	if(sts == MFX_ERR_NONE)
+    		goto PIPELINE_START;
+    	if(sts != MFX_WRN_IN_EXECUTION)
+    		goto DECODE_EXIT0;
+    	//not hibernated: components were closed, re-init them on the surfaces still held
+    	sts = pipeline_init(true);
+    	MD_CHECK_RESULT(sts , MFX_ERR_NONE,"pipeline_init", DECODE_LOOPEND);
+    	goto PIPELINE_RUN;
+    }
+
     //close output pipe/queue
-    m_outputs.close();
-	//wait user call stop()
-	while(!m_stop);
+    close_outputs();
+
+	//wait user call stop(), parked on condition variable so a finished channel costs no CPU
+	{
+		std::unique_lock<std::mutex> lk(m_state_mutex);
+		if(!m_stop) m_state = State::drained;
+		m_cv_state.wait(lk, [this]{ return m_stop.load(); });
+	}
 
 DECODE_LOOPEND:
-    mfxVPP.Close();
-DECODE_EXIT4:
-	mfxDEC.Close();
-
-DECODE_EXIT3:
-DECODE_EXIT2:
-DECODE_EXIT1:
-    Release();
+	pipeline_close();
+
 DECODE_EXIT0:
+	session_close();
+	//consumer may still wait on get() if we exit on error
+	close_outputs();
+	m_state = State::stopped;
 	return;
 }
+
+// raw frames of start_raw(): mapped (or piped) by raw_frame_loader on Linux, fread() elsewhere
+class raw_reader
+{
+public:
+#ifdef __linux__
+	bool open(const std::string & file, const std::string & format, int width, int height, bool bLoop){
+		raw_frame_loader::Format fmt;
+		if(!raw_frame_loader::parse_format(format.c_str(), fmt))
+			return false;
+		m_loader.set_loop(bLoop);
+		return m_loader.open(file.c_str(), fmt, width, height) == MFX_ERR_NONE;
+	}
+	void close(void){ m_loader.close(); }
+#else
+	~raw_reader(){ close(); }
+	bool open(const std::string & file, const std::string & format, int, int, bool bLoop){
+		m_bRGB = (format == "rgb4");
+		m_bLoop = bLoop;
+		m_fSource = fopen(file.c_str(), "rb");
+		return m_fSource != NULL;
+	}
+	void close(void){
+		if(m_fSource) fclose(m_fSource);
+		m_fSource = NULL;
+	}
+#endif
+
+	// one frame into (video memory) surface, MFX_ERR_MORE_DATA at end of input
+	mfxStatus load(surface1 * psurf){
+		mfxStatus sts = psurf->lock();
+		if(sts != MFX_ERR_NONE) return sts;
+#ifdef __linux__
+		sts = m_loader.load(psurf);
+#else
+		sts = read(psurf);
+		if(sts == MFX_ERR_MORE_DATA && m_bLoop && m_nFrames > 0){
+			rewind(m_fSource);
+			sts = read(psurf);
+		}
+		if(sts == MFX_ERR_NONE)
+			m_nFrames ++;
+#endif
+		psurf->unlock();
+		return sts;
+	}
+
+private:
+#ifdef __linux__
+	raw_frame_loader 	m_loader;
+#else
+	mfxStatus read(surface1 * psurf){
+		return m_bRGB ? LoadRawRGBFrame(psurf, m_fSource) : LoadRawFrame(psurf, m_fSource);
+	}
+	FILE * 				m_fSource = NULL;
+	bool 				m_bRGB = false;
+	bool 				m_bLoop = false;
+	long 				m_nFrames = 0;
+#endif
+};
+
+void MediaDecoder::process_raw(mfxIMPL impl, bool drop_on_overflow)
+{
+	mfxStatus sts = MFX_ERR_NONE;
+	raw_reader reader;
+	std::vector<surface1 *> preloaded;
+
+	int in_id = 0;
+	int vpp_id = 0;
+	int dropped_cnt = 0;
+
+	sts = session_open(impl);
+	MD_CHECK_RESULT(sts, MFX_ERR_NONE, "Initialize", RAW_EXIT0);
+
+	vpp_params(m_raw.fourcc, m_raw.width, m_raw.height);
+	memset(m_VPPRequest, 0, sizeof(mfxFrameAllocRequest) * 2);
+	sts = m_pmfxVPP->QueryIOSurf(&m_VPPParams, m_VPPRequest);
+	MSDK_IGNORE_MFX_STS(sts, MFX_WRN_PARTIAL_ACCELERATION);
+	MD_CHECK_RESULT(sts, MFX_ERR_NONE, "QueryIOSurf", RAW_EXIT0);
+	mfxPrintReq(&m_VPPRequest[0], "VPPRequest[0]");
+	mfxPrintReq(&m_VPPRequest[1], "VPPRequest[1]");
+	sts = encode_query();
+	MD_CHECK_RESULT(sts, MFX_ERR_NONE, "encode_query", RAW_EXIT0);
+
+	sts = pipeline_init();
+	MD_CHECK_RESULT(sts, MFX_ERR_NONE, "pipeline_init", RAW_LOOPEND);
+
+	if(!reader.open(m_raw.file, m_raw.format, m_raw.width, m_raw.height, m_raw.bLoop && m_raw.preload == 0)){
+		fprintf(stderr, ANSI_COLOR_RED "%s:%d can't open %s\n" ANSI_COLOR_RESET, __FILENAME__, __LINE__, m_raw.file.c_str());
+		goto RAW_LOOPEND;
+	}
+
+	//in-memory mode: file is only read here, VPP then cycles over these surfaces
+	while((int)preloaded.size() < m_raw.preload){
+		surface1 * psurf = spDEC.getfree();
+		if(psurf == NULL || !spDEC.reserve(psurf, true))
+			break;
+		if(reader.load(psurf) != MFX_ERR_NONE){
+			spDEC.unreserve(psurf);
+			break;
+		}
+		preloaded.push_back(psurf);
+	}
+	if(m_raw.preload > 0){
+		if(preloaded.empty()){
+			fprintf(stderr, ANSI_COLOR_RED "%s:%d no frame in %s\n" ANSI_COLOR_RESET, __FILENAME__, __LINE__, m_raw.file.c_str());
+			goto RAW_LOOPEND;
+		}
+		reader.close();
+	}
+
+	{
+	mfxSyncPoint syncpV;
+
+	while(wait_resume()){
+		surface1 * phddlSurfaceIn = NULL;
+		if(!preloaded.empty()){
+			phddlSurfaceIn = preloaded[in_id % preloaded.size()];
+		}else{
+			phddlSurfaceIn = spDEC.getfree();
+			if(phddlSurfaceIn == NULL){
+				fprintf(stderr, "%s:%d spDEC.getfree() return NULL\n", __FILENAME__, __LINE__);
+				goto RAW_LOOPEND;
+			}
+			//loop restarts at end of file inside reader
+			sts = reader.load(phddlSurfaceIn);
+			if(sts != MFX_ERR_NONE)
+				break;	// end of file
+		}
+		phddlSurfaceIn->Data.FrameOrder = in_id;
+		phddlSurfaceIn->Data.TimeStamp = (mfxU64)in_id * 90000 * m_VPPParams.vpp.In.FrameRateExtD / m_VPPParams.vpp.In.FrameRateExtN;
+		phddlSurfaceIn->m_FrameNumber = in_id;
+		phddlSurfaceIn->m_Arrival = m_low_latency ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+		in_id ++;
+
+		mfxFrameSurface1* pmfxOutSurfaceVPP = spVPP.getfree();
+		if(pmfxOutSurfaceVPP == NULL){
+			fprintf(stderr, "%s:%d spVPP.getfree() return NULL\n", __FILENAME__, __LINE__);
+			goto RAW_LOOPEND;
+		}
+
+		Crop crop_saved = crop_begin(phddlSurfaceIn, static_cast<surface1 *>(pmfxOutSurfaceVPP));
+		do{
+			sts = m_pmfxVPP->RunFrameVPPAsync(phddlSurfaceIn, pmfxOutSurfaceVPP, NULL, &syncpV);
+			if(MFX_WRN_DEVICE_BUSY == sts)
+				MSDK_SLEEP(1);
+		}while(MFX_ERR_NONE < sts && !syncpV && !m_stop);
+
+		if(sts < MFX_ERR_NONE || !syncpV){
+			crop_end(phddlSurfaceIn, crop_saved);
+			fprintf(stderr, ANSI_BOLD ANSI_COLOR_RED "RunFrameVPPAsync() return err %d\n" ANSI_COLOR_RESET, sts);
+			goto RAW_LOOPEND;
+		}
+		sts = m_session.SyncOperation(syncpV, 60000);
+		//VPP has read the input, its own crop can be restored
+		crop_end(phddlSurfaceIn, crop_saved);
+		if(sts != MFX_ERR_NONE){
+			fprintf(stderr, ANSI_BOLD ANSI_COLOR_RED "%s:%d SyncOperation() failed with %d\n" ANSI_COLOR_RESET, __FILENAME__, __LINE__, sts);
+			continue;
+		}
+
+		surface1 * phddlSurfaceVPP = static_cast<surface1 *>(pmfxOutSurfaceVPP);
+		if(m_encode){
+			phddlSurfaceVPP->m_FrameNumber = phddlSurfaceIn->m_FrameNumber;
+			vpp_id ++;
+			if(encode_frame(phddlSurfaceVPP) != MFX_ERR_NONE)
+				goto RAW_LOOPEND;
+			continue;
+		}
+		if(!drop_on_overflow && spVPP.is_full()) m_state = State::backpressured;
+		spVPP.reserve(phddlSurfaceVPP, drop_on_overflow);
+		m_state = State::running;
+		phddlSurfaceVPP->m_FrameNumber = phddlSurfaceIn->m_FrameNumber;
+		phddlSurfaceVPP->m_Arrival = phddlSurfaceIn->m_Arrival;
+
+		std::shared_ptr<surface1> o2(phddlSurfaceVPP, [this](surface1*p) {spVPP.unreserve(p); });
+		if(!o2->is_reserved() || !put_output(Output(NULL, o2), drop_on_overflow))
+			dropped_cnt ++;
+		vpp_id ++;
+
+		if(m_debug == Debug::out || m_debug == Debug::yes)
+			printf("%s%s:%d, raw in %d vpp %d dropped %d\n" ANSI_COLOR_RESET, m_tty_color, __FILENAME__, __LINE__, in_id, vpp_id, dropped_cnt);
+	}
+	}
+
+	if(m_encode && !m_stop && encode_frame(NULL) != MFX_ERR_NONE)
+		goto RAW_LOOPEND;
+
+	close_outputs();
+
+	//wait user call stop(), as decode() does at end of stream
+	{
+		std::unique_lock<std::mutex> lk(m_state_mutex);
+		if(!m_stop) m_state = State::drained;
+		m_cv_state.wait(lk, [this]{ return m_stop.load(); });
+	}
+
+RAW_LOOPEND:
+	pipeline_close();
+	for(auto psurf : preloaded)
+		spDEC.unreserve(psurf);
+	reader.close();
+
+RAW_EXIT0:
+	session_close();
+	close_outputs();
+	m_state = State::stopped;
+}
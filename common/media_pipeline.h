@@ -6,6 +6,16 @@
 #include "surface_pool.h"
 #include "bitstreams.h"
 
+#include <atomic>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+
 
 class MediaDecoder
 {
@@ -14,24 +24,369 @@ public:
 	virtual ~MediaDecoder();
 
 	void start(const char * file_url, mfxIMPL impl = MFX_IMPL_AUTO, bool drop_on_overflow = false);
+	//decode from user provided source (e.g. live camera stream)
+	void start(std::shared_ptr<hddlBitstreamBase> source, mfxIMPL impl = MFX_IMPL_AUTO, bool drop_on_overflow = false);
+	//Playlist: segment files are decoded back to back as one stream, with one session,
+	//surface pools & VPP for all of them. the decoder is only re-initialized when a
+	//segment's stream parameters really differ (handled in place, like a camera
+	//changing resolution). next_segment returns path of the next segment, empty string
+	//after the last one, and may block until it exists (e.g. a recorder still writing):
+	//it runs on a helper thread, stop() doesn't wait for a call still blocked in it
+	void start_playlist(const std::vector<std::string> & files, mfxIMPL impl = MFX_IMPL_AUTO, bool drop_on_overflow = false);
+	void start_playlist(std::function<std::string(void)> next_segment, mfxIMPL impl = MFX_IMPL_AUTO, bool drop_on_overflow = false);
 	void stop(void);
 
+	//VPP only pipeline fed with raw frames instead of the decoder (e.g. to measure VPP alone):
+	//   file holds frames of width x height in format "i420", "yv12", "nv12" (VPP input NV12)
+	//   or "rgb4" (VPP input RGB4). on Linux raw_frame_loader maps the file, or reads a pipe
+	//   ("-" is stdin); elsewhere only i420 & rgb4 files are read with LoadRawFrame()/LoadRawRGBFrame().
+	//   loop restarts at end of file (not for pipes).
+	//   preload > 0: that many frames are loaded once and cycled forever (in-memory mode,
+	//   no file access while running, so only VPP is measured).
+	//Output is (NULL, VPP surface), m_FrameNumber counts input frames
+	void start_raw(const char * file, const char * format, int width, int height, mfxIMPL impl = MFX_IMPL_AUTO,
+				   bool drop_on_overflow = false, bool loop = false, int preload = 0);
+
+	//release surfaces & session after source has no data for idle_ms (0 to disable),
+	//pipeline is rebuilt from cached stream parameters when data arrives again
+	//(must be called before start)
+	void set_hibernate(int idle_ms){ m_hibernate_ms = idle_ms; }
+
+	//name of this channel in frame memory reports
+	void set_name(const char * name);
+
+	//VPP writes its output straight into caller's buffers (e.g. pinned tensor memory),
+	//out.second->index() is the index of the buffer in registration order.
+	//each buffer holds one output frame (RGB4) with given pitch (0: packed rows);
+	//about queue size + 2 buffers are needed, with fewer the queue gets shorter.
+	//buffers must stay valid until decoder is destroyed (must be called before start).
+	//returns false (buffer not used) if shared output is enabled
+	bool add_user_buffer(void * ptr, size_t size, int pitch = 0);
+
+	//dec_vpp  : Output is (DEC surface, VPP surface)
+	//vpp_only : Output is (NULL, VPP surface), DEC surface is recycled right after VPP,
+	//           so consumers don't hold full resolution frames & DEC pool shrinks to minimum
+	//(must be called before start)
+	enum OutputMode{dec_vpp=0, vpp_only};
+	void set_output_mode(OutputMode mode){ m_output_mode = mode; }
+
+	//Transcode: VPP output (NV12) goes straight into an encoder in the same session,
+	//no CPU copy. encoded frames come from a recycled pool of bitstream buffers and are
+	//read by get_packet(); the buffer returns to the pool when the Packet is released.
+	//get() and subscribers see no frames in this mode (must be called before start)
+	struct EncodeParams{
+		mfxU32 	codec = MFX_CODEC_AVC;
+		mfxU16 	width = 0;			// encoded size, 0: decoded size
+		mfxU16 	height = 0;
+		mfxU16 	bitrate_kbps = 2000;
+		mfxU16 	framerate_n = 30;
+		mfxU16 	framerate_d = 1;
+		mfxU16 	gop_size = 60;
+		mfxU16 	async_depth = 4;	// frames in flight inside encoder
+		int 	packet_queue = 8;	// encoded frames waiting for get_packet()
+	};
+	void set_encode(const EncodeParams & params);
+
+	//one encoded frame: Data + DataOffset, DataLength bytes, TimeStamp & FrameType are set
+	//the buffer belongs to the decoder's pool & its deleter refers to the decoder:
+	//every Packet must be released before the MediaDecoder is destroyed
+	typedef std::shared_ptr<mfxBitstream> Packet;
+	//return false after end of stream or stop
+	bool get_packet(Packet & p){ return m_packets && m_packets->get(p); }
+
+	//Dynamic ROI: VPP takes only rectangle (x,y,w,h) of the decoded frame and scales it to
+	//the full output size, applied as input crop from the next VPP frame on, no re-init.
+	//rectangle is made even & clipped to the frame, one entirely outside of it (or w or h <= 0)
+	//gives the whole frame.
+	//VPP output surface m_RoiX/Y/W/H tell which rectangle a frame was scaled from
+	void set_crop(int x, int y, int w, int h);
+	void clear_crop(void){ set_crop(0, 0, 0, 0); }
+
+	//Low latency profile for live alerting (must be called before start):
+	//   decoder AsyncDepth 1, decoded order output where the stream has no B frames (AVC
+	//   baseline), file input is fed one whole frame at a time (MFX_BITSTREAM_COMPLETE_FRAME),
+	//   get() queue keeps only the newest frame, and VPP output is paired with the DEC frame
+	//   it was just made from. latency from bitstream arrival to get() is measured per frame
+	//   (MD_DEBUG=lat prints it), surfaces carry the arrival time in m_Arrival.
+	//live sources should feed whole frames and set DataFlag themselves.
+	void set_low_latency(bool bLowLatency){ m_low_latency = bLowLatency; }
+
+	struct LatencyStats{
+		unsigned long 	frames;
+		double 			last_ms;
+		double 			avg_ms;
+		double 			max_ms;
+	};
+	LatencyStats latency(void);
+
+	//Resolution (or other stream parameter) changes are handled in place: the decoder is
+	//drained, re-initialized from the new header, its surfaces are reused when they are
+	//large & many enough, and VPP keeps the same output, so consumers see no restart.
+	//count & gap between last output frame before and first one after each change
+	struct SwitchStats{
+		int 			count;
+		double 			last_gap_ms;
+		double 			max_gap_ms;
+	};
+	SwitchStats switches(void);
+
+	//on a corrupted frame:
+	//  reset       : decoder is reset and the frame dropped (default)
+	//  skip_to_idr : no reset, bitstream up to the next IDR is discarded before the decoder
+	//                sees it, so pictures depending on the damaged one are never decoded
+	//                (H.264 NAL scan), corrupted frames still coming out are dropped
+	enum Recovery{reset=0, skip_to_idr};
+	void set_recovery(Recovery mode){ m_recovery = mode; }
+
+	struct RecoveryStats{
+		unsigned long 	corrupted;		// corrupted frames out of decoder (all dropped)
+		unsigned long 	resets;			// decoder resets
+		unsigned long 	skipped;		// pictures discarded from bitstream while recovering
+	};
+	RecoveryStats recovery(void);
+
+	//frame memory currently allocated for this decoder's surfaces (bytes)
+	size_t frame_memory(void);
+
+	//put VPP output frames in system memory shared by memfd, so they can be
+	//exported to other processes by mem_allocator_shm::export_frame() (Linux only)
+	//(must be called before start). returns false if not supported or user buffers are added
+	bool set_shared_output(bool bShared);
+
+	//park the decode thread between frames (no CPU is consumed while paused)
+	//frames already in output queue are still available to get(). surface pools stay
+	//allocated so decoding resumes at the same frame; set_hibernate() frees them instead
+	void pause(void);
+	void resume(void);
+
+	//channel state:
+	//  running       : decoding
+	//  backpressured : blocked because consumer is not pulling fast enough
+	//  paused        : parked by pause()
+	//  drained       : end of stream reached, all frames are in output queue
+	//  hibernating   : source is idle, surfaces & session are released
+	//  stopped       : decode thread is not running
+	enum State{running=0, backpressured, paused, drained, hibernating, stopped};
+	State state(void){ return (State)m_state.load(); }
+	static const char * state_name(State s);
+
+	//(DEC surface, VPP surface), DEC surface is NULL in vpp_only mode
 	typedef std::pair<std::shared_ptr<surface1>, std::shared_ptr<surface1>> Output;
 
-	bool get(Output & r){ return m_outputs.get(r); }
+	bool get(Output & r);
+
+	//Fan-out of one decode to several consumers:
+	//   each subscriber has its own bounded queue & overflow policy and sees every Nth frame,
+	//   surfaces return to the pool after all subscribers released them.
+	//   while any subscriber exists, frames are not put into get()'s queue.
+	//subscribe before start() so surface pools are sized for the subscriber queues,
+	//later subscribers share the existing pools (and may see more drops).
+	//a subscription made after the stream ended or stop() is closed from the start.
+	enum Overflow{
+		block=0,		// decoder waits for this subscriber
+		drop_newest,	// new frame is dropped for this subscriber
+		drop_oldest,	// oldest queued frame is dropped for this subscriber
+	};
+	class Subscription
+	{
+	public:
+		Subscription(int queue_size, int every_nth, Overflow policy):
+			m_queue(queue_size), m_every_nth(every_nth > 0 ? every_nth : 1), m_policy(policy),
+			m_count(0), m_dropped(0){}
+
+		//return false after unsubscribe, stop or end of stream
+		bool get(Output & r){ return m_queue.get(r); }
+		//1: got a frame, 0: none before deadline, -1: like get() returning false
+		template<class Clock, class Duration>
+		int get_until(Output & r, const std::chrono::time_point<Clock, Duration> & deadline){ return m_queue.get_until(r, deadline); }
+		int dropped(void){ return m_dropped.load(); }
+		int queue_size(void){ return (int)m_queue.size_limit(); }
+	private:
+		blocking_queue<Output> 	m_queue;
+		const int 				m_every_nth;
+		const Overflow 			m_policy;
+		unsigned long 			m_count;	// frames offered, decode thread only
+		std::atomic<int> 		m_dropped;
+
+		friend class MediaDecoder;
+	};
+	std::shared_ptr<Subscription> subscribe(int queue_size, int every_nth = 1, Overflow policy = Overflow::drop_oldest);
+	void unsubscribe(std::shared_ptr<Subscription> sub);
+
+	//Sliding windows of clip_len consecutive frames, a new window every stride frames
+	//(stride > clip_len skips frames between windows). overlapping windows reference
+	//the same surfaces, nothing is copied. like subscribe(), call before start()
+	//so pools are sized for the frames held by window, queue & the consumer's clip.
+	typedef std::vector<Output> Clip;
+	class ClipSubscription
+	{
+	public:
+		ClipSubscription(int clip_len, int stride, int queue_size, Overflow policy):
+			m_queue(queue_size), m_clip_len(clip_len > 0 ? clip_len : 1), m_stride(stride > 0 ? stride : 1),
+			m_policy(policy), m_skip(0), m_dropped(0){}
+
+		//return false after unsubscribe, stop or end of stream
+		bool get(Clip & r){ return m_queue.get(r); }
+		int dropped(void){ return m_dropped.load(); }
+		int clip_len(void){ return m_clip_len; }
+		int stride(void){ return m_stride; }
+		//distinct frames pinned at most: window being filled, queued clips & the consumer's clip
+		int frames_held(void){ return m_clip_len + ((int)m_queue.size_limit() + 1) * std::min(m_stride, m_clip_len); }
+	private:
+		blocking_queue<Clip> 	m_queue;
+		const int 				m_clip_len;
+		const int 				m_stride;
+		const Overflow 			m_policy;
+		std::deque<Output> 		m_window;	// decode thread only
+		int 					m_skip;		// frames to skip before next window, decode thread only
+		std::atomic<int> 		m_dropped;	// clips dropped
+
+		friend class MediaDecoder;
+	};
+	std::shared_ptr<ClipSubscription> subscribe_clips(int clip_len, int stride = 1, int queue_size = 2,
+													  Overflow policy = Overflow::drop_oldest);
+	void unsubscribe(std::shared_ptr<ClipSubscription> sub);
 private:
+	//hand one frame to get() queue or subscribers, return false if nobody took it
+	bool put_output(const Output & out, bool drop_on_overflow);
+	//put item into a subscriber queue according to policy, false if it's not taken
+	template<class T>
+	bool offer(blocking_queue<T> & q, const T & item, Overflow policy, std::atomic<int> & dropped);
+	//close get() queue & all subscriber queues
+	void close_outputs(void);
+	//frames the consumers may hold, used to size surface pools
+	int output_depth(void);
+
+	//run body on the pipeline thread
+	void start_thread(std::function<void(void)> body);
+
 	//the mediaSDK pipeline
-	void decode(const char * file_url, mfxIMPL impl, bool drop_on_overflow);
+	void decode(std::shared_ptr<hddlBitstreamBase> pBs, mfxIMPL impl, bool drop_on_overflow);
+	//VPP on raw frames of m_raw (start_raw)
+	void process_raw(mfxIMPL impl, bool drop_on_overflow);
+
+	//encode stage: parameters & surface request (added to VPP output request),
+	//one VPP output frame (NULL drains the encoder), packet delivery
+	mfxStatus encode_query(void);
+	mfxStatus encode_init(void);
+	mfxStatus encode_frame(surface1 * psurf);
+	mfxStatus encode_deliver(void);
+
+	//Bs.Feed(), remembering when each fed chunk arrived (low latency mode)
+	mfxU32 feed(hddlBitstreamBase & Bs);
+	//arrival time of the bitstream a decoded frame came from
+	void stamp_arrival(surface1 * psurf);
+
+	mfxStatus session_open(mfxIMPL impl);
+	void session_close(void);
+	//bKeepOutput: stream parameters changed, VPP output & encoder request stay as they are
+	mfxStatus parse_header(hddlBitstreamBase & Bs, bool bKeepOutput = false);
+	//DEC surfaces reserved for frames between DEC, VPP & consumers
+	int dec_reserve(void);
+	//decoder is drained after MFX_ERR_INCOMPATIBLE_VIDEO_PARAM, re-init from new header
+	mfxStatus param_change(hddlBitstreamBase & Bs);
+	//MFX_WRN_VIDEO_PARAM_CHANGED: decoder goes on, refresh cached parameters & VPP input,
+	//bResized: crop did change (a repeated, identical header is not a change)
+	mfxStatus param_update(bool & bResized);
+	//skip_to_idr recovery: drop bitstream up to the next IDR access unit, false if Bs has none yet
+	bool seek_idr(hddlBitstreamBase & Bs);
+	//first output after a parameter change, t_last is when the last one before it was made
+	void switch_done(std::chrono::steady_clock::time_point t_last);
+	//set_crop() rectangle into VPP input surface crop (and output ROI) before submit,
+	//return previous input crop, restored by crop_end() once VPP is synced (or nothing was submitted)
+	struct Crop{ mfxU16 x, y, w, h; };
+	Crop crop_begin(surface1 * pIn, surface1 * pOut);
+	void crop_end(surface1 * pIn, const Crop & saved);
+	//fill m_VPPParams for input of given FourCC & size
+	void vpp_params(mfxU32 fourcc, mfxU16 width, mfxU16 height);
+	mfxStatus pipeline_init(bool bKeepSurfaces = false);
+	void pipeline_close(void);
+	//drop frames queued for consumers & clip windows, their surfaces go back to the pools
+	//(decode thread, or after it has exited)
+	void drop_outputs(void);
+	//forget frames collected for the next clips, caller holds m_sub_mutex
+	void clip_windows_clear(void);
+	mfxStatus hibernate(hddlBitstreamBase & Bs);
+	bool wait_data(hddlBitstreamBase & Bs, int timeout_ms);
+
+	//called by decode thread between frames, blocks while paused
+	//return false if stop is requested
+	bool wait_resume(void);
 
 	std::thread *					m_pthread = NULL;
 	videoframe_allocator			m_mfxAllocator;
 	surface_pool                 	spDEC;
 	surface_pool                 	spVPP;
 	blocking_queue<Output> 			m_outputs;
+	std::mutex 						m_sub_mutex;
+	std::vector<std::shared_ptr<Subscription>> m_subscribers;
+	std::vector<std::shared_ptr<ClipSubscription>> m_clip_subscribers;
+	bool 							m_outputs_closed = false;	// close_outputs() has run (m_sub_mutex)
+
+	//Media SDK components, only accessed by decode thread
+	MFXVideoSession 				m_session;
+	std::unique_ptr<MFXVideoDECODE>	m_pmfxDEC;
+	std::unique_ptr<MFXVideoVPP>	m_pmfxVPP;
+	std::unique_ptr<MFXVideoENCODE>	m_pmfxENC;
+
+	//cached DecodeHeader/QueryIOSurf results, used to rebuild pipeline after hibernation
+	mfxVideoParam 					m_DECParams;
+	mfxVideoParam 					m_VPPParams;
+	mfxFrameAllocRequest 			m_DECRequest;
+	mfxFrameAllocRequest 			m_VPPRequest[2];	// [0] - in, [1] - out
+
+	//raw frame source of start_raw(), spDEC then holds VPP input surfaces
+	struct RawSource{
+		bool 			bEnabled = false;
+		std::string 	file;
+		std::string 	format;						// file layout, see start_raw()
+		mfxU32 			fourcc = MFX_FOURCC_NV12;	// VPP input
+		int 			width = 0;
+		int 			height = 0;
+		bool 			bLoop = false;
+		int 			preload = 0;
+	};
+	RawSource 						m_raw;
+
+	//encode stage, Task.syncp stays set while the packet is queued or held by consumer
+	bool 							m_encode;
+	EncodeParams 					m_enc;
+	mfxVideoParam 					m_ENCParams;
+	mfxFrameAllocRequest 			m_ENCRequest;
+	std::vector<Task> 				m_tasks;
+	std::vector<std::vector<mfxU8>> m_task_data;
+	std::deque<int> 				m_enc_inflight;	// submitted, not yet synced (decode thread only)
+	std::mutex 						m_task_mutex;
+	std::condition_variable 		m_cv_task;
+	std::unique_ptr<blocking_queue<Packet>> m_packets;
 
-	enum Debug{no=0, yes, dec, out, st};
+	int 							m_hibernate_ms;
+	bool 							m_shared_output;
+	OutputMode 						m_output_mode;
+	std::shared_ptr<mem_allocator_user>	m_user_buffers;
+	std::string 					m_name;
+
+	//low latency mode, arrivals are (bitstream TimeStamp, time) of recently fed chunks
+	bool 							m_low_latency;
+	std::deque<std::pair<mfxU64, std::chrono::steady_clock::time_point>> m_arrivals;
+	std::mutex 						m_stats_mutex;
+	LatencyStats 					m_latency;
+	SwitchStats 					m_switches;
+	RecoveryStats 					m_recovery_stats;
+	Recovery 						m_recovery;
+
+	//ROI of set_crop(), w == 0: whole frame
+	std::mutex 						m_crop_mutex;
+	Crop 							m_crop = {0, 0, 0, 0};
+
+	enum Debug{no=0, yes, dec, out, st, lat};
 	Debug							m_debug;
-	volatile bool 					m_stop;
+
+	std::atomic<bool> 				m_stop;
+	bool 							m_pause;
+	std::atomic<int> 				m_state;
+	std::mutex 						m_state_mutex;
+	std::condition_variable 		m_cv_state;
 
 	const char *                    m_tty_color;
 };
@@ -0,0 +1,203 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "raw_frame_loader.h"
+#include "color_convert.h"
+#include "frame_copy.h"
+#include "common_utils.h"
+
+raw_frame_loader::raw_frame_loader():
+	m_format(i420),
+	m_width(0),
+	m_height(0),
+	m_frame_bytes(0),
+	m_fd(-1),
+	m_bOwnFd(false),
+	m_map(NULL),
+	m_map_size(0),
+	m_frames(0),
+	m_next(0),
+	m_bLoop(false),
+	m_threads(1)
+{
+}
+
+raw_frame_loader::~raw_frame_loader()
+{
+	close();
+}
+
+bool raw_frame_loader::parse_format(const char * name, Format & fmt)
+{
+	if(strcmp(name, "i420") == 0) fmt = i420;
+	else if(strcmp(name, "yv12") == 0) fmt = yv12;
+	else if(strcmp(name, "nv12") == 0) fmt = nv12;
+	else if(strcmp(name, "rgb4") == 0) fmt = rgb4;
+	else return false;
+	return true;
+}
+
+mfxStatus raw_frame_loader::open(const char * path, Format fmt, int width, int height)
+{
+	if(m_fd >= 0) return MFX_ERR_UNDEFINED_BEHAVIOR;
+	if(!path || width <= 0 || height <= 0) return MFX_ERR_INVALID_VIDEO_PARAM;
+
+	m_format = fmt;
+	m_width = width;
+	m_height = height;
+	if(fmt == rgb4)
+		m_frame_bytes = (size_t)width * height * 4;
+	else
+		m_frame_bytes = (size_t)width * height + (size_t)((width + 1) / 2) * ((height + 1) / 2) * 2;
+
+	if(strcmp(path, "-") == 0){
+		m_fd = STDIN_FILENO;
+		m_bOwnFd = false;
+	}else{
+		m_fd = ::open(path, O_RDONLY | O_CLOEXEC);
+		m_bOwnFd = true;
+	}
+	if(m_fd < 0){
+		fprintf(stderr, ANSI_COLOR_RED "raw_frame_loader: can't open %s: %s\n" ANSI_COLOR_RESET, path, strerror(errno));
+		return MFX_ERR_NULL_PTR;
+	}
+
+	m_next = 0;
+	m_frames = -1;
+	struct stat st;
+	if(fstat(m_fd, &st) == 0 && S_ISREG(st.st_mode)){
+		m_frames = st.st_size / m_frame_bytes;
+		if(st.st_size % m_frame_bytes)
+			fprintf(stderr, ANSI_COLOR_YELLOW "raw_frame_loader: %s has %llu trailing bytes, not a %dx%d frame multiple\n" ANSI_COLOR_RESET,
+					path, (unsigned long long)(st.st_size % m_frame_bytes), width, height);
+		m_map_size = m_frames * m_frame_bytes;
+		if(m_map_size > 0){
+			void * p = mmap(NULL, m_map_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+			if(p != MAP_FAILED){
+				m_map = (uint8_t*)p;
+				madvise(m_map, m_map_size, MADV_SEQUENTIAL);
+			}else{
+				//fall back to read()
+				m_map_size = 0;
+			}
+		}
+	}
+	if(!m_map)
+		m_buf.resize(m_frame_bytes);
+
+	return MFX_ERR_NONE;
+}
+
+void raw_frame_loader::close(void)
+{
+	if(m_map)
+		munmap(m_map, m_map_size);
+	m_map = NULL;
+	m_map_size = 0;
+	if(m_fd >= 0 && m_bOwnFd)
+		::close(m_fd);
+	m_fd = -1;
+	std::vector<uint8_t>().swap(m_buf);
+}
+
+const uint8_t * raw_frame_loader::frame(int64_t i)
+{
+	if(!m_map || i < 0 || i >= m_frames) return NULL;
+	return m_map + (size_t)i * m_frame_bytes;
+}
+
+bool raw_frame_loader::seek(int64_t i)
+{
+	if(m_fd < 0 || i < 0 || (m_frames >= 0 && i > m_frames)) return false;
+	if(!m_map){
+		//regular file that could not be mapped, pipes can't seek
+		if(lseek(m_fd, (off_t)(i * m_frame_bytes), SEEK_SET) < 0)
+			return false;
+	}
+	m_next = i;
+	return true;
+}
+
+bool raw_frame_loader::read_frame(void)
+{
+	size_t got = 0;
+	while(got < m_frame_bytes){
+		ssize_t n = read(m_fd, m_buf.data() + got, m_frame_bytes - got);
+		if(n < 0){
+			if(errno == EINTR) continue;
+			fprintf(stderr, ANSI_COLOR_RED "raw_frame_loader: read failed: %s\n" ANSI_COLOR_RESET, strerror(errno));
+			return false;
+		}
+		if(n == 0) return false;
+		got += n;
+	}
+	return true;
+}
+
+mfxStatus raw_frame_loader::load(mfxFrameSurface1 * psurf)
+{
+	if(m_fd < 0) return MFX_ERR_NOT_INITIALIZED;
+	if(!psurf) return MFX_ERR_NULL_PTR;
+
+	const uint8_t * src = NULL;
+	if(m_map){
+		if(m_next >= m_frames){
+			if(!m_bLoop || m_frames == 0) return MFX_ERR_MORE_DATA;
+			m_next = 0;
+		}
+		src = frame(m_next);
+	}else{
+		if(!read_frame()){
+			if(!m_bLoop || m_frames < 0 || lseek(m_fd, 0, SEEK_SET) < 0 || !read_frame())
+				return MFX_ERR_MORE_DATA;
+			m_next = 0;
+		}
+		src = m_buf.data();
+	}
+	m_next ++;
+
+	return convert(src, psurf);
+}
+
+mfxStatus raw_frame_loader::convert(const uint8_t * src, mfxFrameSurface1 * psurf)
+{
+	const mfxFrameInfo & fi = psurf->Info;
+	const mfxFrameData & fd = psurf->Data;
+	int w = fi.CropW ? fi.CropW : fi.Width;
+	int h = fi.CropH ? fi.CropH : fi.Height;
+	if(w != m_width || h != m_height)
+		return MFX_ERR_INCOMPATIBLE_VIDEO_PARAM;
+
+	int pitch = ((int)fd.PitchHigh << 16) | fd.PitchLow;
+	int cw = (w + 1) / 2, ch = (h + 1) / 2;
+
+	if(m_format == rgb4){
+		if(fi.FourCC != MFX_FOURCC_RGB4 || !fd.B) return MFX_ERR_UNSUPPORTED;
+		copy_plane(src, w * 4, fd.B + (size_t)fi.CropY * pitch + fi.CropX * 4, pitch,
+				   w * 4, h, false, m_threads);
+		return MFX_ERR_NONE;
+	}
+
+	if(fi.FourCC != MFX_FOURCC_NV12 || !fd.Y || !fd.UV) return MFX_ERR_UNSUPPORTED;
+	uint8_t * dst_y = fd.Y + (size_t)fi.CropY * pitch + fi.CropX;
+	uint8_t * dst_uv = fd.UV + (size_t)(fi.CropY / 2) * pitch + (fi.CropX & ~1);
+	const uint8_t * c0 = src + (size_t)w * h;
+
+	if(m_format == nv12){
+		copy_plane(src, w, dst_y, pitch, w, h, false, m_threads);
+		copy_plane(c0, cw * 2, dst_uv, pitch, cw * 2, ch, false, m_threads);
+		return MFX_ERR_NONE;
+	}
+
+	const uint8_t * c1 = c0 + (size_t)cw * ch;
+	const uint8_t * u = (m_format == i420) ? c0 : c1;
+	const uint8_t * v = (m_format == i420) ? c1 : c0;
+	i420_to_nv12(src, w, u, v, cw, w, h, dst_y, pitch, dst_uv, pitch, m_threads);
+	return MFX_ERR_NONE;
+}
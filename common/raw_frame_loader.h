@@ -0,0 +1,68 @@
+#ifndef _RAW_FRAME_LOADER_H_
+#define _RAW_FRAME_LOADER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+#include "mfxvideo.h"
+
+// Raw video file -> NV12 / RGB4 surfaces (Linux only).
+//   regular files are mapped once and each frame is converted straight from the
+//   mapping, pipes (or "-" for stdin) are read a whole frame per read() loop.
+//   I420/YV12 chroma is interleaved with the SIMD row kernels, any frame width.
+class raw_frame_loader
+{
+public:
+	enum Format{
+		i420 = 0,	// Y, U, V planes			-> NV12 surface
+		yv12,		// Y, V, U planes			-> NV12 surface
+		nv12,		// Y, UV interleaved		-> NV12 surface
+		rgb4,		// B,G,R,A packed			-> RGB4 surface
+	};
+
+	raw_frame_loader();
+	~raw_frame_loader();
+
+	mfxStatus open(const char * path, Format fmt, int width, int height);
+	void close(void);
+
+	//restart from first frame at end of file instead of returning MFX_ERR_MORE_DATA
+	//(mapped files only)
+	void set_loop(bool bLoop){ m_bLoop = bLoop; }
+	//conversion threads, 0: all cores
+	void set_threads(int threads){ m_threads = threads; }
+
+	//next frame into crop rectangle of psurf (Data must be mapped),
+	//MFX_ERR_MORE_DATA at end of input
+	mfxStatus load(mfxFrameSurface1 * psurf);
+
+	//frame i of a mapped file, NULL if out of range or input is a pipe
+	const uint8_t * frame(int64_t i);
+	int64_t frames(void){ return m_frames; }		// -1 for pipes
+	bool seek(int64_t i);
+	size_t frame_bytes(void){ return m_frame_bytes; }
+
+	static bool parse_format(const char * name, Format & fmt);
+
+private:
+	bool read_frame(void);
+	mfxStatus convert(const uint8_t * src, mfxFrameSurface1 * psurf);
+
+	Format 					m_format;
+	int 					m_width;
+	int 					m_height;
+	size_t 					m_frame_bytes;
+	int 					m_fd;
+	bool 					m_bOwnFd;
+	uint8_t * 				m_map;
+	size_t 					m_map_size;
+	int64_t 				m_frames;
+	int64_t 				m_next;
+	bool 					m_bLoop;
+	int 					m_threads;
+	std::vector<uint8_t> 	m_buf;		// pipe input
+};
+
+#endif
@@ -0,0 +1,240 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <condition_variable>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+#include "simd_dispatch.h"
+
+static void cpuid(int leaf, int subleaf, unsigned int r[4])
+{
+#if defined(_MSC_VER)
+	__cpuidex((int*)r, leaf, subleaf);
+#else
+	__cpuid_count(leaf, subleaf, r[0], r[1], r[2], r[3]);
+#endif
+}
+
+static unsigned long long xgetbv0(void)
+{
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	unsigned int eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+simd_level simd_detect(void)
+{
+	static simd_level level = []{
+		unsigned int r[4];
+		simd_level l = SIMD_C;
+
+		cpuid(0, 0, r);
+		int max_leaf = r[0];
+
+		cpuid(1, 0, r);
+		bool sse41 = (r[2] >> 19) & 1;
+		bool osxsave = (r[2] >> 27) & 1;
+		bool avx = (r[2] >> 28) & 1;
+		if(!sse41) return l;
+		l = SIMD_SSE41;
+
+		//OS must save YMM (and ZMM/opmask) state on context switch
+		if(!osxsave || !avx || max_leaf < 7) return l;
+		unsigned long long xcr0 = xgetbv0();
+		if((xcr0 & 0x6) != 0x6) return l;
+
+		cpuid(7, 0, r);
+		bool avx2 = (r[1] >> 5) & 1;
+		bool avx512f = (r[1] >> 16) & 1;
+		bool avx512bw = (r[1] >> 30) & 1;
+		if(!avx2) return l;
+		l = SIMD_AVX2;
+
+		if(avx512f && avx512bw && (xcr0 & 0xE6) == 0xE6)
+			l = SIMD_AVX512;
+		return l;
+	}();
+	return level;
+}
+
+static std::atomic<int> g_forced(-1);
+
+simd_level simd_active(void)
+{
+	static simd_level env_level = []{
+		simd_level l = simd_detect();
+		const char * penv = getenv("MD_SIMD");
+		if(penv){
+			for(int i = 0; i < SIMD_LEVEL_CNT; i++)
+				if(strcmp(penv, simd_level_name((simd_level)i)) == 0 && i < l)
+					l = (simd_level)i;
+		}
+		return l;
+	}();
+
+	int forced = g_forced.load();
+	if(forced >= 0)
+		return (simd_level)std::min(forced, (int)simd_detect());
+	return env_level;
+}
+
+void simd_force(simd_level level)
+{
+	g_forced = level;
+}
+
+const char * simd_level_name(simd_level level)
+{
+	switch(level){
+	case SIMD_C: 		return "c";
+	case SIMD_SSE41: 	return "sse41";
+	case SIMD_AVX2: 	return "avx2";
+	case SIMD_AVX512: 	return "avx512";
+	default: 			return "unknown";
+	}
+}
+
+//===================================================================
+// fork-join worker pool: each job is cut into tiles, idle workers and the
+// submitting thread take tiles until none is left
+class row_pool
+{
+public:
+	struct job {
+		const std::function<void(int, int)> * fn;
+		int 				rows;
+		int 				tiles;
+		int 				max_workers;
+		std::atomic<int> 	next;
+		std::atomic<int> 	done;
+		int 				workers = 0;	// guarded by pool mutex
+	};
+
+	static row_pool & instance(void)
+	{
+		static row_pool pool;
+		return pool;
+	}
+
+	int threads(void){ return (int)m_workers.size() + 1; }
+
+	void run(job & j)
+	{
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			m_jobs.push_back(&j);
+			m_cv.notify_all();
+		}
+
+		work(j);
+
+		{
+			std::unique_lock<std::mutex> lk(m_mutex);
+			m_cv_done.wait(lk, [&j]{ return j.done.load() == j.tiles; });
+			//workers may still look at the job until it's removed
+			m_jobs.erase(std::find(m_jobs.begin(), m_jobs.end(), &j));
+			m_cv_done.wait(lk, [&j]{ return j.workers == 0; });
+		}
+	}
+
+private:
+	row_pool():m_stop(false)
+	{
+		int n = std::thread::hardware_concurrency();
+		for(int i = 1; i < n; i++)
+			m_workers.emplace_back(&row_pool::worker, this);
+	}
+	~row_pool()
+	{
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			m_stop = true;
+			m_cv.notify_all();
+		}
+		for(auto &t : m_workers)
+			t.join();
+	}
+
+	//take tiles of job j until all are taken
+	static void work(job & j)
+	{
+		for(;;){
+			int t = j.next.fetch_add(1);
+			if(t >= j.tiles) break;
+			int y0 = (int)((long long)j.rows * t / j.tiles);
+			int y1 = (int)((long long)j.rows * (t + 1) / j.tiles);
+			(*j.fn)(y0, y1);
+			j.done.fetch_add(1);
+		}
+	}
+
+	void worker(void)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+		for(;;){
+			job * pj = NULL;
+			m_cv.wait(lk, [this, &pj]{
+				for(auto j : m_jobs)
+					if(j->next.load() < j->tiles && j->workers < j->max_workers){ pj = j; return true; }
+				return m_stop;
+			});
+			if(pj == NULL) return;
+
+			pj->workers ++;
+			lk.unlock();
+			work(*pj);
+			lk.lock();
+			pj->workers --;
+			m_cv_done.notify_all();
+		}
+	}
+
+	std::vector<std::thread> 	m_workers;
+	std::deque<job*> 			m_jobs;
+	std::mutex 					m_mutex;
+	std::condition_variable 	m_cv;
+	std::condition_variable 	m_cv_done;
+	bool 						m_stop;
+};
+
+void parallel_rows(int rows, int min_rows, const std::function<void(int y0, int y1)> & fn, int max_threads)
+{
+	if(min_rows < 1) min_rows = 1;
+
+	row_pool & pool = row_pool::instance();
+	int threads = pool.threads();
+	if(max_threads > 0 && max_threads < threads)
+		threads = max_threads;
+
+	int tiles = std::min(threads, rows / min_rows);
+	if(tiles <= 1){
+		fn(0, rows);
+		return;
+	}
+
+	row_pool::job j;
+	j.fn = &fn;
+	j.rows = rows;
+	j.tiles = tiles;
+	j.max_workers = threads - 1;
+	j.next = 0;
+	j.done = 0;
+	pool.run(j);
+}
@@ -0,0 +1,31 @@
+#ifndef _SIMD_DISPATCH_H_
+#define _SIMD_DISPATCH_H_
+
+#include <functional>
+
+// Runtime CPU feature dispatch & row tiling shared by the CPU pixel kernels.
+
+enum simd_level {
+	SIMD_C = 0,
+	SIMD_SSE41,
+	SIMD_AVX2,
+	SIMD_AVX512,	// AVX-512 F + BW
+	SIMD_LEVEL_CNT
+};
+
+// best level supported by CPU & OS
+simd_level simd_detect(void);
+
+// level used by kernels: detected level, lowered by env MD_SIMD=c|sse41|avx2|avx512
+// or simd_force(); never higher than simd_detect()
+simd_level simd_active(void);
+void simd_force(simd_level level);
+
+const char * simd_level_name(simd_level level);
+
+// Split rows [0, rows) into tiles of at least min_rows and run fn(y0, y1) on them,
+// using up to max_threads threads (0: all cores) of a process-wide worker pool.
+// Caller's thread takes part, returns when all tiles are done.
+void parallel_rows(int rows, int min_rows, const std::function<void(int y0, int y1)> & fn, int max_threads = 0);
+
+#endif
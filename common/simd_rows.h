@@ -0,0 +1,87 @@
+#ifndef _SIMD_ROWS_H_
+#define _SIMD_ROWS_H_
+
+#include <stdint.h>
+
+#include "simd_dispatch.h"
+
+// Row kernels of the CPU pixel paths, one table per instruction set.
+// Each simd_rows_<level>.cpp is compiled with its own ISA flags and only
+// reached through simd_rows_get(), after runtime detection.
+
+// YUV->RGB in 16 bit fixed point (all kernels are bit exact to the C version):
+//   inputs are centered & shifted left by 7, multiplied by Q13 coefficients with
+//   rounding high multiply ((a*b + 2^14) >> 15), giving Q5 results which are
+//   summed and rounded back to 8 bit: (x + 16) >> 5
+struct cc_coeffs
+{
+	int16_t 	y_offset;	// 0 (full range) or 16 (limited range)
+	int16_t 	y_scale;	// Q13
+	int16_t 	rv;			// R = Y + rv*V
+	int16_t 	gu;			// G = Y - gu*U - gv*V
+	int16_t 	gv;
+	int16_t 	bu;			// B = Y + bu*U
+};
+
+enum cc_layout
+{
+	CC_LAYOUT_PACKED3 = 0,	// c0 c1 c2
+	CC_LAYOUT_PACKED4,		// c0 c1 c2 255
+	CC_LAYOUT_PLANAR,		// dst[0]: c0, dst[1]: c1, dst[2]: c2
+};
+
+struct simd_row_kernels
+{
+	// one NV12 row to RGB, (c0,c1,c2) is (R,G,B) or (B,G,R) if bgr
+	void (*nv12_to_rgb)(const uint8_t * y, const uint8_t * uv, uint8_t * const dst[3], int width,
+						const cc_coeffs * c, cc_layout layout, bool bgr);
+
+	// drop 4th byte of each pixel (e.g. Media SDK RGB4, which is B,G,R,A in memory, to BGR24)
+	void (*bgra_to_bgr)(const uint8_t * src, uint8_t * dst, int width);
+
+	// copy bytes reading src with streaming loads (MOVNTDQA) through a small cached
+	// bounce buffer: fast on uncached/write-combined (USWC) mappings of video memory,
+	// where plain loads are serialized. the C version is memcpy
+	void (*stream_copy)(const uint8_t * src, uint8_t * dst, int bytes);
+
+	// NV12 chroma row -> I420 U & V rows, pairs UV samples
+	void (*uv_deinterleave)(const uint8_t * uv, uint8_t * u, uint8_t * v, int pairs);
+
+	// I420 U & V rows -> NV12 chroma row
+	void (*uv_interleave)(const uint8_t * u, const uint8_t * v, uint8_t * uv, int pairs);
+
+	// bilinear resize & normalization of one row: output x blends source pixels idx[x] and
+	// idx[x]+1 (Q8 weight wt[x] on the second) of rows s0 & s1 (Q8 weight fy on s1).
+	// a pixel is step bytes, output channel c (< nch) is its byte off[c]:
+	//   dst[c][x] = Q16 sum * alpha[c] + beta[c]
+	// SIMD versions load 4 bytes per tap, with step 1 rows must be readable 2 bytes past the last tap
+	void (*resize_row)(const uint8_t * s0, const uint8_t * s1, int step, const int * off, int nch,
+					   const int * idx, const int * wt, int fy, const float * alpha, const float * beta,
+					   float * const dst[3], int width);
+
+	// dst[x] = src[x] * inv_scale + zero, rounded to nearest even & saturated to int8
+	void (*quantize_i8)(const float * src, int8_t * dst, int n, float inv_scale, float zero);
+};
+
+// bytes of the on-stack bounce buffer of stream_copy, fits L1 with room to spare
+#define STREAM_COPY_BOUNCE 	4096
+
+const simd_row_kernels * simd_rows_get(simd_level level);
+
+// C versions over pixels [x0, width), used by SIMD kernels for row tails
+void nv12_to_rgb_row_c(const uint8_t * y, const uint8_t * uv, uint8_t * const dst[3], int x0, int width,
+					   const cc_coeffs * c, cc_layout layout, bool bgr);
+void bgra_to_bgr_row_c(const uint8_t * src, uint8_t * dst, int x0, int width);
+void uv_deinterleave_row_c(const uint8_t * uv, uint8_t * u, uint8_t * v, int x0, int pairs);
+void uv_interleave_row_c(const uint8_t * u, const uint8_t * v, uint8_t * uv, int x0, int pairs);
+void resize_row_c(const uint8_t * s0, const uint8_t * s1, int step, const int * off, int nch,
+				  const int * idx, const int * wt, int fy, const float * alpha, const float * beta,
+				  float * const dst[3], int x0, int width);
+void quantize_i8_row_c(const float * src, int8_t * dst, int x0, int n, float inv_scale, float zero);
+
+extern const simd_row_kernels simd_rows_c;
+extern const simd_row_kernels simd_rows_sse41;
+extern const simd_row_kernels simd_rows_avx2;
+extern const simd_row_kernels simd_rows_avx512;
+
+#endif
@@ -0,0 +1,298 @@
+
+// compiled with AVX2 enabled (-mavx2), only called after runtime detection
+#include <string.h>
+#include <immintrin.h>
+
+#include <algorithm>
+
+#include "simd_rows.h"
+
+struct cc_consts_avx2
+{
+	__m256i y_offset, y_scale, rv, gu, gv, bu, c128, round;
+
+	cc_consts_avx2(const cc_coeffs * c)
+	{
+		y_offset = _mm256_set1_epi16(c->y_offset);
+		y_scale = _mm256_set1_epi16(c->y_scale);
+		rv = _mm256_set1_epi16(c->rv);
+		gu = _mm256_set1_epi16(c->gu);
+		gv = _mm256_set1_epi16(c->gv);
+		bu = _mm256_set1_epi16(c->bu);
+		c128 = _mm256_set1_epi16(128);
+		round = _mm256_set1_epi16(16);
+	}
+};
+
+static inline __m256i q5_to_u16(__m256i v, const cc_consts_avx2 & k)
+{
+	return _mm256_srai_epi16(_mm256_add_epi16(v, k.round), 5);
+}
+
+// 32 pixels of Y & 16 UV pairs -> R,G,B bytes in pixel order
+//   unpack/pack work inside 128-bit lanes: unpacklo of Y gives pixels 0-7|16-23,
+//   unpacklo of chroma gives the chroma of the same pixels, and packus restores
+//   pixel order, so no cross-lane permute is needed
+static inline void yuv32_to_rgb(__m256i y8, __m256i uv8, const cc_consts_avx2 & k, __m256i & R, __m256i & G, __m256i & B)
+{
+	const __m256i zero = _mm256_setzero_si256();
+
+	__m256i u = _mm256_and_si256(uv8, _mm256_set1_epi16(0xFF));
+	__m256i v = _mm256_srli_epi16(uv8, 8);
+	u = _mm256_slli_epi16(_mm256_sub_epi16(u, k.c128), 7);
+	v = _mm256_slli_epi16(_mm256_sub_epi16(v, k.c128), 7);
+
+	__m256i rV = _mm256_mulhrs_epi16(v, k.rv);
+	__m256i gUV = _mm256_add_epi16(_mm256_mulhrs_epi16(u, k.gu), _mm256_mulhrs_epi16(v, k.gv));
+	__m256i bU = _mm256_mulhrs_epi16(u, k.bu);
+
+	__m256i ylo = _mm256_unpacklo_epi8(y8, zero);
+	__m256i yhi = _mm256_unpackhi_epi8(y8, zero);
+	ylo = _mm256_mulhrs_epi16(_mm256_slli_epi16(_mm256_sub_epi16(ylo, k.y_offset), 7), k.y_scale);
+	yhi = _mm256_mulhrs_epi16(_mm256_slli_epi16(_mm256_sub_epi16(yhi, k.y_offset), 7), k.y_scale);
+
+	__m256i r0 = _mm256_add_epi16(ylo, _mm256_unpacklo_epi16(rV, rV));
+	__m256i r1 = _mm256_add_epi16(yhi, _mm256_unpackhi_epi16(rV, rV));
+	__m256i g0 = _mm256_sub_epi16(ylo, _mm256_unpacklo_epi16(gUV, gUV));
+	__m256i g1 = _mm256_sub_epi16(yhi, _mm256_unpackhi_epi16(gUV, gUV));
+	__m256i b0 = _mm256_add_epi16(ylo, _mm256_unpacklo_epi16(bU, bU));
+	__m256i b1 = _mm256_add_epi16(yhi, _mm256_unpackhi_epi16(bU, bU));
+
+	R = _mm256_packus_epi16(q5_to_u16(r0, k), q5_to_u16(r1, k));
+	G = _mm256_packus_epi16(q5_to_u16(g0, k), q5_to_u16(g1, k));
+	B = _mm256_packus_epi16(q5_to_u16(b0, k), q5_to_u16(b1, k));
+}
+
+// 32 pixels of 4 bytes given lane-interleaved: a = px 0-3|16-19, b = 4-7|20-23,
+// c = 8-11|24-27, d = 12-15|28-31 -> 96 bytes
+static inline void store_packed3(uint8_t * dst, __m256i a, __m256i b, __m256i c, __m256i d)
+{
+	const __m256i m = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+									   0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	a = _mm256_shuffle_epi8(a, m);
+	b = _mm256_shuffle_epi8(b, m);
+	c = _mm256_shuffle_epi8(c, m);
+	d = _mm256_shuffle_epi8(d, m);
+	//lane 0 of o0,o1,o2 holds bytes of px 0-15, lane 1 of px 16-31
+	__m256i o0 = _mm256_or_si256(a, _mm256_slli_si256(b, 12));
+	__m256i o1 = _mm256_or_si256(_mm256_srli_si256(b, 4), _mm256_slli_si256(c, 8));
+	__m256i o2 = _mm256_or_si256(_mm256_srli_si256(c, 8), _mm256_slli_si256(d, 4));
+	_mm256_storeu_si256((__m256i*)(dst + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+	_mm256_storeu_si256((__m256i*)(dst + 32), _mm256_permute2x128_si256(o2, o0, 0x30));
+	_mm256_storeu_si256((__m256i*)(dst + 64), _mm256_permute2x128_si256(o1, o2, 0x31));
+}
+
+static void nv12_to_rgb_avx2(const uint8_t * y, const uint8_t * uv, uint8_t * const dst[3], int width,
+							 const cc_coeffs * c, cc_layout layout, bool bgr)
+{
+	const cc_consts_avx2 k(c);
+	const __m256i alpha = _mm256_set1_epi8(-1);
+	int x = 0;
+
+	for(; x + 32 <= width; x += 32){
+		__m256i R, G, B;
+		yuv32_to_rgb(_mm256_loadu_si256((const __m256i*)(y + x)), _mm256_loadu_si256((const __m256i*)(uv + x)), k, R, G, B);
+
+		__m256i c0 = bgr ? B : R;
+		__m256i c2 = bgr ? R : B;
+
+		if(layout == CC_LAYOUT_PLANAR){
+			_mm256_storeu_si256((__m256i*)(dst[0] + x), c0);
+			_mm256_storeu_si256((__m256i*)(dst[1] + x), G);
+			_mm256_storeu_si256((__m256i*)(dst[2] + x), c2);
+			continue;
+		}
+
+		__m256i c01lo = _mm256_unpacklo_epi8(c0, G);
+		__m256i c01hi = _mm256_unpackhi_epi8(c0, G);
+		__m256i c2alo = _mm256_unpacklo_epi8(c2, alpha);
+		__m256i c2ahi = _mm256_unpackhi_epi8(c2, alpha);
+		__m256i pa = _mm256_unpacklo_epi16(c01lo, c2alo);	// px 0-3|16-19
+		__m256i pb = _mm256_unpackhi_epi16(c01lo, c2alo);	// px 4-7|20-23
+		__m256i pc = _mm256_unpacklo_epi16(c01hi, c2ahi);	// px 8-11|24-27
+		__m256i pd = _mm256_unpackhi_epi16(c01hi, c2ahi);	// px 12-15|28-31
+
+		if(layout == CC_LAYOUT_PACKED4){
+			uint8_t * d = dst[0] + x*4;
+			_mm256_storeu_si256((__m256i*)(d + 0), _mm256_permute2x128_si256(pa, pb, 0x20));
+			_mm256_storeu_si256((__m256i*)(d + 32), _mm256_permute2x128_si256(pc, pd, 0x20));
+			_mm256_storeu_si256((__m256i*)(d + 64), _mm256_permute2x128_si256(pa, pb, 0x31));
+			_mm256_storeu_si256((__m256i*)(d + 96), _mm256_permute2x128_si256(pc, pd, 0x31));
+		}else{
+			store_packed3(dst[0] + x*3, pa, pb, pc, pd);
+		}
+	}
+
+	nv12_to_rgb_row_c(y, uv, dst, x, width, c, layout, bgr);
+}
+
+static void bgra_to_bgr_avx2(const uint8_t * src, uint8_t * dst, int width)
+{
+	int x = 0;
+	for(; x + 32 <= width; x += 32){
+		const __m256i * s = (const __m256i*)(src + x*4);
+		__m256i v0 = _mm256_loadu_si256(s);		// px 0-7
+		__m256i v1 = _mm256_loadu_si256(s + 1);	// px 8-15
+		__m256i v2 = _mm256_loadu_si256(s + 2);	// px 16-23
+		__m256i v3 = _mm256_loadu_si256(s + 3);	// px 24-31
+		store_packed3(dst + x*3,
+					  _mm256_permute2x128_si256(v0, v2, 0x20),
+					  _mm256_permute2x128_si256(v0, v2, 0x31),
+					  _mm256_permute2x128_si256(v1, v3, 0x20),
+					  _mm256_permute2x128_si256(v1, v3, 0x31));
+	}
+	bgra_to_bgr_row_c(src, dst, x, width);
+}
+
+static void stream_copy_avx2(const uint8_t * src, uint8_t * dst, int bytes)
+{
+	__m256i b[STREAM_COPY_BOUNCE / 32];
+
+	//streaming loads need a 32-byte aligned source, the head is read with plain loads
+	int head = (int)((32 - ((uintptr_t)src & 31)) & 31);
+	if(head > bytes) head = bytes;
+	memcpy(dst, src, head);
+	src += head;
+	dst += head;
+	bytes -= head;
+
+	while(bytes >= 128){
+		int n = std::min(bytes & ~127, STREAM_COPY_BOUNCE);
+		for(int i = 0; i < n; i += 128){
+			__m256i v0 = _mm256_stream_load_si256((const __m256i*)(src + i + 0));
+			__m256i v1 = _mm256_stream_load_si256((const __m256i*)(src + i + 32));
+			__m256i v2 = _mm256_stream_load_si256((const __m256i*)(src + i + 64));
+			__m256i v3 = _mm256_stream_load_si256((const __m256i*)(src + i + 96));
+			_mm256_store_si256(b + i/32 + 0, v0);
+			_mm256_store_si256(b + i/32 + 1, v1);
+			_mm256_store_si256(b + i/32 + 2, v2);
+			_mm256_store_si256(b + i/32 + 3, v3);
+		}
+		memcpy(dst, b, n);
+		src += n;
+		dst += n;
+		bytes -= n;
+	}
+	memcpy(dst, src, bytes);
+}
+
+static void uv_deinterleave_avx2(const uint8_t * uv, uint8_t * u, uint8_t * v, int pairs)
+{
+	const __m256i lo = _mm256_set1_epi16(0xFF);
+	int x = 0;
+	for(; x + 32 <= pairs; x += 32){
+		__m256i a = _mm256_loadu_si256((const __m256i*)(uv + x*2));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(uv + x*2 + 32));
+		//packus works per lane: 64-bit groups come out as a0 b0 a1 b1
+		__m256i pu = _mm256_packus_epi16(_mm256_and_si256(a, lo), _mm256_and_si256(b, lo));
+		__m256i pv = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+		_mm256_storeu_si256((__m256i*)(u + x), _mm256_permute4x64_epi64(pu, 0xD8));
+		_mm256_storeu_si256((__m256i*)(v + x), _mm256_permute4x64_epi64(pv, 0xD8));
+	}
+	uv_deinterleave_row_c(uv, u, v, x, pairs);
+}
+
+static void uv_interleave_avx2(const uint8_t * u, const uint8_t * v, uint8_t * uv, int pairs)
+{
+	int x = 0;
+	for(; x + 32 <= pairs; x += 32){
+		__m256i a = _mm256_loadu_si256((const __m256i*)(u + x));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(v + x));
+		__m256i lo = _mm256_unpacklo_epi8(a, b);	// pairs 0-7 | 16-23
+		__m256i hi = _mm256_unpackhi_epi8(a, b);	// pairs 8-15 | 24-31
+		_mm256_storeu_si256((__m256i*)(uv + x*2), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i*)(uv + x*2 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	uv_interleave_row_c(u, v, uv, x, pairs);
+}
+
+// 8 outputs of one channel from the 32-bit loads at both taps of rows a & b:
+// bytes of the channel paired as 16-bit (left, right) so madd applies (256-fx, fx)
+static inline __m256 resize8(__m256i a, __m256i b, __m256i w, __m256i fy, __m256 alpha, __m256 beta)
+{
+	__m256i t = _mm256_madd_epi16(a, w);
+	__m256i u = _mm256_madd_epi16(b, w);
+	//t*(256-fy) + u*fy
+	__m256i v = _mm256_add_epi32(_mm256_slli_epi32(t, 8), _mm256_mullo_epi32(_mm256_sub_epi32(u, t), fy));
+	return _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(v), alpha), beta);
+}
+
+static void resize_avx2(const uint8_t * s0, const uint8_t * s1, int step, const int * off, int nch,
+						const int * idx, const int * wt, int fy, const float * alpha, const float * beta,
+						float * const dst[3], int width)
+{
+	if(step != 1 && step != 4){
+		resize_row_c(s0, s1, step, off, nch, idx, wt, fy, alpha, beta, dst, 0, width);
+		return;
+	}
+
+	const __m256i c256 = _mm256_set1_epi32(256);
+	const __m256i lo8 = _mm256_set1_epi32(0xFF);
+	//step 1: bytes 0 & 1 of the load are both taps
+	const __m256i pair = _mm256_setr_epi8(0, -1, 1, -1, 4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1,
+										  0, -1, 1, -1, 4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1);
+	const __m256i vfy = _mm256_set1_epi32(fy);
+	int x = 0;
+
+	for(; x + 8 <= width; x += 8){
+		__m256i ix = _mm256_loadu_si256((const __m256i*)(idx + x));
+		__m256i fx = _mm256_loadu_si256((const __m256i*)(wt + x));
+		__m256i w = _mm256_or_si256(_mm256_sub_epi32(c256, fx), _mm256_slli_epi32(fx, 16));
+
+		if(step == 1){
+			__m256i a = _mm256_i32gather_epi32((const int*)(s0 + off[0]), ix, 1);
+			__m256i b = _mm256_i32gather_epi32((const int*)(s1 + off[0]), ix, 1);
+			_mm256_storeu_ps(dst[0] + x, resize8(_mm256_shuffle_epi8(a, pair), _mm256_shuffle_epi8(b, pair), w, vfy,
+												 _mm256_set1_ps(alpha[0]), _mm256_set1_ps(beta[0])));
+			continue;
+		}
+
+		//whole pixels at both taps, each channel is shifted out of them
+		__m256i a0 = _mm256_i32gather_epi32((const int*)s0, ix, 4);
+		__m256i a1 = _mm256_i32gather_epi32((const int*)(s0 + 4), ix, 4);
+		__m256i b0 = _mm256_i32gather_epi32((const int*)s1, ix, 4);
+		__m256i b1 = _mm256_i32gather_epi32((const int*)(s1 + 4), ix, 4);
+		for(int c = 0; c < nch; c++){
+			__m128i sh = _mm_cvtsi32_si128(off[c] * 8);
+			__m256i a = _mm256_or_si256(_mm256_and_si256(_mm256_srl_epi32(a0, sh), lo8),
+										_mm256_slli_epi32(_mm256_and_si256(_mm256_srl_epi32(a1, sh), lo8), 16));
+			__m256i b = _mm256_or_si256(_mm256_and_si256(_mm256_srl_epi32(b0, sh), lo8),
+										_mm256_slli_epi32(_mm256_and_si256(_mm256_srl_epi32(b1, sh), lo8), 16));
+			_mm256_storeu_ps(dst[c] + x, resize8(a, b, w, vfy, _mm256_set1_ps(alpha[c]), _mm256_set1_ps(beta[c])));
+		}
+	}
+	resize_row_c(s0, s1, step, off, nch, idx, wt, fy, alpha, beta, dst, x, width);
+}
+
+static void quantize_i8_avx2(const float * src, int8_t * dst, int n, float inv_scale, float zero)
+{
+	const __m256 s = _mm256_set1_ps(inv_scale);
+	const __m256 z = _mm256_set1_ps(zero);
+	//saturate before conversion, so out of int32 range values clamp like the C version
+	const __m256 lo = _mm256_set1_ps(-128.0f);
+	const __m256 hi = _mm256_set1_ps(127.0f);
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	int x = 0;
+
+	for(; x + 32 <= n; x += 32){
+		__m256i q[4];
+		for(int i = 0; i < 4; i++){
+			__m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(src + x + i*8), s), z);
+			q[i] = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(v, lo), hi));
+		}
+		//packs work per lane: dwords come out as q0 q1 q2 q3 of lane 0, then of lane 1
+		__m256i p = _mm256_packs_epi16(_mm256_packs_epi32(q[0], q[1]), _mm256_packs_epi32(q[2], q[3]));
+		_mm256_storeu_si256((__m256i*)(dst + x), _mm256_permutevar8x32_epi32(p, order));
+	}
+	quantize_i8_row_c(src, dst, x, n, inv_scale, zero);
+}
+
+const simd_row_kernels simd_rows_avx2 = {
+	nv12_to_rgb_avx2,
+	bgra_to_bgr_avx2,
+	stream_copy_avx2,
+	uv_deinterleave_avx2,
+	uv_interleave_avx2,
+	resize_avx2,
+	quantize_i8_avx2,
+};
@@ -0,0 +1,310 @@
+
+// compiled with AVX-512 F/BW enabled (-mavx512f -mavx512bw), only called after runtime detection
+#include <string.h>
+#include <immintrin.h>
+
+#include <algorithm>
+
+#include "simd_rows.h"
+
+struct cc_consts_avx512
+{
+	__m512i y_offset, y_scale, rv, gu, gv, bu, c128, round;
+
+	cc_consts_avx512(const cc_coeffs * c)
+	{
+		y_offset = _mm512_set1_epi16(c->y_offset);
+		y_scale = _mm512_set1_epi16(c->y_scale);
+		rv = _mm512_set1_epi16(c->rv);
+		gu = _mm512_set1_epi16(c->gu);
+		gv = _mm512_set1_epi16(c->gv);
+		bu = _mm512_set1_epi16(c->bu);
+		c128 = _mm512_set1_epi16(128);
+		round = _mm512_set1_epi16(16);
+	}
+};
+
+static inline __m512i q5_to_u16(__m512i v, const cc_consts_avx512 & k)
+{
+	return _mm512_srai_epi16(_mm512_add_epi16(v, k.round), 5);
+}
+
+// 64 pixels of Y & 32 UV pairs -> R,G,B bytes in pixel order
+// (in-lane unpack/pack as in the AVX2 version, 4 lanes instead of 2)
+static inline void yuv64_to_rgb(__m512i y8, __m512i uv8, const cc_consts_avx512 & k, __m512i & R, __m512i & G, __m512i & B)
+{
+	const __m512i zero = _mm512_setzero_si512();
+
+	__m512i u = _mm512_and_si512(uv8, _mm512_set1_epi16(0xFF));
+	__m512i v = _mm512_srli_epi16(uv8, 8);
+	u = _mm512_slli_epi16(_mm512_sub_epi16(u, k.c128), 7);
+	v = _mm512_slli_epi16(_mm512_sub_epi16(v, k.c128), 7);
+
+	__m512i rV = _mm512_mulhrs_epi16(v, k.rv);
+	__m512i gUV = _mm512_add_epi16(_mm512_mulhrs_epi16(u, k.gu), _mm512_mulhrs_epi16(v, k.gv));
+	__m512i bU = _mm512_mulhrs_epi16(u, k.bu);
+
+	__m512i ylo = _mm512_unpacklo_epi8(y8, zero);
+	__m512i yhi = _mm512_unpackhi_epi8(y8, zero);
+	ylo = _mm512_mulhrs_epi16(_mm512_slli_epi16(_mm512_sub_epi16(ylo, k.y_offset), 7), k.y_scale);
+	yhi = _mm512_mulhrs_epi16(_mm512_slli_epi16(_mm512_sub_epi16(yhi, k.y_offset), 7), k.y_scale);
+
+	__m512i r0 = _mm512_add_epi16(ylo, _mm512_unpacklo_epi16(rV, rV));
+	__m512i r1 = _mm512_add_epi16(yhi, _mm512_unpackhi_epi16(rV, rV));
+	__m512i g0 = _mm512_sub_epi16(ylo, _mm512_unpacklo_epi16(gUV, gUV));
+	__m512i g1 = _mm512_sub_epi16(yhi, _mm512_unpackhi_epi16(gUV, gUV));
+	__m512i b0 = _mm512_add_epi16(ylo, _mm512_unpacklo_epi16(bU, bU));
+	__m512i b1 = _mm512_add_epi16(yhi, _mm512_unpackhi_epi16(bU, bU));
+
+	R = _mm512_packus_epi16(q5_to_u16(r0, k), q5_to_u16(r1, k));
+	G = _mm512_packus_epi16(q5_to_u16(g0, k), q5_to_u16(g1, k));
+	B = _mm512_packus_epi16(q5_to_u16(b0, k), q5_to_u16(b1, k));
+}
+
+// 4x4 transpose of 128-bit lanes: (a,b,c,d) lane k <-> vector k lane (a,b,c,d)
+static inline void transpose_lanes(__m512i & a, __m512i & b, __m512i & c, __m512i & d)
+{
+	__m512i t0 = _mm512_shuffle_i64x2(a, b, 0x44);
+	__m512i t1 = _mm512_shuffle_i64x2(c, d, 0x44);
+	__m512i t2 = _mm512_shuffle_i64x2(a, b, 0xEE);
+	__m512i t3 = _mm512_shuffle_i64x2(c, d, 0xEE);
+	a = _mm512_shuffle_i64x2(t0, t1, 0x88);
+	b = _mm512_shuffle_i64x2(t0, t1, 0xDD);
+	c = _mm512_shuffle_i64x2(t2, t3, 0x88);
+	d = _mm512_shuffle_i64x2(t2, t3, 0xDD);
+}
+
+// 64 pixels of 4 bytes given lane-interleaved: lane k of a,b,c,d holds
+// px 16k+0..3, 16k+4..7, 16k+8..11, 16k+12..15 -> 192 bytes
+static inline void store_packed3(uint8_t * dst, __m512i a, __m512i b, __m512i c, __m512i d)
+{
+	const __m512i m = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+	a = _mm512_shuffle_epi8(a, m);
+	b = _mm512_shuffle_epi8(b, m);
+	c = _mm512_shuffle_epi8(c, m);
+	d = _mm512_shuffle_epi8(d, m);
+	//lane k of o0,o1,o2 is the 48 bytes of px 16k..16k+15
+	__m512i o0 = _mm512_or_si512(a, _mm512_bslli_epi128(b, 12));
+	__m512i o1 = _mm512_or_si512(_mm512_bsrli_epi128(b, 4), _mm512_bslli_epi128(c, 8));
+	__m512i o2 = _mm512_or_si512(_mm512_bsrli_epi128(c, 8), _mm512_bslli_epi128(d, 4));
+
+	//(o0,o1,o2,x) lane k -> 64 contiguous bytes at 48k, written as 48
+	__m512i x = _mm512_setzero_si512();
+	transpose_lanes(o0, o1, o2, x);
+	_mm512_mask_storeu_epi64(dst + 0, 0x3F, o0);
+	_mm512_mask_storeu_epi64(dst + 48, 0x3F, o1);
+	_mm512_mask_storeu_epi64(dst + 96, 0x3F, o2);
+	_mm512_mask_storeu_epi64(dst + 144, 0x3F, x);
+}
+
+static void nv12_to_rgb_avx512(const uint8_t * y, const uint8_t * uv, uint8_t * const dst[3], int width,
+							   const cc_coeffs * c, cc_layout layout, bool bgr)
+{
+	const cc_consts_avx512 k(c);
+	const __m512i alpha = _mm512_set1_epi8(-1);
+	int x = 0;
+
+	for(; x + 64 <= width; x += 64){
+		__m512i R, G, B;
+		yuv64_to_rgb(_mm512_loadu_si512(y + x), _mm512_loadu_si512(uv + x), k, R, G, B);
+
+		__m512i c0 = bgr ? B : R;
+		__m512i c2 = bgr ? R : B;
+
+		if(layout == CC_LAYOUT_PLANAR){
+			_mm512_storeu_si512(dst[0] + x, c0);
+			_mm512_storeu_si512(dst[1] + x, G);
+			_mm512_storeu_si512(dst[2] + x, c2);
+			continue;
+		}
+
+		__m512i c01lo = _mm512_unpacklo_epi8(c0, G);
+		__m512i c01hi = _mm512_unpackhi_epi8(c0, G);
+		__m512i c2alo = _mm512_unpacklo_epi8(c2, alpha);
+		__m512i c2ahi = _mm512_unpackhi_epi8(c2, alpha);
+		__m512i pa = _mm512_unpacklo_epi16(c01lo, c2alo);
+		__m512i pb = _mm512_unpackhi_epi16(c01lo, c2alo);
+		__m512i pc = _mm512_unpacklo_epi16(c01hi, c2ahi);
+		__m512i pd = _mm512_unpackhi_epi16(c01hi, c2ahi);
+
+		if(layout == CC_LAYOUT_PACKED4){
+			uint8_t * d = dst[0] + x*4;
+			transpose_lanes(pa, pb, pc, pd);
+			_mm512_storeu_si512(d + 0, pa);
+			_mm512_storeu_si512(d + 64, pb);
+			_mm512_storeu_si512(d + 128, pc);
+			_mm512_storeu_si512(d + 192, pd);
+		}else{
+			store_packed3(dst[0] + x*3, pa, pb, pc, pd);
+		}
+	}
+
+	nv12_to_rgb_row_c(y, uv, dst, x, width, c, layout, bgr);
+}
+
+static void bgra_to_bgr_avx512(const uint8_t * src, uint8_t * dst, int width)
+{
+	int x = 0;
+	for(; x + 64 <= width; x += 64){
+		const uint8_t * s = src + x*4;
+		__m512i v0 = _mm512_loadu_si512(s);
+		__m512i v1 = _mm512_loadu_si512(s + 64);
+		__m512i v2 = _mm512_loadu_si512(s + 128);
+		__m512i v3 = _mm512_loadu_si512(s + 192);
+		transpose_lanes(v0, v1, v2, v3);
+		store_packed3(dst + x*3, v0, v1, v2, v3);
+	}
+	bgra_to_bgr_row_c(src, dst, x, width);
+}
+
+static void stream_copy_avx512(const uint8_t * src, uint8_t * dst, int bytes)
+{
+	__m512i b[STREAM_COPY_BOUNCE / 64];
+
+	//streaming loads need a 64-byte aligned source, the head is read with plain loads
+	int head = (int)((64 - ((uintptr_t)src & 63)) & 63);
+	if(head > bytes) head = bytes;
+	memcpy(dst, src, head);
+	src += head;
+	dst += head;
+	bytes -= head;
+
+	while(bytes >= 256){
+		int n = std::min(bytes & ~255, STREAM_COPY_BOUNCE);
+		for(int i = 0; i < n; i += 256){
+			__m512i v0 = _mm512_stream_load_si512((void*)(src + i + 0));
+			__m512i v1 = _mm512_stream_load_si512((void*)(src + i + 64));
+			__m512i v2 = _mm512_stream_load_si512((void*)(src + i + 128));
+			__m512i v3 = _mm512_stream_load_si512((void*)(src + i + 192));
+			_mm512_store_si512(b + i/64 + 0, v0);
+			_mm512_store_si512(b + i/64 + 1, v1);
+			_mm512_store_si512(b + i/64 + 2, v2);
+			_mm512_store_si512(b + i/64 + 3, v3);
+		}
+		memcpy(dst, b, n);
+		src += n;
+		dst += n;
+		bytes -= n;
+	}
+	memcpy(dst, src, bytes);
+}
+
+static void uv_deinterleave_avx512(const uint8_t * uv, uint8_t * u, uint8_t * v, int pairs)
+{
+	const __m512i lo = _mm512_set1_epi16(0xFF);
+	const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+	int x = 0;
+	for(; x + 64 <= pairs; x += 64){
+		__m512i a = _mm512_loadu_si512(uv + x*2);
+		__m512i b = _mm512_loadu_si512(uv + x*2 + 64);
+		__m512i pu = _mm512_packus_epi16(_mm512_and_si512(a, lo), _mm512_and_si512(b, lo));
+		__m512i pv = _mm512_packus_epi16(_mm512_srli_epi16(a, 8), _mm512_srli_epi16(b, 8));
+		_mm512_storeu_si512(u + x, _mm512_permutexvar_epi64(order, pu));
+		_mm512_storeu_si512(v + x, _mm512_permutexvar_epi64(order, pv));
+	}
+	uv_deinterleave_row_c(uv, u, v, x, pairs);
+}
+
+static void uv_interleave_avx512(const uint8_t * u, const uint8_t * v, uint8_t * uv, int pairs)
+{
+	//lane k of lo holds pairs 16k..16k+7, of hi pairs 16k+8..16k+15
+	const __m512i first = _mm512_setr_epi64(0, 1, 8, 9, 2, 3, 10, 11);
+	const __m512i second = _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15);
+	int x = 0;
+	for(; x + 64 <= pairs; x += 64){
+		__m512i a = _mm512_loadu_si512(u + x);
+		__m512i b = _mm512_loadu_si512(v + x);
+		__m512i lo = _mm512_unpacklo_epi8(a, b);
+		__m512i hi = _mm512_unpackhi_epi8(a, b);
+		_mm512_storeu_si512(uv + x*2, _mm512_permutex2var_epi64(lo, first, hi));
+		_mm512_storeu_si512(uv + x*2 + 64, _mm512_permutex2var_epi64(lo, second, hi));
+	}
+	uv_interleave_row_c(u, v, uv, x, pairs);
+}
+
+// mul & add with explicit rounding, -mavx512f allows FMA contraction which rounds once
+// and would not be bit exact to the C version
+static inline __m512 mul_add(__m512 v, __m512 m, __m512 a)
+{
+	return _mm512_maskz_add_round_ps(0xFFFF, _mm512_maskz_mul_round_ps(0xFFFF, v, m, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC),
+									 a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+
+// 16 outputs of one channel, see resize8() of the AVX2 version
+static inline __m512 resize16(__m512i a, __m512i b, __m512i w, __m512i fy, __m512 alpha, __m512 beta)
+{
+	__m512i t = _mm512_madd_epi16(a, w);
+	__m512i u = _mm512_madd_epi16(b, w);
+	__m512i v = _mm512_add_epi32(_mm512_slli_epi32(t, 8), _mm512_mullo_epi32(_mm512_sub_epi32(u, t), fy));
+	return mul_add(_mm512_cvtepi32_ps(v), alpha, beta);
+}
+
+static void resize_avx512(const uint8_t * s0, const uint8_t * s1, int step, const int * off, int nch,
+						  const int * idx, const int * wt, int fy, const float * alpha, const float * beta,
+						  float * const dst[3], int width)
+{
+	if(step != 1 && step != 4){
+		resize_row_c(s0, s1, step, off, nch, idx, wt, fy, alpha, beta, dst, 0, width);
+		return;
+	}
+
+	const __m512i c256 = _mm512_set1_epi32(256);
+	const __m512i lo8 = _mm512_set1_epi32(0xFF);
+	const __m512i pair = _mm512_broadcast_i32x4(_mm_setr_epi8(0, -1, 1, -1, 4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1));
+	const __m512i vfy = _mm512_set1_epi32(fy);
+	int x = 0;
+
+	for(; x + 16 <= width; x += 16){
+		__m512i ix = _mm512_loadu_si512(idx + x);
+		__m512i fx = _mm512_loadu_si512(wt + x);
+		__m512i w = _mm512_or_si512(_mm512_sub_epi32(c256, fx), _mm512_slli_epi32(fx, 16));
+
+		if(step == 1){
+			__m512i a = _mm512_i32gather_epi32(ix, s0 + off[0], 1);
+			__m512i b = _mm512_i32gather_epi32(ix, s1 + off[0], 1);
+			_mm512_storeu_ps(dst[0] + x, resize16(_mm512_shuffle_epi8(a, pair), _mm512_shuffle_epi8(b, pair), w, vfy,
+												  _mm512_set1_ps(alpha[0]), _mm512_set1_ps(beta[0])));
+			continue;
+		}
+
+		__m512i a0 = _mm512_i32gather_epi32(ix, s0, 4);
+		__m512i a1 = _mm512_i32gather_epi32(ix, s0 + 4, 4);
+		__m512i b0 = _mm512_i32gather_epi32(ix, s1, 4);
+		__m512i b1 = _mm512_i32gather_epi32(ix, s1 + 4, 4);
+		for(int c = 0; c < nch; c++){
+			__m128i sh = _mm_cvtsi32_si128(off[c] * 8);
+			__m512i a = _mm512_or_si512(_mm512_and_si512(_mm512_srl_epi32(a0, sh), lo8),
+										_mm512_slli_epi32(_mm512_and_si512(_mm512_srl_epi32(a1, sh), lo8), 16));
+			__m512i b = _mm512_or_si512(_mm512_and_si512(_mm512_srl_epi32(b0, sh), lo8),
+										_mm512_slli_epi32(_mm512_and_si512(_mm512_srl_epi32(b1, sh), lo8), 16));
+			_mm512_storeu_ps(dst[c] + x, resize16(a, b, w, vfy, _mm512_set1_ps(alpha[c]), _mm512_set1_ps(beta[c])));
+		}
+	}
+	resize_row_c(s0, s1, step, off, nch, idx, wt, fy, alpha, beta, dst, x, width);
+}
+
+static void quantize_i8_avx512(const float * src, int8_t * dst, int n, float inv_scale, float zero)
+{
+	const __m512 s = _mm512_set1_ps(inv_scale);
+	const __m512 z = _mm512_set1_ps(zero);
+	const __m512 lo = _mm512_set1_ps(-128.0f);
+	const __m512 hi = _mm512_set1_ps(127.0f);
+	int x = 0;
+
+	for(; x + 16 <= n; x += 16){
+		__m512 v = mul_add(_mm512_loadu_ps(src + x), s, z);
+		__m512i q = _mm512_cvtps_epi32(_mm512_min_ps(_mm512_max_ps(v, lo), hi));
+		_mm_storeu_si128((__m128i*)(dst + x), _mm512_cvtsepi32_epi8(q));
+	}
+	quantize_i8_row_c(src, dst, x, n, inv_scale, zero);
+}
+
+const simd_row_kernels simd_rows_avx512 = {
+	nv12_to_rgb_avx512,
+	bgra_to_bgr_avx512,
+	stream_copy_avx512,
+	uv_deinterleave_avx512,
+	uv_interleave_avx512,
+	resize_avx512,
+	quantize_i8_avx512,
+};
@@ -0,0 +1,162 @@
+
+#include <math.h>
+#include <string.h>
+
+#include "simd_rows.h"
+
+// same arithmetic as _mm_mulhrs_epi16
+static inline int mulhrs(int a, int b)
+{
+	return (a * b + 0x4000) >> 15;
+}
+
+static inline uint8_t round_q5(int v)
+{
+	v = (v + 16) >> 5;
+	return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+void nv12_to_rgb_row_c(const uint8_t * y, const uint8_t * uv, uint8_t * const dst[3], int x0, int width,
+					   const cc_coeffs * c, cc_layout layout, bool bgr)
+{
+	for(int x = x0; x < width; x++){
+		int Y = mulhrs((y[x] - c->y_offset) << 7, c->y_scale);
+		int U = (uv[x & ~1] - 128) << 7;
+		int V = (uv[x | 1] - 128) << 7;
+
+		uint8_t R = round_q5(Y + mulhrs(V, c->rv));
+		uint8_t G = round_q5(Y - (mulhrs(U, c->gu) + mulhrs(V, c->gv)));
+		uint8_t B = round_q5(Y + mulhrs(U, c->bu));
+
+		uint8_t c0 = bgr ? B : R;
+		uint8_t c2 = bgr ? R : B;
+
+		switch(layout){
+		case CC_LAYOUT_PACKED3:
+			dst[0][x*3 + 0] = c0;
+			dst[0][x*3 + 1] = G;
+			dst[0][x*3 + 2] = c2;
+			break;
+		case CC_LAYOUT_PACKED4:
+			dst[0][x*4 + 0] = c0;
+			dst[0][x*4 + 1] = G;
+			dst[0][x*4 + 2] = c2;
+			dst[0][x*4 + 3] = 255;
+			break;
+		case CC_LAYOUT_PLANAR:
+			dst[0][x] = c0;
+			dst[1][x] = G;
+			dst[2][x] = c2;
+			break;
+		}
+	}
+}
+
+void bgra_to_bgr_row_c(const uint8_t * src, uint8_t * dst, int x0, int width)
+{
+	for(int x = x0; x < width; x++){
+		dst[x*3 + 0] = src[x*4 + 0];
+		dst[x*3 + 1] = src[x*4 + 1];
+		dst[x*3 + 2] = src[x*4 + 2];
+	}
+}
+
+void uv_deinterleave_row_c(const uint8_t * uv, uint8_t * u, uint8_t * v, int x0, int pairs)
+{
+	for(int x = x0; x < pairs; x++){
+		u[x] = uv[x*2];
+		v[x] = uv[x*2 + 1];
+	}
+}
+
+void uv_interleave_row_c(const uint8_t * u, const uint8_t * v, uint8_t * uv, int x0, int pairs)
+{
+	for(int x = x0; x < pairs; x++){
+		uv[x*2] = u[x];
+		uv[x*2 + 1] = v[x];
+	}
+}
+
+void resize_row_c(const uint8_t * s0, const uint8_t * s1, int step, const int * off, int nch,
+				  const int * idx, const int * wt, int fy, const float * alpha, const float * beta,
+				  float * const dst[3], int x0, int width)
+{
+	for(int c = 0; c < nch; c++){
+		const uint8_t * a = s0 + off[c];
+		const uint8_t * b = s1 + off[c];
+		float * d = dst[c];
+		for(int x = x0; x < width; x++){
+			int i = idx[x] * step;
+			int fx = wt[x];
+			int t = a[i] * (256 - fx) + a[i + step] * fx;
+			int u = b[i] * (256 - fx) + b[i + step] * fx;
+			d[x] = (t * (256 - fy) + u * fy) * alpha[c] + beta[c];
+		}
+	}
+}
+
+void quantize_i8_row_c(const float * src, int8_t * dst, int x0, int n, float inv_scale, float zero)
+{
+	for(int x = x0; x < n; x++){
+		long i = lrintf(src[x] * inv_scale + zero);
+		dst[x] = (int8_t)(i < -128 ? -128 : (i > 127 ? 127 : i));
+	}
+}
+
+static void nv12_to_rgb_c(const uint8_t * y, const uint8_t * uv, uint8_t * const dst[3], int width,
+						  const cc_coeffs * c, cc_layout layout, bool bgr)
+{
+	nv12_to_rgb_row_c(y, uv, dst, 0, width, c, layout, bgr);
+}
+
+static void bgra_to_bgr_c(const uint8_t * src, uint8_t * dst, int width)
+{
+	bgra_to_bgr_row_c(src, dst, 0, width);
+}
+
+static void resize_c(const uint8_t * s0, const uint8_t * s1, int step, const int * off, int nch,
+					 const int * idx, const int * wt, int fy, const float * alpha, const float * beta,
+					 float * const dst[3], int width)
+{
+	resize_row_c(s0, s1, step, off, nch, idx, wt, fy, alpha, beta, dst, 0, width);
+}
+
+static void quantize_i8_c(const float * src, int8_t * dst, int n, float inv_scale, float zero)
+{
+	quantize_i8_row_c(src, dst, 0, n, inv_scale, zero);
+}
+
+static void stream_copy_c(const uint8_t * src, uint8_t * dst, int bytes)
+{
+	memcpy(dst, src, bytes);
+}
+
+static void uv_deinterleave_c(const uint8_t * uv, uint8_t * u, uint8_t * v, int pairs)
+{
+	uv_deinterleave_row_c(uv, u, v, 0, pairs);
+}
+
+static void uv_interleave_c(const uint8_t * u, const uint8_t * v, uint8_t * uv, int pairs)
+{
+	uv_interleave_row_c(u, v, uv, 0, pairs);
+}
+
+const simd_row_kernels simd_rows_c = {
+	nv12_to_rgb_c,
+	bgra_to_bgr_c,
+	stream_copy_c,
+	uv_deinterleave_c,
+	uv_interleave_c,
+	resize_c,
+	quantize_i8_c,
+};
+
+const simd_row_kernels * simd_rows_get(simd_level level)
+{
+	switch(level){
+	case SIMD_AVX512: 	return &simd_rows_avx512;
+	case SIMD_AVX2: 	return &simd_rows_avx2;
+	case SIMD_SSE41: 	return &simd_rows_sse41;
+	default: 			return &simd_rows_c;
+	}
+}
@@ -0,0 +1,281 @@
+
+// compiled with SSE4.1 enabled (-msse4.1), only called after runtime detection
+#include <string.h>
+#include <smmintrin.h>
+
+#include <algorithm>
+
+#include "simd_rows.h"
+
+struct cc_consts_sse41
+{
+	__m128i y_offset, y_scale, rv, gu, gv, bu, c128, round;
+
+	cc_consts_sse41(const cc_coeffs * c)
+	{
+		y_offset = _mm_set1_epi16(c->y_offset);
+		y_scale = _mm_set1_epi16(c->y_scale);
+		rv = _mm_set1_epi16(c->rv);
+		gu = _mm_set1_epi16(c->gu);
+		gv = _mm_set1_epi16(c->gv);
+		bu = _mm_set1_epi16(c->bu);
+		c128 = _mm_set1_epi16(128);
+		round = _mm_set1_epi16(16);
+	}
+};
+
+// 8 pixels: Q5 luma + duplicated chroma terms -> 16 bit results
+static inline __m128i q5_to_u16(__m128i v, const cc_consts_sse41 & k)
+{
+	return _mm_srai_epi16(_mm_add_epi16(v, k.round), 5);
+}
+
+// 16 pixels of Y & 8 UV pairs -> R,G,B bytes in pixel order
+static inline void yuv16_to_rgb(__m128i y8, __m128i uv8, const cc_consts_sse41 & k, __m128i & R, __m128i & G, __m128i & B)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	__m128i u = _mm_and_si128(uv8, _mm_set1_epi16(0xFF));
+	__m128i v = _mm_srli_epi16(uv8, 8);
+	u = _mm_slli_epi16(_mm_sub_epi16(u, k.c128), 7);
+	v = _mm_slli_epi16(_mm_sub_epi16(v, k.c128), 7);
+
+	__m128i rV = _mm_mulhrs_epi16(v, k.rv);
+	__m128i gUV = _mm_add_epi16(_mm_mulhrs_epi16(u, k.gu), _mm_mulhrs_epi16(v, k.gv));
+	__m128i bU = _mm_mulhrs_epi16(u, k.bu);
+
+	__m128i ylo = _mm_unpacklo_epi8(y8, zero);
+	__m128i yhi = _mm_unpackhi_epi8(y8, zero);
+	ylo = _mm_mulhrs_epi16(_mm_slli_epi16(_mm_sub_epi16(ylo, k.y_offset), 7), k.y_scale);
+	yhi = _mm_mulhrs_epi16(_mm_slli_epi16(_mm_sub_epi16(yhi, k.y_offset), 7), k.y_scale);
+
+	//each chroma sample covers 2 pixels
+	__m128i r0 = _mm_add_epi16(ylo, _mm_unpacklo_epi16(rV, rV));
+	__m128i r1 = _mm_add_epi16(yhi, _mm_unpackhi_epi16(rV, rV));
+	__m128i g0 = _mm_sub_epi16(ylo, _mm_unpacklo_epi16(gUV, gUV));
+	__m128i g1 = _mm_sub_epi16(yhi, _mm_unpackhi_epi16(gUV, gUV));
+	__m128i b0 = _mm_add_epi16(ylo, _mm_unpacklo_epi16(bU, bU));
+	__m128i b1 = _mm_add_epi16(yhi, _mm_unpackhi_epi16(bU, bU));
+
+	R = _mm_packus_epi16(q5_to_u16(r0, k), q5_to_u16(r1, k));
+	G = _mm_packus_epi16(q5_to_u16(g0, k), q5_to_u16(g1, k));
+	B = _mm_packus_epi16(q5_to_u16(b0, k), q5_to_u16(b1, k));
+}
+
+// 16 pixels given as four 4-pixel groups of 4 bytes -> 48 bytes
+static inline void store_packed3(uint8_t * dst, __m128i p0, __m128i p1, __m128i p2, __m128i p3)
+{
+	//4 pixels of 4 bytes each -> 12 bytes (last 4 bytes zero)
+	const __m128i m = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	p0 = _mm_shuffle_epi8(p0, m);
+	p1 = _mm_shuffle_epi8(p1, m);
+	p2 = _mm_shuffle_epi8(p2, m);
+	p3 = _mm_shuffle_epi8(p3, m);
+	_mm_storeu_si128((__m128i*)(dst + 0), _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+	_mm_storeu_si128((__m128i*)(dst + 16), _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+	_mm_storeu_si128((__m128i*)(dst + 32), _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+}
+
+static void nv12_to_rgb_sse41(const uint8_t * y, const uint8_t * uv, uint8_t * const dst[3], int width,
+							  const cc_coeffs * c, cc_layout layout, bool bgr)
+{
+	const cc_consts_sse41 k(c);
+	const __m128i alpha = _mm_set1_epi8(-1);
+	int x = 0;
+
+	for(; x + 16 <= width; x += 16){
+		__m128i R, G, B;
+		yuv16_to_rgb(_mm_loadu_si128((const __m128i*)(y + x)), _mm_loadu_si128((const __m128i*)(uv + x)), k, R, G, B);
+
+		__m128i c0 = bgr ? B : R;
+		__m128i c2 = bgr ? R : B;
+
+		if(layout == CC_LAYOUT_PLANAR){
+			_mm_storeu_si128((__m128i*)(dst[0] + x), c0);
+			_mm_storeu_si128((__m128i*)(dst[1] + x), G);
+			_mm_storeu_si128((__m128i*)(dst[2] + x), c2);
+			continue;
+		}
+
+		__m128i c01lo = _mm_unpacklo_epi8(c0, G);
+		__m128i c01hi = _mm_unpackhi_epi8(c0, G);
+		__m128i c2alo = _mm_unpacklo_epi8(c2, alpha);
+		__m128i c2ahi = _mm_unpackhi_epi8(c2, alpha);
+		__m128i p0 = _mm_unpacklo_epi16(c01lo, c2alo);
+		__m128i p1 = _mm_unpackhi_epi16(c01lo, c2alo);
+		__m128i p2 = _mm_unpacklo_epi16(c01hi, c2ahi);
+		__m128i p3 = _mm_unpackhi_epi16(c01hi, c2ahi);
+
+		if(layout == CC_LAYOUT_PACKED4){
+			uint8_t * d = dst[0] + x*4;
+			_mm_storeu_si128((__m128i*)(d + 0), p0);
+			_mm_storeu_si128((__m128i*)(d + 16), p1);
+			_mm_storeu_si128((__m128i*)(d + 32), p2);
+			_mm_storeu_si128((__m128i*)(d + 48), p3);
+		}else{
+			store_packed3(dst[0] + x*3, p0, p1, p2, p3);
+		}
+	}
+
+	nv12_to_rgb_row_c(y, uv, dst, x, width, c, layout, bgr);
+}
+
+static void bgra_to_bgr_sse41(const uint8_t * src, uint8_t * dst, int width)
+{
+	int x = 0;
+	for(; x + 16 <= width; x += 16){
+		const __m128i * s = (const __m128i*)(src + x*4);
+		store_packed3(dst + x*3, _mm_loadu_si128(s), _mm_loadu_si128(s + 1),
+					  _mm_loadu_si128(s + 2), _mm_loadu_si128(s + 3));
+	}
+	bgra_to_bgr_row_c(src, dst, x, width);
+}
+
+static void stream_copy_sse41(const uint8_t * src, uint8_t * dst, int bytes)
+{
+	__m128i b[STREAM_COPY_BOUNCE / 16];
+
+	//streaming loads need a 16-byte aligned source, the head is read with plain loads
+	int head = (int)((16 - ((uintptr_t)src & 15)) & 15);
+	if(head > bytes) head = bytes;
+	memcpy(dst, src, head);
+	src += head;
+	dst += head;
+	bytes -= head;
+
+	while(bytes >= 64){
+		int n = std::min(bytes & ~63, STREAM_COPY_BOUNCE);
+		for(int i = 0; i < n; i += 64){
+			__m128i v0 = _mm_stream_load_si128((__m128i*)(src + i + 0));
+			__m128i v1 = _mm_stream_load_si128((__m128i*)(src + i + 16));
+			__m128i v2 = _mm_stream_load_si128((__m128i*)(src + i + 32));
+			__m128i v3 = _mm_stream_load_si128((__m128i*)(src + i + 48));
+			_mm_store_si128(b + i/16 + 0, v0);
+			_mm_store_si128(b + i/16 + 1, v1);
+			_mm_store_si128(b + i/16 + 2, v2);
+			_mm_store_si128(b + i/16 + 3, v3);
+		}
+		memcpy(dst, b, n);
+		src += n;
+		dst += n;
+		bytes -= n;
+	}
+	memcpy(dst, src, bytes);
+}
+
+static void uv_deinterleave_sse41(const uint8_t * uv, uint8_t * u, uint8_t * v, int pairs)
+{
+	const __m128i lo = _mm_set1_epi16(0xFF);
+	int x = 0;
+	for(; x + 16 <= pairs; x += 16){
+		__m128i a = _mm_loadu_si128((const __m128i*)(uv + x*2));
+		__m128i b = _mm_loadu_si128((const __m128i*)(uv + x*2 + 16));
+		_mm_storeu_si128((__m128i*)(u + x), _mm_packus_epi16(_mm_and_si128(a, lo), _mm_and_si128(b, lo)));
+		_mm_storeu_si128((__m128i*)(v + x), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+	}
+	uv_deinterleave_row_c(uv, u, v, x, pairs);
+}
+
+static void uv_interleave_sse41(const uint8_t * u, const uint8_t * v, uint8_t * uv, int pairs)
+{
+	int x = 0;
+	for(; x + 16 <= pairs; x += 16){
+		__m128i a = _mm_loadu_si128((const __m128i*)(u + x));
+		__m128i b = _mm_loadu_si128((const __m128i*)(v + x));
+		_mm_storeu_si128((__m128i*)(uv + x*2), _mm_unpacklo_epi8(a, b));
+		_mm_storeu_si128((__m128i*)(uv + x*2 + 16), _mm_unpackhi_epi8(a, b));
+	}
+	uv_interleave_row_c(u, v, uv, x, pairs);
+}
+
+// no gather before AVX2: 4 unaligned 32-bit loads at base + i[k]
+static inline __m128i load4x32(const uint8_t * base, const int * i, int scale)
+{
+	int32_t v[4];
+	for(int k = 0; k < 4; k++)
+		memcpy(&v[k], base + (size_t)i[k] * scale, 4);
+	return _mm_loadu_si128((const __m128i*)v);
+}
+
+// 4 outputs of one channel, see resize8() of the AVX2 version
+static inline __m128 resize4(__m128i a, __m128i b, __m128i w, __m128i fy, __m128 alpha, __m128 beta)
+{
+	__m128i t = _mm_madd_epi16(a, w);
+	__m128i u = _mm_madd_epi16(b, w);
+	__m128i v = _mm_add_epi32(_mm_slli_epi32(t, 8), _mm_mullo_epi32(_mm_sub_epi32(u, t), fy));
+	return _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(v), alpha), beta);
+}
+
+static void resize_sse41(const uint8_t * s0, const uint8_t * s1, int step, const int * off, int nch,
+						 const int * idx, const int * wt, int fy, const float * alpha, const float * beta,
+						 float * const dst[3], int width)
+{
+	if(step != 1 && step != 4){
+		resize_row_c(s0, s1, step, off, nch, idx, wt, fy, alpha, beta, dst, 0, width);
+		return;
+	}
+
+	const __m128i c256 = _mm_set1_epi32(256);
+	const __m128i lo8 = _mm_set1_epi32(0xFF);
+	const __m128i pair = _mm_setr_epi8(0, -1, 1, -1, 4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1);
+	const __m128i vfy = _mm_set1_epi32(fy);
+	int x = 0;
+
+	for(; x + 4 <= width; x += 4){
+		__m128i fx = _mm_loadu_si128((const __m128i*)(wt + x));
+		__m128i w = _mm_or_si128(_mm_sub_epi32(c256, fx), _mm_slli_epi32(fx, 16));
+
+		if(step == 1){
+			__m128i a = load4x32(s0 + off[0], idx + x, 1);
+			__m128i b = load4x32(s1 + off[0], idx + x, 1);
+			_mm_storeu_ps(dst[0] + x, resize4(_mm_shuffle_epi8(a, pair), _mm_shuffle_epi8(b, pair), w, vfy,
+											  _mm_set1_ps(alpha[0]), _mm_set1_ps(beta[0])));
+			continue;
+		}
+
+		__m128i a0 = load4x32(s0, idx + x, 4);
+		__m128i a1 = load4x32(s0 + 4, idx + x, 4);
+		__m128i b0 = load4x32(s1, idx + x, 4);
+		__m128i b1 = load4x32(s1 + 4, idx + x, 4);
+		for(int c = 0; c < nch; c++){
+			__m128i sh = _mm_cvtsi32_si128(off[c] * 8);
+			__m128i a = _mm_or_si128(_mm_and_si128(_mm_srl_epi32(a0, sh), lo8),
+									 _mm_slli_epi32(_mm_and_si128(_mm_srl_epi32(a1, sh), lo8), 16));
+			__m128i b = _mm_or_si128(_mm_and_si128(_mm_srl_epi32(b0, sh), lo8),
+									 _mm_slli_epi32(_mm_and_si128(_mm_srl_epi32(b1, sh), lo8), 16));
+			_mm_storeu_ps(dst[c] + x, resize4(a, b, w, vfy, _mm_set1_ps(alpha[c]), _mm_set1_ps(beta[c])));
+		}
+	}
+	resize_row_c(s0, s1, step, off, nch, idx, wt, fy, alpha, beta, dst, x, width);
+}
+
+static void quantize_i8_sse41(const float * src, int8_t * dst, int n, float inv_scale, float zero)
+{
+	const __m128 s = _mm_set1_ps(inv_scale);
+	const __m128 z = _mm_set1_ps(zero);
+	//saturate before conversion, so out of int32 range values clamp like the C version
+	const __m128 lo = _mm_set1_ps(-128.0f);
+	const __m128 hi = _mm_set1_ps(127.0f);
+	int x = 0;
+
+	for(; x + 16 <= n; x += 16){
+		__m128i q[4];
+		for(int i = 0; i < 4; i++){
+			__m128 v = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src + x + i*4), s), z);
+			q[i] = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(v, lo), hi));
+		}
+		__m128i p = _mm_packs_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3]));
+		_mm_storeu_si128((__m128i*)(dst + x), p);
+	}
+	quantize_i8_row_c(src, dst, x, n, inv_scale, zero);
+}
+
+const simd_row_kernels simd_rows_sse41 = {
+	nv12_to_rgb_sse41,
+	bgra_to_bgr_sse41,
+	stream_copy_sse41,
+	uv_deinterleave_sse41,
+	uv_interleave_sse41,
+	resize_sse41,
+	quantize_i8_sse41,
+};
@@ -13,9 +13,11 @@
 
 
 surface_pool::surface_pool(const mfxFrameAllocator & mfxAllocator):
-		m_mfxAllocator(mfxAllocator)
+		m_mfxAllocator(mfxAllocator),
+		m_bAborted(false)
 {
 	memset(&m_mfxResponse, 0, sizeof(m_mfxResponse));
+	memset(&m_Info, 0, sizeof(m_Info));
 	_clear();
 }
 
@@ -23,37 +25,92 @@ surface_pool::~surface_pool()
 {
 	std::lock_guard<std::mutex> guard(m_SurfaceQMutex);
 	_clear();
+	for(auto &r : m_Retired){
+		r.surfaces.clear();
+		m_mfxAllocator.Free(m_mfxAllocator.pthis, &r.response);
+	}
+	m_Retired.clear();
 }
 
-mfxStatus surface_pool::realloc(mfxFrameAllocRequest Request, int cntReserved)
+mfxStatus surface_pool::realloc(mfxFrameAllocRequest Request, int cntReserved, int cntReservedMin)
 {
 	std::lock_guard<std::mutex> guard(m_SurfaceQMutex);
 
 	mfxFrameAllocResponse mfxResponse;
+	mfxFrameAllocRequest  Request0 = Request;
+	const int cntReservedWanted = cntReserved;
+	mfxStatus sts;
+
+	if(cntReservedMin < 0 || cntReservedMin > cntReserved)
+		cntReservedMin = cntReserved;
 
-	Request.NumFrameMin += cntReserved;
-	Request.NumFrameSuggested += cntReserved;
+	for(;;){
+		Request = Request0;
+		Request.NumFrameMin += cntReserved;
+		Request.NumFrameSuggested += cntReserved;
 
-	mfxStatus sts = m_mfxAllocator.Alloc(m_mfxAllocator.pthis, &Request, &mfxResponse);
+		sts = m_mfxAllocator.Alloc(m_mfxAllocator.pthis, &Request, &mfxResponse);
+		if(MFX_ERR_MEMORY_ALLOC != sts || cntReserved <= cntReservedMin)
+			break;
+
+		//shrink reserve count instead of failing
+		cntReserved--;
+	}
 	if(MFX_ERR_NONE != sts) return sts;
 
+	if(cntReserved < cntReservedWanted)
+		printf(ANSI_COLOR_YELLOW "surface_pool: reserved count shrinks from %d to %d\n" ANSI_COLOR_RESET, cntReservedWanted, cntReserved);
+
 	//clear old pool only when new allocation success
-	_clear();
+	_retire();
 
 	//replace configuration data
 	m_ReservedMaxCnt = cntReserved;
 	m_mfxResponse = mfxResponse;
+	m_Info = Request.Info;
 
 	// Allocate surface headers (mfxFrameSurface1) for decoder
 	for (int i = 0; i < m_mfxResponse.NumFrameActual; i++) {
 		surface1 s(m_mfxAllocator, &(Request.Info), i);
 		s.Data.MemId = m_mfxResponse.mids[i];
+		//lets consumers pick the right way to read a locked surface (e.g. copy_out)
+		s.Data.MemType = Request.Type;
 		m_SurfaceAll.push_back(s);
 	}
 
 	return MFX_ERR_NONE;
 }
 
+bool surface_pool::fits(const mfxFrameAllocRequest & Request, int cntReserved)
+{
+	std::lock_guard<std::mutex> guard(m_SurfaceQMutex);
+	if(m_SurfaceAll.empty())
+		return false;
+	return m_Info.FourCC == Request.Info.FourCC &&
+		   m_Info.Width >= Request.Info.Width && m_Info.Height >= Request.Info.Height &&
+		   (int)m_SurfaceAll.size() >= Request.NumFrameSuggested + cntReserved;
+}
+
+bool surface_pool::release(void)
+{
+	std::unique_lock<std::mutex> guard(m_SurfaceQMutex);
+
+	m_cvReserve.wait(guard, [this]() {return _idle() || m_bAborted; });
+	if (!_idle())
+		return false;
+
+	_clear();
+	return true;
+}
+
+bool surface_pool::wait_idle(int timeout_ms)
+{
+	std::unique_lock<std::mutex> guard(m_SurfaceQMutex);
+
+	m_cvReserve.wait_for(guard, std::chrono::milliseconds(timeout_ms), [this]() {return _idle() || m_bAborted; });
+	return _idle();
+}
+
 // Get free raw frame surface
 surface1 * surface_pool::getfree(void)
 {
@@ -104,8 +161,15 @@ bool surface_pool::reserve(surface1 * psurf, bool drop_on_overflow)
 
 	std::unique_lock<std::mutex> guard(m_SurfaceQMutex);
 	
+	if (m_bAborted)
+		return false;
+
 	if (!drop_on_overflow) {
-		m_cvReserve.wait(guard, [this]() {return m_ReservedCnt < m_ReservedMaxCnt; });
+		m_cvReserve.wait(guard, [this]() {return m_ReservedCnt < m_ReservedMaxCnt || m_bAborted; });
+		if (m_bAborted) {
+			PDEBUG("  reserve() cancelled by abort() \n");
+			return false;
+		}
 		psurf->reserve(true);
 		m_ReservedCnt++;
 		return true;
@@ -120,13 +184,37 @@ bool surface_pool::reserve(surface1 * psurf, bool drop_on_overflow)
 	return false;
 }
 
+static bool owns(std::vector<surface1> & surfaces, surface1 * psurf)
+{
+	int i = psurf->index();
+	return i >= 0 && i < (int)surfaces.size() && psurf == &surfaces[i];
+}
+
 bool surface_pool::unreserve(surface1 * psurf)
 {
+	std::lock_guard<std::mutex> guard(m_SurfaceQMutex);
+
+	//surface of a retired allocation: last one returned frees it
+	if (!owns(m_SurfaceAll, psurf)) {
+		for (auto it = m_Retired.begin(); it != m_Retired.end(); ++it) {
+			if (!owns(it->surfaces, psurf))
+				continue;
+			if (psurf->is_reserved()) {
+				psurf->reserve(false);
+				if (--it->reserved == 0) {
+					it->surfaces.clear();
+					m_mfxAllocator.Free(m_mfxAllocator.pthis, &it->response);
+					m_Retired.erase(it);
+				}
+				m_cvReserve.notify_all();
+			}
+			return true;
+		}
 #if CONSISTENCY_CHECK 
-	assert(find(psurf) != NULL || (printf("%s:%d invalid input parameter\n", __FILE__, __LINE__), 0));
+		assert((printf("%s:%d invalid input parameter\n", __FILE__, __LINE__), 0));
 #endif
-
-	std::lock_guard<std::mutex> guard(m_SurfaceQMutex);
+		return false;
+	}
 	
 	if (psurf->is_reserved()) {
 		psurf->reserve(false);
@@ -136,6 +224,19 @@ bool surface_pool::unreserve(surface1 * psurf)
 	return true;
 }
 
+bool surface_pool::is_full(void)
+{
+	std::lock_guard<std::mutex> guard(m_SurfaceQMutex);
+	return m_ReservedCnt >= m_ReservedMaxCnt;
+}
+
+void surface_pool::abort(bool bAbort)
+{
+	std::lock_guard<std::mutex> guard(m_SurfaceQMutex);
+	m_bAborted = bAbort;
+	m_cvReserve.notify_all();
+}
+
 //
 void surface_pool::debug(void)
 {
@@ -169,6 +270,24 @@ void surface_pool::debug(void)
 }
 
 
+//current allocation makes way for a new one: freed now if no surface is reserved,
+//otherwise kept with its reserved surfaces until they are all unreserved
+void surface_pool::_retire()
+{
+	if(m_ReservedCnt == 0){
+		_clear();
+		return;
+	}
+	Retired r;
+	r.response = m_mfxResponse;
+	r.surfaces.swap(m_SurfaceAll);
+	r.reserved = m_ReservedCnt;
+	m_Retired.push_back(std::move(r));
+
+	m_ReservedCnt = 0;
+	memset(&m_mfxResponse, 0, sizeof(m_mfxResponse));
+}
+
 void surface_pool::_clear()
 {
 	m_ReservedCnt = 0;
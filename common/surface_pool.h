@@ -2,6 +2,7 @@
 #define _SURFACE_POOL_H_
 
 #include <vector>
+#include <list>
 #include <algorithm>
 #include <atomic>
 #include <cassert>
@@ -13,6 +14,8 @@
 
 #include <string.h>
 
+#include <chrono>
+
 #include "mfxvideo.h"
 
 class surface_pool;
@@ -41,6 +44,9 @@ public:
 		m_bReserved.store(rhs.m_bReserved.load());
 		m_bLockedByAllocator = rhs.m_bLockedByAllocator;
 		m_FrameNumber = rhs.m_FrameNumber;
+		m_RoiX = rhs.m_RoiX; m_RoiY = rhs.m_RoiY;
+		m_RoiW = rhs.m_RoiW; m_RoiH = rhs.m_RoiH;
+		m_Arrival = rhs.m_Arrival;
 	}
 
 	//after successfully Lock(), the Pitch,YUV,RGB field of Data member will be set
@@ -64,6 +70,10 @@ public:
 	}
 
 	unsigned long m_FrameNumber = 0;
+	//rectangle of the source frame that VPP scaled into this surface, W == 0: whole frame
+	mfxU16 m_RoiX = 0, m_RoiY = 0, m_RoiW = 0, m_RoiH = 0;
+	//when the bitstream of this frame arrived (MediaDecoder low latency mode, else epoch)
+	std::chrono::steady_clock::time_point m_Arrival;
 
 	int index(void) { return m_index; }
 	bool is_reserved(void) { return m_bReserved.load(); }
@@ -90,7 +100,22 @@ public:
 	surface_pool(const mfxFrameAllocator & mfxAllocator);
 	~surface_pool();
 
-	mfxStatus realloc(mfxFrameAllocRequest Request, int cntReserved = 0);
+	//cntReservedMin >= 0: if allocation is refused (e.g. by frame memory budget)
+	//retry with fewer reserved surfaces, down to cntReservedMin.
+	//surfaces of the previous allocation still reserved (e.g. held by consumers) stay valid,
+	//that allocation is freed by the unreserve() of its last one
+	mfxStatus realloc(mfxFrameAllocRequest Request, int cntReserved = 0, int cntReservedMin = -1);
+
+	//true if the pool can serve Request instead of realloc(): same FourCC, surfaces at least
+	//as large and enough of them besides cntReserved
+	bool fits(const mfxFrameAllocRequest & Request, int cntReserved);
+
+	//free all surfaces after every reserved surface (of any allocation) is returned,
+	//return false if abort() is called before that
+	bool release(void);
+
+	//wait until no surface (of any allocation) is reserved, return false on timeout or abort()
+	bool wait_idle(int timeout_ms);
 
 	// Get free raw frame surface
 	surface1 * getfree(void);
@@ -104,13 +129,30 @@ public:
 	bool reserve(surface1 * psurf, bool drop_on_overflow);
 	bool unreserve(surface1 * psurf);
 
+	//true if next blocking reserve() will wait for unreserve()
+	bool is_full(void);
+
+	//cancel (or re-enable) blocking reserve(): waiters return false immediately
+	void abort(bool bAbort = true);
+
 
 	void debug(void);
 
 private:
 	void _clear();
+	void _retire();
+	bool _idle(void){ return m_ReservedCnt == 0 && m_Retired.empty(); }
+
+	//allocation replaced by realloc() while some of its surfaces were reserved
+	struct Retired
+	{
+		mfxFrameAllocResponse 	response;
+		std::vector<surface1> 	surfaces;
+		int 					reserved;
+	};
 
 	mfxFrameAllocResponse   		m_mfxResponse;
+	mfxFrameInfo 					m_Info;			// as allocated
 	const mfxFrameAllocator &      	m_mfxAllocator;
 
 	std::vector<surface1> 			m_SurfaceAll;
@@ -118,6 +160,8 @@ private:
 	int                             m_ReservedMaxCnt;
 	int                             m_ReservedCnt;
 	std::condition_variable     	m_cvReserve;
+	bool                            m_bAborted;
+	std::list<Retired> 				m_Retired;
 
 	
 };
@@ -0,0 +1,283 @@
+
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "tensor_preprocess.h"
+#include "simd_rows.h"
+
+// tensor rows per tile
+#define TENSOR_MIN_TILE_ROWS 	16
+
+size_t tensor_size(const tensor_params & p)
+{
+	size_t elem = (p.dtype == TENSOR_F32) ? 4 : ((p.dtype == TENSOR_F16) ? 2 : 1);
+	return (size_t)p.width * p.height * 3 * elem;
+}
+
+// round to nearest even, overflow to inf, underflow to (signed) zero/subnormal
+static inline uint16_t float_to_half(float f)
+{
+	uint32_t x;
+	memcpy(&x, &f, 4);
+	uint32_t sign = (x >> 16) & 0x8000;
+	uint32_t fexp = (x >> 23) & 0xFF;
+	uint32_t mant = x & 0x7FFFFF;
+	int exp = (int)fexp - 127 + 15;
+
+	if(fexp == 0xFF) return (uint16_t)(sign | 0x7C00 | (mant ? 0x200 : 0));
+	if(exp >= 31) return (uint16_t)(sign | 0x7C00);
+	if(exp <= 0){
+		if(exp < -10) return (uint16_t)sign;
+		mant |= 0x800000;
+		int shift = 14 - exp;
+		uint32_t h = mant >> shift;
+		uint32_t rem = mant & ((1u << shift) - 1);
+		uint32_t half = 1u << (shift - 1);
+		if(rem > half || (rem == half && (h & 1))) h++;
+		return (uint16_t)(sign | h);
+	}
+	uint32_t h = ((uint32_t)exp << 10) | (mant >> 13);
+	uint32_t rem = mant & 0x1FFF;
+	if(rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+	return (uint16_t)(sign | h);
+}
+
+struct quant
+{
+	float inv_scale;
+	float zero;
+};
+
+template<typename T> static inline T to_dtype(float v, const quant & q);
+
+template<> inline float to_dtype<float>(float v, const quant &){ return v; }
+template<> inline uint16_t to_dtype<uint16_t>(float v, const quant &){ return float_to_half(v); }
+
+// one tensor row from the normalized row fr (3 channels of width floats)
+template<typename T>
+static void store_row(const float * fr, const tensor_params & p, int ty, const quant & q, void * dst)
+{
+	int w = p.width;
+	T * t = (T*)dst;
+	if(p.layout == TENSOR_NCHW){
+		for(int c = 0; c < 3; c++){
+			T * d = t + ((size_t)c * p.height + ty) * w;
+			const float * s = fr + c * w;
+			for(int x = 0; x < w; x++)
+				d[x] = to_dtype<T>(s[x], q);
+		}
+	}else{
+		T * d = t + (size_t)ty * w * 3;
+		for(int x = 0; x < w; x++){
+			d[x*3 + 0] = to_dtype<T>(fr[x], q);
+			d[x*3 + 1] = to_dtype<T>(fr[w + x], q);
+			d[x*3 + 2] = to_dtype<T>(fr[2*w + x], q);
+		}
+	}
+}
+
+// int8 tensor row, quantized by the SIMD kernel (NHWC: into tmp, then interleaved)
+static void store_row_i8(const float * fr, const tensor_params & p, int ty, const quant & q, void * dst,
+						 const simd_row_kernels * k, std::vector<int8_t> & tmp)
+{
+	int w = p.width;
+	int8_t * t = (int8_t*)dst;
+	if(p.layout == TENSOR_NCHW){
+		for(int c = 0; c < 3; c++)
+			k->quantize_i8(fr + c * w, t + ((size_t)c * p.height + ty) * w, w, q.inv_scale, q.zero);
+	}else{
+		if(tmp.size() < (size_t)w * 3) tmp.resize((size_t)w * 3);
+		k->quantize_i8(fr, tmp.data(), w * 3, q.inv_scale, q.zero);
+		int8_t * d = t + (size_t)ty * w * 3;
+		for(int x = 0; x < w; x++){
+			d[x*3 + 0] = tmp[x];
+			d[x*3 + 1] = tmp[w + x];
+			d[x*3 + 2] = tmp[2*w + x];
+		}
+	}
+}
+
+// bilinear source position of each tensor column/row inside the image:
+// index of the left/top tap & Q8 weight of the right/bottom tap
+static void make_taps(int src_len, int dst_len, std::vector<int> & idx, std::vector<int> & wt)
+{
+	idx.resize(dst_len);
+	wt.resize(dst_len);
+	double step = (double)src_len / dst_len;
+	for(int i = 0; i < dst_len; i++){
+		double pos = (i + 0.5) * step - 0.5;
+		if(pos < 0) pos = 0;
+		int i0 = (int)pos;
+		int w = (int)lround((pos - i0) * 256);
+		if(i0 >= src_len - 1){
+			i0 = src_len - 2;
+			w = 256;
+		}
+		idx[i] = i0;
+		wt[i] = w;
+	}
+}
+
+// the last 2 source rows converted to planar 8 bit in tensor channel order
+// (NV12 only; RGB4 rows are sampled in place). padded for the 4-byte loads of resize_row
+struct row_cache
+{
+	std::vector<uint8_t> 	buf;
+	int 					row[2];
+	int 					width;
+
+	void reset(int w)
+	{
+		width = w;
+		if(buf.size() < (size_t)w * 6 + 4) buf.resize((size_t)w * 6 + 4);
+		row[0] = row[1] = -1;
+	}
+
+	uint8_t * get(int r, const tensor_src & src, const simd_row_kernels * k, const cc_coeffs * cc, bool bgr)
+	{
+		for(int i = 0; i < 2; i++)
+			if(row[i] == r) return &buf[(size_t)i * width * 3];
+
+		//rows are requested in increasing order, the lower one is not needed again
+		int i = (row[0] < row[1]) ? 0 : 1;
+		uint8_t * p = &buf[(size_t)i * width * 3];
+		uint8_t * const planes[3] = {p, p + width, p + 2*width};
+		k->nv12_to_rgb(src.data[0] + (size_t)src.pitch[0] * r, src.data[1] + (size_t)src.pitch[1] * (r/2),
+					   planes, width, cc, CC_LAYOUT_PLANAR, bgr);
+		row[i] = r;
+		return p;
+	}
+};
+
+bool tensor_preprocess(const tensor_src & src, const tensor_params & p, void * dst,
+					   tensor_letterbox * plb, int threads)
+{
+	if(!dst || !src.data[0] || (src.format == TENSOR_SRC_NV12 && !src.data[1]))
+		return false;
+	if(src.width < 2 || src.height < 2 || p.width <= 0 || p.height <= 0)
+		return false;
+
+	const int sw = src.width, sh = src.height;
+	const int dw = p.width, dh = p.height;
+
+	tensor_letterbox lb = {0, 0, dw, dh};
+	if(p.letterbox){
+		double s = std::min((double)dw / sw, (double)dh / sh);
+		lb.width = std::max(1, std::min(dw, (int)lround(sw * s)));
+		lb.height = std::max(1, std::min(dh, (int)lround(sh * s)));
+		lb.x = (dw - lb.width) / 2;
+		lb.y = (dh - lb.height) / 2;
+	}
+	if(plb) *plb = lb;
+
+	std::vector<int> xidx, xwt, yidx, ywt;
+	make_taps(sw, lb.width, xidx, xwt);
+	make_taps(sh, lb.height, yidx, ywt);
+
+	//normalization folded into out = v * alpha + beta, v being the Q16 bilinear sum
+	float alpha[3], beta[3], pad[3];
+	for(int c = 0; c < 3; c++){
+		alpha[c] = p.scale / p.std[c] / 65536.0f;
+		beta[c] = -p.mean[c] / p.std[c];
+		pad[c] = p.pad[c] * alpha[c] * 65536.0f + beta[c];
+	}
+	quant q = {1.0f / p.q_scale, (float)p.q_zero};
+
+	cc_coeffs cc;
+	cc_make_coeffs(p.matrix, p.range, &cc);
+	const simd_row_kernels * k = simd_rows_get(simd_active());
+
+	parallel_rows(dh, TENSOR_MIN_TILE_ROWS, [&](int y0, int y1){
+		static thread_local std::vector<float> fr;
+		static thread_local row_cache rows;
+		static thread_local std::vector<int8_t> qrow;
+		if(fr.size() < (size_t)dw * 3) fr.resize((size_t)dw * 3);
+		rows.reset(sw);
+
+		for(int ty = y0; ty < y1; ty++){
+			int iy = ty - lb.y;
+			if(iy < 0 || iy >= lb.height){
+				for(int c = 0; c < 3; c++)
+					std::fill(fr.begin() + c*dw, fr.begin() + (c+1)*dw, pad[c]);
+			}else{
+				int sy = yidx[iy];
+				int fy = ywt[iy];
+				float * f = fr.data();
+				float * const d[3] = {f + lb.x, f + dw + lb.x, f + 2*dw + lb.x};
+				for(int c = 0; c < 3; c++){
+					std::fill(f + c*dw, d[c], pad[c]);
+					std::fill(d[c] + lb.width, f + (c+1)*dw, pad[c]);
+				}
+				if(src.format == TENSOR_SRC_NV12){
+					const uint8_t * a = rows.get(sy, src, k, &cc, p.bgr);
+					const uint8_t * b = rows.get(sy + 1, src, k, &cc, p.bgr);
+					const int off = 0;
+					for(int c = 0; c < 3; c++)
+						k->resize_row(a + c*sw, b + c*sw, 1, &off, 1, xidx.data(), xwt.data(), fy,
+									  &alpha[c], &beta[c], &d[c], lb.width);
+				}else{
+					const uint8_t * a = src.data[0] + (size_t)src.pitch[0] * sy;
+					const uint8_t * b = a + src.pitch[0];
+					int off[3];
+					for(int c = 0; c < 3; c++)
+						off[c] = p.bgr ? c : 2 - c;	// memory order is B,G,R,A
+					k->resize_row(a, b, 4, off, 3, xidx.data(), xwt.data(), fy, alpha, beta, d, lb.width);
+				}
+			}
+
+			switch(p.dtype){
+			case TENSOR_F32: store_row<float>(fr.data(), p, ty, q, dst); break;
+			case TENSOR_F16: store_row<uint16_t>(fr.data(), p, ty, q, dst); break;
+			case TENSOR_I8: store_row_i8(fr.data(), p, ty, q, dst, k, qrow); break;
+			}
+		}
+	}, threads);
+
+	return true;
+}
+
+mfxStatus surface_to_tensor(surface1 * psurf, const tensor_params & p, void * dst,
+							tensor_letterbox * plb, int threads)
+{
+	if(!psurf || !dst) return MFX_ERR_NULL_PTR;
+
+	const mfxFrameInfo & fi = psurf->Info;
+	if(fi.FourCC != MFX_FOURCC_NV12 && fi.FourCC != MFX_FOURCC_RGB4)
+		return MFX_ERR_UNSUPPORTED;
+
+	bool bLocked = false;
+	if(psurf->Data.Y == NULL && psurf->Data.B == NULL){
+		mfxStatus sts = psurf->lock();
+		if(sts != MFX_ERR_NONE) return sts;
+		bLocked = true;
+	}
+
+	const mfxFrameData & fd = psurf->Data;
+	int cw = fi.CropW ? fi.CropW : fi.Width;
+	int ch = fi.CropH ? fi.CropH : fi.Height;
+
+	tensor_src src;
+	memset(&src, 0, sizeof(src));
+	src.width = cw;
+	src.height = ch;
+	if(fi.FourCC == MFX_FOURCC_NV12){
+		src.format = TENSOR_SRC_NV12;
+		src.data[0] = fd.Y + (size_t)fi.CropY * fd.Pitch + fi.CropX;
+		src.data[1] = fd.UV + (size_t)(fi.CropY / 2) * fd.Pitch + (fi.CropX & ~1);
+		src.pitch[0] = src.pitch[1] = fd.Pitch;
+	}else{
+		src.format = TENSOR_SRC_RGB4;
+		src.data[0] = fd.B + (size_t)fi.CropY * fd.Pitch + fi.CropX * 4;
+		src.pitch[0] = fd.Pitch;
+	}
+
+	bool bOK = tensor_preprocess(src, p, dst, plb, threads);
+
+	if(bLocked)
+		psurf->unlock();
+
+	return bOK ? MFX_ERR_NONE : MFX_ERR_INVALID_VIDEO_PARAM;
+}
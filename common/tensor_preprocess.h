@@ -0,0 +1,86 @@
+#ifndef _TENSOR_PREPROCESS_H_
+#define _TENSOR_PREPROCESS_H_
+
+#include <stdint.h>
+
+#include "color_convert.h"
+#include "surface_pool.h"
+
+// Fused inference preprocessing: color conversion, (letterbox) bilinear resize,
+// mean/std normalization and the store into an NCHW/NHWC float32, fp16 or int8
+// tensor, done row by row so each source and tensor byte is touched once.
+
+enum tensor_layout {
+	TENSOR_NCHW = 0,
+	TENSOR_NHWC,
+};
+
+enum tensor_dtype {
+	TENSOR_F32 = 0,
+	TENSOR_F16,				// IEEE half, stored as uint16_t
+	TENSOR_I8,
+};
+
+struct tensor_params
+{
+	int 			width = 0;				// tensor spatial size
+	int 			height = 0;
+	tensor_layout 	layout = TENSOR_NCHW;
+	tensor_dtype 	dtype = TENSOR_F32;
+	bool 			bgr = false;			// channel order of the tensor
+
+	// keep aspect ratio and center the image, borders get pad color;
+	// otherwise stretch to width x height
+	bool 			letterbox = true;
+	uint8_t 		pad[3] = {114, 114, 114};	// in tensor channel order
+
+	// per channel c: out = (pixel * scale - mean[c]) / std[c]
+	float 			scale = 1.0f;
+	float 			mean[3] = {0, 0, 0};
+	float 			std[3] = {1, 1, 1};
+
+	// TENSOR_I8 only: q = round(out / q_scale) + q_zero, saturated
+	float 			q_scale = 1.0f;
+	int 			q_zero = 0;
+
+	// NV12 sources only
+	cc_matrix 		matrix = CC_BT601;
+	cc_range 		range = CC_RANGE_LIMITED;
+};
+
+// where the image landed in the tensor, to map results back to the source:
+//   src_x = (tensor_x - x) * src_width / width
+struct tensor_letterbox
+{
+	int 	x;
+	int 	y;
+	int 	width;
+	int 	height;
+};
+
+enum tensor_src_format {
+	TENSOR_SRC_NV12 = 0,	// data[0]: Y, data[1]: UV
+	TENSOR_SRC_RGB4,		// data[0]: B,G,R,A
+};
+
+struct tensor_src
+{
+	tensor_src_format 	format;
+	const uint8_t * 	data[2];
+	int 				pitch[2];
+	int 				width;
+	int 				height;
+};
+
+// bytes of one tensor (one batch item) described by p
+size_t tensor_size(const tensor_params & p);
+
+// dst must hold tensor_size(p) bytes, threads 0: all cores
+bool tensor_preprocess(const tensor_src & src, const tensor_params & p, void * dst,
+					   tensor_letterbox * plb = NULL, int threads = 0);
+
+// same on the crop rectangle of a NV12/RGB4 surface, locking it if needed
+mfxStatus surface_to_tensor(surface1 * psurf, const tensor_params & p, void * dst,
+							tensor_letterbox * plb = NULL, int threads = 0);
+
+#endif
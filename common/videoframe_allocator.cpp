@@ -1,7 +1,13 @@
 #include "mfxvideo.h"
 #include <set>
 #include <string.h>
+#include <stdlib.h>
 #include <algorithm>
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
 
 #include "videoframe_allocator.h"
 #include "cassert"
@@ -12,54 +18,157 @@
 
 
 //===================================================================
+// All frames of one response are carved from a single slab:
+//   - slab & every plane row start 64-byte aligned (cache line / AVX-512)
+//   - each frame starts page aligned, so it can be mapped/advised individually
+//   - pitch avoids multiples of 2KB/4KB, where rows alias in L1 (4K aliasing)
+#define SYSMEM_ALIGN 		64
+#define SYSMEM_PAGE 		4096
+#define SYSMEM_HUGEPAGE 	(2*1024*1024)
+#define SYSMEM_ALIGN_UP(x, a) (((x) + (a) - 1) / (a) * (a))
+
+struct sysmem_slab;
+
 struct sysmem_frame : public mfxFrameData
 {
-	mfxU32  FourCC;
-	mfxU8 * pBuffer;
-	sysmem_frame(const mfxFrameInfo & info){
-		memset((mfxFrameData*)this,0, sizeof(mfxFrameData));
-		FourCC = info.FourCC;
-		pBuffer = NULL;
-
-		switch(FourCC){
-		case MFX_FOURCC_NV12:
-			this->Pitch = info.Width;
-			pBuffer = (mfxU8*)malloc(this->Pitch * info.Height + (this->Pitch * info.Height/2));
-			this->Y = pBuffer;
-			this->U = this->Y + this->Pitch * info.Height;
-			this->V = this->U + 1;
-			break;
-		case MFX_FOURCC_RGB4:
-			this->Pitch = info.Width * 4;
-			pBuffer = (mfxU8*)malloc(this->Pitch * info.Height);
-			this->B = pBuffer;
-			this->G = this->B + 1;
-			this->R = this->B + 2;
-			this->A = this->B + 3;
-			break;
-		default:
-			printf("Unknow format:%s %dx%d\n", get_fourcc(FourCC).c_str(),
-					info.Width, info.Height);
-			assert(0);
-			this->Pitch = 0;
-			break;
-		}
-	}
-	~sysmem_frame(){
-		if(pBuffer) free(pBuffer);
-	}
+	mfxU32  		FourCC;
+	sysmem_slab * 	pSlab;
 };
+
+struct sysmem_slab
+{
+	mfxU8 * 		pBuffer;
+	size_t 			size;
+	bool 			bHugePage;
+	sysmem_frame * 	frames;		// contiguous array, one per mid
+};
+
+static mfxU32 sysmem_pitch(mfxU32 row_bytes)
+{
+	mfxU32 pitch = SYSMEM_ALIGN_UP(row_bytes, SYSMEM_ALIGN);
+	if((pitch % 2048) == 0)
+		pitch += SYSMEM_ALIGN;
+	return pitch;
+}
+
+static mfxU8 * sysmem_slab_alloc(size_t size, bool bHugePage)
+{
+	size_t align = bHugePage ? SYSMEM_HUGEPAGE : SYSMEM_ALIGN;
+	void * p = NULL;
+#ifdef _WIN32
+	p = _aligned_malloc(size, align);
+#else
+	if(posix_memalign(&p, align, size) != 0)
+		p = NULL;
+#ifdef MADV_HUGEPAGE
+	//transparent huge page backing: fewer TLB misses when streaming over large frames
+	if(p && bHugePage)
+		madvise(p, size, MADV_HUGEPAGE);
+#endif
+#endif
+	return (mfxU8*)p;
+}
+
+static void sysmem_slab_free(mfxU8 * p)
+{
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
 //===================================================================
+bool mem_allocator_system::frame_layout(const mfxFrameInfo & info, mfxU32 & pitch, size_t & frame_size)
+{
+	mfxU32 height = SYSMEM_ALIGN_UP(info.Height, 2);
+
+	switch(info.FourCC){
+	case MFX_FOURCC_NV12:
+		pitch = sysmem_pitch(info.Width);
+		frame_size = (size_t)pitch * height * 3 / 2;
+		break;
+	case MFX_FOURCC_RGB4:
+		pitch = sysmem_pitch(info.Width * 4);
+		frame_size = (size_t)pitch * height;
+		break;
+	default:
+		printf("Unknow format:%s %dx%d\n", get_fourcc(info.FourCC).c_str(),
+				info.Width, info.Height);
+		return false;
+	}
+	frame_size = SYSMEM_ALIGN_UP(frame_size, SYSMEM_PAGE);
+	return true;
+}
+void mem_allocator_system::frame_planes(const mfxFrameInfo & info, mfxU8 * base, mfxU32 pitch, mfxFrameData * f)
+{
+	mfxU32 height = SYSMEM_ALIGN_UP(info.Height, 2);
+
+	f->PitchHigh = (mfxU16)(pitch >> 16);
+	f->PitchLow = (mfxU16)(pitch & 0xFFFF);
+
+	switch(info.FourCC){
+	case MFX_FOURCC_NV12:
+		f->Y = base;
+		f->U = f->Y + (size_t)pitch * height;
+		f->V = f->U + 1;
+		break;
+	case MFX_FOURCC_RGB4:
+		f->B = base;
+		f->G = f->B + 1;
+		f->R = f->B + 2;
+		f->A = f->B + 3;
+		break;
+	}
+}
+size_t mem_allocator_system::alloc_size(const mfxFrameAllocRequest & request)
+{
+	mfxU32 pitch;
+	size_t frame_size;
+	if(!frame_layout(request.Info, pitch, frame_size))
+		return mem_allocator::alloc_size(request);
+
+	//one slab per response, huge page backed slabs are whole huge pages
+	size_t size = frame_size * request.NumFrameSuggested;
+	if(m_bHugePage && size >= SYSMEM_HUGEPAGE)
+		size = SYSMEM_ALIGN_UP(size, SYSMEM_HUGEPAGE);
+	return size;
+}
 mfxStatus mem_allocator_system::do_alloc(mfxFrameAllocRequest* request, mfxFrameAllocResponse* response)
 {
 	if((request->Type & MFX_MEMTYPE_SYSTEM_MEMORY) != MFX_MEMTYPE_SYSTEM_MEMORY)
 		return MFX_ERR_UNSUPPORTED;
 
+	const mfxFrameInfo & info = request->Info;
+	mfxU32 pitch;
+	size_t frame_size;
+
+	if(!frame_layout(info, pitch, frame_size))
+		return MFX_ERR_UNSUPPORTED;
+
 	int N = request->NumFrameSuggested;
+	sysmem_slab * slab = new sysmem_slab();
+	slab->size = alloc_size(*request);
+	slab->bHugePage = m_bHugePage && slab->size >= SYSMEM_HUGEPAGE;
+	slab->pBuffer = sysmem_slab_alloc(slab->size, slab->bHugePage);
+	if(slab->pBuffer == NULL){
+		delete slab;
+		return MFX_ERR_MEMORY_ALLOC;
+	}
+
+	slab->frames = new sysmem_frame[N];
 	response->mids = (mfxMemId*)calloc(N, sizeof(mfxMemId));
 
-	for(int i=0; i<N; i++)
-		response->mids[i] = (mfxMemId)new sysmem_frame(request->Info);
+	for(int i=0; i<N; i++){
+		sysmem_frame * f = &slab->frames[i];
+		mfxU8 * base = slab->pBuffer + frame_size * i;
+
+		memset((mfxFrameData*)f, 0, sizeof(mfxFrameData));
+		f->FourCC = info.FourCC;
+		f->pSlab = slab;
+		frame_planes(info, base, pitch, f);
+		response->mids[i] = (mfxMemId)f;
+	}
 
 	response->NumFrameActual = N;
 	return MFX_ERR_NONE;
@@ -68,8 +177,10 @@ mfxStatus mem_allocator_system::do_free(mfxFrameAllocResponse* response)
 {
 	if(response->NumFrameActual <= 0) return MFX_ERR_NONE;
 
-	for(int i=0; i<response->NumFrameActual; i++)
-		delete (sysmem_frame*)(response->mids[i]);
+	sysmem_slab * slab = ((sysmem_frame*)(response->mids[0]))->pSlab;
+	sysmem_slab_free(slab->pBuffer);
+	delete [] slab->frames;
+	delete slab;
 
 	free(response->mids);
 	return MFX_ERR_NONE;
@@ -99,6 +210,92 @@ mfxStatus mem_allocator_system::do_gethdl(mfxMemId mid, mfxHDL* handle)
 }
 
 
+//===================================================================
+void mem_allocator_user::add_buffer(void * ptr, size_t size, mfxU32 pitch)
+{
+	buffer b = {(mfxU8*)ptr, size, pitch};
+	m_buffers.push_back(b);
+}
+mfxStatus mem_allocator_user::do_alloc(mfxFrameAllocRequest* request, mfxFrameAllocResponse* response)
+{
+	const mfxFrameInfo & info = request->Info;
+	mfxU32 height = SYSMEM_ALIGN_UP(info.Height, 2);
+	int N = request->NumFrameSuggested;
+
+	//surface_pool retries with fewer reserved frames on MFX_ERR_MEMORY_ALLOC
+	if(N > (int)m_buffers.size()){
+		fprintf(stderr, "%s:%d %d user buffers registered, %d required\n", __FILE__, __LINE__,
+				(int)m_buffers.size(), N);
+		return MFX_ERR_MEMORY_ALLOC;
+	}
+
+	mfxFrameData * frames = new mfxFrameData[N];
+	for(int i=0; i<N; i++){
+		const buffer & b = m_buffers[i];
+		mfxU32 pitch = b.pitch;
+		size_t need;
+
+		switch(info.FourCC){
+		case MFX_FOURCC_NV12:
+			if(pitch == 0) pitch = info.Width;
+			need = (size_t)pitch * height * 3 / 2;
+			break;
+		case MFX_FOURCC_RGB4:
+			if(pitch == 0) pitch = info.Width * 4;
+			need = (size_t)pitch * height;
+			break;
+		default:
+			printf("Unknow format:%s %dx%d\n", get_fourcc(info.FourCC).c_str(),
+					info.Width, info.Height);
+			delete [] frames;
+			return MFX_ERR_UNSUPPORTED;
+		}
+		if(b.size < need){
+			fprintf(stderr, "%s:%d user buffer %d has %zu bytes, %zu required for %s %dx%d\n", __FILE__, __LINE__,
+					i, b.size, need, get_fourcc(info.FourCC).c_str(), info.Width, info.Height);
+			delete [] frames;
+			return MFX_ERR_NOT_ENOUGH_BUFFER;
+		}
+
+		memset(&frames[i], 0, sizeof(mfxFrameData));
+		mem_allocator_system::frame_planes(info, b.ptr, pitch, &frames[i]);
+	}
+
+	response->mids = (mfxMemId*)calloc(N, sizeof(mfxMemId));
+	for(int i=0; i<N; i++)
+		response->mids[i] = (mfxMemId)&frames[i];
+	response->NumFrameActual = N;
+	return MFX_ERR_NONE;
+}
+mfxStatus mem_allocator_user::do_free(mfxFrameAllocResponse* response)
+{
+	if(response->NumFrameActual <= 0) return MFX_ERR_NONE;
+
+	//buffers belong to caller, only frame headers are ours
+	delete [] (mfxFrameData*)(response->mids[0]);
+	free(response->mids);
+	return MFX_ERR_NONE;
+}
+mfxStatus mem_allocator_user::do_lock(mfxMemId mid, mfxFrameData* ptr)
+{
+	mfxFrameData * p = (mfxFrameData*) mid;
+	ptr->R = p->R;
+	ptr->G = p->G;
+	ptr->B = p->B;
+	ptr->A = p->A;
+	ptr->Pitch = p->Pitch;
+	ptr->PitchHigh = p->PitchHigh;
+	return MFX_ERR_NONE;
+}
+mfxStatus mem_allocator_user::do_unlock(mfxMemId /*mid*/, mfxFrameData* /*ptr*/)
+{
+	return MFX_ERR_NONE;
+}
+mfxStatus mem_allocator_user::do_gethdl(mfxMemId /*mid*/, mfxHDL* /*handle*/)
+{
+	return MFX_ERR_UNSUPPORTED;
+}
+
 //===================================================================
 // add the binding of reference to allocator to each MemId
 // so each memory surface can be operated individually
@@ -114,22 +311,26 @@ struct typped_memid
 };
 
 void typped_memid::wrap(mfxFrameAllocResponse* response, mem_allocator * allocator){
-	//replace each item
+	//replace each item, wrappers of one response are kept in one contiguous array
+	typped_memid * pts = new typped_memid[response->NumFrameActual];
 	for(int i=0; i<response->NumFrameActual; i++){
-		typped_memid * pt = new typped_memid();
+		typped_memid * pt = &pts[i];
 		pt->allocator = allocator;
 		pt->mid = response->mids[i];
 		response->mids[i] = pt;
 	}
 }
 mem_allocator * typped_memid::unwrap(mfxFrameAllocResponse* response){
-	mem_allocator * allocator;
+	mem_allocator * allocator = NULL;
+	if(response->NumFrameActual <= 0) return allocator;
+
+	typped_memid * pts = (typped_memid *) response->mids[0];
 	for(int i=0; i<response->NumFrameActual; i++){
 		typped_memid * pt = (typped_memid *) response->mids[i];
 		allocator = pt->allocator;
 		response->mids[i] = pt->mid;
-		delete pt;
 	}
+	delete [] pts;
 	return allocator;
 }
 
@@ -142,6 +343,7 @@ mfxStatus videoframe_allocator::_alloc(mfxHDL pthis, mfxFrameAllocRequest* reque
     bool b_possible_redundant_req =   MFX_MEMTYPE_EXTERNAL_FRAME & request->Type
                                    && MFX_MEMTYPE_FROM_DECODE & request->Type;
     int allocator_id = -1;
+    size_t charged = 0;
 
     if (0 == request || 0 == response || 0 == request->NumFrameSuggested){
         sts = MFX_ERR_MEMORY_ALLOC;
@@ -173,12 +375,9 @@ mfxStatus videoframe_allocator::_alloc(mfxHDL pthis, mfxFrameAllocRequest* reque
 
     //type based distribution
     for(allocator_id=0; allocator_id < that->m_allocators.size(); allocator_id++){
-    	auto &a = that->m_allocators[allocator_id];
-		if(a->is_mytype(request->Type)){
-			sts = a->do_alloc(request, response);
-			break;
-		}
-	}
+    	if(that->m_allocators[allocator_id]->is_mytype(request->Type))
+    		break;
+    }
 
     if(allocator_id >= that->m_allocators.size()){
     	sts = MFX_ERR_UNSUPPORTED;
@@ -186,10 +385,30 @@ mfxStatus videoframe_allocator::_alloc(mfxHDL pthis, mfxFrameAllocRequest* reque
     	goto Exit;
     }
 
+    //admission control against process-wide frame memory budget
+    //(caller owned memory is not accounted)
+    if(that->m_allocators[allocator_id]->owns_memory()){
+    	charged = that->m_allocators[allocator_id]->alloc_size(*request);
+    	if(!frame_memory_accountant::instance().charge(that, request->Info.FourCC, charged)){
+    		fprintf(stderr, ANSI_BOLD ANSI_COLOR_RED "%s:%d frame memory budget exceeded, %dx%dx%d %s refused\n" ANSI_COLOR_RESET,__FILE__,__LINE__,
+    				request->Info.Width, request->Info.Height, request->NumFrameSuggested, get_fourcc(request->Info.FourCC).c_str());
+    		sts = MFX_ERR_MEMORY_ALLOC;
+    		goto Exit;
+    	}
+    }
+
+    sts = that->m_allocators[allocator_id]->do_alloc(request, response);
+
+    if(MFX_ERR_NONE != sts){
+    	frame_memory_accountant::instance().uncharge(that, request->Info.FourCC, charged);
+    }
+
 	if (MFX_ERR_NONE == sts) {
 		response->AllocId = request->AllocId;
 
 		typped_memid::wrap(response, that->m_allocators[allocator_id].get());
+		if(charged)
+			that->m_Charged[response->mids] = std::make_pair(request->Info.FourCC, charged);
 
 		if (b_possible_redundant_req) {
 			// Decode alloc response handling
@@ -228,6 +447,7 @@ mfxStatus videoframe_allocator::_free(mfxHDL pthis, mfxFrameAllocResponse* respo
     	if(--that->m_refCount == 0){
 
     		//replace each item back
+    		that->uncharge(response->mids);
     		mem_allocator * palloc = typped_memid::unwrap(response);
     		palloc->do_free(response);
 
@@ -241,6 +461,7 @@ mfxStatus videoframe_allocator::_free(mfxHDL pthis, mfxFrameAllocResponse* respo
     it = that->m_SetMemId.find(response->mids);
     if(it !=  that->m_SetMemId.end()){
 		//replace each item back
+    	that->uncharge(response->mids);
     	mem_allocator * palloc = typped_memid::unwrap(response);
     	palloc->do_free(response);
 
@@ -263,6 +484,22 @@ Exit:
 	return sts;
 }
 
+mfxMemId videoframe_allocator::native_mid(mfxMemId mid, mem_allocator ** ppallocator)
+{
+	typped_memid * pt = (typped_memid *) mid;
+	if(ppallocator)
+		*ppallocator = pt->allocator;
+	return pt->mid;
+}
+
+void videoframe_allocator::uncharge(mfxMemId* mids)
+{
+	auto it = m_Charged.find(mids);
+	if(it == m_Charged.end()) return;
+	frame_memory_accountant::instance().uncharge(this, it->second.first, it->second.second);
+	m_Charged.erase(it);
+}
+
 mfxStatus videoframe_allocator::_lock(mfxHDL pthis, mfxMemId mid, mfxFrameData* ptr){
 	typped_memid * pt = (typped_memid *) mid;
 	mfxStatus sts = pt->allocator->do_lock(pt->mid,ptr);
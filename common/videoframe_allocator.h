@@ -7,8 +7,10 @@
 #include <vector>
 #include <memory>
 #include <string.h>
+#include <stdlib.h>
 
 #include "common_utils.h"
+#include "frame_memory.h"
 // =================================================================
 // Intel Media SDK memory allocator entrypoints....
 // Implementation of this functions is OS/Memory type specific.
@@ -18,6 +20,12 @@ class mem_allocator
 public:
 	virtual ~mem_allocator(){}
 	virtual bool is_mytype(int type)=0;
+	//false if frames live in memory owned by caller (not accounted to frame memory budget)
+	virtual bool owns_memory(void){ return true; }
+	//bytes do_alloc() takes for request, charged to frame memory budget
+	virtual size_t alloc_size(const mfxFrameAllocRequest & request){
+		return frame_memory_accountant::frame_size(request.Info) * request.NumFrameSuggested;
+	}
 	virtual mfxStatus do_alloc(mfxFrameAllocRequest* request, mfxFrameAllocResponse* response)=0;
 	virtual mfxStatus do_lock(mfxMemId mid, mfxFrameData* ptr)=0;
 	virtual mfxStatus do_unlock(mfxMemId mid, mfxFrameData* ptr)=0;
@@ -27,13 +35,52 @@ public:
 class mem_allocator_system:public mem_allocator
 {
 public:
+	//bHugePage: back large frame slabs by transparent huge pages (Linux)
+	mem_allocator_system(bool bHugePage = false):m_bHugePage(bHugePage){}
 	virtual ~mem_allocator_system(){}
 	virtual bool is_mytype(int type){return ((type & MFX_MEMTYPE_SYSTEM_MEMORY) == MFX_MEMTYPE_SYSTEM_MEMORY);}
+	virtual size_t alloc_size(const mfxFrameAllocRequest & request);
 	virtual mfxStatus do_alloc(mfxFrameAllocRequest* request, mfxFrameAllocResponse* response);
 	virtual mfxStatus do_lock(mfxMemId mid, mfxFrameData* ptr);
 	virtual mfxStatus do_unlock(mfxMemId mid, mfxFrameData* ptr);
 	virtual mfxStatus do_gethdl(mfxMemId mid, mfxHDL* handle);
 	virtual mfxStatus do_free(mfxFrameAllocResponse* response);
+
+	//padded pitch & page aligned size of one frame, false if FourCC is not supported
+	static bool frame_layout(const mfxFrameInfo & info, mfxU32 & pitch, size_t & frame_size);
+	//set pitch & plane pointers of a frame starting at base
+	static void frame_planes(const mfxFrameInfo & info, mfxU8 * base, mfxU32 pitch, mfxFrameData * f);
+private:
+	bool m_bHugePage;
+};
+// VPP output frames in caller owned buffers (e.g. pinned/registered tensor memory),
+// frame i of a response is the i-th registered buffer.
+// Buffers must stay valid until the allocator's owner is destroyed.
+class mem_allocator_user:public mem_allocator
+{
+public:
+	virtual ~mem_allocator_user(){}
+	virtual bool is_mytype(int type){
+		return ((type & MFX_MEMTYPE_SYSTEM_MEMORY) == MFX_MEMTYPE_SYSTEM_MEMORY) &&
+			   ((type & MFX_MEMTYPE_FROM_VPPOUT) == MFX_MEMTYPE_FROM_VPPOUT);
+	}
+	virtual bool owns_memory(void){ return false; }
+	virtual mfxStatus do_alloc(mfxFrameAllocRequest* request, mfxFrameAllocResponse* response);
+	virtual mfxStatus do_lock(mfxMemId mid, mfxFrameData* ptr);
+	virtual mfxStatus do_unlock(mfxMemId mid, mfxFrameData* ptr);
+	virtual mfxStatus do_gethdl(mfxMemId mid, mfxHDL* handle);
+	virtual mfxStatus do_free(mfxFrameAllocResponse* response);
+
+	//pitch 0 means rows are packed, 64-byte aligned ptr & pitch are preferred
+	void add_buffer(void * ptr, size_t size, mfxU32 pitch = 0);
+	int count(void){ return (int)m_buffers.size(); }
+private:
+	struct buffer{
+		mfxU8 * ptr;
+		size_t 	size;
+		mfxU32 	pitch;
+	};
+	std::vector<buffer> m_buffers;
 };
 // Win32/Linux platform dependent implementations are required for this allocator to work
 class mem_allocator_video:public mem_allocator
@@ -67,15 +114,37 @@ public:
 		m_alloc_count = 0;
 		m_free_count = 0;
 
-		m_allocators.push_back(std::shared_ptr<mem_allocator>(new mem_allocator_system()));
+		//MD_HUGEPAGE=1 enables transparent huge page backing of system memory frames
+		const char * phugepage = getenv("MD_HUGEPAGE");
+		bool bHugePage = (phugepage && strcmp(phugepage, "0") != 0);
+
+		m_allocators.push_back(std::shared_ptr<mem_allocator>(new mem_allocator_system(bHugePage)));
 		m_allocators.push_back(std::shared_ptr<mem_allocator>(new mem_allocator_video()));
 	}
+	~videoframe_allocator()
+	{
+		frame_memory_accountant::instance().forget(this);
+	}
+
+	//name shown in frame memory reports
+	void set_name(const char * name){ frame_memory_accountant::instance().set_label(this, name); }
+
+	//put allocator in front of default ones, so it takes precedence for the types it claims
+	//(must be called before any allocation)
+	void add_allocator(std::shared_ptr<mem_allocator> a){ m_allocators.insert(m_allocators.begin(), a); }
+
+	//MemId seen by Media SDK is a wrapper, return the one given by internal allocator
+	static mfxMemId native_mid(mfxMemId mid, mem_allocator ** ppallocator = NULL);
 
     mfxFrameAllocResponse 			m_mfxResponse;
     int 							m_refCount;
 
 	std::set<mfxMemId*>     		m_SetMemId;
 
+	//bytes charged to frame_memory_accountant for each response
+	std::map<mfxMemId*, std::pair<mfxU32, size_t>>	m_Charged;
+	void uncharge(mfxMemId* mids);
+
 	int 							m_alloc_count;
 	int 							m_free_count;
 
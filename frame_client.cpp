@@ -0,0 +1,213 @@
+
+// Load-test client of frame_server: N subscribers, each on its own connection,
+// read frames in place from the shared pools and report fps & latency.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <map>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "frame_ipc.h"
+
+static void usage(const char * program)
+{
+	printf(
+		"Subscribes to frame_server channels and reports delivered fps & latency.\n"
+		"\n"
+		"Usage: %s [options] [CHANNEL...]\n"
+		"   -s path    unix socket path (default /tmp/frame_server.sock)\n"
+		"   -n N       number of subscribers, spread over CHANNELs (default 1)\n"
+		"   -c N       credits of each subscriber (default 4)\n"
+		"   -t sec     test duration (default 10)\n"
+		"   -w ms      simulated processing time per frame (default 0)\n",
+		program);
+}
+
+struct Subscriber
+{
+	int 					id;
+	int 					channel;
+	int 					credits;
+
+	uint64_t 				frames = 0;
+	uint64_t 				dropped = 0;
+	uint64_t 				first_ns = 0;
+	uint64_t 				last_ns = 0;
+	uint32_t 				checksum = 0;
+	std::vector<double> 	latency_ms;		// decoder output to client
+	std::vector<double> 	transport_ms;	// server send to client
+	bool 					bRejected = false;
+};
+
+struct MappedPool
+{
+	const uint8_t * 	p;
+	uint64_t 			size;
+};
+
+static double percentile(std::vector<double> v, double pct)
+{
+	if(v.empty()) return 0;
+	size_t k = (size_t)(pct * (v.size() - 1));
+	std::nth_element(v.begin(), v.begin() + k, v.end());
+	return v[k];
+}
+
+static double average(const std::vector<double> & v)
+{
+	double sum = 0;
+	for(auto x : v) sum += x;
+	return v.empty() ? 0 : sum / v.size();
+}
+
+static void subscribe(const char * sock_path, Subscriber * ps, int duration_s, int work_ms)
+{
+	std::map<uint32_t, MappedPool> pools;
+
+	int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, sock_path, sizeof(addr.sun_path) - 1);
+	if(sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0){
+		fprintf(stderr, "subscriber %d: connect to %s failed: %s\n", ps->id, sock_path, strerror(errno));
+		if(sock >= 0) close(sock);
+		return;
+	}
+
+	frame_ipc_msg msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.type = FRAME_IPC_SUBSCRIBE;
+	msg.channel = ps->channel;
+	msg.subscribe.credits = ps->credits;
+	frame_ipc_send(sock, msg);
+
+	uint64_t t_end = frame_ipc_now_ns() + (uint64_t)duration_s * 1000000000ull;
+
+	while(frame_ipc_now_ns() < t_end){
+		struct pollfd pfd = {sock, POLLIN, 0};
+		if(poll(&pfd, 1, 100) <= 0)
+			continue;
+
+		int fd;
+		if(!frame_ipc_recv(sock, msg, &fd)){
+			fprintf(stderr, "subscriber %d: server closed connection\n", ps->id);
+			break;
+		}
+
+		if(msg.type == FRAME_IPC_REJECT){
+			fprintf(stderr, "subscriber %d: channel %d rejected\n", ps->id, ps->channel);
+			ps->bRejected = true;
+			break;
+		}
+
+		if(msg.type == FRAME_IPC_POOL){
+			//map once, the mapping stays valid after fd is closed
+			const uint8_t * p = mem_allocator_shm::map_pool(fd, msg.pool.pool_size);
+			if(fd >= 0) close(fd);
+			if(p)
+				pools[msg.pool.pool_id] = {p, msg.pool.pool_size};
+			continue;
+		}
+
+		if(msg.type != FRAME_IPC_FRAME)
+			continue;
+
+		uint64_t now = frame_ipc_now_ns();
+		const shm_frame_desc & d = msg.frame.desc;
+
+		//read the frame in place: sample first pixel of every row
+		auto it = pools.find(d.pool_id);
+		if(it != pools.end()){
+			const uint8_t * pframe = it->second.p + d.offset;
+			for(int y = 0; y < d.height; y++)
+				ps->checksum += pframe[(size_t)y * d.pitch];
+		}
+
+		if(ps->frames == 0) ps->first_ns = now;
+		ps->last_ns = now;
+		ps->frames ++;
+		ps->dropped = msg.frame.dropped;
+		ps->latency_ms.push_back((now - msg.frame.ready_ns) / 1e6);
+		ps->transport_ms.push_back((now - msg.frame.sent_ns) / 1e6);
+
+		if(work_ms > 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(work_ms));
+
+		frame_ipc_msg rm;
+		memset(&rm, 0, sizeof(rm));
+		rm.type = FRAME_IPC_RELEASE;
+		rm.channel = ps->channel;
+		rm.release.pool_id = d.pool_id;
+		rm.release.index = d.index;
+		frame_ipc_send(sock, rm);
+	}
+
+	close(sock);
+	for(auto &p : pools)
+		mem_allocator_shm::unmap_pool(p.second.p, p.second.size);
+}
+
+int main(int argc, char** argv)
+{
+	const char * sock_path = "/tmp/frame_server.sock";
+	int subscribers = 1;
+	int credits = 4;
+	int duration_s = 10;
+	int work_ms = 0;
+	int opt;
+
+	while((opt = getopt(argc, argv, "s:n:c:t:w:h")) != -1){
+		switch(opt){
+		case 's': sock_path = optarg; break;
+		case 'n': subscribers = atoi(optarg); break;
+		case 'c': credits = atoi(optarg); break;
+		case 't': duration_s = atoi(optarg); break;
+		case 'w': work_ms = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+
+	std::vector<int> channels;
+	for(int i = optind; i < argc; i++)
+		channels.push_back(atoi(argv[i]));
+	if(channels.empty())
+		channels.push_back(0);
+
+	std::vector<Subscriber> subs(subscribers);
+	std::vector<std::thread> threads;
+	for(int i = 0; i < subscribers; i++){
+		subs[i].id = i;
+		subs[i].channel = channels[i % channels.size()];
+		subs[i].credits = credits;
+		threads.emplace_back(subscribe, sock_path, &subs[i], duration_s, work_ms);
+	}
+	for(auto &t : threads)
+		t.join();
+
+	printf("%4s %8s %8s %8s %8s | %27s | %18s\n", "sub", "channel", "frames", "dropped", "fps",
+			"latency ms avg/p99/max", "transport ms avg/max");
+	for(auto &s : subs){
+		if(s.bRejected) continue;
+		double sec = (s.last_ns - s.first_ns) / 1e9;
+		double fps = (s.frames > 1 && sec > 0) ? (s.frames - 1) / sec : 0;
+		printf("%4d %8d %8lu %8lu %8.1f | %8.2f %8.2f %9.2f | %8.2f %9.2f\n",
+				s.id, s.channel, (unsigned long)s.frames, (unsigned long)s.dropped, fps,
+				average(s.latency_ms), percentile(s.latency_ms, 0.99), percentile(s.latency_ms, 1.0),
+				average(s.transport_ms), percentile(s.transport_ms, 1.0));
+	}
+	return 0;
+}
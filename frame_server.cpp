@@ -0,0 +1,372 @@
+
+// Local frame server: one decode per camera, shared by many client processes.
+//   decoded & resized frames are kept in memfd backed pools, clients subscribe
+//   to a channel over a Unix domain socket and receive frames by descriptor.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <map>
+#include <algorithm>
+#include <set>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+#include "common_utils.h"
+#include "channel_manager.h"
+#include "frame_ipc.h"
+
+static std::atomic<bool> g_stop(false);
+
+static void on_signal(int)
+{
+	g_stop = true;
+}
+
+static void usage(const char * program)
+{
+	printf(
+		"Decodes each INPUT as one channel and serves frames to local clients.\n"
+		"\n"
+		"Usage: %s [options] INPUT...\n"
+		"   -s path    unix socket path (default /tmp/frame_server.sock)\n"
+		"   -q N       frames kept by each decoder (default 8)\n"
+		"   -c N       max credits (frames in flight) per client (default 4)\n"
+		"   -p policy  slow client policy: drop (default) or evict\n"
+		"   -e N       evict client after N frames dropped in a row (default 300)\n",
+		program);
+}
+
+class FrameServer
+{
+public:
+	enum Policy{drop=0, evict};
+
+	FrameServer(int max_credits, Policy policy, int evict_after):
+		m_max_credits(max_credits),
+		m_policy(policy),
+		m_evict_after(evict_after),
+		m_closing(false)
+	{}
+
+	//called by channel consumer threads
+	void on_frame(int channel, MediaDecoder::Output & out);
+
+	//accept & serve clients until g_stop
+	void serve(int listen_fd, ChannelManager & manager);
+
+	//drop all clients, frames they hold go back to the pools
+	void close(void);
+
+private:
+	struct Client {
+		int 			sock;
+		int 			channel = -1;
+		int 			credits = 0;
+		uint64_t 		sent = 0;
+		uint64_t 		dropped = 0;
+		int 			dropped_in_row = 0;
+		std::set<uint32_t> pools;		// pool memfd already passed to client
+		std::map<std::pair<uint32_t, uint32_t>, std::shared_ptr<surface1>> inflight;
+
+		Client(int s):sock(s){}
+		~Client(){ ::close(sock); }
+	};
+
+	void drop_frame(Client & c);
+	void on_message(Client & c, const frame_ipc_msg & msg, ChannelManager & manager);
+	void report(void);
+
+	const int 							m_max_credits;
+	const Policy 						m_policy;
+	const int 							m_evict_after;
+
+	std::mutex 							m_mutex;
+	std::map<int, std::unique_ptr<Client>> m_clients;
+	bool 								m_closing;
+};
+
+void FrameServer::on_frame(int channel, MediaDecoder::Output & out)
+{
+	frame_ipc_msg msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.type = FRAME_IPC_FRAME;
+	msg.channel = channel;
+	msg.frame.ready_ns = frame_ipc_now_ns();
+	msg.frame.frame_number = out.second->m_FrameNumber;
+
+	if(!mem_allocator_shm::export_frame(out.second->Data.MemId, msg.frame.desc)){
+		fprintf(stderr, "channel %d: frame is not in shared memory\n", channel);
+		return;
+	}
+	const shm_frame_desc & desc = msg.frame.desc;
+
+	std::lock_guard<std::mutex> guard(m_mutex);
+	if(m_closing) return;
+
+	for(auto &it : m_clients){
+		Client & c = *it.second;
+		if(c.channel != channel)
+			continue;
+
+		//no credit: client is still busy with earlier frames
+		if(c.credits <= 0){
+			drop_frame(c);
+			continue;
+		}
+
+		//socket sends never block the decoder, a full socket counts as no credit
+		if(c.pools.count(desc.pool_id) == 0){
+			frame_ipc_msg pm;
+			memset(&pm, 0, sizeof(pm));
+			pm.type = FRAME_IPC_POOL;
+			pm.channel = channel;
+			pm.pool.pool_id = desc.pool_id;
+			pm.pool.pool_size = desc.pool_size;
+			if(!frame_ipc_send(c.sock, pm, desc.fd, true)){
+				drop_frame(c);
+				continue;
+			}
+			c.pools.insert(desc.pool_id);
+		}
+
+		msg.frame.dropped = c.dropped;
+		msg.frame.sent_ns = frame_ipc_now_ns();
+		if(!frame_ipc_send(c.sock, msg, -1, true)){
+			drop_frame(c);
+			continue;
+		}
+
+		//surface stays reserved until client releases it
+		c.inflight[std::make_pair(desc.pool_id, desc.index)] = out.second;
+		c.credits --;
+		c.sent ++;
+		c.dropped_in_row = 0;
+	}
+}
+
+void FrameServer::drop_frame(Client & c)
+{
+	c.dropped ++;
+	c.dropped_in_row ++;
+	if(m_policy == Policy::evict && c.dropped_in_row == m_evict_after){
+		fprintf(stderr, "client %d on channel %d evicted after %d dropped frames\n",
+				c.sock, c.channel, c.dropped_in_row);
+		//poll loop sees hang-up and removes client
+		shutdown(c.sock, SHUT_RDWR);
+	}
+}
+
+void FrameServer::on_message(Client & c, const frame_ipc_msg & msg, ChannelManager & manager)
+{
+	switch(msg.type){
+	case FRAME_IPC_SUBSCRIBE:
+	{
+		auto ids = manager.channels();
+		if(std::find(ids.begin(), ids.end(), msg.channel) == ids.end()){
+			frame_ipc_msg rm;
+			memset(&rm, 0, sizeof(rm));
+			rm.type = FRAME_IPC_REJECT;
+			rm.channel = msg.channel;
+			frame_ipc_send(c.sock, rm);
+			break;
+		}
+		std::lock_guard<std::mutex> guard(m_mutex);
+		c.channel = msg.channel;
+		c.credits = std::min((int)msg.subscribe.credits, m_max_credits) - (int)c.inflight.size();
+		printf("client %d subscribed channel %d with %d credits\n", c.sock, c.channel, c.credits);
+		break;
+	}
+	case FRAME_IPC_RELEASE:
+	{
+		std::shared_ptr<surface1> surf;
+		std::lock_guard<std::mutex> guard(m_mutex);
+		auto it = c.inflight.find(std::make_pair(msg.release.pool_id, msg.release.index));
+		if(it != c.inflight.end()){
+			surf = it->second;
+			c.inflight.erase(it);
+			c.credits ++;
+		}
+		break;
+	}
+	default:
+		fprintf(stderr, "client %d: unexpected message %u\n", c.sock, msg.type);
+		break;
+	}
+}
+
+void FrameServer::serve(int listen_fd, ChannelManager & manager)
+{
+	auto t_report = std::chrono::steady_clock::now();
+
+	while(!g_stop){
+		std::vector<struct pollfd> fds;
+		fds.push_back({listen_fd, POLLIN, 0});
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			for(auto &it : m_clients)
+				fds.push_back({it.first, POLLIN, 0});
+		}
+
+		int r = poll(fds.data(), fds.size(), 200);
+		if(r < 0 && errno != EINTR){
+			perror("poll");
+			break;
+		}
+
+		for(size_t i = 1; r > 0 && i < fds.size(); i++){
+			if(fds[i].revents == 0)
+				continue;
+
+			Client * pc;
+			{
+				std::lock_guard<std::mutex> guard(m_mutex);
+				pc = m_clients[fds[i].fd].get();
+			}
+
+			frame_ipc_msg msg;
+			if((fds[i].revents & POLLIN) && frame_ipc_recv(pc->sock, msg)){
+				on_message(*pc, msg, manager);
+				continue;
+			}
+
+			//hang-up or error: frames held by client go back to pools
+			std::unique_ptr<Client> gone;
+			{
+				std::lock_guard<std::mutex> guard(m_mutex);
+				auto it = m_clients.find(fds[i].fd);
+				gone = std::move(it->second);
+				m_clients.erase(it);
+			}
+			printf("client %d on channel %d left: %lu sent, %lu dropped\n",
+					gone->sock, gone->channel, (unsigned long)gone->sent, (unsigned long)gone->dropped);
+		}
+
+		if(r > 0 && (fds[0].revents & POLLIN)){
+			int s = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+			if(s >= 0){
+				std::lock_guard<std::mutex> guard(m_mutex);
+				m_clients[s].reset(new Client(s));
+			}
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		if(now - t_report > std::chrono::seconds(5)){
+			report();
+			manager.report();
+			t_report = now;
+		}
+	}
+}
+
+void FrameServer::report(void)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	for(auto &it : m_clients){
+		Client & c = *it.second;
+		printf("    client %3d channel %3d: sent %8lu dropped %8lu in flight %2d credits %2d\n",
+				c.sock, c.channel, (unsigned long)c.sent, (unsigned long)c.dropped,
+				(int)c.inflight.size(), c.credits);
+	}
+}
+
+void FrameServer::close(void)
+{
+	std::map<int, std::unique_ptr<Client>> clients;
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		m_closing = true;
+		clients.swap(m_clients);
+	}
+	//clients are destructed out of lock
+}
+
+int main(int argc, char** argv)
+{
+	const char * sock_path = "/tmp/frame_server.sock";
+	int queue_size = 8;
+	int max_credits = 4;
+	int evict_after = 300;
+	FrameServer::Policy policy = FrameServer::Policy::drop;
+	int opt;
+
+	while((opt = getopt(argc, argv, "s:q:c:p:e:h")) != -1){
+		switch(opt){
+		case 's': sock_path = optarg; break;
+		case 'q': queue_size = atoi(optarg); break;
+		case 'c': max_credits = atoi(optarg); break;
+		case 'e': evict_after = atoi(optarg); break;
+		case 'p':
+			if(strcmp(optarg, "evict") == 0) policy = FrameServer::Policy::evict;
+			else if(strcmp(optarg, "drop") == 0) policy = FrameServer::Policy::drop;
+			else { usage(argv[0]); return -1; }
+			break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if(optind >= argc){
+		printf("error: no INPUT\n");
+		usage(argv[0]);
+		return -1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(listen_fd < 0){
+		perror("socket");
+		return -1;
+	}
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, sock_path, sizeof(addr.sun_path) - 1);
+	unlink(sock_path);
+	if(bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 64) != 0){
+		perror(sock_path);
+		::close(listen_fd);
+		return -1;
+	}
+
+	FrameServer server(max_credits, policy, evict_after);
+
+	//decoders never wait for clients: frames no one can take are dropped
+	ChannelManager manager(queue_size, MFX_IMPL_AUTO_ANY, true);
+	manager.set_shared_output(true);
+	//clients only see the VPP output
+	manager.set_output_mode(MediaDecoder::OutputMode::vpp_only);
+
+	for(int i = optind; i < argc; i++){
+		int id = i - optind;
+		if(!manager.add(id, argv[i], [&server](int id, MediaDecoder::Output & out){ server.on_frame(id, out); }))
+			fprintf(stderr, "channel %d (%s) not started\n", id, argv[i]);
+		else
+			printf("channel %d: %s\n", id, argv[i]);
+	}
+
+	printf("serving %d channels on %s\n", (int)manager.channels().size(), sock_path);
+	server.serve(listen_fd, manager);
+
+	//surfaces held by clients must be returned before decoders are freed
+	server.close();
+	manager.remove_all();
+
+	::close(listen_fd);
+	unlink(sock_path);
+	return 0;
+}
@@ -0,0 +1,120 @@
+// Batching: -ch N decoders of the same INPUT feed one frame_batcher, every batch is
+//   printed with the channel, frame number & wait time of each slot. A second thread
+//   calls stop() at the end, while next() may still be waiting for frames.
+
+#include "common_utils.h"
+#include "cmd_options.h"
+
+#include "media_pipeline.h"
+#include "frame_batcher.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+static void usage(CmdOptionsCtx* ctx)
+{
+    printf(
+        "Batches frames of -ch channels decoding INPUT into one tensor (-g WxH, default 640x640).\n"
+        "\n"
+        "Usage: %s [options] INPUT\n"
+        "\n"
+        "Environment:\n"
+        "  BATCH=N         frames per batch (default 4)\n"
+        "  WAIT_MS=N       a batch is handed out N ms after its first frame (default 20)\n"
+        "  BATCHES=N       stop after N batches (default 100)\n"
+        "  INFER_MS=N      simulated inference time per batch, channels drop meanwhile (default 0)\n", ctx->program);
+}
+
+int main(int argc, char** argv)
+{
+    CmdOptions options;
+
+    memset(&options, 0, sizeof(CmdOptions));
+    options.ctx.options = OPTIONS_VPP;
+    options.ctx.usage = usage;
+    options.values.impl = MFX_IMPL_AUTO_ANY;
+
+    ParseOptions(argc, argv, &options);
+
+    if (!options.values.SourceName[0]) {
+        printf("error: source file name not set (mandatory)\n");
+        return -1;
+    }
+    int nChannels = options.values.Channels > 0 ? options.values.Channels : 1;
+    const char * penv = getenv("BATCH");
+    int batch_size = penv ? atoi(penv) : 4;
+    penv = getenv("WAIT_MS");
+    int wait_ms = penv ? atoi(penv) : 20;
+    penv = getenv("BATCHES");
+    int nBatches = penv ? atoi(penv) : 100;
+    penv = getenv("INFER_MS");
+    int infer_ms = penv ? atoi(penv) : 0;
+
+    tensor_params tp;
+    tp.width = options.values.Width ? options.values.Width : 640;
+    tp.height = options.values.Height ? options.values.Height : 640;
+    tp.scale = 1.0f / 255;
+
+    std::vector<std::unique_ptr<MediaDecoder>> decoders;
+    frame_batcher batcher(batch_size, tp, wait_ms);
+    for (int i = 0; i < nChannels; i++) {
+        decoders.emplace_back(new MediaDecoder(8));
+        batcher.add_channel(i, decoders.back().get());
+    }
+
+    printf("Start batching %d x [%s], batch %d, max wait %d ms, tensor %dx%d (%zu bytes)\n", nChannels,
+           options.values.SourceName, batch_size, wait_ms, tp.width, tp.height, batcher.tensor_bytes());
+
+    auto t_start = std::chrono::high_resolution_clock::now();
+    for (auto &d : decoders)
+        d->start(options.values.SourceName, options.values.impl);
+
+    std::vector<frame_batcher::Slot> slots;
+    int nBatch = 0;
+    int nFull = 0;
+    int nFrames = 0;
+    double sum_wait = 0, max_wait = 0;
+    for (; nBatch < nBatches; nBatch++) {
+        int n = batcher.next(slots);
+        if (n == 0) break;
+
+        if (n == batch_size) nFull ++;
+        nFrames += n;
+        printf("batch %4d: %d frames ", nBatch, n);
+        for (auto &s : slots) {
+            printf(" ch%d#%lu %.2fms", s.channel, s.frame_number, s.wait_ms);
+            sum_wait += s.wait_ms;
+            if (s.wait_ms > max_wait) max_wait = s.wait_ms;
+        }
+        printf("\n");
+
+        if (infer_ms > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(infer_ms));
+    }
+    int dropped = batcher.dropped();
+
+    //stop() from another thread must wake a next() blocked on arrivals
+    auto t_stop = std::chrono::high_resolution_clock::now();
+    std::thread stopper([&batcher]() { batcher.stop(); });
+    int nAfter = 0;
+    while (batcher.next(slots) > 0)
+        nAfter ++;
+    stopper.join();
+    double stop_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t_stop).count();
+
+    for (auto &d : decoders)
+        d->stop();
+
+    auto t_end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = t_end - t_start;
+
+    printf("\nTotal Batches: %d (%d full, %d by deadline), %d frames, Execution time: %3.2f s (%3.2f fps)\n",
+           nBatch, nFull, nBatch - nFull, nFrames, diff.count(), nFrames / diff.count());
+    printf("slot wait avg %.2f ms max %.2f ms, %d frames dropped by channel queues\n",
+           nFrames ? sum_wait / nFrames : 0, max_wait, dropped);
+    printf("stop() returned after %.2f ms, %d batches formed meanwhile\n", stop_ms, nAfter);
+    return 0;
+}
@@ -0,0 +1,106 @@
+// Channel churn: -ch N channels decoding INPUT are added to a ChannelManager, then
+//   each round removes one channel, replaces another and adds a new one,
+//   printing ChannelManager & frame memory reports after every step.
+
+#include "common_utils.h"
+#include "cmd_options.h"
+
+#include "channel_manager.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+static void usage(CmdOptionsCtx* ctx)
+{
+    printf(
+        "Adds -ch channels decoding INPUT, then removes, replaces and adds channels at runtime.\n"
+        "\n"
+        "Usage: %s [options] INPUT\n"
+        "\n"
+        "Environment:\n"
+        "  ROUNDS=N        churn rounds (default 3)\n"
+        "  HOLD_MS=N       how long channels run between steps (default 1000)\n"
+        "  BUDGET_MB=N     frame memory budget, channels beyond it are refused (default unlimited)\n", ctx->program);
+}
+
+int main(int argc, char** argv)
+{
+    CmdOptions options;
+
+    memset(&options, 0, sizeof(CmdOptions));
+    options.ctx.options = OPTIONS_DECODE;
+    options.ctx.usage = usage;
+    options.values.impl = MFX_IMPL_AUTO_ANY;
+
+    ParseOptions(argc, argv, &options);
+
+    if (!options.values.SourceName[0]) {
+        printf("error: source file name not set (mandatory)\n");
+        return -1;
+    }
+    int nChannels = options.values.Channels > 0 ? options.values.Channels : 1;
+    const char * penv = getenv("ROUNDS");
+    int nRounds = penv ? atoi(penv) : 3;
+    penv = getenv("HOLD_MS");
+    int hold_ms = penv ? atoi(penv) : 1000;
+    penv = getenv("BUDGET_MB");
+    if (penv)
+        frame_memory_accountant::instance().set_budget((size_t)atoi(penv) * 1024 * 1024);
+
+    std::atomic<long> frames[64];
+    for (auto &f : frames) f = 0;
+
+    //callback only counts, it keeps no Output
+    ChannelManager manager(8, options.values.impl, true);
+    auto cb = [&frames](int id, MediaDecoder::Output &) { frames[id % 64] ++; };
+
+    auto step = [&](const char * what) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(hold_ms));
+        printf("\n==== %s\n", what);
+        for (auto id : manager.channels())
+            printf("    channel %2d: %ld frames\n", id, frames[id % 64].load());
+        manager.report();
+        frame_memory_accountant::instance().report();
+    };
+
+    for (int i = 0; i < nChannels; i++)
+        if (!manager.add(i, options.values.SourceName, cb))
+            printf("channel %d refused\n", i);
+    step("initial channels");
+
+    int next_id = nChannels;
+    for (int r = 0; r < nRounds; r++) {
+        std::vector<int> ids = manager.channels();
+        if (ids.empty()) break;
+
+        char what[64];
+        manager.remove(ids[0]);
+        snprintf(what, sizeof(what), "round %d: removed channel %d", r, ids[0]);
+        step(what);
+
+        if (ids.size() > 1) {
+            //a source that can't be opened is refused, the channel keeps running
+            if (r == 0 && !manager.replace(ids[1], "/nonexistent/stream.h264"))
+                printf("channel %d: replace with missing source refused, state %s\n", ids[1],
+                       MediaDecoder::state_name(manager.state(ids[1])));
+            manager.replace(ids[1], options.values.SourceName);
+            snprintf(what, sizeof(what), "round %d: replaced channel %d", r, ids[1]);
+            step(what);
+        }
+
+        if (!manager.add(next_id, options.values.SourceName, cb))
+            printf("channel %d refused\n", next_id);
+        snprintf(what, sizeof(what), "round %d: added channel %d", r, next_id);
+        next_id ++;
+        step(what);
+    }
+
+    manager.remove_all();
+    printf("\n==== all channels removed\n");
+    manager.report();
+    frame_memory_accountant::instance().report();
+    return 0;
+}
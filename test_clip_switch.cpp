@@ -0,0 +1,164 @@
+// Clip windows across pipeline rebuilds: a clip subscriber with stride < clip length
+//   pins frames of the window being filled while the decoder
+//     - hibernates: INPUT is copied into a followed file in two halves with an idle gap, or
+//     - changes resolution: INPUT and INPUT2 are decoded back to back as one playlist.
+//   Passes if clips keep coming after the rebuild and stop() returns.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+
+#include "common_utils.h"
+#include "media_pipeline.h"
+
+static void usage(const char * program)
+{
+	printf(
+		"Runs a clip subscriber through hibernation (INPUT) or a resolution change (INPUT INPUT2).\n"
+		"\n"
+		"Usage: %s [options] INPUT [INPUT2]\n"
+		"   -k N       clip length (default 8)\n"
+		"   -s N       clip stride, less than clip length (default 2)\n"
+		"   -i ms      hibernate after ms idle, the gap in INPUT is 3x longer (default 300)\n"
+		"   -t sec     give up after sec (default 30)\n",
+		program);
+}
+
+// write INPUT into path in two halves, idle for gap_ms in between
+static void feed_file(const char * input, const char * path, int gap_ms, std::atomic<bool> * pDone)
+{
+	std::vector<char> data;
+	FILE * fin = fopen(input, "rb");
+	if(fin){
+		char buf[64*1024];
+		size_t n;
+		while((n = fread(buf, 1, sizeof(buf), fin)) > 0)
+			data.insert(data.end(), buf, buf + n);
+		fclose(fin);
+	}
+
+	FILE * fout = fopen(path, "ab");
+	if(fout){
+		size_t half = data.size() / 2;
+		fwrite(data.data(), 1, half, fout);
+		fflush(fout);
+		std::this_thread::sleep_for(std::chrono::milliseconds(gap_ms));
+		fwrite(data.data() + half, 1, data.size() - half, fout);
+		fclose(fout);
+	}
+	*pDone = true;
+}
+
+int main(int argc, char** argv)
+{
+	int clip_len = 8;
+	int stride = 2;
+	int idle_ms = 300;
+	int timeout_s = 30;
+	int opt;
+
+	while((opt = getopt(argc, argv, "k:s:i:t:h")) != -1){
+		switch(opt){
+		case 'k': clip_len = atoi(optarg); break;
+		case 's': stride = atoi(optarg); break;
+		case 'i': idle_ms = atoi(optarg); break;
+		case 't': timeout_s = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if(optind >= argc){
+		printf("error: no INPUT\n");
+		usage(argv[0]);
+		return -1;
+	}
+	const char * input = argv[optind];
+	const char * input2 = (optind + 1 < argc) ? argv[optind + 1] : NULL;
+
+	MediaDecoder decoder(4);
+	auto sub = decoder.subscribe_clips(clip_len, stride, 2, MediaDecoder::Overflow::drop_oldest);
+
+	std::atomic<int> clips(0);
+	std::thread consumer([&](){
+		MediaDecoder::Clip clip;
+		while(sub->get(clip)){
+			clips ++;
+			clip.clear();
+		}
+	});
+
+	char path[] = "/tmp/clip_switch_XXXXXX";
+	std::atomic<bool> bFed(false);
+	std::thread writer;
+	if(input2){
+		printf("resolution change: %s -> %s, clip %d stride %d\n", input, input2, clip_len, stride);
+		decoder.start_playlist(std::vector<std::string>{input, input2}, MFX_IMPL_AUTO_ANY);
+	}else{
+		int fd = mkstemp(path);
+		if(fd < 0){
+			perror(path);
+			return -1;
+		}
+		close(fd);
+		printf("hibernation: %s with %d ms gap, clip %d stride %d\n", input, idle_ms * 3, clip_len, stride);
+		decoder.set_hibernate(idle_ms);
+		decoder.start(std::make_shared<hddlBitstreamFile>(path, false, true), MFX_IMPL_AUTO_ANY);
+		writer = std::thread(feed_file, input, path, idle_ms * 3, &bFed);
+	}
+
+	//rebuild seen: decoder hibernated, or switched to new stream parameters
+	bool bRebuilt = false;
+	int clips_at_rebuild = 0;
+	int last_clips = -1;
+	auto t_start = std::chrono::steady_clock::now();
+	auto t_change = t_start;
+	for(;;){
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		auto now = std::chrono::steady_clock::now();
+		MediaDecoder::State st = decoder.state();
+
+		if(!bRebuilt && (input2 ? decoder.switches().count > 0 : st == MediaDecoder::State::hibernating)){
+			bRebuilt = true;
+			clips_at_rebuild = clips;
+			printf("%s after %d clips\n", input2 ? "resolution changed" : "hibernating", clips_at_rebuild);
+		}
+		if(clips != last_clips){
+			last_clips = clips;
+			t_change = now;
+		}
+
+		if(st == MediaDecoder::State::drained || st == MediaDecoder::State::stopped)
+			break;
+		//followed file never ends: done once the second half stops producing clips
+		if(!input2 && bFed && bRebuilt && now - t_change > std::chrono::seconds(2))
+			break;
+		if(now - t_start > std::chrono::seconds(timeout_s)){
+			printf("timeout\n");
+			break;
+		}
+	}
+
+	auto t_stop = std::chrono::steady_clock::now();
+	decoder.stop();
+	double stop_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_stop).count();
+	consumer.join();
+	if(writer.joinable())
+		writer.join();
+	if(!input2)
+		unlink(path);
+
+	int clips_after = clips - clips_at_rebuild;
+	printf("clips: %d before, %d after rebuild, stop() took %.1f ms\n", clips_at_rebuild, clips_after, stop_ms);
+
+	bool bPass = bRebuilt && clips_after > 0;
+	printf("%s\n", bPass ? "PASS" : "FAIL");
+	return bPass ? 0 : 1;
+}
@@ -12,6 +12,9 @@ Copyright(c) 2005-2014 Intel Corporation. All Rights Reserved.
 #include "cmd_options.h"
 
 #include "media_pipeline.h"
+#ifdef __linux__
+#include "frame_sink.h"
+#endif
 
 static void usage(CmdOptionsCtx* ctx)
 {
@@ -234,7 +237,17 @@ void decode(const char * bsfile, mfxIMPL impl, bool drop_on_overflow, const char
 {
     MediaDecoder m(8);
     FILE* fSink = NULL;
-    if(ofile){
+#ifdef __linux__
+    //SINK_FORMAT=nv12|i420|y4m|rgb4: frames are dumped by frame_sink's writer thread
+    frame_sink sink;
+    frame_sink::Format sink_format;
+    const char * psinkfmt = getenv("SINK_FORMAT");
+    bool bAsyncSink = ofile && psinkfmt && frame_sink::parse_format(psinkfmt, sink_format);
+    bool bSinkOpen = false;
+#else
+    bool bAsyncSink = false;
+#endif
+    if(ofile && !bAsyncSink){
     	fSink = fopen(ofile,"wb");
     }
 
@@ -248,14 +261,89 @@ void decode(const char * bsfile, mfxIMPL impl, bool drop_on_overflow, const char
 
     auto t_start = std::chrono::high_resolution_clock::now();
 
-    m.start(bsfile, impl, drop_on_overflow);
+    //VPP_ONLY=1: only VPP output is queued, DEC surfaces are recycled immediately
+    const char * pvpponly = getenv("VPP_ONLY");
+    if(pvpponly && strcmp(pvpponly, "0") != 0)
+    	m.set_output_mode(MediaDecoder::OutputMode::vpp_only);
+
+    //USER_BUFFERS=N: VPP writes into N buffers owned by this test
+    std::vector<std::unique_ptr<mfxU8[]>> user_buffers;
+    const char * puserbuf = getenv("USER_BUFFERS");
+    if(puserbuf){
+    	const size_t size = 448*448*4;
+    	for(int i = 0; i < atoi(puserbuf); i++){
+    		user_buffers.emplace_back(new mfxU8[size]);
+    		m.add_user_buffer(user_buffers.back().get(), size);
+    	}
+    }
+
+    //CLIP=K[,S]: frames are consumed as sliding windows of K frames, a new one every S frames
+    std::shared_ptr<MediaDecoder::ClipSubscription> clips;
+    const char * pclip = getenv("CLIP");
+    if(pclip){
+    	int stride = 1;
+    	const char * pstride = strchr(pclip, ',');
+    	if(pstride) stride = atoi(pstride + 1);
+    	clips = m.subscribe_clips(atoi(pclip), stride, 2, MediaDecoder::Overflow::block);
+    }
+
+    //ROI=x,y,w,h: VPP scales only this rectangle of the decoded frame to output size
+    const char * proi = getenv("ROI");
+    if(proi){
+    	int rx = 0, ry = 0, rw = 0, rh = 0;
+    	if(sscanf(proi, "%d,%d,%d,%d", &rx, &ry, &rw, &rh) == 4)
+    		m.set_crop(rx, ry, rw, rh);
+    }
+
+    //LOW_LATENCY=1: whole frames fed, AsyncDepth 1, get() returns the newest frame only
+    const char * plowlat = getenv("LOW_LATENCY");
+    bool bLowLatency = plowlat && strcmp(plowlat, "0") != 0;
+    m.set_low_latency(bLowLatency);
+
+    //RECOVERY=idr: on corruption skip to next IDR instead of resetting the decoder
+    const char * precovery = getenv("RECOVERY");
+    if(precovery && strcmp(precovery, "idr") == 0)
+    	m.set_recovery(MediaDecoder::Recovery::skip_to_idr);
+
+    //PLAYLIST=1: INPUT is a text file listing segment files (one per line), decoded
+    //back to back by this one decoder
+    const char * pplaylist = getenv("PLAYLIST");
+    if(pplaylist && strcmp(pplaylist, "0") != 0){
+    	std::vector<std::string> segments;
+    	FILE * fList = fopen(bsfile, "r");
+    	char line[MSDK_MAX_PATH];
+    	while(fList && fgets(line, sizeof(line), fList)){
+    		line[strcspn(line, "\r\n")] = 0;
+    		if(line[0]) segments.push_back(line);
+    	}
+    	if(fList) fclose(fList);
+    	printf("Playlist of %d segments\n", (int)segments.size());
+    	m.start_playlist(segments, impl, drop_on_overflow);
+    }else{
+    	m.start(bsfile, impl, drop_on_overflow);
+    }
+
+	int nFrame = 0;
+    for(int nClip = 0; clips && nClip < 1000; nClip++){
+    	MediaDecoder::Clip clip;
+    	if(!clips->get(clip)) break;
+
+    	unsigned long first = clip[0].second->m_FrameNumber;
+    	for(size_t i = 1; i < clip.size(); i++)
+    		if(clip[i].second->m_FrameNumber != first + i)
+    			printf(ANSI_COLOR_RED "BUG: clip %d is not consecutive at %d\n" ANSI_COLOR_RESET, nClip, (int)i);
+    	if(first != (unsigned long)nClip * clips->stride())
+    		printf(ANSI_COLOR_RED "BUG: clip %d starts at frame %lu\n" ANSI_COLOR_RESET, nClip, first);
+
+    	printf("Clip %d: frames %lu-%lu\n", nClip, first, clip.back().second->m_FrameNumber);
+    	nFrame += clips->stride();
+    }
 
-	int nFrame;
-    for(nFrame=0; nFrame < 1000;nFrame++){
+    for(; !clips && nFrame < 1000;nFrame++){
     	MediaDecoder::Output out;
     	if(!m.get(out)) break;
 
-    	if(!out.first->is_reserved())
+    	if(out.first && !out.first->is_reserved())
     	{
     		printf(ANSI_COLOR_RED "BUG: un-reserved DEC frame %d\n" ANSI_COLOR_RESET,
     				out.first->m_FrameNumber);
@@ -269,13 +357,13 @@ void decode(const char * bsfile, mfxIMPL impl, bool drop_on_overflow, const char
     	//simulate intense computation
     	//std::this_thread::sleep_for(std::chrono::milliseconds(20));
 
-    	if(out.first->m_FrameNumber != out.second->m_FrameNumber)
+    	if(out.first && out.first->m_FrameNumber != out.second->m_FrameNumber)
     	{
     		printf(ANSI_COLOR_RED "BUG: inconsistent DEC & VPP frame number: %d v %d\n" ANSI_COLOR_RESET,
     				out.first->m_FrameNumber, out.second->m_FrameNumber);
     	}
 
-    	if(dec_id != out.first->m_FrameNumber)
+    	if(out.first && (unsigned long)dec_id != out.first->m_FrameNumber)
     		dec_id_disagree_cnt ++;
 
     	if(vpp_id != out.second->m_FrameNumber)
@@ -284,6 +372,16 @@ void decode(const char * bsfile, mfxIMPL impl, bool drop_on_overflow, const char
     	dec_id ++;
     	vpp_id ++;
 
+#ifdef __linux__
+		if (bAsyncSink) {
+			if (!bSinkOpen) {
+				bSinkOpen = (sink.open(ofile, sink_format, out.second->Info) == MFX_ERR_NONE);
+				bAsyncSink = bSinkOpen;
+			}
+			if (bSinkOpen && sink.write(out.second.get()) != MFX_ERR_NONE)
+				fprintf(stderr, ANSI_COLOR_RED "frame_sink write failed at frame %d\n" ANSI_COLOR_RESET, nFrame);
+		}
+#endif
 		while (fSink) {
 			mfxStatus sts = out.second->lock();
 			if(sts != MFX_ERR_NONE)
@@ -295,11 +393,14 @@ void decode(const char * bsfile, mfxIMPL impl, bool drop_on_overflow, const char
 			MSDK_BREAK_ON_ERROR(sts);
 
 			MSDK_BREAK_ON_ERROR(out.second->unlock());
-			printf("%sFrame number (DEC, VPP): %d, %d  index %d,%d \n" ANSI_COLOR_RESET,
-				out.first->m_FrameNumber == out.second->m_FrameNumber?ANSI_COLOR_RESET:ANSI_COLOR_RED,
+			if(out.first)
+				printf("%sFrame number (DEC, VPP): %lu, %lu  index %d,%d \n" ANSI_COLOR_RESET,
+					out.first->m_FrameNumber == out.second->m_FrameNumber?ANSI_COLOR_RESET:ANSI_COLOR_RED,
 
-				out.first->m_FrameNumber, out.second->m_FrameNumber,
-				out.first->index(), out.second->index());
+					out.first->m_FrameNumber, out.second->m_FrameNumber,
+					out.first->index(), out.second->index());
+			else
+				printf("Frame number (VPP): %lu  index %d \n", out.second->m_FrameNumber, out.second->index());
 			break;
 		}
 		//the surface in out will automatically returned
@@ -314,7 +415,24 @@ void decode(const char * bsfile, mfxIMPL impl, bool drop_on_overflow, const char
     printf("\nTotal Frames: %d, Execution time: %3.2f s (%3.2f fps)\n", nFrame, diff.count(), fps);
     printf("dec_id_disagree_cnt = %d\n", dec_id_disagree_cnt);
     printf("vpp_id_disagree_cnt = %d\n", vpp_id_disagree_cnt);
+    MediaDecoder::RecoveryStats rec = m.recovery();
+    if (rec.corrupted)
+    	printf("corrupted frames: %lu, decoder resets: %lu, pictures skipped: %lu\n", rec.corrupted, rec.resets, rec.skipped);
+    MediaDecoder::SwitchStats sw = m.switches();
+    if (sw.count)
+    	printf("stream parameter changes: %d, output gap last %.2f ms, max %.2f ms\n", sw.count, sw.last_gap_ms, sw.max_gap_ms);
+    if (bLowLatency) {
+    	MediaDecoder::LatencyStats lat = m.latency();
+    	printf("latency (arrival -> get): %lu frames, avg %.2f ms, max %.2f ms\n", lat.frames, lat.avg_ms, lat.max_ms);
+    }
     if (fSink) fclose(fSink);
+#ifdef __linux__
+    if (bSinkOpen) {
+    	bool bOK = sink.close();
+    	printf("frame_sink: %llu frames, %llu bytes written%s\n", (unsigned long long)sink.frames(),
+    			(unsigned long long)sink.bytes(), bOK ? "" : " (with errors)");
+    }
+#endif
 }
 
 int main(int argc, char** argv)
@@ -0,0 +1,105 @@
+// Mosaic: -ch N decoders of the same INPUT are composed into one grid surface by
+//   MediaCompositor, mosaics (RGB4, -g WxH, default 1920x1080) optionally go to OUTPUT.
+
+#include "common_utils.h"
+#include "cmd_options.h"
+
+#include "media_pipeline.h"
+#include "media_compositor.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <memory>
+
+static void usage(CmdOptionsCtx* ctx)
+{
+    printf(
+        "Composes -ch channels decoding INPUT into one grid and optionally writes OUTPUT (RGB4).\n"
+        "\n"
+        "Usage: %s [options] INPUT [OUTPUT]\n"
+        "  -g WxH is the mosaic size (default: 1920x1080)\n"
+        "\n"
+        "Environment:\n"
+        "  FRAMES=N        stop after N mosaics (default 1000)\n", ctx->program);
+}
+
+int main(int argc, char** argv)
+{
+    CmdOptions options;
+
+    memset(&options, 0, sizeof(CmdOptions));
+    options.ctx.options = OPTIONS_VPP;
+    options.ctx.usage = usage;
+    options.values.impl = MFX_IMPL_AUTO_ANY;
+
+    ParseOptions(argc, argv, &options);
+
+    if (!options.values.SourceName[0]) {
+        printf("error: source file name not set (mandatory)\n");
+        return -1;
+    }
+    int width = options.values.Width ? options.values.Width : 1920;
+    int height = options.values.Height ? options.values.Height : 1080;
+    int nChannels = options.values.Channels > 0 ? options.values.Channels : 1;
+    const char * pframes = getenv("FRAMES");
+    int nFrames = pframes ? atoi(pframes) : 1000;
+
+    FILE* fSink = NULL;
+    if (options.values.SinkName[0])
+        fSink = fopen(options.values.SinkName, "wb");
+
+    //smallest square-ish grid holding every channel
+    int cols = (int)ceil(sqrt((double)nChannels));
+    int rows = (nChannels + cols - 1) / cols;
+
+    std::vector<std::unique_ptr<MediaDecoder>> decoders;
+    std::vector<MediaDecoder *> pdecs;
+    for (int i = 0; i < nChannels; i++) {
+        decoders.emplace_back(new MediaDecoder(8));
+        pdecs.push_back(decoders.back().get());
+    }
+
+    MediaCompositor comp(width, height, MFX_FOURCC_RGB4);
+    comp.add_grid(pdecs, cols, rows);
+
+    printf("Start mosaic of %d x [%s] in %dx%d grid, %dx%d\n", nChannels, options.values.SourceName,
+           cols, rows, width, height);
+
+    auto t_start = std::chrono::high_resolution_clock::now();
+    for (auto &d : decoders)
+        d->start(options.values.SourceName, options.values.impl);
+    comp.start(options.values.impl);
+
+    int nFrame = 0;
+    int nStale = 0;
+    for (; nFrame < nFrames; nFrame++) {
+        MediaCompositor::Mosaic m;
+        if (!comp.get(m)) break;
+
+        for (auto &t : m.tiles)
+            if (!t.bFresh) nStale ++;
+
+        while (fSink) {
+            mfxStatus sts = m.surface->lock();
+            MSDK_BREAK_ON_ERROR(sts);
+            sts = WriteRawFrame(static_cast<mfxFrameSurface1*>(m.surface.get()), fSink);
+            m.surface->unlock();
+            MSDK_BREAK_ON_ERROR(sts);
+            break;
+        }
+    }
+
+    comp.stop();
+    for (auto &d : decoders)
+        d->stop();
+
+    auto t_end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = t_end - t_start;
+
+    printf("\nTotal Mosaics: %d, Execution time: %3.2f s (%3.2f fps)\n", nFrame, diff.count(), nFrame / diff.count());
+    printf("stale tiles = %d\n", nStale);
+    if (fSink) fclose(fSink);
+    return 0;
+}
@@ -0,0 +1,277 @@
+// raw_frame_loader test: small odd-width clips of every format are written to a temp file
+//   (and a pipe on stdin) with a known pattern, loaded into system memory surfaces and
+//   compared pixel by pixel, including loop, seek and end of input.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "common_utils.h"
+#include "raw_frame_loader.h"
+
+static void usage(const char * program)
+{
+	printf(
+		"Loads generated raw clips of all formats through raw_frame_loader and checks every pixel.\n"
+		"\n"
+		"Usage: %s [options]\n"
+		"   -g WxH     frame size (default 33x17, odd on purpose)\n"
+		"   -n N       frames per clip (default 3)\n"
+		"   -t N       conversion threads (default 1)\n",
+		program);
+}
+
+static const char * format_names[] = {"i420", "yv12", "nv12", "rgb4"};
+
+// pattern byte of plane p at (x, y) of frame i, differs per frame, plane & position
+static uint8_t pattern(int i, int p, int x, int y)
+{
+	return (uint8_t)(i * 37 + p * 71 + x * 3 + y * 11);
+}
+
+// clip as found in the file
+static std::vector<uint8_t> make_clip(raw_frame_loader::Format fmt, int w, int h, int frames)
+{
+	int cw = (w + 1) / 2, ch = (h + 1) / 2;
+	std::vector<uint8_t> clip;
+	for(int i = 0; i < frames; i++){
+		if(fmt == raw_frame_loader::rgb4){
+			for(int y = 0; y < h; y++)
+				for(int x = 0; x < w * 4; x++)
+					clip.push_back(pattern(i, 0, x, y));
+			continue;
+		}
+		for(int y = 0; y < h; y++)
+			for(int x = 0; x < w; x++)
+				clip.push_back(pattern(i, 0, x, y));
+		if(fmt == raw_frame_loader::nv12){
+			for(int y = 0; y < ch; y++)
+				for(int x = 0; x < cw; x++){
+					clip.push_back(pattern(i, 1, x, y));
+					clip.push_back(pattern(i, 2, x, y));
+				}
+			continue;
+		}
+		//i420: U then V, yv12: V then U
+		const int planes[2] = {fmt == raw_frame_loader::i420 ? 1 : 2, fmt == raw_frame_loader::i420 ? 2 : 1};
+		for(int p : planes)
+			for(int y = 0; y < ch; y++)
+				for(int x = 0; x < cw; x++)
+					clip.push_back(pattern(i, p, x, y));
+	}
+	return clip;
+}
+
+// system memory surface, crop at (2, 2) inside a padded frame so out-of-crop writes show up
+struct SysSurface
+{
+	mfxFrameSurface1 	surf;
+	std::vector<uint8_t> 	mem;
+
+	SysSurface(mfxU32 fourcc, int w, int h){
+		memset(&surf, 0, sizeof(surf));
+		mfxFrameInfo & fi = surf.Info;
+		fi.FourCC = fourcc;
+		fi.CropX = 2;
+		fi.CropY = 2;
+		fi.CropW = w;
+		fi.CropH = h;
+		fi.Width = MSDK_ALIGN16(w + 4);
+		fi.Height = MSDK_ALIGN16(h + 4);
+		int pitch = (fourcc == MFX_FOURCC_RGB4) ? fi.Width * 4 : fi.Width;
+		surf.Data.PitchLow = (mfxU16)pitch;
+		if(fourcc == MFX_FOURCC_RGB4){
+			mem.assign((size_t)pitch * fi.Height, 0xEE);
+			surf.Data.B = mem.data();
+			surf.Data.G = surf.Data.B + 1;
+			surf.Data.R = surf.Data.B + 2;
+			surf.Data.A = surf.Data.B + 3;
+		}else{
+			mem.assign((size_t)pitch * fi.Height * 3 / 2, 0xEE);
+			surf.Data.Y = mem.data();
+			surf.Data.UV = surf.Data.Y + (size_t)pitch * fi.Height;
+		}
+	}
+};
+
+// surface must hold frame i of the clip, padding untouched; returns mismatches
+static int check(SysSurface & s, raw_frame_loader::Format fmt, int i)
+{
+	const mfxFrameInfo & fi = s.surf.Info;
+	const int pitch = s.surf.Data.PitchLow;
+	const int w = fi.CropW, h = fi.CropH;
+	int bad = 0;
+
+	if(fmt == raw_frame_loader::rgb4){
+		for(int y = 0; y < fi.Height; y++)
+			for(int x = 0; x < pitch; x++){
+				bool in = y >= 2 && y < h + 2 && x >= 8 && x < (w + 2) * 4;
+				uint8_t want = in ? pattern(i, 0, x - 8, y - 2) : 0xEE;
+				bad += s.surf.Data.B[(size_t)y * pitch + x] != want;
+			}
+		return bad;
+	}
+
+	for(int y = 0; y < fi.Height; y++)
+		for(int x = 0; x < pitch; x++){
+			bool in = y >= 2 && y < h + 2 && x >= 2 && x < w + 2;
+			uint8_t want = in ? pattern(i, 0, x - 2, y - 2) : 0xEE;
+			bad += s.surf.Data.Y[(size_t)y * pitch + x] != want;
+		}
+	//odd width: the last chroma pair is written whole, nothing past it
+	const int cw = (w + 1) / 2, ch = (h + 1) / 2;
+	for(int y = 0; y < fi.Height / 2; y++)
+		for(int x = 0; x < pitch; x++){
+			bool in = y >= 1 && y < ch + 1 && x >= 2 && x < cw * 2 + 2;
+			uint8_t want = in ? pattern(i, 1 + (x & 1), (x - 2) / 2, y - 1) : 0xEE;
+			bad += s.surf.Data.UV[(size_t)y * pitch + x] != want;
+		}
+	return bad;
+}
+
+#define EXPECT(cond, ...) do{ \
+	if(!(cond)){ \
+		fprintf(stderr, ANSI_COLOR_RED "%s: " ANSI_COLOR_RESET, name); \
+		fprintf(stderr, __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		errors ++; \
+	} }while(0)
+
+static int test_format(raw_frame_loader::Format fmt, int w, int h, int frames, int threads)
+{
+	const char * name = format_names[fmt];
+	int errors = 0;
+	std::vector<uint8_t> clip = make_clip(fmt, w, h, frames);
+	SysSurface s(fmt == raw_frame_loader::rgb4 ? MFX_FOURCC_RGB4 : MFX_FOURCC_NV12, w, h);
+
+	char path[] = "/tmp/test_raw_loader_XXXXXX";
+	int fd = mkstemp(path);
+	if(fd < 0 || write(fd, clip.data(), clip.size()) != (ssize_t)clip.size()){
+		perror(path);
+		return 1;
+	}
+	close(fd);
+
+	//mapped file: frames in order, then end of file, then loop & seek
+	{
+		raw_frame_loader loader;
+		loader.set_threads(threads);
+		EXPECT(loader.open(path, fmt, w, h) == MFX_ERR_NONE, "open failed");
+		EXPECT(loader.frame_bytes() * frames == clip.size(), "frame_bytes %zu", loader.frame_bytes());
+		EXPECT(loader.frames() == frames, "frames() %lld", (long long)loader.frames());
+		EXPECT(loader.frame(frames - 1) && memcmp(loader.frame(frames - 1), &clip[(frames - 1) * loader.frame_bytes()], loader.frame_bytes()) == 0,
+			   "frame(%d) is not the last frame", frames - 1);
+		EXPECT(loader.frame(frames) == NULL, "frame(%d) past the end", frames);
+
+		for(int i = 0; i < frames; i++){
+			EXPECT(loader.load(&s.surf) == MFX_ERR_NONE, "load %d failed", i);
+			int bad = check(s, fmt, i);
+			EXPECT(bad == 0, "frame %d: %d bytes differ", i, bad);
+		}
+		EXPECT(loader.load(&s.surf) == MFX_ERR_MORE_DATA, "no end of file without loop");
+
+		loader.set_loop(true);
+		EXPECT(loader.load(&s.surf) == MFX_ERR_NONE && check(s, fmt, 0) == 0, "loop did not restart at frame 0");
+
+		EXPECT(loader.seek(frames - 1), "seek(%d) failed", frames - 1);
+		EXPECT(loader.load(&s.surf) == MFX_ERR_NONE && check(s, fmt, frames - 1) == 0, "seek(%d) loaded wrong frame", frames - 1);
+		EXPECT(loader.load(&s.surf) == MFX_ERR_NONE && check(s, fmt, 0) == 0, "loop after seek did not restart at frame 0");
+		EXPECT(!loader.seek(frames + 1), "seek past the end accepted");
+		loader.close();
+	}
+	unlink(path);
+
+	//pipe on stdin: same frames read(), no seek, no loop
+	{
+		int pfd[2];
+		int saved_stdin = dup(STDIN_FILENO);
+		if(saved_stdin < 0 || pipe(pfd) != 0 || dup2(pfd[0], STDIN_FILENO) < 0){
+			perror("pipe");
+			return errors + 1;
+		}
+		close(pfd[0]);
+		//writer in small pieces, so frames straddle read() calls
+		std::thread writer([&clip, pfd]() {
+			for(size_t off = 0; off < clip.size(); ){
+				ssize_t n = write(pfd[1], &clip[off], std::min<size_t>(clip.size() - off, 100));
+				if(n <= 0) break;
+				off += n;
+			}
+			close(pfd[1]);
+		});
+
+		raw_frame_loader loader;
+		loader.set_threads(threads);
+		loader.set_loop(true);
+		EXPECT(loader.open("-", fmt, w, h) == MFX_ERR_NONE, "open stdin failed");
+		EXPECT(loader.frames() == -1, "pipe frames() %lld", (long long)loader.frames());
+		EXPECT(!loader.seek(1), "seek on a pipe accepted");
+		for(int i = 0; i < frames; i++){
+			EXPECT(loader.load(&s.surf) == MFX_ERR_NONE, "pipe load %d failed", i);
+			int bad = check(s, fmt, i);
+			EXPECT(bad == 0, "pipe frame %d: %d bytes differ", i, bad);
+		}
+		EXPECT(loader.load(&s.surf) == MFX_ERR_MORE_DATA, "no end of pipe (loop must not apply)");
+		loader.close();
+		writer.join();
+
+		dup2(saved_stdin, STDIN_FILENO);
+		close(saved_stdin);
+	}
+
+	printf("%s %dx%d x %d: %s\n", name, w, h, frames, errors ? "FAIL" : "ok");
+	return errors;
+}
+
+int main(int argc, char** argv)
+{
+	int width = 33, height = 17;
+	int frames = 3;
+	int threads = 1;
+	int opt;
+
+	while((opt = getopt(argc, argv, "g:n:t:h")) != -1){
+		switch(opt){
+		case 'g':
+			if(sscanf(optarg, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0){
+				usage(argv[0]);
+				return -1;
+			}
+			break;
+		case 'n': frames = atoi(optarg); break;
+		case 't': threads = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if(frames < 2){
+		printf("error: need at least 2 frames\n");
+		return -1;
+	}
+
+	int errors = 0;
+	for(int f = raw_frame_loader::i420; f <= raw_frame_loader::rgb4; f++){
+		raw_frame_loader::Format fmt;
+		if(!raw_frame_loader::parse_format(format_names[f], fmt) || fmt != f){
+			fprintf(stderr, "parse_format(%s) failed\n", format_names[f]);
+			errors ++;
+			continue;
+		}
+		errors += test_format(fmt, width, height, frames, threads);
+	}
+	raw_frame_loader::Format fmt;
+	if(raw_frame_loader::parse_format("yuy2", fmt)){
+		fprintf(stderr, "parse_format(yuy2) accepted\n");
+		errors ++;
+	}
+
+	printf("%s\n", errors ? "FAIL" : "PASS");
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,97 @@
+// VPP only benchmark: raw frames are fed to MediaDecoder::start_raw() instead of a
+//   decoder, with RAW_PRELOAD the input is cycled from memory so VPP alone is measured.
+
+#include "common_utils.h"
+#include "cmd_options.h"
+
+#include "media_pipeline.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+static void usage(CmdOptionsCtx* ctx)
+{
+    printf(
+        "Runs VPP on raw frames of INPUT (\"-\" is stdin on Linux) and optionally writes OUTPUT.\n"
+        "\n"
+        "Usage: %s [options] -g WxH INPUT [OUTPUT]\n"
+        "\n"
+        "Environment:\n"
+        "  RAW_FORMAT=F    i420 (default), yv12, nv12 or rgb4\n"
+        "  RAW_LOOP=1      restart at end of file\n"
+        "  RAW_PRELOAD=N   load N frames once and cycle them in memory (VPP only, no file access)\n"
+        "  FRAMES=N        stop after N frames (default 1000)\n", ctx->program);
+}
+
+int main(int argc, char** argv)
+{
+    CmdOptions options;
+
+    memset(&options, 0, sizeof(CmdOptions));
+    options.ctx.options = OPTIONS_VPP;
+    options.ctx.usage = usage;
+    options.values.impl = MFX_IMPL_AUTO_ANY;
+
+    ParseOptions(argc, argv, &options);
+
+    if (!options.values.SourceName[0]) {
+        printf("error: source file name not set (mandatory)\n");
+        return -1;
+    }
+    if (!options.values.Width || !options.values.Height) {
+        printf("error: input geometry not set (mandatory)\n");
+        return -1;
+    }
+
+    const char * pformat = getenv("RAW_FORMAT");
+    if (!pformat)
+    	pformat = "i420";
+    const char * ploop = getenv("RAW_LOOP");
+    bool bLoop = ploop && strcmp(ploop, "0") != 0;
+    const char * ppreload = getenv("RAW_PRELOAD");
+    int preload = ppreload ? atoi(ppreload) : 0;
+    const char * pframes = getenv("FRAMES");
+    int nFrames = pframes ? atoi(pframes) : 1000;
+
+    FILE* fSink = NULL;
+    if (options.values.SinkName[0])
+    	fSink = fopen(options.values.SinkName, "wb");
+
+    MediaDecoder m(8);
+    printf("Start VPP on raw [%s] %s %dx%d loop=%d preload=%d\n", options.values.SourceName, pformat,
+    		options.values.Width, options.values.Height, bLoop, preload);
+
+    auto t_start = std::chrono::high_resolution_clock::now();
+    m.start_raw(options.values.SourceName, pformat, options.values.Width, options.values.Height,
+    		options.values.impl, options.values.AutoDropFrames, bLoop, preload);
+
+    int nFrame = 0;
+    int id_disagree_cnt = 0;
+    for (; nFrame < nFrames; nFrame++) {
+    	MediaDecoder::Output out;
+    	if (!m.get(out)) break;
+
+    	if ((int)out.second->m_FrameNumber != nFrame && !options.values.AutoDropFrames)
+    		id_disagree_cnt ++;
+
+    	while (fSink) {
+    		mfxStatus sts = out.second->lock();
+    		MSDK_BREAK_ON_ERROR(sts);
+    		sts = WriteRawFrame(static_cast<mfxFrameSurface1*>(out.second.get()), fSink);
+    		out.second->unlock();
+    		MSDK_BREAK_ON_ERROR(sts);
+    		break;
+    	}
+    }
+
+    m.stop();
+
+    auto t_end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = t_end - t_start;
+
+    printf("\nTotal Frames: %d, Execution time: %3.2f s (%3.2f fps)\n", nFrame, diff.count(), nFrame / diff.count());
+    printf("id_disagree_cnt = %d\n", id_disagree_cnt);
+    if (fSink) fclose(fSink);
+    return 0;
+}
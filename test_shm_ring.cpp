@@ -0,0 +1,191 @@
+// Shared-memory frame ring test: INPUT is decoded into memfd backed frames, a forked
+//   consumer process maps the pools once, reads frames in place and hands them back
+//   over the release ring. Passes if every published frame comes back to its pool.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <map>
+#include <set>
+#include <thread>
+#include <chrono>
+
+#include "common_utils.h"
+#include "media_pipeline.h"
+#include "frame_share.h"
+#include "frame_ipc.h"
+
+static void usage(const char * program)
+{
+	printf(
+		"Decodes INPUT into shared memory frames, read by a child process through shm_frame_ring.\n"
+		"\n"
+		"Usage: %s [options] INPUT\n"
+		"   -n N       frames to publish (default 300)\n"
+		"   -w ms      simulated processing time per frame in consumer (default 0)\n",
+		program);
+}
+
+struct MappedPool
+{
+	const uint8_t * 	p;
+	uint64_t 			size;
+};
+
+// child process: pool memfds arrive on sock (POOL message before the first frame of a pool),
+// frames on the ready ring; returns when producer closes the ring
+static int consume(int ring_fd, int sock, int work_ms)
+{
+	std::unique_ptr<shm_frame_ring> ring = shm_frame_ring::attach(ring_fd);
+	if(!ring)
+		return 1;
+
+	std::map<uint32_t, MappedPool> pools;
+	uint64_t frames = 0;
+	uint32_t checksum = 0;
+	shm_frame_msg msg;
+
+	while(ring->pop_ready(msg, -1)){
+		const shm_frame_desc & d = msg.desc;
+
+		while(pools.count(d.pool_id) == 0){
+			frame_ipc_msg pm;
+			int fd;
+			if(!frame_ipc_recv(sock, pm, &fd))
+				return 1;
+			if(pm.type != FRAME_IPC_POOL)
+				continue;
+			const uint8_t * p = mem_allocator_shm::map_pool(fd, pm.pool.pool_size);
+			if(fd >= 0) close(fd);
+			if(!p) return 1;
+			pools[pm.pool.pool_id] = {p, pm.pool.pool_size};
+		}
+
+		//read the frame in place: sample first pixel of every row
+		const uint8_t * pframe = pools[d.pool_id].p + d.offset;
+		for(int y = 0; y < d.height; y++)
+			checksum += pframe[(size_t)y * d.pitch];
+		frames ++;
+
+		if(work_ms > 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(work_ms));
+
+		shm_release_msg rel = {d.pool_id, d.index};
+		if(!ring->push_released(rel)){
+			fprintf(stderr, "consumer: release ring is full\n");
+			return 1;
+		}
+	}
+
+	printf("consumer: %lu frames from %d pools, checksum 0x%08X\n",
+			(unsigned long)frames, (int)pools.size(), checksum);
+	for(auto &p : pools)
+		mem_allocator_shm::unmap_pool(p.second.p, p.second.size);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	int nFrames = 300;
+	int work_ms = 0;
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:w:h")) != -1){
+		switch(opt){
+		case 'n': nFrames = atoi(optarg); break;
+		case 'w': work_ms = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if(optind >= argc){
+		printf("error: no INPUT\n");
+		usage(argv[0]);
+		return -1;
+	}
+
+	//not less than any pool the decoder allocates, so releasing never blocks
+	std::unique_ptr<shm_frame_ring> ring = shm_frame_ring::create(64);
+	int sv[2];
+	if(!ring || socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0){
+		perror("frame ring");
+		return -1;
+	}
+
+	//fork before any decoder thread exists
+	pid_t pid = fork();
+	if(pid < 0){
+		perror("fork");
+		return -1;
+	}
+	if(pid == 0){
+		close(sv[0]);
+		_exit(consume(dup(ring->fd()), sv[1], work_ms));
+	}
+	close(sv[1]);
+
+	MediaDecoder decoder(8);
+	decoder.set_shared_output(true);
+	decoder.set_output_mode(MediaDecoder::OutputMode::vpp_only);
+	decoder.start(argv[optind], MFX_IMPL_AUTO_ANY);
+
+	shm_frame_publisher publisher(*ring);
+	std::set<uint32_t> pools;
+	int published = 0;
+	int dropped = 0;
+	auto t_start = std::chrono::steady_clock::now();
+
+	MediaDecoder::Output out;
+	while(published + dropped < nFrames && decoder.get(out)){
+		shm_frame_desc desc;
+		if(!mem_allocator_shm::export_frame(out.second->Data.MemId, desc)){
+			fprintf(stderr, "frame is not in shared memory\n");
+			break;
+		}
+		if(pools.count(desc.pool_id) == 0){
+			frame_ipc_msg pm;
+			memset(&pm, 0, sizeof(pm));
+			pm.type = FRAME_IPC_POOL;
+			pm.pool.pool_id = desc.pool_id;
+			pm.pool.pool_size = desc.pool_size;
+			if(!frame_ipc_send(sv[0], pm, desc.fd))
+				break;
+			pools.insert(desc.pool_id);
+		}
+
+		//ring stays full while consumer is busy: frame is dropped, decoder goes on
+		if(publisher.publish(out.second, out.second->m_FrameNumber, 100))
+			published ++;
+		else
+			dropped ++;
+		out = MediaDecoder::Output();
+	}
+
+	//consumer drains the ring, then sees it closed
+	ring->close();
+	int status = 0;
+	waitpid(pid, &status, 0);
+	close(sv[0]);
+
+	while(publisher.reclaim(0) > 0);
+	int leaked = publisher.in_flight();
+
+	std::chrono::duration<double> diff = std::chrono::steady_clock::now() - t_start;
+	printf("producer: %d frames published, %d dropped, %d not released, %.2f s (%.2f fps)\n",
+			published, dropped, leaked, diff.count(), published / diff.count());
+
+	//surfaces go back to their pools before the decoder frees them
+	publisher.clear();
+	decoder.stop();
+
+	bool bPass = WIFEXITED(status) && WEXITSTATUS(status) == 0 && leaked == 0 && published > 0;
+	printf("%s\n", bPass ? "PASS" : "FAIL");
+	return bPass ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+// Transcode: decode -> VPP (resize) -> encode per channel, encoded packets are read
+//   from MediaDecoder::get_packet(); the last channel writes its stream to OUTPUT.
+
+#include "common_utils.h"
+#include "cmd_options.h"
+
+#include "media_pipeline.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <chrono>
+
+static void usage(CmdOptionsCtx* ctx)
+{
+    printf(
+        "Transcodes INPUT (H.264) and optionally writes OUTPUT (.h265/.hevc: HEVC, else H.264).\n"
+        "\n"
+        "Usage: %s [options] INPUT [OUTPUT]\n"
+        "  -g WxH is the encoded size (default: decoded size)\n", ctx->program);
+}
+
+static void transcode(const CmdOptions * options, const char * ofile)
+{
+    MediaDecoder m(8);
+    MediaDecoder::EncodeParams enc;
+    const CmdOptionsValues & v = options->values;
+
+    enc.width = v.Width;
+    enc.height = v.Height;
+    if (v.Bitrate) enc.bitrate_kbps = v.Bitrate;
+    if (v.FrameRateN && v.FrameRateD) {
+        enc.framerate_n = v.FrameRateN;
+        enc.framerate_d = v.FrameRateD;
+    }
+    if (ofile && (strstr(ofile, ".h265") || strstr(ofile, ".hevc")))
+        enc.codec = MFX_CODEC_HEVC;
+    m.set_encode(enc);
+
+    FILE* fSink = ofile ? fopen(ofile, "wb") : NULL;
+
+    auto t_start = std::chrono::high_resolution_clock::now();
+    m.start(v.SourceName, v.impl);
+
+    int nFrame = 0;
+    unsigned long long nBytes = 0;
+    int nKeyFrames = 0;
+    MediaDecoder::Packet p;
+    while (m.get_packet(p)) {
+        if (p->FrameType & MFX_FRAMETYPE_IDR)
+            nKeyFrames ++;
+        if (fSink && fwrite(p->Data + p->DataOffset, 1, p->DataLength, fSink) != p->DataLength) {
+            fprintf(stderr, ANSI_COLOR_RED "write to %s failed\n" ANSI_COLOR_RESET, ofile);
+            fclose(fSink);
+            fSink = NULL;
+        }
+        nBytes += p->DataLength;
+        nFrame ++;
+        //buffer goes back to the encoder's pool
+        p.reset();
+    }
+
+    m.stop();
+
+    auto t_end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = t_end - t_start;
+    printf("\nTotal Frames: %d (%d IDR), %llu bytes, Execution time: %3.2f s (%3.2f fps)\n",
+           nFrame, nKeyFrames, nBytes, diff.count(), nFrame / diff.count());
+    if (fSink) fclose(fSink);
+}
+
+int main(int argc, char** argv)
+{
+    CmdOptions options;
+
+    memset(&options, 0, sizeof(CmdOptions));
+    options.ctx.options = OPTIONS_TRANSCODE | OPTION_GEOMETRY;
+    options.ctx.usage = usage;
+    options.values.impl = MFX_IMPL_AUTO_ANY;
+
+    ParseOptions(argc, argv, &options);
+
+    if (!options.values.SourceName[0]) {
+        printf("error: source file name not set (mandatory)\n");
+        return -1;
+    }
+    const char * ofile = options.values.SinkName[0] ? options.values.SinkName : NULL;
+
+    //-ch N: N channels transcoding the same input, only the last one writes OUTPUT
+    std::vector<std::thread> channels;
+    for (int t = 0; t < options.values.Channels; t++)
+        channels.emplace_back(transcode, &options, t == options.values.Channels - 1 ? ofile : NULL);
+    for (auto &th : channels)
+        th.join();
+    return 0;
+}